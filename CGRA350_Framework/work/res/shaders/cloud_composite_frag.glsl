@@ -0,0 +1,64 @@
+#version 330 core
+
+in vec2 texCoord;
+
+out vec4 fragColor;
+
+uniform sampler2D uCloudColour;     // low-res resolved clouds
+uniform sampler2D uCloudDepth;      // low-res cloud ray distance
+uniform vec2 uLowResSize;
+
+uniform sampler2D uSceneDepth;      // full-res opaque depth
+uniform mat4 uInvViewProj;
+uniform vec3 uCameraPos;
+
+float sceneDistance() {
+    float depth = texelFetch(uSceneDepth, ivec2(gl_FragCoord.xy), 0).r;
+    if (depth >= 1.0) {
+        return 1.0e6;
+    }
+    vec4 world = uInvViewProj * vec4(texCoord * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    return length(world.xyz / world.w - uCameraPos);
+}
+
+void main() {
+    // Bilinear footprint of the four nearest low-res texels
+    vec2 pos = texCoord * uLowResSize - 0.5;
+    ivec2 base = ivec2(floor(pos));
+    vec2 f = fract(pos);
+    ivec2 maxCoord = ivec2(uLowResSize) - 1;
+
+    // Low-res texels can straddle a silhouette, cloud that lies behind this pixel's geometry is rejected
+    float sceneDist = sceneDistance();
+    float occlusionLimit = sceneDist * 1.05 + 1.0;
+
+    // Reference depth from the closest texel, neighbours at different depths are down-weighted
+    // so edges between near and far clouds stay sharp instead of smearing
+    float refDepth = texelFetch(uCloudDepth, clamp(ivec2(floor(pos + 0.5)), ivec2(0), maxCoord), 0).r;
+    refDepth = min(refDepth, sceneDist);
+
+    vec4 colourSum = vec4(0.0);
+    float weightSum = 0.0;
+    for (int y = 0; y <= 1; y++) {
+        for (int x = 0; x <= 1; x++) {
+            ivec2 c = clamp(base + ivec2(x, y), ivec2(0), maxCoord);
+            float bilinear = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            float d = texelFetch(uCloudDepth, c, 0).r;
+            float depthWeight = exp(-abs(d - refDepth) / (0.05 * refDepth + 1.0));
+            float w = (d > occlusionLimit) ? 0.0 : bilinear * depthWeight + 1e-5;
+            colourSum += texelFetch(uCloudColour, c, 0) * w;
+            weightSum += w;
+        }
+    }
+
+    if (weightSum <= 0.0) {
+        discard;
+    }
+
+    vec4 clouds = colourSum / weightSum;
+    if (clouds.a < 0.001) {
+        discard;
+    }
+
+    fragColor = clouds;
+}
@@ -0,0 +1,90 @@
+// The cloud density model, shared by the view raymarch (cloud_frag.glsl), the weather map
+// that bounds it (cloud_weather_frag.glsl) and the shadow map (cloud_shadow_frag.glsl), so
+// the three always agree on where the clouds are.
+
+// Cloud control parameters
+uniform float uCloudCoverage;
+uniform float uCloudDensity;
+uniform float uCloudScale;
+uniform float uEvolutionSpeed;
+uniform float uCloudHeight;
+uniform float uCloudThickness;
+uniform float uCloudFuzziness;
+
+// Baked tileable noise volumes (see cloud_noise.hpp for the channel layout)
+uniform sampler3D uShapeNoise;   // R perlin-worley (4 cells), G worley (8), B worley (16), A perlin (4)
+uniform sampler3D uDetailNoise;  // RGB inverted worley (2/4/8 cells), A perlin (4)
+
+// Noise-space coordinate of a world position
+vec3 cloudNoiseCoord(vec3 pos, float time) {
+    // WIND - clouds drift horizontally
+    vec3 windOffset = vec3(time * 0.01, 0.0, time * 0.005);
+    
+    // EVOLUTION - clouds morph over time (controlled by uEvolutionSpeed)
+    float evolutionTime = time * uEvolutionSpeed;
+    vec3 evolution = vec3(
+        sin(evolutionTime) * 5.0,
+        cos(evolutionTime * 0.7) * 3.0,
+        sin(evolutionTime * 0.5) * 4.0
+    );
+    
+    return (pos + windOffset + evolution) * uCloudScale;
+}
+
+// COVERAGE with user control
+float cloudCoverage(vec3 p, float time) {
+    float coverage = texture(uShapeNoise, (p * 0.025 + vec3(time * uEvolutionSpeed)) / 4.0).a;
+    float coverageMin = mix(0.15, 0.5, 1.0 - uCloudCoverage);
+    float coverageMax = mix(0.5, 0.95, uCloudCoverage);
+    return smoothstep(coverageMin, coverageMax, coverage);
+}
+
+// Optimized but fluffy cloud density with dynamic evolution and user controls
+float cloudDensity(vec3 pos, float time) {
+    vec3 p = cloudNoiseCoord(pos, time);
+    
+    // BASE SHAPE - animated in 4D (3D space + time)
+    float timeOffset = time * uEvolutionSpeed * 1.5;
+    vec3 p1 = p + vec3(timeOffset * 10.0);
+    vec3 p2 = p + vec3(timeOffset * -8.0);
+    
+    // Volume coordinates are divided by the channel's cell count so one cell spans one noise unit
+    float baseShape1 = texture(uShapeNoise, p1 * 0.04 / 4.0).r;
+    float baseShape2 = texture(uShapeNoise, p2 * 0.04 / 4.0 + vec3(0.5)).r;
+    
+    // Blend between two noise fields for smooth transitions
+    float blendFactor = sin(time * uEvolutionSpeed * 0.5) * 0.5 + 0.5;
+    float baseShape = mix(baseShape1, baseShape2, blendFactor);
+    
+    baseShape *= cloudCoverage(p, time);
+    
+    // WORLEY for cloud structure - animated for changing shapes
+    float worleyFreq = mix(0.15, 0.25, uCloudFuzziness);
+    float worley = texture(uShapeNoise, (p * worleyFreq + vec3(0.0, time * uEvolutionSpeed * 0.5, 0.0)) / 8.0).g;
+    float edgeMin = mix(0.1, 0.3, uCloudFuzziness);
+    float edgeMax = mix(0.6, 0.8, uCloudFuzziness);
+    float edges = smoothstep(edgeMin, edgeMax, worley);
+    
+    float erosion = mix(0.15, 0.3, uCloudFuzziness);
+    float density = baseShape * (1.0 - edges * erosion);
+    
+    // Add back subtle detail for fluffiness - also animated
+    vec4 detailNoise = texture(uDetailNoise, (p * 0.8 + vec3(sin(time * uEvolutionSpeed), 0.0, cos(time * uEvolutionSpeed))) / 4.0);
+    float detail = mix(detailNoise.a, dot(detailNoise.rgb, vec3(0.625, 0.25, 0.125)), 0.5);
+    density = mix(density, density * detail, 0.15);
+    
+    // Apply density control
+    density *= uCloudDensity;
+    
+    // HEIGHT GRADIENT with user-controlled altitude
+    float cloudBase = uCloudHeight - uCloudThickness * 0.5;
+    float cloudTop = uCloudHeight + uCloudThickness * 0.5;
+    float heightFactor = smoothstep(cloudBase - 3.0, cloudBase + 8.0, pos.y) *
+                        (1.0 - smoothstep(cloudTop - 12.0, cloudTop + 2.0, pos.y));
+    density *= heightFactor;
+    
+    // SOFTER THRESHOLD for puffier appearance
+    density = smoothstep(0.25, 0.75, density);
+    
+    return clamp(density, 0.0, 1.0);
+}
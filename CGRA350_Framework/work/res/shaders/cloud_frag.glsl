@@ -3,166 +3,60 @@
 in vec3 fragRayDir;
 in vec2 texCoord;
 
-out vec4 fragColor;
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out float fragCloudDepth; // transmittance-weighted ray distance
+
 
 uniform vec3 uCameraPos;
 uniform float uTime;
 uniform vec3 uSunPos;
 uniform vec3 uSunColor;
+uniform int uFrameIndex;
+uniform mat4 uInvViewProj;
 
-// Cloud control parameters
-uniform float uCloudCoverage;
-uniform float uCloudDensity;
-uniform float uCloudScale;
-uniform float uEvolutionSpeed;
-uniform float uCloudHeight;
-uniform float uCloudThickness;
-uniform float uCloudFuzziness;
+// Full-resolution depth of the opaque scene, rays stop where they hit geometry
+uniform sampler2D uSceneDepth;
+uniform int uResolutionDivisor;
 
-// Hash Function
-vec3 hash3(vec3 p) {
-    p = vec3(dot(p, vec3(127.1, 311.7, 74.7)),
-             dot(p, vec3(269.5, 183.3, 246.1)),
-             dot(p, vec3(113.5, 271.9, 124.6)));
-    return -1.0 + 2.0 * fract(sin(p) * 43758.5453123);
-}
+// Conservative 2D coverage map around the camera (see cloud_weather_frag.glsl), used to skip empty sky
+uniform sampler2D uWeatherMap;
+uniform vec2 uWeatherOrigin;     // world xz of the map's min corner
+uniform float uWeatherExtent;    // world size covered by the map
 
 // Single float hash for jittering
 float hash(vec2 p) {
     return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453123);
 }
 
-// Improved Perlin Noise with better interpolation
-float perlinNoise(vec3 p) {
-    vec3 i = floor(p);
-    vec3 f = fract(p);
-    
-    // Quintic interpolation for smoother results
-    vec3 u = f * f * f * (f * (f * 6.0 - 15.0) + 10.0);
-    
-    return mix(mix(mix(dot(hash3(i + vec3(0,0,0)), f - vec3(0,0,0)),
-                       dot(hash3(i + vec3(1,0,0)), f - vec3(1,0,0)), u.x),
-                   mix(dot(hash3(i + vec3(0,1,0)), f - vec3(0,1,0)),
-                       dot(hash3(i + vec3(1,1,0)), f - vec3(1,1,0)), u.x), u.y),
-               mix(mix(dot(hash3(i + vec3(0,0,1)), f - vec3(0,0,1)),
-                       dot(hash3(i + vec3(1,0,1)), f - vec3(1,0,1)), u.x),
-                   mix(dot(hash3(i + vec3(0,1,1)), f - vec3(0,1,1)),
-                       dot(hash3(i + vec3(1,1,1)), f - vec3(1,1,1)), u.x), u.y), u.z);
-}
-
-// FBM with rotation for more organic look
-float perlinFbm(vec3 p, int octaves) {
-    float value = 0.0;
-    float amplitude = 0.5;
-    float frequency = 1.0;
-    
-    // Rotation matrix for breaking up patterns
-    mat3 rot = mat3(0.00, 0.80, 0.60,
-                    -0.80, 0.36, -0.48,
-                    -0.60, -0.48, 0.64);
-    
-    for(int i = 0; i < octaves; i++) {
-        value += amplitude * perlinNoise(p * frequency);
-        p = rot * p; // Rotate for each octave
-        frequency *= 2.0;
-        amplitude *= 0.5;
-    }
-    return value;
-}
-
-// Improved Worley with better distribution
-float worleyNoise(vec3 p) {
-    vec3 id = floor(p);
-    vec3 f = fract(p);
-    
-    float minDist = 1.0;
-    
-    // Full 3x3x3 search for better quality
-    for(int k = -1; k <= 1; k++) {
-        for(int j = -1; j <= 1; j++) {
-            for(int i = -1; i <= 1; i++) {
-                vec3 neighbor = vec3(float(i), float(j), float(k));
-                
-                // Better hash for point distribution
-                vec3 cellId = id + neighbor;
-                vec3 point = fract(sin(cellId * vec3(12.9898, 78.233, 45.164)) * 43758.5453);
-                point = 0.5 + 0.25 * sin(point * 6.2831 + uTime * 0.1); // Slight animation
-                
-                vec3 diff = neighbor + point - f;
-                float dist = length(diff);
-                
-                minDist = min(minDist, dist);
-            }
+// Distance along the view ray to the farthest opaque surface inside this low-res pixel's
+// footprint (the farthest, so sky visible anywhere in the footprint keeps its clouds)
+float sceneDistance() {
+    ivec2 fullSize = textureSize(uSceneDepth, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * uResolutionDivisor;
+    float depth = 0.0;
+    for (int y = 0; y < uResolutionDivisor; y++) {
+        for (int x = 0; x < uResolutionDivisor; x++) {
+            depth = max(depth, texelFetch(uSceneDepth, min(base + ivec2(x, y), fullSize - 1), 0).r);
         }
     }
+    if (depth >= 1.0) {
+        return 1.0e6; // sky
+    }
     
-    return minDist;
+    vec4 world = uInvViewProj * vec4(texCoord * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    return length(world.xyz / world.w - uCameraPos);
 }
 
-// Optimized but fluffy cloud density with dynamic evolution and user controls
-float cloudDensity(vec3 pos, float time) {
-    // WIND - clouds drift horizontally
-    vec3 windOffset = vec3(time * 0.01, 0.0, time * 0.005);
-    
-    // EVOLUTION - clouds morph over time (controlled by uEvolutionSpeed)
-    float evolutionTime = time * uEvolutionSpeed;
-    vec3 evolution = vec3(
-        sin(evolutionTime) * 5.0,
-        cos(evolutionTime * 0.7) * 3.0,
-        sin(evolutionTime * 0.5) * 4.0
-    );
-    
-    vec3 p = (pos + windOffset + evolution) * uCloudScale;
-    
-    // BASE SHAPE - animated in 4D (3D space + time)
-    float timeOffset = time * uEvolutionSpeed * 1.5;
-    vec3 p1 = p + vec3(timeOffset * 10.0);
-    vec3 p2 = p + vec3(timeOffset * -8.0);
-    
-    float baseShape1 = perlinFbm(p1 * 0.04, 3);
-    float baseShape2 = perlinFbm(p2 * 0.04, 3);
-    
-    // Blend between two noise fields for smooth transitions
-    float blendFactor = sin(time * uEvolutionSpeed * 0.5) * 0.5 + 0.5;
-    float baseShape = mix(baseShape1, baseShape2, blendFactor);
-    baseShape = baseShape * 0.5 + 0.5;
-    
-    // COVERAGE with user control
-    float coverage = perlinNoise(p * 0.025 + vec3(time * uEvolutionSpeed)) * 0.5 + 0.5;
-    float coverageMin = mix(0.15, 0.5, 1.0 - uCloudCoverage);
-    float coverageMax = mix(0.5, 0.95, uCloudCoverage);
-    coverage = smoothstep(coverageMin, coverageMax, coverage);
-    
-    baseShape *= coverage;
-    
-    // WORLEY for cloud structure - animated for changing shapes
-    float worleyFreq = mix(0.15, 0.25, uCloudFuzziness);
-    float worley = worleyNoise(p * worleyFreq + vec3(0.0, time * uEvolutionSpeed * 0.5, 0.0));
-    float edgeMin = mix(0.1, 0.3, uCloudFuzziness);
-    float edgeMax = mix(0.6, 0.8, uCloudFuzziness);
-    float edges = smoothstep(edgeMin, edgeMax, worley);
-    
-    float erosion = mix(0.15, 0.3, uCloudFuzziness);
-    float density = baseShape * (1.0 - edges * erosion);
-    
-    // Add back subtle detail for fluffiness - also animated
-    float detail = perlinNoise(p * 0.8 + vec3(sin(time * uEvolutionSpeed), 0.0, cos(time * uEvolutionSpeed))) * 0.5 + 0.5;
-    density = mix(density, density * detail, 0.15);
-    
-    // Apply density control
-    density *= uCloudDensity;
-    
-    // HEIGHT GRADIENT with user-controlled altitude
-    float cloudBase = uCloudHeight - uCloudThickness * 0.5;
-    float cloudTop = uCloudHeight + uCloudThickness * 0.5;
-    float heightFactor = smoothstep(cloudBase - 3.0, cloudBase + 8.0, pos.y) *
-                        (1.0 - smoothstep(cloudTop - 12.0, cloudTop + 2.0, pos.y));
-    density *= heightFactor;
-    
-    // SOFTER THRESHOLD for puffier appearance
-    density = smoothstep(0.25, 0.75, density);
-    
-    return clamp(density, 0.0, 1.0);
+#include "cloud_density.glsl"
+
+// True if no density can exist in this column: density before the final
+// smoothstep is bounded by coverage * uCloudDensity, which must reach 0.25
+bool cloudColumnEmpty(vec3 pos) {
+    vec2 uv = (pos.xz - uWeatherOrigin) / uWeatherExtent;
+    if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0)))) {
+        return false;
+    }
+    return texture(uWeatherMap, uv).r * uCloudDensity < 0.25;
 }
 
 // Lighting with day/night optimization
@@ -172,7 +66,8 @@ float cloudLighting(vec3 pos, vec3 sunDir, float time, float dayFactor) {
         return 0.1; // Minimal lighting at night
     }
     
-    float shadowSample = cloudDensity(pos + sunDir * 4.0, time);
+    vec3 shadowPos = pos + sunDir * 4.0;
+    float shadowSample = cloudColumnEmpty(shadowPos) ? 0.0 : cloudDensity(shadowPos, time);
     
     float shadow = exp(-shadowSample * 1.5);
     
@@ -183,7 +78,8 @@ float cloudLighting(vec3 pos, vec3 sunDir, float time, float dayFactor) {
 }
 
 // Optimized Cloud Rendering with jittering, user controls, and day/night cycle
-vec4 renderClouds(vec3 rayOrigin, vec3 rayDir, float time) {
+vec4 renderClouds(vec3 rayOrigin, vec3 rayDir, float time, float tMax, out float cloudDepth) {
+    cloudDepth = 1.0e4; // no cloud: treat as infinitely far for reprojection
     if (rayDir.y < 0.05) {
         return vec4(0.0);
     }
@@ -199,7 +95,12 @@ vec4 renderClouds(vec3 rayOrigin, vec3 rayDir, float time) {
     }
     
     float tStart = max(0.0, min(tBottom, tTop));
-    float tEnd = max(tBottom, tTop);
+    float tEnd = min(max(tBottom, tTop), tMax);
+    
+    // Geometry in front of the cloud layer hides the whole ray
+    if (tEnd <= tStart) {
+        return vec4(0.0);
+    }
     
     // Calculate day factor based on sun height
     float sunHeight = uSunPos.y;
@@ -209,10 +110,19 @@ vec4 renderClouds(vec3 rayOrigin, vec3 rayDir, float time) {
     int maxSteps = int(mix(20.0, 26.0, dayFactor));
     float stepSize = (tEnd - tStart) / float(maxSteps);
     
+    // Through empty columns take up to 4x steps, limited to one weather-map texel horizontally
+    // (the map is dilated by a texel so that jump cannot skip over cloud)
+    float texelStep = (uWeatherExtent / float(textureSize(uWeatherMap, 0).x)) / max(length(rayDir.xz), 1e-3);
+    float coarseStepSize = max(stepSize, min(stepSize * 4.0, texelStep));
+    
     // CRITICAL: Add jitter to starting position to reduce banding/streaking
-    float jitter = hash(gl_FragCoord.xy + time * 0.1) * stepSize;
+    // (golden-ratio offset per frame so the temporal history integrates different offsets)
+    float jitter = fract(hash(gl_FragCoord.xy) + float(uFrameIndex) * 0.618034) * stepSize;
+    float t = tStart + jitter;
+    float depthAccum = 0.0;
+    float weightAccum = 0.0;
     
-    vec3 pos = rayOrigin + rayDir * (tStart + jitter);
+    vec3 pos;
     float transmittance = 1.0;
     vec3 lightAccum = vec3(0.0);
     
@@ -227,7 +137,13 @@ vec4 renderClouds(vec3 rayOrigin, vec3 rayDir, float time) {
     float phaseConstant = (1.0 - g * g) / (4.0 * 3.14159);
     
     for(int i = 0; i < maxSteps; i++) {
-        if(transmittance < 0.01) break;
+        if(transmittance < 0.01 || t > tEnd) break;
+        
+        pos = rayOrigin + rayDir * t;
+        if (cloudColumnEmpty(pos)) {
+            t += coarseStepSize;
+            continue;
+        }
         
         float density = cloudDensity(pos, time);
         
@@ -246,11 +162,18 @@ vec4 renderClouds(vec3 rayOrigin, vec3 rayDir, float time) {
             float dt = density * stepSize * 1.2;
             float sampleTransmittance = exp(-dt);
             
-            lightAccum += transmittance * (1.0 - sampleTransmittance) * lighting;
+            float weight = transmittance * (1.0 - sampleTransmittance);
+            lightAccum += weight * lighting;
+            depthAccum += weight * t;
+            weightAccum += weight;
             transmittance *= sampleTransmittance;
         }
         
-        pos += rayDir * stepSize;
+        t += stepSize;
+    }
+    
+    if (weightAccum > 0.0) {
+        cloudDepth = depthAccum / weightAccum;
     }
     
     float alpha = 1.0 - transmittance;
@@ -270,10 +193,13 @@ void main() {
     vec3 rayDir = normalize(fragRayDir - uCameraPos);
     
     if (rayDir.y < -0.1) {
-        discard;
+        fragColor = vec4(0.0);
+        fragCloudDepth = 1.0e4;
+        return;
     }
     
-    vec4 clouds = renderClouds(uCameraPos, rayDir, uTime);
+    float cloudDepth;
+    vec4 clouds = renderClouds(uCameraPos, rayDir, uTime, sceneDistance(), cloudDepth);
     
     // Horizon fade
     float horizonFade = smoothstep(0.0, 0.25, rayDir.y);
@@ -294,4 +220,5 @@ void main() {
     clouds.rgb = mix(skyColor, clouds.rgb, atmosphericFade);
     
     fragColor = clouds;
+    fragCloudDepth = cloudDepth;
 }
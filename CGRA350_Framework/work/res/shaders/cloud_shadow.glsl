@@ -0,0 +1,15 @@
+// Cloud shadows: top-down transmittance map rebuilt by CloudRenderer (see cloud_shadow_frag.glsl)
+uniform sampler2D uCloudShadowMap;
+uniform vec4 uCloudShadowRegion;    // xy = world xz of the min corner, z = 1 / extent, w = strength (0 = off)
+uniform vec3 uCloudShadowSunDir;    // sun direction the map was built with
+uniform float uCloudShadowPlane;    // height the map is parameterised on
+
+float cloudShadow(vec3 worldPos) {
+    if (uCloudShadowRegion.w <= 0.0 || uCloudShadowSunDir.y <= 0.01) {
+        return 1.0;
+    }
+    // Slide along the sun direction onto the map plane
+    vec3 p = worldPos + uCloudShadowSunDir * ((uCloudShadowPlane - worldPos.y) / uCloudShadowSunDir.y);
+    vec2 uv = (p.xz - uCloudShadowRegion.xy) * uCloudShadowRegion.z;
+    return mix(1.0, texture(uCloudShadowMap, uv).r, uCloudShadowRegion.w);
+}
@@ -0,0 +1,43 @@
+#version 330 core
+
+// Top-down cloud transmittance map used to shadow the terrain, trees, water and sand.
+// Texel (x, z) holds the transmittance of the ray that leaves the plane uShadowPlaneHeight
+// at that point towards the sun, so receivers at any height project onto the plane along
+// the sun direction and take a single fetch.
+
+in vec2 texCoord;
+
+out float outTransmittance;
+
+uniform float uTime;
+uniform vec3 uSunDir;
+
+uniform vec2 uShadowOrigin;        // world xz of the map's min corner
+uniform float uShadowExtent;       // world size covered by the map
+uniform float uShadowPlaneHeight;  // just below the cloud layer
+
+#include "cloud_density.glsl"
+
+void main() {
+    vec3 start = vec3(uShadowOrigin + texCoord * uShadowExtent, uShadowPlaneHeight).xzy;
+
+    // Sun at or below the horizon: nothing to shadow against, receivers ignore the map anyway
+    if (uSunDir.y <= 0.01) {
+        outTransmittance = 1.0;
+        return;
+    }
+
+    float cloudTop = uCloudHeight + uCloudThickness * 0.5 + 2.0;
+    float tEnd = min((cloudTop - uShadowPlaneHeight) / uSunDir.y, 200.0);
+
+    const int steps = 8;
+    float stepSize = tEnd / float(steps);
+    float opticalDepth = 0.0;
+    for (int i = 0; i < steps; i++) {
+        vec3 pos = start + uSunDir * ((float(i) + 0.5) * stepSize);
+        opticalDepth += cloudDensity(pos, uTime);
+    }
+
+    // Same extinction scale as the view raymarch
+    outTransmittance = exp(-opticalDepth * stepSize * 1.2);
+}
@@ -0,0 +1,57 @@
+#version 330 core
+
+in vec2 texCoord;
+
+layout(location = 0) out vec4 outColour;
+layout(location = 1) out float outDepth;
+
+uniform sampler2D uCurrentColour;   // this frame's low-res raymarch
+uniform sampler2D uCurrentDepth;
+uniform sampler2D uHistoryColour;   // accumulated result of previous frames
+
+uniform mat4 uInvViewProj;          // current (unjittered)
+uniform mat4 uPrevViewProj;         // previous frame
+uniform vec3 uCameraPos;
+uniform float uBlend;               // weight of the current frame
+uniform bool uHistoryValid;
+
+void main() {
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    ivec2 maxCoord = textureSize(uCurrentColour, 0) - 1;
+
+    vec4 current = texelFetch(uCurrentColour, coord, 0);
+    float depth = texelFetch(uCurrentDepth, coord, 0).r;
+    outDepth = depth;
+
+    if (!uHistoryValid) {
+        outColour = current;
+        return;
+    }
+
+    // Neighbourhood bounds used to reject stale history (clouds move and evolve)
+    vec4 nMin = current;
+    vec4 nMax = current;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            vec4 n = texelFetch(uCurrentColour, clamp(coord + ivec2(x, y), ivec2(0), maxCoord), 0);
+            nMin = min(nMin, n);
+            nMax = max(nMax, n);
+        }
+    }
+
+    // Reconstruct the world position the cloud sample came from and project it into last frame
+    vec4 farPoint = uInvViewProj * vec4(texCoord * 2.0 - 1.0, 1.0, 1.0);
+    vec3 rayDir = normalize(farPoint.xyz / farPoint.w - uCameraPos);
+    vec3 worldPos = uCameraPos + rayDir * depth;
+
+    vec4 prevClip = uPrevViewProj * vec4(worldPos, 1.0);
+    vec2 prevUv = prevClip.xy / prevClip.w * 0.5 + 0.5;
+
+    if (prevClip.w <= 0.0 || any(lessThan(prevUv, vec2(0.0))) || any(greaterThan(prevUv, vec2(1.0)))) {
+        outColour = current;
+        return;
+    }
+
+    vec4 history = clamp(texture(uHistoryColour, prevUv), nMin, nMax);
+    outColour = mix(history, current, uBlend);
+}
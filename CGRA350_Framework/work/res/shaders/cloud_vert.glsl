@@ -6,12 +6,13 @@ out vec3 fragRayDir;
 out vec2 texCoord;
 
 uniform mat4 uInvViewProj;
+uniform vec2 uJitter; // sub-texel offset (NDC) for temporal accumulation
 
 void main() {
     texCoord = aPos * 0.5 + 0.5;
     gl_Position = vec4(aPos, 0.999, 1.0); // Almost at far plane
     
     // Compute world space position for ray direction
-    vec4 worldPos = uInvViewProj * vec4(aPos, 1.0, 1.0);
+    vec4 worldPos = uInvViewProj * vec4(aPos + uJitter, 1.0, 1.0);
     fragRayDir = worldPos.xyz / worldPos.w;
 }
@@ -0,0 +1,37 @@
+#version 330 core
+
+// Builds a conservative top-down coverage map for empty-space skipping in cloud_frag.glsl.
+// Each texel stores the maximum coverage over its footprint dilated by one texel on every
+// side and sampled through the cloud layer, so a marcher can trust "empty" for any point
+// up to a texel away.
+
+out float outCoverage;
+
+uniform float uTime;
+
+uniform vec2 uWeatherOrigin;     // world xz of the map's min corner
+uniform float uWeatherExtent;    // world size covered by the map
+uniform float uWeatherResolution;
+
+#include "cloud_density.glsl"
+
+void main() {
+    float texelSize = uWeatherExtent / uWeatherResolution;
+    vec2 texelMin = uWeatherOrigin + (gl_FragCoord.xy - 0.5) * texelSize;
+
+    float cloudBase = uCloudHeight - uCloudThickness * 0.5;
+
+    float maxCoverage = 0.0;
+    for (int h = 0; h < 3; h++) {
+        float y = cloudBase + uCloudThickness * float(h) * 0.5;
+        for (int j = -1; j <= 2; j++) {
+            for (int i = -1; i <= 2; i++) {
+                vec3 pos = vec3(texelMin.x + float(i) * texelSize, y, texelMin.y + float(j) * texelSize);
+                maxCoverage = max(maxCoverage, cloudCoverage(cloudNoiseCoord(pos, uTime), uTime));
+            }
+        }
+    }
+
+    // Small margin for coverage variation between the sample points
+    outCoverage = min(maxCoverage * 1.1 + 0.02, 1.0);
+}
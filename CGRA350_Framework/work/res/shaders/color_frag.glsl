@@ -3,9 +3,8 @@
 in vec3 vWorldPos;
 in vec3 vNormal;
 
-uniform vec3 uCameraPos;
-uniform vec3 uSunPos;
-uniform vec3 uSunColor;
+#include "frame_uniforms.glsl"
+
 uniform vec3 uAlbedo;
 
 out vec4 FragColor;
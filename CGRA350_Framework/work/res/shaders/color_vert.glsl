@@ -4,20 +4,22 @@ layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
 
+#include "frame_uniforms.glsl"
+
 uniform mat4 uModelViewMatrix;
-uniform mat4 uProjectionMatrix;
-uniform mat4 uLightSpacematrix;
 
 // Output world-space position and normal
 out vec3 vWorldPos;
 out vec3 vNormal;
 out vec2 vUv;
-out vec4 vFragPosLightSpace;
+
+// The depth prepass draws with this shader too and shading tests GL_EQUAL against it,
+// so both must compute bit-identical positions
+invariant gl_Position;
 
 void main() {
     vUv = aTexCoord;
     vWorldPos = aPosition;      // world-space position
     vNormal = normalize(aNormal); // world-space normal
-    vFragPosLightSpace = uLightSpacematrix * vec4(vWorldPos, 1.0);
     gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(aPosition, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 330 core
+
+// Depth-only prepass of shaders without cutouts, the depth test does all the work
+void main()
+{
+}
@@ -0,0 +1,26 @@
+#version 330 core
+
+// One direction of the separable Gaussian blur over EVSM moments (see EvsmShadowMap)
+
+out vec4 fragColor;
+
+uniform sampler2DArray uSource;
+uniform int uLayer;
+uniform ivec2 uDirection;   // (1, 0) or (0, 1)
+uniform ivec2 uRegion;      // texels of the layer that belong to the cascade
+uniform int uRadius;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float sigma = max(float(uRadius) * 0.5, 0.5);
+
+    vec4 sum = vec4(0.0);
+    float weightSum = 0.0;
+    for (int i = -uRadius; i <= uRadius; i++) {
+        ivec2 c = clamp(texel + uDirection * i, ivec2(0), uRegion - 1);
+        float w = exp(-float(i * i) / (2.0 * sigma * sigma));
+        sum += texelFetch(uSource, ivec3(c, uLayer), 0) * w;
+        weightSum += w;
+    }
+    fragColor = sum / weightSum;
+}
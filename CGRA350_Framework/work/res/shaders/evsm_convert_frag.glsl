@@ -0,0 +1,28 @@
+#version 330 core
+
+// Warps cascade depth into EVSM moments (see EvsmShadowMap), averaging 2x2 depth texels
+// per output texel. Moments are linear so averaging them is a correct box prefilter.
+
+out vec4 fragColor;
+
+uniform sampler2DArray uShadowDepth;
+uniform int uLayer;
+uniform vec2 uExponents;    // positive, negative warp exponents
+
+vec4 warpDepth(float depth) {
+    float d = depth * 2.0 - 1.0;
+    float pos = exp(uExponents.x * d);
+    float neg = -exp(-uExponents.y * d);
+    return vec4(pos, pos * pos, neg, neg * neg);
+}
+
+void main() {
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+    vec4 moments = vec4(0.0);
+    for (int y = 0; y <= 1; y++) {
+        for (int x = 0; x <= 1; x++) {
+            moments += warpDepth(texelFetch(uShadowDepth, ivec3(base + ivec2(x, y), uLayer), 0).r);
+        }
+    }
+    fragColor = moments * 0.25;
+}
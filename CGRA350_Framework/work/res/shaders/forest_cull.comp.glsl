@@ -0,0 +1,72 @@
+#version 430 core
+
+// Culls forest instances and sorts the survivors into per [archetype][level] buckets
+// (see ForestCuller). The tests and the level selection are in forest_cull_common.glsl,
+// shared with forest_cull_vert.glsl, the transform feedback path.
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+struct CullInstance {
+    mat4 model;
+    vec4 boundsMin;    // w = archetype index
+    vec4 boundsMax;    // w = archetype radius
+};
+
+// The instance attributes read by the tree and impostor shaders
+struct InstanceData {
+    mat4 model;
+    vec4 lod;          // x = fade amount, y = 1 for the incoming level
+};
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer {
+    CullInstance instances[];
+};
+
+// Per archetype: first output slot of its level 0 bucket, and the capacity of each bucket
+layout(std430, binding = 1) readonly buffer ArchetypeBuffer {
+    uvec2 archetypes[];
+};
+
+layout(std430, binding = 2) writeonly buffer VisibleBuffer {
+    InstanceData visible[];
+};
+
+layout(std430, binding = 3) buffer CounterBuffer {
+    uint counters[];
+};
+
+uniform uint uInstanceCount;
+
+#include "forest_cull_common.glsl"
+
+void emit(uint archetype, int level, mat4 model, vec4 lod) {
+    uvec2 range = archetypes[archetype];
+    uint slot = atomicAdd(counters[archetype * LEVELS + level], 1u);
+    visible[range.x + uint(level) * range.y + slot] = InstanceData(model, lod);
+}
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uInstanceCount) return;
+
+    CullInstance instance = instances[index];
+    vec3 boundsMin = instance.boundsMin.xyz;
+    vec3 boundsMax = instance.boundsMax.xyz;
+    if (!inFrustum(boundsMin, boundsMax)) return;
+    if (uOcclusion && isOccluded(boundsMin, boundsMax)) return;
+
+    uint archetype = uint(instance.boundsMin.w);
+    if (!uLodEnabled) {
+        emit(archetype, 0, instance.model, vec4(0.0));
+        return;
+    }
+
+    float fade;
+    int level = selectLevel(boundsMin, boundsMax, instance.boundsMax.w, fade);
+    if (fade > 0.0) {
+        emit(archetype, level, instance.model, vec4(fade, 0.0, 0.0, 0.0));
+        emit(archetype, level + 1, instance.model, vec4(fade, 1.0, 0.0, 0.0));
+    } else {
+        emit(archetype, level, instance.model, vec4(0.0));
+    }
+}
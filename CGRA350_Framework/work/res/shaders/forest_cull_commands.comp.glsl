@@ -0,0 +1,44 @@
+#version 430 core
+
+// Turns the bucket counts of forest_cull.comp.glsl into indirect draw commands, one per
+// mesh drawn from a bucket (see ForestCuller::Draw)
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+struct Draw {
+    uint indexCount;
+    uint perTree;      // instances per tree, the leaf count for leaves
+    uint bucket;
+    uint baseInstance;
+};
+
+// DrawElementsIndirectCommand, tightly packed
+struct Command {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer DrawBuffer {
+    Draw draws[];
+};
+
+layout(std430, binding = 1) readonly buffer CounterBuffer {
+    uint counters[];
+};
+
+layout(std430, binding = 2) writeonly buffer CommandBuffer {
+    Command commands[];
+};
+
+uniform uint uDrawCount;
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uDrawCount) return;
+
+    Draw draw = draws[index];
+    commands[index] = Command(draw.indexCount, counters[draw.bucket] * draw.perTree, 0u, 0, draw.baseInstance);
+}
@@ -0,0 +1,72 @@
+// Shared by the two forest culling paths, forest_cull.comp.glsl and forest_cull_vert.glsl,
+// so their tests and level selection cannot drift apart
+
+const int LEVELS = 4;                  // mesh levels and the impostor
+const int IMPOSTOR_LEVEL = LEVELS - 1;
+
+uniform vec4 uFrustum[6];
+uniform vec3 uCameraPos;
+
+uniform bool uLodEnabled;
+uniform float uPixelScale;
+uniform float uLodPixels[LEVELS - 1];
+uniform float uLodFadeBand;
+
+// Hi-Z pyramid of the previous frame's depth, level 0 at half of uDepthSize
+uniform bool uOcclusion;
+uniform sampler2D uHiZ;
+uniform mat4 uHiZViewProj;
+uniform ivec2 uDepthSize;
+uniform int uHiZLevels;
+
+bool inFrustum(vec3 boundsMin, vec3 boundsMax) {
+    for (int i = 0; i < 6; i++) {
+        // The corner furthest along the plane normal
+        vec3 p = mix(boundsMin, boundsMax, step(0.0, uFrustum[i].xyz));
+        if (dot(uFrustum[i].xyz, p) + uFrustum[i].w < 0.0) return false;
+    }
+    return true;
+}
+
+bool isOccluded(vec3 boundsMin, vec3 boundsMax) {
+    vec3 lo = vec3(1.0), hi = vec3(-1.0);
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = mix(boundsMin, boundsMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+        vec4 clip = uHiZViewProj * vec4(corner, 1.0);
+        if (clip.w <= 0.0) return false;    // reaches behind the camera
+        vec3 ndc = clip.xyz / clip.w;
+        lo = min(lo, ndc);
+        hi = max(hi, ndc);
+    }
+
+    // Pick the level where the rectangle covers at most 2x2 texels and take their furthest depth
+    vec2 size = vec2(uDepthSize);
+    ivec2 p0 = ivec2(clamp((lo.xy * 0.5 + 0.5) * size, vec2(0.0), size - 1.0));
+    ivec2 p1 = ivec2(clamp((hi.xy * 0.5 + 0.5) * size, vec2(0.0), size - 1.0));
+    int extent = max(p1.x - p0.x, p1.y - p0.y) + 1;
+    int level = clamp(int(ceil(log2(float(extent)))) - 1, 0, uHiZLevels - 1);
+
+    // Level sizes halve from the depth size rounded down, the pyramid is built that way
+    ivec2 last = max(uDepthSize >> (level + 1), ivec2(1)) - 1;
+    ivec2 t0 = min(p0 >> (level + 1), last);
+    ivec2 t1 = min(p1 >> (level + 1), last);
+    float depth = max(max(texelFetch(uHiZ, t0, level).r, texelFetch(uHiZ, ivec2(t1.x, t0.y), level).r),
+                      max(texelFetch(uHiZ, ivec2(t0.x, t1.y), level).r, texelFetch(uHiZ, t1, level).r));
+    return lo.z * 0.5 + 0.5 > depth;
+}
+
+// The level the trees choose by projected size, as Forest::selectLods does on the CPU.
+// Just above the next threshold this level fades out as the next one fades in: fade is
+// how far, and 0 when the instance is not in a band.
+int selectLevel(vec3 boundsMin, vec3 boundsMax, float radius, out float fade) {
+    vec3 center = (boundsMin + boundsMax) * 0.5;
+    float distance = max(length(center - uCameraPos), 0.001);
+    float pixels = radius * uPixelScale / distance;
+
+    int level = 0;
+    while (level < IMPOSTOR_LEVEL && pixels < uLodPixels[level]) level++;
+
+    float fadeStart = level < IMPOSTOR_LEVEL ? uLodPixels[level] * (1.0 + uLodFadeBand) : 0.0;
+    fade = pixels < fadeStart ? (fadeStart - pixels) / (uLodPixels[level] * uLodFadeBand) : 0.0;
+    return level;
+}
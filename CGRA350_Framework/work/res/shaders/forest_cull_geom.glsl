@@ -0,0 +1,31 @@
+#version 330 core
+
+// Passes on the instances forest_cull_vert.glsl kept, captured by transform feedback as
+// the tree shaders' instance attributes (the model matrix columns, then the cross-fade)
+
+layout(points) in;
+layout(points, max_vertices = 1) out;
+
+in VertexData {
+    mat4 model;
+    vec4 lod;
+    flat int keep;
+} v_in[];
+
+out vec4 gModel0;
+out vec4 gModel1;
+out vec4 gModel2;
+out vec4 gModel3;
+out vec4 gLod;
+
+void main() {
+    if (v_in[0].keep == 0) return;
+
+    gModel0 = v_in[0].model[0];
+    gModel1 = v_in[0].model[1];
+    gModel2 = v_in[0].model[2];
+    gModel3 = v_in[0].model[3];
+    gLod = v_in[0].lod;
+    EmitVertex();
+    EndPrimitive();
+}
@@ -0,0 +1,47 @@
+#version 330 core
+
+// Transform feedback path of the forest culling (see ForestCuller), for GL 3.3: the
+// tests and level selection of forest_cull.comp.glsl, shared in forest_cull_common.glsl,
+// but one instance per vertex and one level (uLevel) per pass. forest_cull_geom.glsl
+// drops instances not in that level.
+
+layout(location = 0) in mat4 aModel;        // locations 0-3
+layout(location = 4) in vec4 aBoundsMin;    // w = archetype index
+layout(location = 5) in vec4 aBoundsMax;    // w = archetype radius
+
+out VertexData {
+    mat4 model;
+    vec4 lod;
+    flat int keep;
+} v_out;
+
+uniform int uLevel;
+
+#include "forest_cull_common.glsl"
+
+void main() {
+    v_out.model = aModel;
+    v_out.lod = vec4(0.0);
+    v_out.keep = 0;
+
+    vec3 boundsMin = aBoundsMin.xyz;
+    vec3 boundsMax = aBoundsMax.xyz;
+    if (!inFrustum(boundsMin, boundsMax)) return;
+    if (uOcclusion && isOccluded(boundsMin, boundsMax)) return;
+
+    if (!uLodEnabled) {
+        v_out.keep = uLevel == 0 ? 1 : 0;
+        return;
+    }
+
+    float fade;
+    int level = selectLevel(boundsMin, boundsMax, aBoundsMax.w, fade);
+    if (fade > 0.0) {
+        if (uLevel == level || uLevel == level + 1) {
+            v_out.lod = vec4(fade, uLevel == level ? 0.0 : 1.0, 0.0, 0.0);
+            v_out.keep = 1;
+        }
+    } else {
+        v_out.keep = uLevel == level ? 1 : 0;
+    }
+}
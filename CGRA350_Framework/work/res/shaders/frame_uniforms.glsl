@@ -0,0 +1,27 @@
+// Per-frame camera, sun and shadow data shared by the scene shaders. Filled once a frame
+// by FrameUniforms and bound at a fixed binding point, so draws no longer set any of it.
+// The layout is mirrored by FrameData in frame_uniforms.hpp.
+layout(std140) uniform FrameUniforms {
+    mat4 uViewMatrix;
+    mat4 uProjectionMatrix;
+    mat4 uViewProjMatrix;
+    mat4 uInvViewProj;
+    vec3 uCameraPos;
+    vec3 uSunPos;
+    vec3 uSunColor;
+
+    // PCSS filtering of the sun shadow, see ShadowMask
+    float uLightSize;
+    float uNearPlane;
+    int uBlockerSearchSamples;
+    int uPCFSamples;
+
+    // The cascades as last rendered, see CascadedShadowMap
+    mat4 uCascadeMatrices[4];
+    vec4 uCascadeSplits;            // far view depth of each cascade
+    vec4 uCascadeScale;             // part of the layer the cascade was rendered into
+    vec4 uCascadeFilterScale;       // keeps uLightSize constant in world units
+    vec3 uCascadeCameraPos;
+    int uCascadeCount;
+    vec3 uCascadeCameraForward;
+};
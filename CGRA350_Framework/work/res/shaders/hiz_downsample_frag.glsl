@@ -0,0 +1,27 @@
+#version 330 core
+
+// One level of the forest's Hi-Z pyramid (see ForestCuller): the furthest depth of the
+// 2x2 source texels under each target texel. Along an odd edge the last target texel
+// also takes the leftover row or column, so no source texel is ever skipped.
+
+out float fragDepth;
+
+uniform sampler2D uSource;     // depth, or the previous level (as its only level)
+uniform ivec2 uSourceSize;
+uniform ivec2 uTargetSize;
+
+void main() {
+    ivec2 target = ivec2(gl_FragCoord.xy);
+    ivec2 first = target * 2;
+    ivec2 last = min(first + 1, uSourceSize - 1);
+    if (target.x == uTargetSize.x - 1) last.x = uSourceSize.x - 1;
+    if (target.y == uTargetSize.y - 1) last.y = uSourceSize.y - 1;
+
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; y++) {
+        for (int x = first.x; x <= last.x; x++) {
+            depth = max(depth, texelFetch(uSource, ivec2(x, y), 0).r);
+        }
+    }
+    fragDepth = depth;
+}
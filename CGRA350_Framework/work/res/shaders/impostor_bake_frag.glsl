@@ -0,0 +1,31 @@
+#version 330 core
+in vec3 vNormal;
+in vec3 vColour;
+in vec2 vTexCoord;
+
+uniform sampler2D uTrunkDiffuse;
+uniform bool uIsLeaf;
+
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec4 outNormal;
+
+void main() {
+    // Same albedo as tree_frag.glsl, lighting is applied when the impostor is drawn
+    vec3 albedo;
+    if (uIsLeaf) {
+        albedo = vColour;
+    } else {
+        albedo = texture(uTrunkDiffuse, vTexCoord).rgb;
+        if (length(albedo) < 0.1) {
+            albedo = vec3(0.4, 0.25, 0.15);
+        }
+    }
+
+    outAlbedo = vec4(albedo, 1.0);
+    // Single-sided leaves face the view they were baked from
+    vec3 N = normalize(vNormal);
+    if (uIsLeaf && !gl_FrontFacing) {
+        N = -N;
+    }
+    outNormal = vec4(N * 0.5 + 0.5, 1.0);
+}
@@ -0,0 +1,30 @@
+#version 330 core
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 texCoord;
+layout(location = 3) in vec3 colour;
+
+uniform mat4 uViewProj;    // one orthographic view of the tree, in its local space
+
+out vec3 vNormal;
+out vec3 vColour;
+out vec2 vTexCoord;
+
+#include "leaf_instance.glsl"
+
+void main() {
+    vec3 localPos = position;
+    vNormal = normal;
+    vColour = colour;
+    if (uIsLeaf) {
+        vec4 placement;
+        float variant;
+        vec4 q = leafOrientation(placement, variant);
+        localPos = placement.xyz + quatRotate(q, position * placement.w * uLeafScale);
+        vNormal = quatRotate(q, normal);
+        vColour = colour * mix(vec3(0.8, 0.85, 0.8), vec3(1.1, 1.05, 0.8), variant);
+    }
+    vTexCoord = texCoord;
+    gl_Position = uViewProj * vec4(localPos, 1.0);
+}
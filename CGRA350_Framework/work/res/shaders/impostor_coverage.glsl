@@ -0,0 +1,19 @@
+// The baked albedo of an impostor, blended between the two nearest views, and whether it
+// covers the pixel. Shading and the depth prepass test coverage the same way.
+in vec2 vUv0;
+in vec2 vUv1;
+in float vViewBlend;
+
+uniform sampler2DArray uImpostorAlbedo;
+uniform float uImpostorLayer;
+
+vec4 impostorAlbedo() {
+    vec4 albedo0 = texture(uImpostorAlbedo, vec3(vUv0, uImpostorLayer));
+    vec4 albedo1 = texture(uImpostorAlbedo, vec3(vUv1, uImpostorLayer));
+    return mix(albedo0, albedo1, vViewBlend);
+}
+
+// Mipmapping averages coverage down, so test below one half to keep distant crowns full
+bool impostorCovers(vec4 albedo) {
+    return albedo.a >= 0.3;
+}
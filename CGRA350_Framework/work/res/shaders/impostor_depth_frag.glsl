@@ -0,0 +1,12 @@
+#version 330 core
+
+#include "impostor_coverage.glsl"
+#include "lod_fade.glsl"
+
+// Impostors in the depth prepass: the coverage and cross-fade discards of
+// impostor_frag.glsl without its lighting
+void main() {
+    if (!impostorCovers(impostorAlbedo()) || lodFadedOut()) {
+        discard;
+    }
+}
@@ -0,0 +1,58 @@
+#version 330 core
+in vec3 vWorldPos;
+flat in mat3 vNormalMatrix;
+
+#include "frame_uniforms.glsl"
+
+uniform sampler2DArray uImpostorNormal;
+
+out vec4 FragColor;
+
+#include "impostor_coverage.glsl"
+#include "lod_fade.glsl"
+
+// Sun visibility resolved once per pixel from the depth prepass (see ShadowMask)
+uniform sampler2D uShadowMask;
+
+float sunShadow() {
+    return 1.0 - texelFetch(uShadowMask, ivec2(gl_FragCoord.xy), 0).r;
+}
+
+#include "cloud_shadow.glsl"
+
+void main() {
+    vec4 albedo = impostorAlbedo();
+    if (!impostorCovers(albedo) || lodFadedOut()) {
+        discard;
+    }
+    albedo.rgb /= albedo.a;
+
+    // Both maps were cleared to zero, so filtered texels are premultiplied by coverage
+    vec4 normal = mix(texture(uImpostorNormal, vec3(vUv0, uImpostorLayer)),
+                      texture(uImpostorNormal, vec3(vUv1, uImpostorLayer)), vViewBlend);
+    vec3 localNormal = normal.xyz / max(normal.a, 0.001) * 2.0 - 1.0;
+
+    // Lit like tree_frag.glsl
+    vec3 N = normalize(vNormalMatrix * localNormal);
+    vec3 L = normalize(uSunPos - vWorldPos);
+    vec3 V = normalize(uCameraPos - vWorldPos);
+
+    float dayFactor = smoothstep(-50.0, 50.0, uSunPos.y);
+
+    float shadow = sunShadow();
+    shadow = 1.0 - (1.0 - shadow) * cloudShadow(vWorldPos);
+
+    float NdotL = max(dot(N, L), 0.0);
+
+    vec3 ambient = mix(vec3(0.01) * albedo.rgb, vec3(0.3) * albedo.rgb, dayFactor);
+    vec3 diffuse = dayFactor * NdotL * albedo.rgb * uSunColor;
+
+    vec3 H = normalize(V + L);
+    float spec = pow(max(dot(N, H), 0.0), 32.0);
+    vec3 specular = dayFactor * spec * uSunColor * 0.3;
+
+    vec3 finalColor = ambient + (1.0 - shadow) * (diffuse + specular);
+    finalColor = max(finalColor, vec3(0.01));
+
+    FragColor = vec4(finalColor, 1.0);
+}
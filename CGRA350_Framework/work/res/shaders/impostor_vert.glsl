@@ -0,0 +1,58 @@
+#version 330 core
+
+layout(location = 0) in vec3 position;          // quad corner, xy in [-1, 1]
+layout(location = 4) in mat4 instanceModel;     // per instance, see Forest
+layout(location = 8) in vec4 instanceLod;       // x = cross-fade, y = 1 while fading in
+
+#include "frame_uniforms.glsl"
+
+// Atlas layout and this archetype's extent, see TreeImpostors
+uniform sampler2DArray uImpostorAlbedo;
+uniform int uImpostorViews;
+uniform ivec2 uImpostorGrid;
+uniform vec3 uImpostorExtent;   // x = radius about the up axis, y = centre height, z = half height
+
+out vec3 vWorldPos;
+out vec2 vUv0;                  // atlas coordinates in the two nearest views
+out vec2 vUv1;
+out float vViewBlend;
+flat out mat3 vNormalMatrix;    // tree local space to world
+flat out vec2 vLodFade;
+
+vec2 atlasUv(int view, vec2 uv) {
+    // Stay half a texel inside the tile so filtering never reads the neighbouring view
+    vec2 tileTexels = vec2(textureSize(uImpostorAlbedo, 0).xy) / vec2(uImpostorGrid);
+    uv = clamp(uv, 0.5 / tileTexels, 1.0 - 0.5 / tileTexels);
+    vec2 tile = vec2(view % uImpostorGrid.x, view / uImpostorGrid.x);
+    return (tile + uv) / vec2(uImpostorGrid);
+}
+
+// Shared with impostor_depth_frag in the depth prepass, shading tests GL_EQUAL against it
+invariant gl_Position;
+
+void main() {
+    mat3 rotation = mat3(instanceModel);
+    vec3 origin = vec3(instanceModel[3]);
+
+    // Camera azimuth about the tree's own up axis, in the frame the views were baked in
+    vec3 localCamera = transpose(rotation) * (uCameraPos - origin);
+    float phi = atan(localCamera.z, localCamera.x);
+    vec3 right = vec3(sin(phi), 0.0, -cos(phi));
+
+    vec3 local = right * (position.x * uImpostorExtent.x)
+               + vec3(0.0, uImpostorExtent.y + position.y * uImpostorExtent.z, 0.0);
+    vWorldPos = vec3(instanceModel * vec4(local, 1.0));
+
+    float view = mod(phi / 6.28318530718 * float(uImpostorViews), float(uImpostorViews));
+    int view0 = int(floor(view)) % uImpostorViews;
+    int view1 = (view0 + 1) % uImpostorViews;
+    vec2 uv = position.xy * 0.5 + 0.5;
+    vUv0 = atlasUv(view0, uv);
+    vUv1 = atlasUv(view1, uv);
+    vViewBlend = fract(view);
+
+    vNormalMatrix = rotation;
+    vLodFade = instanceLod.xy;
+
+    gl_Position = uViewProjMatrix * vec4(vWorldPos, 1.0);
+}
@@ -0,0 +1,20 @@
+// Leaves are instanced: each instance places the shared leaf shape with a record
+// from uLeafInstances (two texels: position and scale, quaternion xyz and tint).
+// uLeafCount records are drawn per tree, every uLeafStride-th, see Tree::bindLeaves.
+uniform bool uIsLeaf;
+uniform samplerBuffer uLeafInstances;
+uniform int uLeafCount;
+uniform int uLeafStride;
+uniform float uLeafScale;
+
+vec3 quatRotate(vec4 q, vec3 v) {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+vec4 leafOrientation(out vec4 placement, out float variant) {
+    int leaf = (gl_InstanceID % uLeafCount) * uLeafStride;
+    placement = texelFetch(uLeafInstances, leaf * 2);
+    vec4 texel = texelFetch(uLeafInstances, leaf * 2 + 1);
+    variant = texel.w;
+    return vec4(texel.xyz, sqrt(max(1.0 - dot(texel.xyz, texel.xyz), 0.0)));
+}
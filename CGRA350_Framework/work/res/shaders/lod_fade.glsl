@@ -0,0 +1,17 @@
+// Screen-door cross-fade between levels of detail, see Forest::selectLods. Every pass that
+// draws the trees discards the same pixels, so the depth prepass matches shading.
+flat in vec2 vLodFade;
+
+float bayer4(ivec2 p) {
+    const float pattern[16] = float[16](
+         0.0,  8.0,  2.0, 10.0,
+        12.0,  4.0, 14.0,  6.0,
+         3.0, 11.0,  1.0,  9.0,
+        15.0,  7.0, 13.0,  5.0);
+    return (pattern[(p.y & 3) * 4 + (p.x & 3)] + 0.5) / 16.0;
+}
+
+bool lodFadedOut() {
+    float d = bayer4(ivec2(gl_FragCoord.xy));
+    return vLodFade.y > 0.5 ? d >= vLodFade.x : d < vLodFade.x;
+}
@@ -1,6 +1,12 @@
 #version 330 core
 
+#include "lod_fade.glsl"
+
 void main()
-{             
+{
+    // Trees cross-fading between levels of detail in the depth prepass
+    if (lodFadedOut()) {
+        discard;
+    }
     // gl_FragDepth = gl_FragCoord.z;
-}  
\ No newline at end of file
+}
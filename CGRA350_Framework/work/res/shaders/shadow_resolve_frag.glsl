@@ -0,0 +1,263 @@
+#version 330 core
+
+// Screen-space sun shadow resolve (see ShadowMask). Filters the cascades once per pixel of
+// the depth prepass, with PCSS or EVSM, and writes sun visibility (1 = lit), which the
+// materials read with one texelFetch.
+
+in vec2 texCoord;
+
+out vec4 fragColor;
+
+// Camera, sun, PCSS parameters and cascade matrices
+#include "frame_uniforms.glsl"
+
+uniform sampler2D uSceneDepth;     // depth prepass
+uniform int uDepthStep;            // full-res depth texels per output texel (1 or 2)
+uniform vec2 uScreenSize;          // full-res size
+uniform int uShadowFilter;         // 0 = PCSS, 1 = EVSM
+
+// Cascaded sun shadow maps (see CascadedShadowMap::bind)
+uniform sampler2DArray uShadowCascades;
+
+float sampleCascade(vec2 uv, int cascade) {
+    return texture(uShadowCascades, vec3(clamp(uv, 0.0, 1.0) * uCascadeScale[cascade], float(cascade))).r;
+}
+
+// Pick the first cascade whose slice of the view frustum contains this point, -1 if none.
+// There is no blend at the splits or at the shadow distance, everything past it is lit.
+int selectCascade(vec3 worldPos) {
+    float viewDepth = dot(worldPos - uCascadeCameraPos, uCascadeCameraForward);
+    for (int i = 0; i < uCascadeCount; i++) {
+        if (viewDepth < uCascadeSplits[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// EVSM moments of the cascades (see EvsmShadowMap::bind), same layout as uShadowCascades
+uniform sampler2DArray uShadowMoments;
+uniform vec2 uEvsmExponents;
+uniform float uEvsmBleedReduction;
+
+// --- Poisson disk sampling pattern ---
+const vec2 poissonDisk[64] = vec2[](
+    vec2(-0.613392, 0.617481),
+    vec2(0.170019, -0.040254),
+    vec2(-0.299417, 0.791925),
+    vec2(0.645680, 0.493210),
+    vec2(-0.651784, 0.717887),
+    vec2(0.421003, 0.027070),
+    vec2(-0.817194, -0.271096),
+    vec2(-0.705374, -0.668203),
+    vec2(0.977050, -0.108615),
+    vec2(0.063326, 0.142369),
+    vec2(0.203528, 0.214331),
+    vec2(-0.667531, 0.326090),
+    vec2(-0.098422, -0.295755),
+    vec2(-0.885922, 0.215369),
+    vec2(0.566637, 0.605213),
+    vec2(0.039766, -0.396100),
+    vec2(0.751946, 0.453352),
+    vec2(0.078707, -0.715323),
+    vec2(-0.075838, -0.529344),
+    vec2(0.724479, -0.580798),
+    vec2(0.222999, -0.215125),
+    vec2(-0.467574, -0.405438),
+    vec2(-0.248268, -0.814753),
+    vec2(0.354411, -0.887570),
+    vec2(0.175817, 0.382366),
+    vec2(0.487472, -0.063082),
+    vec2(-0.084078, 0.898312),
+    vec2(0.488876, -0.783441),
+    vec2(0.470016, 0.217933),
+    vec2(-0.696890, -0.549791),
+    vec2(-0.149693, 0.605762),
+    vec2(0.034211, 0.979980),
+    vec2(0.503098, -0.308878),
+    vec2(-0.016205, -0.872921),
+    vec2(0.385784, -0.393902),
+    vec2(-0.146886, -0.859249),
+    vec2(0.643361, 0.164098),
+    vec2(0.634388, -0.049471),
+    vec2(-0.688894, 0.007843),
+    vec2(0.464034, -0.188818),
+    vec2(-0.440840, 0.137486),
+    vec2(0.364483, 0.511704),
+    vec2(0.034028, 0.325968),
+    vec2(0.099094, -0.308023),
+    vec2(0.693960, -0.366253),
+    vec2(0.678884, -0.204688),
+    vec2(0.001801, 0.780328),
+    vec2(0.145177, -0.898984),
+    vec2(0.062655, -0.611866),
+    vec2(0.315226, -0.604297),
+    vec2(-0.780145, 0.486251),
+    vec2(-0.371868, 0.882138),
+    vec2(0.200476, 0.494430),
+    vec2(-0.494552, -0.711051),
+    vec2(0.612476, 0.705252),
+    vec2(-0.578845, -0.768792),
+    vec2(-0.772454, -0.090976),
+    vec2(0.504440, 0.372295),
+    vec2(0.155736, 0.065157),
+    vec2(0.391522, 0.849605),
+    vec2(-0.620106, -0.328104),
+    vec2(0.789239, -0.419965),
+    vec2(-0.545396, 0.538133),
+    vec2(-0.178564, -0.596057)
+);
+
+// Step 1: Find average blocker depth
+float findBlockerDistance(vec2 uv, float zReceiver, float searchWidth, int cascade) {
+    float blockerSum = 0.0;
+    int blockerCount = 0;
+    
+    for (int i = 0; i < uBlockerSearchSamples; i++) {
+        vec2 offset = poissonDisk[i] * searchWidth;
+        float shadowMapDepth = sampleCascade(uv + offset, cascade);
+        
+        if (shadowMapDepth < zReceiver) {
+            blockerSum += shadowMapDepth;
+            blockerCount++;
+        }
+    }
+    
+    if (blockerCount == 0) {
+        return -1.0; // No blockers found
+    }
+    
+    return blockerSum / float(blockerCount);
+}
+
+// Step 2: Estimate penumbra size
+float estimatePenumbraSize(float zReceiver, float zBlocker) {
+    return (zReceiver - zBlocker) / zBlocker;
+}
+
+// Step 3: PCF with variable filter size
+float PCF(vec2 uv, float zReceiver, float filterRadius, vec3 normal, vec3 lightDir, int cascade) {
+    float sum = 0.0;
+    float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+    
+    for (int i = 0; i < uPCFSamples; i++) {
+        vec2 offset = poissonDisk[i % 64] * filterRadius;
+        float shadowMapDepth = sampleCascade(uv + offset, cascade);
+        sum += (zReceiver - bias > shadowMapDepth) ? 1.0 : 0.0;
+    }
+    
+    return sum / float(uPCFSamples);
+}
+
+// PCSS Shadow calculation
+float calculatePCSS(vec3 worldPos, vec3 normal, vec3 lightDir) {
+    int cascade = selectCascade(worldPos);
+    if (cascade < 0) {
+        return 0.0;
+    }
+    float lightSize = uLightSize * uCascadeFilterScale[cascade];
+
+    vec4 fragPosLightSpace = uCascadeMatrices[cascade] * vec4(worldPos, 1.0);
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+    
+    // Early exit if outside shadow map
+    if (projCoords.z > 1.0 || projCoords.x < 0.0 || projCoords.x > 1.0 || 
+        projCoords.y < 0.0 || projCoords.y > 1.0) {
+        return 0.0;
+    }
+    
+    float zReceiver = projCoords.z;
+    
+    // Step 1: Blocker search
+    float searchWidth = lightSize * (zReceiver - uNearPlane) / zReceiver;
+    float avgBlockerDepth = findBlockerDistance(projCoords.xy, zReceiver, searchWidth, cascade);
+    
+    // No blockers means no shadow
+    if (avgBlockerDepth < 0.0) {
+        return 0.0;
+    }
+    
+    // Step 2: Penumbra estimation
+    float penumbraWidth = estimatePenumbraSize(zReceiver, avgBlockerDepth);
+    float filterRadius = penumbraWidth * lightSize * uNearPlane / zReceiver;
+    
+    // Step 3: PCF filtering
+    return PCF(projCoords.xy, zReceiver, filterRadius, normal, lightDir, cascade);
+}
+
+// Upper bound on the lit fraction from the mean and variance of the occluder depth
+float chebyshevUpperBound(vec2 moments, float mean, float minVariance) {
+    if (mean <= moments.x) {
+        return 1.0;
+    }
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    float pMax = variance / (variance + d * d);
+    // Light bleeding reduction: treat the low tail of the bound as fully shadowed
+    return clamp((pMax - uEvsmBleedReduction) / (1.0 - uEvsmBleedReduction), 0.0, 1.0);
+}
+
+// EVSM shadow calculation, one trilinear fetch of the pre-blurred moments
+float calculateEVSM(vec3 worldPos, vec3 dPdx, vec3 dPdy) {
+    int cascade = selectCascade(worldPos);
+    if (cascade < 0) {
+        return 0.0;
+    }
+
+    vec4 fragPosLightSpace = uCascadeMatrices[cascade] * vec4(worldPos, 1.0);
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+    if (projCoords.z > 1.0 || any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThan(projCoords.xy, vec2(1.0)))) {
+        return 0.0;
+    }
+
+    // Texture-space footprint of the pixel from its world-space derivatives (taken in main,
+    // outside this branch). They jump at silhouettes, so clamp them to keep those pixels
+    // off the coarse mips.
+    vec2 uv = projCoords.xy * uCascadeScale[cascade];
+    float uvScale = 0.5 * uCascadeScale[cascade];
+    float maxGrad = 4.0 / float(textureSize(uShadowMoments, 0).x);
+    vec2 gradX = clamp((uCascadeMatrices[cascade] * vec4(dPdx, 0.0)).xy * uvScale, vec2(-maxGrad), vec2(maxGrad));
+    vec2 gradY = clamp((uCascadeMatrices[cascade] * vec4(dPdy, 0.0)).xy * uvScale, vec2(-maxGrad), vec2(maxGrad));
+    vec4 moments = textureGrad(uShadowMoments, vec3(uv, float(cascade)), gradX, gradY);
+
+    float d = projCoords.z * 2.0 - 1.0;
+    float pos = exp(uEvsmExponents.x * d);
+    float neg = -exp(-uEvsmExponents.y * d);
+
+    // Minimum variance scaled by the warp's derivative so the bias is uniform in depth
+    float minVariance = 0.0001;
+    float posDepthScale = uEvsmExponents.x * pos;
+    float negDepthScale = uEvsmExponents.y * neg;
+    float posLit = chebyshevUpperBound(moments.xy, pos, minVariance * posDepthScale * posDepthScale);
+    float negLit = chebyshevUpperBound(moments.zw, neg, minVariance * negDepthScale * negDepthScale);
+    return 1.0 - min(posLit, negLit);
+}
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy) * uDepthStep;
+    float depth = texelFetch(uSceneDepth, texel, 0).r;
+
+    vec2 ndc = (vec2(texel) + 0.5) / uScreenSize * 2.0 - 1.0;
+    vec4 world = uInvViewProj * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    vec3 worldPos = world.xyz / world.w;
+
+    // Derivatives are taken before any branching so they stay defined for the whole quad
+    vec3 dPdx = dFdx(worldPos);
+    vec3 dPdy = dFdy(worldPos);
+
+    if (depth >= 1.0) {
+        fragColor = vec4(1.0);
+        return;
+    }
+
+    // Geometric normal from the reconstructed position, only used for the depth bias
+    vec3 normal = normalize(cross(dPdx, dPdy));
+    if (dot(normal, uCameraPos - worldPos) < 0.0) {
+        normal = -normal;
+    }
+
+    vec3 lightDir = normalize(uSunPos - worldPos);
+    float shadow = (uShadowFilter == 1) ? calculateEVSM(worldPos, dPdx, dPdy) : calculatePCSS(worldPos, normal, lightDir);
+    fragColor = vec4(1.0 - shadow);
+}
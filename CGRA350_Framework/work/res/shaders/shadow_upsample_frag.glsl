@@ -0,0 +1,48 @@
+#version 330 core
+
+// Bilateral upsample of the half-resolution shadow mask. Each pixel blends the four nearest
+// low-res texels, down-weighting those whose surface lies at a different distance so
+// shadow edges don't bleed across silhouettes.
+
+in vec2 texCoord;
+
+out vec4 fragColor;
+
+#include "frame_uniforms.glsl"
+
+uniform sampler2D uLowMask;        // half-res visibility
+uniform vec2 uLowResSize;
+uniform sampler2D uSceneDepth;     // full-res depth prepass
+
+float viewDistance(ivec2 texel) {
+    float depth = texelFetch(uSceneDepth, texel, 0).r;
+    vec2 ndc = (vec2(texel) + 0.5) / vec2(textureSize(uSceneDepth, 0)) * 2.0 - 1.0;
+    vec4 world = uInvViewProj * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    return length(world.xyz / world.w - uCameraPos);
+}
+
+void main() {
+    ivec2 fullTexel = ivec2(gl_FragCoord.xy);
+    float refDist = viewDistance(fullTexel);
+
+    // Low-res texel c was resolved at full-res texel 2c
+    vec2 pos = (gl_FragCoord.xy - 0.5) * 0.5;
+    ivec2 base = ivec2(floor(pos));
+    vec2 f = fract(pos);
+    ivec2 maxCoord = ivec2(uLowResSize) - 1;
+
+    float sum = 0.0;
+    float weightSum = 0.0;
+    for (int y = 0; y <= 1; y++) {
+        for (int x = 0; x <= 1; x++) {
+            ivec2 c = clamp(base + ivec2(x, y), ivec2(0), maxCoord);
+            float bilinear = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            float d = viewDistance(c * 2);
+            float w = bilinear * exp(-abs(d - refDist) / (0.02 * refDist + 0.1)) + 1e-5;
+            sum += texelFetch(uLowMask, c, 0).r * w;
+            weightSum += w;
+        }
+    }
+
+    fragColor = vec4(sum / weightSum);
+}
@@ -1,10 +1,26 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 4) in mat4 aInstanceModel;   // per instance, see Forest
+layout (location = 8) in vec4 aInstanceLod;     // x = cross-fade, y = 1 while fading in
 
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
+uniform bool uInstanced;
+
+flat out vec2 vLodFade;
+
+#include "leaf_instance.glsl"
 
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    vec3 localPos = aPos;
+    if (uIsLeaf) {
+        vec4 placement;
+        float variant;
+        vec4 q = leafOrientation(placement, variant);
+        localPos = placement.xyz + quatRotate(q, aPos * placement.w * uLeafScale);
+    }
+
+    vLodFade = aInstanceLod.xy;
+    gl_Position = lightSpaceMatrix * (uInstanced ? aInstanceModel : model) * vec4(localPos, 1.0);
 } 
\ No newline at end of file
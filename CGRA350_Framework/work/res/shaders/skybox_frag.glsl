@@ -5,8 +5,8 @@ out vec4 FragColor;
 uniform samplerCube uDayCubemap;
 uniform samplerCube uNightCubemap;
 uniform float uDayFactor;
-uniform vec3 uSunPos;
-uniform vec3 uSunColor;
+
+#include "frame_uniforms.glsl"
 
 void main()
 {
@@ -4,12 +4,11 @@ layout(location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 view;
-uniform mat4 projection;
+#include "frame_uniforms.glsl"
 
 void main() {
-    mat4 rotView = mat4(mat3(view));
-    vec4 pos = projection * rotView * vec4(aPos, 1.0);
+    mat4 rotView = mat4(mat3(uViewMatrix));
+    vec4 pos = uProjectionMatrix * rotView * vec4(aPos, 1.0);
     gl_Position = pos.xyww;
     TexCoords = aPos;
 }
\ No newline at end of file
@@ -4,24 +4,43 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 texCoord;
 layout(location = 3) in vec3 colour;
+layout(location = 4) in mat4 instanceModel;   // per instance, see Forest
+layout(location = 8) in vec4 instanceLod;     // x = cross-fade, y = 1 while fading in
+
+#include "frame_uniforms.glsl"
 
-uniform mat4 uProjectionMatrix;
-uniform mat4 uModelViewMatrix;
 uniform mat4 uModelMatrix;
-uniform mat4 uLightSpacematrix;
+uniform bool uInstanced;
 
 out vec3 vWorldPos;
 out vec3 vNormal;
 out vec3 vColour; 
 out vec2 vTexCoord;
-out vec4 vFragPosLightSpace;
+flat out vec2 vLodFade;
+
+#include "leaf_instance.glsl"
+
+// Paired with shadow_frag for the depth prepass, which shading must match exactly
+invariant gl_Position;
 
 void main() {
-    vWorldPos = vec3(uModelMatrix * vec4(position, 1.0));
-    vNormal = mat3(transpose(inverse(uModelMatrix))) * normal;
-    vTexCoord = texCoord;
+    vec3 localPos = position;
+    vec3 localNormal = normal;
     vColour = colour;
-    vFragPosLightSpace = uLightSpacematrix * vec4(vWorldPos, 1.0);
+    if (uIsLeaf) {
+        vec4 placement;
+        float variant;
+        vec4 q = leafOrientation(placement, variant);
+        localPos = placement.xyz + quatRotate(q, position * placement.w * uLeafScale);
+        localNormal = quatRotate(q, normal);
+        vColour = colour * mix(vec3(0.8, 0.85, 0.8), vec3(1.1, 1.05, 0.8), variant);
+    }
+
+    mat4 model = uInstanced ? instanceModel : uModelMatrix;
+    vWorldPos = vec3(model * vec4(localPos, 1.0));
+    vNormal = mat3(transpose(inverse(model))) * localNormal;
+    vTexCoord = texCoord;
+    vLodFade = instanceLod.xy;
 
-    gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(position, 1.0);
+    gl_Position = uViewProjMatrix * vec4(vWorldPos, 1.0);
 }
\ No newline at end of file
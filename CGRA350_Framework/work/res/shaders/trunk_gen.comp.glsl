@@ -3,98 +3,88 @@
 // Use a work group size of 64 threads
 layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
 
-// Tree parameters
-layout(std140, binding = 0) uniform TreeParams {
-    float scale;           // Tree height
-    float baseSize;        // Base radius multiplier
-    float ratio;           // Radius to height ratio
-    float ratioPower;      // Taper exponent
-    float flare;           // Base flare amount
-    int segments;          // Number of segments along trunk
-    int radialSegments;    // Number of vertices around trunk
+// One ring of a stem, laid out by the CPU generator (see StemRing in trunk_generator.hpp)
+struct Ring {
+    vec4 positionV;        // xyz = ring centre, w = v texture coordinate
+    vec4 rotation;         // quaternion taking +Y to the stem direction
+    float radius;
+    uint indexBase;        // first index of the strip to the next ring
+    uint hasNext;          // 0 for the last ring of a stem
+    uint pad;
 };
 
-// Output vertex structure
-struct Vertex {
-    vec3 position;
-    vec3 normal;
-    vec2 uv;
+layout(std430, binding = 0) readonly buffer RingBuffer {
+    Ring rings[];
 };
 
-// Output buffers
-layout(std430, binding = 1) buffer VertexBuffer {
-    Vertex vertices[];
+// The mesh's own vertex and index buffers. Vertices are cgra::mesh_vertex, tightly
+// packed floats (pos, norm, uv, col), so they are written as a flat float array.
+layout(std430, binding = 1) writeonly buffer VertexBuffer {
+    float vertices[];
 };
 
-layout(std430, binding = 2) buffer IndexBuffer {
+layout(std430, binding = 2) writeonly buffer IndexBuffer {
     uint indices[];
 };
 
-// Calculate trunk radius at a given height
-float getTrunkRadius(float offset, float length) {
-    float unitTaper = offset / length;
-    float radius = scale * ratio * pow(1.0 - unitTaper, ratioPower);
-    
-    // Add flare at base
-    if (offset < flare * length) {
-        float flareAmount = 1.0 - offset / (flare * length);
-        radius += flareAmount * flareAmount * flare * baseSize;
-    }
-    
-    return max(radius, 0.005);
+uniform uint uRingCount;
+uniform int uRadialSegments;
+uniform uint uVertexStride;    // floats per vertex
+
+vec3 rotate(vec4 q, vec3 v) {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void writeVertex(uint index, vec3 position, vec3 normal, vec2 uv) {
+    uint base = index * uVertexStride;
+    vertices[base + 0] = position.x;
+    vertices[base + 1] = position.y;
+    vertices[base + 2] = position.z;
+    vertices[base + 3] = normal.x;
+    vertices[base + 4] = normal.y;
+    vertices[base + 5] = normal.z;
+    vertices[base + 6] = uv.x;
+    vertices[base + 7] = uv.y;
+    vertices[base + 8] = 1.0;
+    vertices[base + 9] = 1.0;
+    vertices[base + 10] = 1.0;
 }
 
 void main() {
     // Each invocation generates one segment ring
-    uint segmentIdx = gl_GlobalInvocationID.x;
-    
-    if (segmentIdx > segments) return;
-    
-    float trunkLength = scale;
-    float segmentLength = trunkLength / float(segments);
-    float yPos = float(segmentIdx) * segmentLength;
-    float radius = getTrunkRadius(yPos, trunkLength);
-    
-    // Generate ring of vertices at this height
-    uint baseVertexIdx = segmentIdx * radialSegments;
-    
-    for (int i = 0; i < radialSegments; i++) {
+    uint ringIdx = gl_GlobalInvocationID.x;
+    if (ringIdx >= uRingCount) return;
+
+    Ring ring = rings[ringIdx];
+    uint radialSegments = uint(uRadialSegments);
+    uint baseVertexIdx = ringIdx * radialSegments;
+
+    // Generate the ring of vertices, matching Tree::generateMeshFromSegments
+    for (uint i = 0u; i < radialSegments; i++) {
         float angle = float(i) / float(radialSegments) * 2.0 * 3.14159265359;
-        
-        Vertex v;
-        v.position = vec3(
-            cos(angle) * radius,
-            yPos,
-            sin(angle) * radius
-        );
-        v.normal = normalize(vec3(cos(angle), 0.0, sin(angle)));
-        v.uv = vec2(
-            float(i) / float(radialSegments),
-            float(segmentIdx) / float(segments)
-        );
-        
-        vertices[baseVertexIdx + i] = v;
+        vec3 offset = rotate(ring.rotation, vec3(cos(angle) * ring.radius, 0.0, sin(angle) * ring.radius));
+
+        writeVertex(baseVertexIdx + i, ring.positionV.xyz + offset, normalize(offset),
+                    vec2(float(i) / float(radialSegments), ring.positionV.w));
     }
-    
+
     // Generate indices to connect this ring to the next
-    if (segmentIdx < segments) {
-        uint nextRingBase = (segmentIdx + 1) * radialSegments;
-        uint indexBase = segmentIdx * radialSegments * 6;
-        
-        for (int i = 0; i < radialSegments; i++) {
-            int nextI = (i + 1) % radialSegments;
-            
-            uint idx = indexBase + i * 6;
-            
+    if (ring.hasNext != 0u) {
+        uint nextRingBase = baseVertexIdx + radialSegments;
+
+        for (uint i = 0u; i < radialSegments; i++) {
+            uint nextI = (i + 1u) % radialSegments;
+            uint idx = ring.indexBase + i * 6u;
+
             // Triangle 1
-            indices[idx + 0] = baseVertexIdx + i;
-            indices[idx + 1] = baseVertexIdx + nextI;
-            indices[idx + 2] = nextRingBase + i;
-            
+            indices[idx + 0u] = baseVertexIdx + i;
+            indices[idx + 1u] = baseVertexIdx + nextI;
+            indices[idx + 2u] = nextRingBase + i;
+
             // Triangle 2
-            indices[idx + 3] = baseVertexIdx + nextI;
-            indices[idx + 4] = nextRingBase + nextI;
-            indices[idx + 5] = nextRingBase + i;
+            indices[idx + 3u] = baseVertexIdx + nextI;
+            indices[idx + 4u] = nextRingBase + nextI;
+            indices[idx + 5u] = nextRingBase + i;
         }
     }
 }
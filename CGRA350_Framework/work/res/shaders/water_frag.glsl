@@ -2,6 +2,9 @@
 
 precision highp float;
 
+// Camera, sun, PCSS parameters and cascade matrices
+#include "frame_uniforms.glsl"
+
 uniform float uOpacity;
 
 uniform vec3 uTroughColor;
@@ -13,27 +16,27 @@ uniform float uPeakTransition;
 uniform float uTroughThreshold;
 uniform float uTroughTransition;
 
-uniform vec3 uSunPos;
-uniform vec3 uSunColor;
-
 uniform float uFresnelScale;
 uniform float uFresnelPower;
 
-uniform sampler2D uShadowMap;
-uniform float uLightSize;
-uniform float uNearPlane;
-uniform int uBlockerSearchSamples;
-uniform int uPCFSamples;
+// Water is not in the depth prepass, so it filters the cascades per fragment itself,
+// with half the samples the shadow mask uses
+const int SAMPLE_DIVISOR = 2;
 
 in vec3 vNormal;
 in vec3 vWorldPosition;
-in vec4 vFragPosLightSpace; 
 
-uniform vec3 cameraPosition;
 uniform samplerCube uEnvironmentMap;
 
 out vec4 fragColor;
 
+// Cascaded sun shadow maps (see CascadedShadowMap::bind)
+uniform sampler2DArray uShadowCascades;
+
+float sampleCascade(vec2 uv, int cascade) {
+    return texture(uShadowCascades, vec3(clamp(uv, 0.0, 1.0) * uCascadeScale[cascade], float(cascade))).r;
+}
+
 // --- Poisson disk for PCSS sampling ---
 const vec2 poissonDisk[64] = vec2[](
     vec2(-0.613392, 0.617481),
@@ -103,13 +106,14 @@ const vec2 poissonDisk[64] = vec2[](
 );
 
 // Step 1: Find average blocker depth
-float findBlockerDistance(vec2 uv, float zReceiver, float searchWidth) {
+float findBlockerDistance(vec2 uv, float zReceiver, float searchWidth, int cascade) {
     float blockerSum = 0.0;
     int blockerCount = 0;
     
-    for (int i = 0; i < uBlockerSearchSamples; i++) {
+    int samples = max(uBlockerSearchSamples / SAMPLE_DIVISOR, 1);
+    for (int i = 0; i < samples; i++) {
         vec2 offset = poissonDisk[i] * searchWidth;
-        float shadowMapDepth = texture(uShadowMap, uv + offset).r;
+        float shadowMapDepth = sampleCascade(uv + offset, cascade);
         
         if (shadowMapDepth < zReceiver) {
             blockerSum += shadowMapDepth;
@@ -130,21 +134,37 @@ float estimatePenumbraSize(float zReceiver, float zBlocker) {
 }
 
 // Step 3: PCF with variable filter size
-float PCF(vec2 uv, float zReceiver, float filterRadius, vec3 normal, vec3 lightDir) {
+float PCF(vec2 uv, float zReceiver, float filterRadius, vec3 normal, vec3 lightDir, int cascade) {
     float sum = 0.0;
     float bias = max(0.02 * (1.0 - dot(normal, lightDir)), 0.005);
     
-    for (int i = 0; i < uPCFSamples; i++) {
+    int samples = max(uPCFSamples / SAMPLE_DIVISOR, 1);
+    for (int i = 0; i < samples; i++) {
         vec2 offset = poissonDisk[i % 64] * filterRadius;
-        float shadowMapDepth = texture(uShadowMap, uv + offset).r;
+        float shadowMapDepth = sampleCascade(uv + offset, cascade);
         sum += (zReceiver - bias > shadowMapDepth) ? 1.0 : 0.0;
     }
     
-    return sum / float(uPCFSamples);
+    return sum / float(samples);
 }
 
 // PCSS Shadow calculation
-float calculatePCSS(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
+float calculatePCSS(vec3 worldPos, vec3 normal, vec3 lightDir) {
+    // Pick the first cascade whose slice of the view frustum contains this point
+    float viewDepth = dot(worldPos - uCascadeCameraPos, uCascadeCameraForward);
+    int cascade = -1;
+    for (int i = 0; i < uCascadeCount; i++) {
+        if (viewDepth < uCascadeSplits[i]) {
+            cascade = i;
+            break;
+        }
+    }
+    if (cascade < 0) {
+        return 0.0;
+    }
+    float lightSize = uLightSize * uCascadeFilterScale[cascade];
+
+    vec4 fragPosLightSpace = uCascadeMatrices[cascade] * vec4(worldPos, 1.0);
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     projCoords = projCoords * 0.5 + 0.5;
     
@@ -156,8 +176,8 @@ float calculatePCSS(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
     float zReceiver = projCoords.z;
     
     // Step 1: Blocker search
-    float searchWidth = uLightSize * (zReceiver - uNearPlane) / zReceiver;
-    float avgBlockerDepth = findBlockerDistance(projCoords.xy, zReceiver, searchWidth);
+    float searchWidth = lightSize * (zReceiver - uNearPlane) / zReceiver;
+    float avgBlockerDepth = findBlockerDistance(projCoords.xy, zReceiver, searchWidth, cascade);
     
     if (avgBlockerDepth < 0.0) {
         return 0.0;
@@ -165,14 +185,16 @@ float calculatePCSS(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
     
     // Step 2: Penumbra estimation
     float penumbraWidth = estimatePenumbraSize(zReceiver, avgBlockerDepth);
-    float filterRadius = penumbraWidth * uLightSize * uNearPlane / zReceiver;
+    float filterRadius = penumbraWidth * lightSize * uNearPlane / zReceiver;
     
     // Step 3: PCF filtering
-    return PCF(projCoords.xy, zReceiver, filterRadius, normal, lightDir);
+    return PCF(projCoords.xy, zReceiver, filterRadius, normal, lightDir, cascade);
 }
 
+#include "cloud_shadow.glsl"
+
 void main() {
-  vec3 viewDir = normalize(cameraPosition - vWorldPosition);
+  vec3 viewDir = normalize(uCameraPos - vWorldPosition);
   vec3 reflectedDir = reflect(-viewDir, normalize(vNormal));
   vec3 sunDir = normalize(uSunPos - vWorldPosition);
   float diffuse = max(dot(normalize(vNormal), sunDir), 0.0);
@@ -194,7 +216,8 @@ void main() {
   vec3 mixedColor2 = mix(mixedColor1, uPeakColor, peakFactor);
   vec3 finalColor = mix(mixedColor2, reflectionColor.rgb, fresnel);
   
-  float shadow = calculatePCSS(vFragPosLightSpace, normalize(vNormal), sunDir);
+  float shadow = calculatePCSS(vWorldPosition, normalize(vNormal), sunDir);
+  shadow = 1.0 - (1.0 - shadow) * cloudShadow(vWorldPosition);
   
   vec3 ambient = mix(
     vec3(0.005) * finalColor,
@@ -4,10 +4,9 @@ precision highp float;
 
 layout(location = 0) in vec3 position;
 
+#include "frame_uniforms.glsl"
+
 uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
-uniform mat4 uLightSpaceMatrix;
 
 uniform float uTime;
 uniform float uWavesAmplitude;
@@ -19,7 +18,6 @@ uniform float uWavesIterations;
 
 out vec3 vNormal;
 out vec3 vWorldPosition;
-out vec4 vFragPosLightSpace;
 
 //	Simplex 3D Noise 
 //
@@ -95,7 +93,6 @@ void main() {
 
   vNormal = objectNormal;
   vWorldPosition = modelPosition.xyz;
-  vFragPosLightSpace = uLightSpaceMatrix * modelPosition;
 
-  gl_Position = projectionMatrix * viewMatrix * modelPosition;
+  gl_Position = uViewProjMatrix * modelPosition;
 }
\ No newline at end of file
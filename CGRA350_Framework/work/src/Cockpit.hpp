@@ -7,6 +7,7 @@
 #include <cmath>
 #include <GL/glew.h>
 #include "cgra/cgra_gui.hpp"
+#include "cgra/cgra_shader.hpp"
 #include <imgui.h>
 
 struct PovCamera;
@@ -119,7 +120,7 @@ public:
         return m_hover;
     }
     
-    inline void init(GLuint colorShader){
+    inline void init(const cgra::shader_program& colorShader){
         m_shader = colorShader;
         layout();
         ensureWireCube();
@@ -176,7 +177,7 @@ public:
         glm::vec3 hit;
         bool hitPanel = rayPlaneZ(ray, m_panelZ, hit);
         AABB dot = makeAABB(hit, {0.01f, 0.01f, 0.01f});
-        drawAABB(dot, view, proj, {1,0,1});
+        drawAABB(dot, view, {1,0,1});
         
         
         //slider interaction
@@ -282,21 +283,21 @@ public:
         }
         
         //draw
-        drawAABB(m_table,view, proj, {0.35f,0.35f,0.4f});
-        drawAABB(m_sliderFOV.aabb(),view, proj, {0.2f,0.8f,0.9f});
-        drawAABB(m_buttonReset.aabb(),view, proj, {0.9f,0.7f,0.2f});
+        drawAABB(m_table, view, {0.35f,0.35f,0.4f});
+        drawAABB(m_sliderFOV.aabb(), view, {0.2f,0.8f,0.9f});
+        drawAABB(m_buttonReset.aabb(), view, {0.9f,0.7f,0.2f});
         
         //new
-        drawAABB(m_sAmp.aabb(), view, proj, {0.10f,0.70f,0.95f});
-        drawAABB(m_sFreq.aabb(), view, proj, {0.10f,0.85f,0.30f});
-        drawAABB(m_sOct.aabb(), view, proj, {0.95f,0.85f,0.10f});
-        drawAABB(m_sPers.aabb(),view, proj, {0.80f,0.40f,0.95f});
-        drawAABB(m_sLac.aabb(),view, proj, {0.95f,0.55f,0.25f});
-        drawAABB(m_sMin.aabb(),view, proj, {0.55f,0.65f,0.95f});
+        drawAABB(m_sAmp.aabb(), view, {0.10f,0.70f,0.95f});
+        drawAABB(m_sFreq.aabb(), view, {0.10f,0.85f,0.30f});
+        drawAABB(m_sOct.aabb(), view, {0.95f,0.85f,0.10f});
+        drawAABB(m_sPers.aabb(), view, {0.80f,0.40f,0.95f});
+        drawAABB(m_sLac.aabb(), view, {0.95f,0.55f,0.25f});
+        drawAABB(m_sMin.aabb(), view, {0.55f,0.65f,0.95f});
         
         // toggle buttons
-        drawAABB(m_bClouds.aabb(), view, proj, (m_links.showClouds && *m_links.showClouds)? glm::vec3{0.1f,0.8f,0.3f}:glm::vec3{0.4f,0.4f,0.4f});
-        drawAABB(m_bTrees.aabb(),  view, proj, (m_links.showTrees  && *m_links.showTrees )? glm::vec3{0.1f,0.8f,0.3f}:glm::vec3{0.4f,0.4f,0.4f});
+        drawAABB(m_bClouds.aabb(), view, (m_links.showClouds && *m_links.showClouds)? glm::vec3{0.1f,0.8f,0.3f}:glm::vec3{0.4f,0.4f,0.4f});
+        drawAABB(m_bTrees.aabb(), view, (m_links.showTrees  && *m_links.showTrees )? glm::vec3{0.1f,0.8f,0.3f}:glm::vec3{0.4f,0.4f,0.4f});
         
     }
 
@@ -326,7 +327,7 @@ private:
     bool m_leftDown = false;
 
     //drawing
-    GLuint m_shader = 0;
+    cgra::shader_program m_shader;
     GLuint m_unitWireVAO = 0, m_unitWireVBO = 0; //wireframe unit cube
     
     //ray
@@ -504,26 +505,26 @@ private:
         };
         glGenVertexArrays(1, &m_unitWireVAO);
         glGenBuffers(1, &m_unitWireVBO);
-        glBindVertexArray(m_unitWireVAO);
+        cgra::gl_state::bind_vertex_array(m_unitWireVAO);
         glBindBuffer(GL_ARRAY_BUFFER, m_unitWireVBO);
         glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(lines.size()*sizeof(glm::vec3)), lines.data(), GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,sizeof(glm::vec3),(void*)0);
-        glBindVertexArray(0);
+        cgra::gl_state::bind_vertex_array(0);
     }
 
-    inline void drawAABB(const AABB& b, const glm::mat4& view, const glm::mat4& proj, const glm::vec3& color){
+    // The projection comes from the per-frame uniforms
+    inline void drawAABB(const AABB& b, const glm::mat4& view, const glm::vec3& color){
         glm::vec3 c = (b.min + b.max) * 0.5f;
         glm::vec3 s = (b.max - b.min) * 0.5f;     //half-extents
         glm::mat4 M = glm::translate(glm::mat4(1), c) * glm::scale(glm::mat4(1), s);
         glm::mat4 MV = view * M;
-        glUseProgram(m_shader);
-        glUniformMatrix4fv(glGetUniformLocation(m_shader,"uProjectionMatrix"),1,GL_FALSE,glm::value_ptr(proj));
-        glUniformMatrix4fv(glGetUniformLocation(m_shader,"uModelViewMatrix"),1,GL_FALSE,glm::value_ptr(MV));
-        glUniform3fv(glGetUniformLocation(m_shader,"uColor"),1,glm::value_ptr(color));
-        glBindVertexArray(m_unitWireVAO);
+        cgra::gl_state::use_program(m_shader);
+        m_shader.set_uniform("uModelViewMatrix", MV);
+        m_shader.set_uniform("uColor", color);
+        cgra::gl_state::bind_vertex_array(m_unitWireVAO);
         glDrawArrays(GL_LINES, 0, 24);
-        glBindVertexArray(0);
+        cgra::gl_state::bind_vertex_array(0);
     }
 
     static inline glm::vec2 mouseToNDC(const glm::vec2& mouse, int w, int h){
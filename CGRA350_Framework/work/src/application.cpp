@@ -26,13 +26,12 @@ using namespace std;
 using namespace cgra;
 using namespace glm;
 
-void basic_model::draw(const glm::mat4 &view, const glm::mat4 proj) {
+void basic_model::draw(const glm::mat4 &view) {
     mat4 modelview = view * modelTransform;
     
-    glUseProgram(shader); // load shader and variables
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uModelViewMatrix"), 1, false, value_ptr(modelview));
-    glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, value_ptr(color));
+    gl_state::use_program(shader); // load shader and variables
+    shader.set_uniform("uModelViewMatrix", modelview);
+    shader.set_uniform("uColor", color);
 
     mesh.draw(); // draw
 }
@@ -41,7 +40,8 @@ void basic_model::draw(const glm::mat4 &view, const glm::mat4 proj) {
 Application::Application(GLFWwindow *window) : m_window(window) {
     float scene_size = 200.0f;
 
-    initShadowMap();
+    m_frameUniforms.init();
+    m_shadowCascades.init();
 
     shader_builder sb;
     sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("//res//shaders//color_vert.glsl"));
@@ -91,11 +91,68 @@ Application::Application(GLFWwindow *window) : m_window(window) {
     tree_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("//res//shaders//tree_frag.glsl"));
     m_treeShader = tree_sb.build();
 
+    shader_builder impostor_sb;
+    impostor_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/impostor_vert.glsl"));
+    impostor_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/impostor_frag.glsl"));
+    m_impostorShader = impostor_sb.build();
+
+    shader_builder impostor_bake_sb;
+    impostor_bake_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/impostor_bake_vert.glsl"));
+    impostor_bake_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/impostor_bake_frag.glsl"));
+    m_impostorBakeShader = impostor_bake_sb.build();
+
     shader_builder shadow_sb;
     shadow_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("//res//shaders//shadow_vert.glsl"));
     shadow_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("//res//shaders//shadow_frag.glsl"));
     m_shadowShader = shadow_sb.build();
 
+    // Depth-only versions of the expensive opaque shaders for the prepass. Each keeps the
+    // vertex shader it shades with, so positions match exactly and shading can test GL_EQUAL.
+    shader_builder sand_depth_sb;
+    sand_depth_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/caustics_vert.glsl"));
+    sand_depth_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/depth_frag.glsl"));
+    m_sandDepthShader = sand_depth_sb.build();
+
+    shader_builder terrain_depth_sb;
+    terrain_depth_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/color_vert.glsl"));
+    terrain_depth_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/depth_frag.glsl"));
+    m_terrainDepthShader = terrain_depth_sb.build();
+
+    // shadow_frag discards the same cross-fading texels as tree_frag
+    shader_builder tree_depth_sb;
+    tree_depth_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/tree_vert.glsl"));
+    tree_depth_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/shadow_frag.glsl"));
+    m_treeDepthShader = tree_depth_sb.build();
+
+    shader_builder impostor_depth_sb;
+    impostor_depth_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/impostor_vert.glsl"));
+    impostor_depth_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/impostor_depth_frag.glsl"));
+    m_impostorDepthShader = impostor_depth_sb.build();
+
+    shader_builder shadow_resolve_sb;
+    shadow_resolve_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+    shadow_resolve_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/shadow_resolve_frag.glsl"));
+    m_shadowResolveShader = shadow_resolve_sb.build();
+
+    shader_builder shadow_upsample_sb;
+    shadow_upsample_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+    shadow_upsample_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/shadow_upsample_frag.glsl"));
+    m_shadowUpsampleShader = shadow_upsample_sb.build();
+
+    m_shadowMask.init(m_shadowResolveShader, m_shadowUpsampleShader);
+
+    shader_builder evsm_convert_sb;
+    evsm_convert_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+    evsm_convert_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/evsm_convert_frag.glsl"));
+    m_evsmConvertShader = evsm_convert_sb.build();
+
+    shader_builder evsm_blur_sb;
+    evsm_blur_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+    evsm_blur_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/evsm_blur_frag.glsl"));
+    m_evsmBlurShader = evsm_blur_sb.build();
+
+    m_shadowMoments.init(m_evsmConvertShader, m_evsmBlurShader);
+
     stbi_set_flip_vertically_on_load(false);
     std::vector<std::string> dayFaces = {
         CGRA_SRCDIR + std::string("//res//textures//cubemap//day//px.bmp"), // right
@@ -130,8 +187,36 @@ Application::Application(GLFWwindow *window) : m_window(window) {
     cloud_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/cloud_vert.glsl"));
     cloud_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/cloud_frag.glsl"));
     m_cloudShader = cloud_sb.build();
+
+    shader_builder cloud_temporal_sb;
+    cloud_temporal_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+    cloud_temporal_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/cloud_temporal_frag.glsl"));
+    m_cloudTemporalShader = cloud_temporal_sb.build();
+
+    shader_builder cloud_composite_sb;
+    cloud_composite_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+    cloud_composite_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/cloud_composite_frag.glsl"));
+    m_cloudCompositeShader = cloud_composite_sb.build();
+
+    shader_builder cloud_weather_sb;
+    cloud_weather_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+    cloud_weather_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/cloud_weather_frag.glsl"));
+    m_cloudWeatherShader = cloud_weather_sb.build();
+
+    shader_builder cloud_shadow_sb;
+    cloud_shadow_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+    cloud_shadow_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/cloud_shadow_frag.glsl"));
+    m_cloudShadowShader = cloud_shadow_sb.build();
+
+    for (const shader_program& program : { m_shader, m_terrainShader, m_waterShader, m_skyboxShader, m_causticsShader,
+                                           m_treeShader, m_impostorShader, m_shadowResolveShader, m_shadowUpsampleShader,
+                                           m_sandDepthShader, m_terrainDepthShader, m_treeDepthShader, m_impostorDepthShader }) {
+        FrameUniforms::attach(program);
+    }
+
     // Initialize cloud renderer
-    m_cloudRenderer.init(m_cloudShader);
+    m_cloudRenderer.init(m_cloudShader, m_cloudTemporalShader, m_cloudCompositeShader, m_cloudWeatherShader, m_cloudShadowShader,
+                         CGRA_SRCDIR + std::string("//res//cache"));
     
     m_showTrees = true;
     regenerateTrees();
@@ -159,6 +244,8 @@ Application::Application(GLFWwindow *window) : m_window(window) {
     m_trunkTexture = loadTexture(CGRA_SRCDIR + std::string("/res/textures/bark_willow_diff_4k.jpg"));
     m_trunkNormal = loadTexture(CGRA_SRCDIR + std::string("/res/textures/bark_willow_nor_gl_4k.jpg"));
     m_trunkRoughness = loadTexture(CGRA_SRCDIR + std::string("/res/textures/bark_willow_rough_4k.jpg"));
+    m_forest.initImpostors(m_impostorBakeShader, m_impostorShader, m_impostorDepthShader, m_trunkTexture);
+    m_forest.setCacheDirectory(CGRA_SRCDIR + std::string("/res/cache"));
 
     initSkybox();
 
@@ -167,57 +254,79 @@ Application::Application(GLFWwindow *window) : m_window(window) {
     }
 }
 
-void Application::initShadowMap() {
-    glGenFramebuffers(1, &m_shadowFBO);
-    glGenTextures(1, &m_shadowMap);
-    glBindTexture(GL_TEXTURE_2D, m_shadowMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, m_shadowFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_shadowMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// Distance from p to the nearest point of a box, zero inside it
+static float distanceToBox(const vec3& p, const vec3& boxMin, const vec3& boxMax) {
+    return length(max(max(boxMin - p, p - boxMax), vec3(0.0f)));
+}
+
+void Application::queueScene(const glm::mat4& view) {
+    vec3 cameraPos = vec3(inverse(view)[3]);
+
+    float half = m_scene_size / 2;
+    float sandDistance = distanceToBox(cameraPos, vec3(-half, -1.0f, -half), vec3(half, -1.0f, half));
+    float waterLevel = m_water.getSeaLevel();
+    float waterDistance = distanceToBox(cameraPos, vec3(-half, waterLevel, -half), vec3(half, waterLevel, half));
+
+    // Only the terrain's footprint is known without its heights
+    float terrainHalf = m_terrain.getScale() / 2;
+    float terrainDistance = distanceToBox(cameraPos, vec3(-terrainHalf, cameraPos.y, -terrainHalf), vec3(terrainHalf, cameraPos.y, terrainHalf));
+
+    vec3 forestMin, forestMax;
+    float forestDistance = m_forest.getBounds(forestMin, forestMax) ? distanceToBox(cameraPos, forestMin, forestMax) : 0.0f;
+
+    m_renderQueue.submit(RenderQueue::DEPTH_PREPASS, m_sandDepthShader, 0, sandDistance, [this]() {
+        gl_state::use_program(m_sandDepthShader);
+        m_sandMesh.draw();
+    });
+    m_renderQueue.submit(RenderQueue::DEPTH_PREPASS, m_terrainDepthShader, 0, terrainDistance, [this, view]() {
+        m_terrain.drawDepth(view, m_terrainDepthShader);
+    });
+    m_renderQueue.submit(RenderQueue::DEPTH_PREPASS, m_treeDepthShader, 0, forestDistance, [this]() {
+        m_forest.drawShadows(m_treeDepthShader);
+    });
+
+    m_renderQueue.submit(RenderQueue::OPAQUE, m_causticsShader, m_sandTexture, sandDistance, [this]() {
+        renderSandPlane(m_time);
+    });
+    m_renderQueue.submit(RenderQueue::OPAQUE, m_terrainShader, m_grassTexture, terrainDistance, [this, view]() {
+        m_terrain.draw(view, m_terrainShader, vec3(0.2f, 0.8f, 0.2f), m_grassTexture, m_grassNormal, m_grassRoughness);
+    });
+    m_renderQueue.submit(RenderQueue::OPAQUE, m_treeShader, m_trunkTexture, forestDistance, [this]() {
+        m_forest.draw(m_treeShader, m_trunkTexture, m_trunkNormal, m_trunkRoughness);
+    });
+
+    m_renderQueue.submit(RenderQueue::TRANSPARENT, m_waterShader, dayCubemap, waterDistance, [this]() {
+        m_water.draw(m_waterShader, dayCubemap);
+    });
 }
 
 void Application::initSkybox() {
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
+    gl_state::bind_vertex_array(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glBindVertexArray(0);
+    gl_state::bind_vertex_array(0);
 }
 
 void Application::render() {
+    m_profiler.beginFrame();
+    gl_state::end_frame();
+
     //temp
     int winW, winH;  glfwGetWindowSize(m_window, &winW, &winH);
     int fbW,  fbH;   glfwGetFramebufferSize(m_window, &fbW, &fbH);
     
-    glViewport(0, 0, fbW, fbH);
     float aspect = (fbH > 0) ? float(fbW) / float(fbH) : 1.0f;
-    
-    
-    // retrieve the window hieght
-    int width, height;
-    glfwGetFramebufferSize(m_window, &width, &height);
-
-    m_windowsize = vec2(width, height); // update window size
-    //glViewport(0, 0, width, height); // set the viewport to draw to the entire window
 
-    // clear the back-buffer
-    glClearColor(0.3f, 0.3f, 0.4f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    m_windowsize = vec2(fbW, fbH); // update window size
 
     // enable flags for normal/forward rendering
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
+    gl_state::enable(GL_DEPTH_TEST);
+    gl_state::depth_func(GL_LESS);
+    glPolygonMode(GL_FRONT_AND_BACK, (m_showWireframe) ? GL_LINE : GL_FILL);
 
     /** projection matrix
     mat4 proj = perspective(1.f, float(width) / height, 0.1f, 1000.f);
@@ -228,25 +337,12 @@ void Application::render() {
         * rotate(mat4(1), m_yaw,   vec3(0, 1, 0));*/
     
     //camera
-    
-    //float aspect = (height > 0) ? float(width)/float(height) : 1.0f;
     m_cam.compute(aspect);
     mat4 proj = m_cam.proj;
     mat4 view = m_cam.view;
-
-    //bool leftDownScene = m_leftMouseDown && !ImGui::GetIO().WantCaptureMouse;
-    //m_panel.frame(winW, winH, m_mousePosition, leftDownScene, view, proj, m_cam);
-
-    //bool leftDownScene = m_leftMouseDown && !ImGui::GetIO().WantCaptureMouse;
-    //m_panel.frame(width, height, m_mousePosition, leftDownScene, view, proj, m_cam);
     
     m_time += 0.001f;
 
-    // helpful draw options
-    if (m_show_grid) drawGrid(view, proj);
-    if (m_show_axis) drawAxis(view, proj);
-    glPolygonMode(GL_FRONT_AND_BACK, (m_showWireframe) ? GL_LINE : GL_FILL);
-
     bool terrainChanged = false;
     
     terrainChanged |= m_terrain.getAmplitude()!= m_amp && (m_terrain.setAmplitude(m_amp), true);
@@ -257,14 +353,12 @@ void Application::render() {
     terrainChanged |= m_terrain.getMinHeight() != m_minHeight && (m_terrain.setMinHeight(m_minHeight), true);
     if (terrainChanged) {
         m_terrain.update();
+        m_shadowCascades.invalidate();
         if (m_showTrees) {
             regenerateTrees(); // Regenerate tree positions to match new terrain
         }
     }
 
-    // draw the model
-    //m_model.draw(view, proj);
-
     float angle = m_time * sunSpeed;
     vec3 sunPos = vec3(
         sunOrbitRadius * cos(angle),    // X: horizontal position
@@ -285,215 +379,276 @@ void Application::render() {
             heightFactor);            // 0 at horizon, 1 at top
     }
 
-    renderShadows(sunPos);
-    
-
-    glViewport(0, 0, fbW, fbH);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    
-    bool leftDownScene = m_leftMouseDown && !ImGui::GetIO().WantCaptureMouse;
-    
-    m_panel.frame(winW, winH, m_mousePosition, leftDownScene, view, proj, m_cam);
-
+    static auto lastTime = std::chrono::high_resolution_clock::now();
+    auto currentTime = std::chrono::high_resolution_clock::now();
+    float deltaTime = std::chrono::duration<float>(currentTime - lastTime).count();
+    lastTime = currentTime;
 
-    // helpful draw options
-    if (m_show_grid) drawGrid(view, proj);
-    if (m_show_axis) drawAxis(view, proj);
-    glPolygonMode(GL_FRONT_AND_BACK, (m_showWireframe) ? GL_LINE : GL_FILL);
+    m_water.update(deltaTime);
 
-    glDepthFunc(GL_LEQUAL);
-    renderSkybox(m_skyboxShader, skyboxVAO, dayCubemap, view, proj, sunPos, sunColour);
-    glDepthFunc(GL_LESS);
+    // Archetypes and impostors are rebuilt here rather than in the middle of a pass
+    m_forest.update();
 
-    glPolygonMode(GL_FRONT_AND_BACK, (m_showWireframe ? GL_LINE : GL_FILL));
-    
-    // cloud stuff
+    m_renderQueue.clear();
+    queueScene(view);
 
-    
-    static int frameCount = 0;
-    // In Application::render(), around line 254, replace the cloud section with:
+    bool leftDownScene = m_leftMouseDown && !ImGui::GetIO().WantCaptureMouse;
+    bool evsm = m_shadowMask.getFilter() == ShadowFilter::EVSM;
+    float cloudShadowStrength = m_showClouds ? m_cloudShadowStrength : 0.0f;
+    const glm::vec3& cameraPos = m_frameUniforms.data().cameraPos;
+
+    // The passes only say what they read and write. The graph runs them in that order,
+    // skips the ones nothing reads (the EVSM moments under PCSS, the cloud shadow with the
+    // clouds off) and clears the backbuffer and scene depth once each.
+    typedef FrameGraph::Builder Builder;
+    typedef FrameGraph::Resource Resource;
+    m_frameGraph.reset();
+    Resource backbuffer = m_frameGraph.importBackbuffer("Backbuffer", fbW, fbH, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, vec4(0.3f, 0.3f, 0.4f, 1.0f));
+    Resource frameData = m_frameGraph.import("Frame uniforms");
+    Resource cascades = m_frameGraph.import("Shadow cascades");
+    Resource moments = m_frameGraph.import("Shadow moments");
+    Resource shadowMask = m_frameGraph.import("Shadow mask");
+    Resource cloudShadow = m_frameGraph.import("Cloud shadow map");
+    Resource treeDraws = m_frameGraph.import("Tree draws");
+    Resource sceneDepth = FrameGraph::NONE;
+
+    m_frameGraph.addPass("Shadow cascades", [&](Builder& builder) {
+        builder.write(cascades);
+        builder.write(frameData);
+    }, [&](const FrameGraph&) {
+        renderShadows(sunPos, view, aspect);
+
+        // Everything the scene shaders share, now that the cascades are fitted
+        m_frameUniforms.setCamera(view, proj);
+        m_frameUniforms.setSun(sunPos, sunColour);
+        m_shadowCascades.writeFrameData(m_frameUniforms.data());
+        m_shadowMask.writeFrameData(m_frameUniforms.data());
+        m_frameUniforms.upload();
+    });
+
+    m_frameGraph.addPass("Shadow moments (EVSM)", [&](Builder& builder) {
+        builder.read(cascades);
+        builder.write(moments);
+    }, [&](const FrameGraph&) {
+        m_shadowMoments.update(m_shadowCascades);
+    });
+
+    m_frameGraph.addPass("Tree culling", [&](Builder& builder) {
+        builder.write(treeDraws);
+    }, [&](const FrameGraph&) {
+        m_forest.selectLods(view, proj, fbH);
+    });
+
+    // With GL_EQUAL shading the prepass goes straight into the backbuffer and is copied out
+    // for the passes that sample it, otherwise it has a target of its own
+    m_frameGraph.addPass("Depth prepass", [&](Builder& builder) {
+        FrameGraphTextureDesc depth;
+        depth.width = fbW;
+        depth.height = fbH;
+        depth.internalFormat = GL_DEPTH_COMPONENT24;
+        depth.clear = m_equalShading ? 0 : GL_DEPTH_BUFFER_BIT;
+        sceneDepth = builder.create("Scene depth", depth);
+        builder.renderTo(m_equalShading ? backbuffer : sceneDepth);
+        builder.read(frameData);
+        builder.read(treeDraws);
+    }, [&](const FrameGraph& graph) {
+        gl_state::color_mask(GL_FALSE);
+        m_renderQueue.execute(RenderQueue::DEPTH_PREPASS);
+        gl_state::color_mask(GL_TRUE);
+
+        if (m_equalShading) {
+            gl_state::active_texture(GL_TEXTURE0);
+            gl_state::bind_texture(GL_TEXTURE_2D, graph.getTexture(sceneDepth));
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, fbW, fbH);
+            gl_state::bind_texture(GL_TEXTURE_2D, 0);
+        }
+        m_forest.buildOcclusion(graph.getTexture(sceneDepth), fbW, fbH, proj * view);
+    });
+
+    // Resolve sun shadows once per pixel, the materials then read a single texel
+    m_frameGraph.addPass(evsm ? "Shadow resolve (EVSM)" : "Shadow resolve (PCSS)", [&](Builder& builder) {
+        builder.read(frameData);
+        builder.read(cascades);
+        if (evsm) builder.read(moments);
+        builder.read(sceneDepth);
+        builder.write(shadowMask);
+    }, [&](const FrameGraph& graph) {
+        m_shadowMask.resize(fbW, fbH);
+        m_shadowMask.resolve(m_shadowCascades, m_shadowMoments, graph.getTexture(sceneDepth));
+    });
+
+    // Cloud shadows for everything lit by the sun
+    m_frameGraph.addPass("Cloud shadow map", [&](Builder& builder) {
+        builder.write(cloudShadow);
+    }, [&](const FrameGraph&) {
+        m_cloudRenderer.updateShadowMap(sunPos, m_time,
+                                        m_cloudCoverage, m_cloudDensity, m_cloudSpeed,
+                                        m_cloudScale, m_cloudEvolutionSpeed,
+                                        m_cloudHeight, m_cloudThickness, m_cloudFuzziness);
+    });
 
-    // Calculate camera position from view matrix
-    glm::mat4 invView = glm::inverse(view);
-    glm::vec3 cameraPos = glm::vec3(invView[3]);
+    // helpful draw options
+    m_frameGraph.addPass("Overlays", [&](Builder& builder) {
+        builder.read(frameData);
+        builder.renderTo(backbuffer);
+    }, [&](const FrameGraph&) {
+        m_panel.frame(winW, winH, m_mousePosition, leftDownScene, view, proj, m_cam);
+        if (m_show_grid) drawGrid(view, proj);
+        if (m_show_axis) drawAxis(view, proj);
+        glPolygonMode(GL_FRONT_AND_BACK, (m_showWireframe) ? GL_LINE : GL_FILL);
+    });
+
+    m_frameGraph.addPass("Skybox", [&](Builder& builder) {
+        builder.read(frameData);
+        builder.renderTo(backbuffer);
+    }, [&](const FrameGraph&) {
+        gl_state::depth_func(GL_LEQUAL);
+        renderSkybox(m_skyboxShader, skyboxVAO, dayCubemap, sunPos);
+        gl_state::depth_func(GL_LESS);
+    });
+
+    m_frameGraph.addPass("Opaque scene", [&](Builder& builder) {
+        builder.read(frameData);
+        builder.read(shadowMask);
+        builder.read(treeDraws);
+        if (m_showClouds) builder.read(cloudShadow);
+        builder.renderTo(backbuffer);
+    }, [&](const FrameGraph&) {
+        for (GLuint program : { m_causticsShader, m_terrainShader, m_treeShader, m_impostorShader }) {
+            m_cloudRenderer.bindShadowMap(program, cloudShadowStrength);
+            m_shadowMask.bind(program, 5);
+        }
 
-    // Render clouds (no frame skipping for smoother results)
-    if (m_showClouds && frameCount % 2 == 0) {
-        m_cloudRenderer.render(view, proj, cameraPos, m_time, sunPos, sunColour,
-                              m_cloudCoverage, m_cloudDensity, m_cloudSpeed,
-                              m_cloudScale, m_cloudEvolutionSpeed,
-                              m_cloudHeight, m_cloudThickness, m_cloudFuzziness);
-    }
-    renderSandPlane(view, proj, m_time, sunPos, sunColour);
+        // Every opaque fragment already has its depth, shade only the one that won
+        if (m_equalShading) {
+            gl_state::depth_func(GL_EQUAL);
+            gl_state::depth_mask(GL_FALSE);
+        }
+        m_renderQueue.execute(RenderQueue::OPAQUE);
+        gl_state::depth_func(GL_LESS);
+        gl_state::depth_mask(GL_TRUE);
+    });
 
-    // draw the model
-    m_terrain.draw(view, proj, m_terrainShader, vec3(0.2f, 0.8f, 0.2f), sunPos, sunColour, m_grassTexture, m_grassNormal, m_grassRoughness, lightSpaceMatrix, m_shadowMap);
-  
-    // Draw trees
-    for (auto& tree : m_trees) {
-        glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
-        tree.draw(view, proj, m_treeShader, sunPos, sunColour,
-            m_trunkTexture, m_trunkNormal, m_trunkRoughness, cameraPos, lightSpaceMatrix, m_shadowMap);
+    // cloud stuff
+    // Drawn after the opaque geometry so rays stop at the scene depth and covered pixels are skipped
+    if (m_showClouds) {
+        m_frameGraph.addPass("Clouds", [&](Builder& builder) {
+            builder.read(frameData);
+            builder.read(sceneDepth);
+            builder.renderTo(backbuffer);
+        }, [&](const FrameGraph& graph) {
+            m_cloudRenderer.setResolutionDivisor(m_cloudResolutionDivisor);
+            m_cloudRenderer.setTemporalReprojection(m_cloudTemporal);
+            m_cloudRenderer.resize(fbW, fbH);
+            m_cloudRenderer.render(view, proj, cameraPos, m_time, sunPos, sunColour,
+                                  m_cloudCoverage, m_cloudDensity, m_cloudSpeed,
+                                  m_cloudScale, m_cloudEvolutionSpeed,
+                                  m_cloudHeight, m_cloudThickness, m_cloudFuzziness,
+                                  graph.getTexture(sceneDepth));
+            glPolygonMode(GL_FRONT_AND_BACK, (m_showWireframe ? GL_LINE : GL_FILL));
+        });
     }
 
-    static auto lastTime = std::chrono::high_resolution_clock::now();
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    float deltaTime = std::chrono::duration<float>(currentTime - lastTime).count();
-    lastTime = currentTime;
-
-    float sunHeight = sunPos.y;
-    float dayFactor = smoothstep(-50.0f, 50.0f, sunHeight);
-        
-    m_water.update(deltaTime);
-    m_water.draw(view, proj, m_waterShader, dayCubemap, vec3(0.1f, 0.3f, 0.7f), sunPos, sunColour, lightSpaceMatrix, m_shadowMap);
-
+    // Water is transparent and not in the depth prepass, so it still filters the cascades itself
+    m_frameGraph.addPass("Water", [&](Builder& builder) {
+        builder.read(frameData);
+        builder.read(cascades);
+        if (m_showClouds) builder.read(cloudShadow);
+        builder.renderTo(backbuffer);
+    }, [&](const FrameGraph&) {
+        m_cloudRenderer.bindShadowMap(m_waterShader, cloudShadowStrength);
+        m_shadowCascades.bind(m_waterShader, 6);
+        m_renderQueue.execute(RenderQueue::TRANSPARENT);
+    });
+
+    m_frameGraph.execute([&](const std::string& pass) { m_profiler.begin(pass); });
+    m_profiler.end();
 }
 
-void Application::renderSandPlane(const glm::mat4& view, const glm::mat4& proj, float time, const glm::vec3& sunPos, const glm::vec3& sunColour) {
-    glUseProgram(m_causticsShader);
-
-    // Model matrix for sand plane (identity, or translate if needed)
-    glm::mat4 modelview = view * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-
-    // Set transformation uniforms
-    glUniformMatrix4fv(glGetUniformLocation(m_causticsShader, "uModelViewMatrix"), 1, GL_FALSE, glm::value_ptr(modelview));
-    glUniformMatrix4fv(glGetUniformLocation(m_causticsShader, "uProjectionMatrix"), 1, GL_FALSE, glm::value_ptr(proj));
-    glUniform3fv(glGetUniformLocation(m_causticsShader, "uSunPos"), 1, glm::value_ptr(sunPos));
-    glUniform3fv(glGetUniformLocation(m_causticsShader, "uSunColor"), 1, glm::value_ptr(sunColour));
-    glUniformMatrix4fv(glGetUniformLocation(m_causticsShader, "uLightSpacematrix"), 1, false, glm::value_ptr(lightSpaceMatrix));
+void Application::renderSandPlane(float time) {
+    // The sand plane is in world space, the camera and sun come from the per-frame uniforms
+    gl_state::use_program(m_causticsShader);
 
     // Set caustics uniforms (tweak these as needed)
-    glUniform1f(glGetUniformLocation(m_causticsShader, "uTime"), time);
-    glUniform3fv(glGetUniformLocation(m_causticsShader, "uCausticsColor"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.8f))); // pale yellow caustics
-    glUniform1f(glGetUniformLocation(m_causticsShader, "uCausticsIntensity"), 0.78f);
-    glUniform1f(glGetUniformLocation(m_causticsShader, "uCausticsOffset"), 0.3f);
-    glUniform1f(glGetUniformLocation(m_causticsShader, "uCausticsScale"), 8.0f);
-    glUniform1f(glGetUniformLocation(m_causticsShader, "uCausticsSpeed"), 0.5f);
-    glUniform1f(glGetUniformLocation(m_causticsShader, "uCausticsThickness"), 0.75f);
-
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, m_shadowMap);
-    glUniform1i(glGetUniformLocation(m_causticsShader, "uShadowMap"), 1);
-
-    glUniform1f(glGetUniformLocation(m_causticsShader, "uLightSize"), 0.01f);
-    glUniform1f(glGetUniformLocation(m_causticsShader, "uNearPlane"), 0.1f);
-    glUniform1i(glGetUniformLocation(m_causticsShader, "uBlockerSearchSamples"), 16);
-    glUniform1i(glGetUniformLocation(m_causticsShader, "uPCFSamples"), 32);
+    m_causticsShader.set_uniform("uTime", time);
+    m_causticsShader.set_uniform("uCausticsColor", glm::vec3(1.0f, 1.0f, 0.8f)); // pale yellow caustics
+    m_causticsShader.set_uniform("uCausticsIntensity", 0.78f);
+    m_causticsShader.set_uniform("uCausticsOffset", 0.3f);
+    m_causticsShader.set_uniform("uCausticsScale", 8.0f);
+    m_causticsShader.set_uniform("uCausticsSpeed", 0.5f);
+    m_causticsShader.set_uniform("uCausticsThickness", 0.75f);
 
     // Bind sand texture to texture unit 0
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_sandTexture);
-    glUniform1i(glGetUniformLocation(m_causticsShader, "uTexture"), 0);
+    gl_state::active_texture(GL_TEXTURE0);
+    gl_state::bind_texture(GL_TEXTURE_2D, m_sandTexture);
+    m_causticsShader.set_uniform("uTexture", 0);
 
     // Draw the sand mesh
     m_sandMesh.draw();
 }
 
-void Application::renderSkybox(GLuint skyboxShader, GLuint skyboxVAO, GLuint cubemap, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& sunPos, const glm::vec3& sunColour) {
-    glDepthMask(GL_FALSE);
-    glCullFace(GL_FRONT);
+void Application::renderSkybox(const cgra::shader_program& skyboxShader, GLuint skyboxVAO, GLuint cubemap, const glm::vec3& sunPos) {
+    gl_state::depth_mask(GL_FALSE);
+    gl_state::cull_face(GL_FRONT);
 
-    glUseProgram(skyboxShader);
+    gl_state::use_program(skyboxShader);
 
     float sunHeight = sunPos.y;
     float dayFactor = smoothstep(-50.0f, 50.0f, sunHeight);
 
-    glm::mat4 viewNoTranslation = glm::mat4(glm::mat3(view));
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader, "view"), 1, GL_FALSE, glm::value_ptr(viewNoTranslation));
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    glUniform3fv(glGetUniformLocation(skyboxShader, "uSunPos"), 1, glm::value_ptr(sunPos));
-    glUniform3fv(glGetUniformLocation(skyboxShader, "uSunColor"), 1, glm::value_ptr(sunColour));
-
     // Pass blend factor
-    glUniform1f(glGetUniformLocation(m_skyboxShader, "uDayFactor"), dayFactor);
+    skyboxShader.set_uniform("uDayFactor", dayFactor);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, dayCubemap);
-    glUniform1i(glGetUniformLocation(m_skyboxShader, "uDayCubemap"), 0);
+    gl_state::active_texture(GL_TEXTURE0);
+    gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, dayCubemap);
+    skyboxShader.set_uniform("uDayCubemap", 0);
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, nightCubemap);
-    glUniform1i(glGetUniformLocation(m_skyboxShader, "uNightCubemap"), 1);
+    gl_state::active_texture(GL_TEXTURE1);
+    gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, nightCubemap);
+    skyboxShader.set_uniform("uNightCubemap", 1);
 
-    glBindVertexArray(skyboxVAO);
+    gl_state::bind_vertex_array(skyboxVAO);
     glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
+    gl_state::bind_vertex_array(0);
 
-    glCullFace(GL_BACK);
-    glDepthMask(GL_TRUE);
+    gl_state::cull_face(GL_BACK);
+    gl_state::depth_mask(GL_TRUE);
 }
 
-void Application::renderShadows(glm::vec3 lightPos) {
-    glm::mat4 lightProjection, lightView;
-    float near_plane = 0.1f, far_plane = 300.0f;
-
-    lightProjection = glm::ortho(-30.0f, 30.0f, -30.0f, 30.0f, near_plane, far_plane);
-    lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    lightSpaceMatrix = lightProjection * lightView;
+void Application::renderShadows(glm::vec3 lightPos, const glm::mat4& view, float aspect) {
+    // Cascades are fitted to the part of the camera frustum that receives shadows
+    m_shadowCascades.update(view, glm::radians(m_cam.fovDeg), aspect, m_cam.nearP, lightPos);
 
-    glUseProgram(m_shadowShader);
-    glUniformMatrix4fv(glGetUniformLocation(m_shadowShader, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    m_shadowTriangles = 0;
+    m_shadowFullTriangles = 0;
 
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, m_shadowFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    m_shadowCascades.render(m_shadowShader, [&](int cascade) {
+        auto visible = [&](const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+            return !m_shadowCulling || m_shadowCascades.intersects(cascade, boundsMin, boundsMax);
+        };
 
-    m_terrain.drawShadows(m_shadowShader);
-    for (auto& tree : m_trees) {
-        tree.drawShadows(m_shadowShader);
-    }
+        m_shadowFullTriangles += m_terrain.getTriangleCount();
+        if (m_shadowProxies) {
+            m_shadowTriangles += m_terrain.drawShadowProxy(m_shadowShader, visible);
+        } else {
+            m_terrain.drawShadows(m_shadowShader);
+            m_shadowTriangles += m_terrain.getTriangleCount();
+        }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        m_shadowFullTriangles += m_forest.getTriangleCount();
+        m_shadowTriangles += m_forest.drawShadowCasters(m_shadowShader, m_shadowProxies, visible);
+    });
 }
 
 void Application::regenerateTrees() {
-    m_trees.clear();
-    
-    std::mt19937 rng(std::random_device{}());
-    std::uniform_real_distribution<float> distX(-m_scene_size / 2.0f, m_scene_size / 2.0f);
-    std::uniform_real_distribution<float> distZ(-m_scene_size / 2.0f, m_scene_size / 2.0f);
-
-    int numTrees = 50;
-    float waterLevel = 0.0f;
-    float minHeightAboveWater = 0.5f;
+    m_shadowCascades.invalidate();
 
-    int treesPlaced = 0;
-    int maxAttempts = numTrees * 10;
+    std::vector<Forest::Instance> instances;
+    m_treeScatterSettings.areaSize = m_scene_size;
+    m_treeScatterSettings.maxCount = m_treeCount;
+    m_treeScatter.scatter(m_terrain, m_treeScatterSettings, instances);
 
-    for (int attempt = 0; attempt < maxAttempts && treesPlaced < numTrees; attempt++) {
-        float x = distX(rng);
-        float z = distZ(rng);
-        
-        // Get terrain height and normal at this position
-        float terrainHeight = m_terrain.getHeightAtWorld(x, z);
-        glm::vec3 terrainNormal = m_terrain.getNormalAtWorld(x, z);
-        
-        // Only place tree if terrain is above water
-        if (terrainHeight > waterLevel + minHeightAboveWater) {
-            // FIXED: Account for terrain's -1.5f offset and place tree at ground level
-            glm::vec3 treePos(x, terrainHeight - 1.5f, z);
-            Tree tree(treePos);
-            
-            // Calculate rotation to align with terrain normal
-            glm::vec3 upVector(0, 1, 0);
-            float dotProduct = glm::dot(upVector, terrainNormal);
-            
-            if (dotProduct < 0.99f) {
-                glm::quat rotation = glm::rotation(upVector, terrainNormal);
-                glm::vec3 eulerAngles = glm::eulerAngles(rotation);
-                
-                float maxTilt = glm::radians(15.0f);
-                eulerAngles.x = glm::clamp(eulerAngles.x, -maxTilt, maxTilt);
-                eulerAngles.z = glm::clamp(eulerAngles.z, -maxTilt, maxTilt);
-                
-                tree.setRotation(eulerAngles);
-            }
-            
-            m_trees.push_back(tree);
-            treesPlaced++;
-        }
-    }
+    m_forest.setInstances(instances);
 }
 
 void Application::renderGUI() {
@@ -522,6 +677,16 @@ void Application::renderGUI() {
     ImGui::Checkbox("Wireframe", &m_showWireframe);
     ImGui::SameLine();
     if (ImGui::Button("Screenshot")) rgba_image::screenshot(true);
+    bool showProfiler = m_profiler.getEnabled();
+    if (ImGui::Checkbox("GPU Profiler", &showProfiler)) {
+        m_profiler.setEnabled(showProfiler);
+    }
+    const gl_state::counters& glCalls = gl_state::frame_counters();
+    ImGui::Text("GL state calls: %lld, filtered: %lld", glCalls.total_calls(), glCalls.total_filtered());
+    ImGui::Text("Frame graph: %d passes, %d culled, %d pooled targets", m_frameGraph.getPassCount(),
+                m_frameGraph.getCulledPassCount(), m_frameGraph.getPooledTextureCount());
+    ImGui::Checkbox("Shade after depth prepass (GL_EQUAL)", &m_equalShading);
+    ImGui::Text("Scene draws: %d, program changes: %d", m_renderQueue.getDrawCount(), m_renderQueue.getProgramChanges());
     
     ImGui::Separator();
     ImGui::Text("Terrain Settings");
@@ -563,6 +728,7 @@ void Application::renderGUI() {
 
     if (terrainChanged) {
         m_terrain.update();
+        m_shadowCascades.invalidate();
     }
 
     if (ImGui::SliderFloat("Min Height (Water Depth)", &m_minHeight, -10.0f, 0.0f)) {
@@ -595,6 +761,17 @@ void Application::renderGUI() {
             ImGui::SliderFloat("Thickness", &m_cloudThickness, 10.0f, 40.0f);
             ImGui::TreePop();
         }
+
+        if (ImGui::TreeNode("Cloud Quality")) {
+            const char* resolutions[] = { "Full", "Half", "Quarter" };
+            int resIndex = (m_cloudResolutionDivisor == 1) ? 0 : (m_cloudResolutionDivisor == 2 ? 1 : 2);
+            if (ImGui::Combo("Resolution", &resIndex, resolutions, 3)) {
+                m_cloudResolutionDivisor = 1 << resIndex;
+            }
+            ImGui::Checkbox("Temporal Reprojection", &m_cloudTemporal);
+            ImGui::SliderFloat("Shadow Strength", &m_cloudShadowStrength, 0.0f, 1.0f);
+            ImGui::TreePop();
+        }
         
         // Preset buttons
         if (ImGui::Button("Clear Sky")) {
@@ -613,23 +790,172 @@ void Application::renderGUI() {
         }
     }
     
+    ImGui::Separator();
+    ImGui::Text("Shadow Settings");
+    int cascadeCount = m_shadowCascades.getCascadeCount();
+    if (ImGui::SliderInt("Cascades", &cascadeCount, 1, CascadedShadowMap::MAX_CASCADES)) {
+        m_shadowCascades.setCascadeCount(cascadeCount);
+    }
+    float shadowDistance = m_shadowCascades.getShadowDistance();
+    if (ImGui::SliderFloat("Shadow Distance", &shadowDistance, 50.0f, 600.0f)) {
+        m_shadowCascades.setShadowDistance(shadowDistance);
+    }
+    if (ImGui::TreeNode("Cascade Resolution")) {
+        static const int resolutions[] = { 512, 1024, 2048, 4096 };
+        static const char* resolutionNames[] = { "512", "1024", "2048", "4096" };
+        for (int i = 0; i < m_shadowCascades.getCascadeCount(); i++) {
+            int current = 0;
+            while (current < 3 && resolutions[current] < m_shadowCascades.getResolution(i)) current++;
+            std::string label = "Cascade " + std::to_string(i) + " (to " + std::to_string(int(m_shadowCascades.getSplit(i))) + ")";
+            if (ImGui::Combo(label.c_str(), &current, resolutionNames, 4)) {
+                m_shadowCascades.setResolution(i, resolutions[current]);
+            }
+        }
+        ImGui::TreePop();
+    }
+    // The single map this replaced was 4096x4096
+    ImGui::Text("Shadow texels: %.1fM (was %.1fM)", m_shadowCascades.getTexelCount() / 1.0e6, 4096.0 * 4096.0 / 1.0e6);
+
+    bool shadowCache = m_shadowCascades.getCacheEnabled();
+    if (ImGui::Checkbox("Cache Shadows", &shadowCache)) {
+        m_shadowCascades.setCacheEnabled(shadowCache);
+    }
+    if (shadowCache) {
+        ImGui::SameLine();
+        bool amortize = m_shadowCascades.getAmortize();
+        if (ImGui::Checkbox("One Cascade Per Frame", &amortize)) {
+            m_shadowCascades.setAmortize(amortize);
+        }
+        float angleThreshold = m_shadowCascades.getAngleThreshold();
+        if (ImGui::SliderFloat("Sun Angle Threshold", &angleThreshold, 0.0f, 2.0f, "%.2f deg")) {
+            m_shadowCascades.setAngleThreshold(angleThreshold);
+        }
+    }
+    ImGui::Text("Cascades rendered: %d / %d", m_shadowCascades.getCascadesRenderedLastFrame(), m_shadowCascades.getCascadeCount());
+
+    bool castersChanged = ImGui::Checkbox("Cull Casters", &m_shadowCulling);
+    ImGui::SameLine();
+    castersChanged |= ImGui::Checkbox("Caster Proxies", &m_shadowProxies);
+    if (castersChanged) m_shadowCascades.invalidate();
+    ImGui::Text("Shadow triangles: %.2fM (full: %.2fM)", m_shadowTriangles / 1.0e6, m_shadowFullTriangles / 1.0e6);
+
+    int shadowFilter = (m_shadowMask.getFilter() == ShadowFilter::EVSM) ? 1 : 0;
+    if (ImGui::Combo("Shadow Filter", &shadowFilter, "PCSS\0EVSM\0")) {
+        m_shadowMask.setFilter(shadowFilter == 1 ? ShadowFilter::EVSM : ShadowFilter::PCSS);
+    }
+    bool halfResShadows = m_shadowMask.getHalfResolution();
+    if (ImGui::Checkbox("Half-Res Shadow Resolve", &halfResShadows)) {
+        m_shadowMask.setHalfResolution(halfResShadows);
+    }
+    if (shadowFilter == 0) {
+        int blockerSamples = m_shadowMask.getBlockerSearchSamples();
+        if (ImGui::SliderInt("Blocker Samples", &blockerSamples, 4, 64)) {
+            m_shadowMask.setBlockerSearchSamples(blockerSamples);
+        }
+        int pcfSamples = m_shadowMask.getPCFSamples();
+        if (ImGui::SliderInt("PCF Samples", &pcfSamples, 4, 64)) {
+            m_shadowMask.setPCFSamples(pcfSamples);
+        }
+    } else {
+        int blurRadius = m_shadowMoments.getBlurRadius();
+        if (ImGui::SliderInt("Moment Blur Radius", &blurRadius, 0, 8)) {
+            m_shadowMoments.setBlurRadius(blurRadius);
+        }
+        float bleedReduction = m_shadowMoments.getBleedReduction();
+        if (ImGui::SliderFloat("Light Bleed Reduction", &bleedReduction, 0.0f, 0.9f)) {
+            m_shadowMoments.setBleedReduction(bleedReduction);
+        }
+    }
+
     ImGui::Separator();
     ImGui::Text("Tree Settings");
     ImGui::Checkbox("Show Trees", &m_showTrees);
 
+    // A new placement seed gives a new, still reproducible, layout
     if (ImGui::Button("Regenerate Tree Positions")) {
+        m_treeScatterSettings.seed++;
         if (m_showTrees) {
             regenerateTrees();
         }
     }
+    bool placementChanged = false;
+    placementChanged |= ImGui::SliderInt("Tree Count", &m_treeCount, 1, 200000);
+    placementChanged |= ImGui::SliderFloat("Tree Spacing", &m_treeScatterSettings.spacing, 0.4f, 20.0f, "%.2f", 2.0f);
+    if (ImGui::TreeNode("Placement Masks")) {
+        placementChanged |= ImGui::SliderFloat("Min Height", &m_treeScatterSettings.minHeight, -2.0f, 10.0f);
+        placementChanged |= ImGui::SliderFloat("Tree Line", &m_treeScatterSettings.maxHeight, 0.0f, 30.0f);
+        placementChanged |= ImGui::SliderFloat("Height Fade", &m_treeScatterSettings.heightFade, 0.0f, 5.0f);
+        placementChanged |= ImGui::SliderFloat("Max Slope", &m_treeScatterSettings.maxSlope, 5.0f, 90.0f);
+        placementChanged |= ImGui::SliderFloat("Slope Fade", &m_treeScatterSettings.slopeFade, 0.0f, 30.0f);
+        ImGui::TreePop();
+    }
+    if (placementChanged && m_showTrees) {
+        regenerateTrees();
+    }
+    ImGui::Text("Placed %d of %d candidates in %.1f ms", m_forest.getInstanceCount(),
+        m_treeScatter.getCandidateCount(), m_treeScatter.getScatterMs());
+    int treeVariants = m_forest.getVariantCount();
+    if (ImGui::SliderInt("Tree Variants", &treeVariants, 1, 8)) {
+        m_forest.setVariantCount(treeVariants);
+        m_shadowCascades.invalidate();
+    }
+    int treeSeed = int(m_forest.getSeed());
+    if (ImGui::InputInt("Tree Seed", &treeSeed)) {
+        m_forest.setSeed(uint32_t(treeSeed));
+        m_shadowCascades.invalidate();
+    }
+    ImGui::Text("Trees: %d, draw calls: %d", m_forest.getInstanceCount(), m_forest.getDrawCalls());
+    bool treeLods = m_forest.getLodEnabled();
+    if (ImGui::Checkbox("Tree LODs", &treeLods)) {
+        m_forest.setLodEnabled(treeLods);
+    }
+    float lodBias = m_forest.getLodBias();
+    if (ImGui::SliderFloat("LOD Bias", &lodBias, 0.25f, 4.0f, "%.2f", 2.0f)) {
+        m_forest.setLodBias(lodBias);
+    }
+    ImGui::Text("Full: %d, reduced: %d / %d, impostors: %d", m_forest.getLodInstanceCount(0),
+        m_forest.getLodInstanceCount(1), m_forest.getLodInstanceCount(2), m_forest.getLodInstanceCount(3));
+    ImGui::Text("Tree triangles: %.2fM (full: %.2fM)", m_forest.getLodTriangleCount() / 1.0e6, m_forest.getTriangleCount() / 1.0e6);
+    if (m_forest.isGpuCullingAvailable()) {
+        bool gpuCulling = m_forest.getGpuCulling();
+        if (ImGui::Checkbox("GPU Culling", &gpuCulling)) {
+            m_forest.setGpuCulling(gpuCulling);
+        }
+        if (gpuCulling) {
+            ImGui::SameLine();
+            ImGui::TextDisabled(m_forest.isGpuCullingIndirect() ? "(compute, indirect draws)" : "(transform feedback)");
+            bool occlusion = m_forest.getOcclusionCulling();
+            if (ImGui::Checkbox("Occlusion Culling (Hi-Z)", &occlusion)) {
+                m_forest.setOcclusionCulling(occlusion);
+            }
+        }
+    }
+    ImGui::Text("Generated in %.1f ms, %d of %d from cache", m_forest.getGenerationMs(),
+        m_forest.getCachedArchetypeCount(), m_forest.getVariantCount());
+    if (m_forest.isGpuStemsAvailable()) {
+        bool gpuStems = m_forest.getGpuStems();
+        if (ImGui::Checkbox("GPU Stem Generation", &gpuStems)) {
+            m_forest.setGpuStems(gpuStems);
+        }
+    } else {
+        ImGui::TextDisabled("GPU stem generation needs GL 4.3");
+    }
+    ImGui::Text("Stem geometry: CPU %.2f ms, GPU %.2f ms", m_forest.getStemGenerationMs(false), m_forest.getStemGenerationMs(true));
+    if (ImGui::Button("Benchmark Generation")) {
+        m_forest.benchmarkGeneration(200);
+    }
+    if (m_forest.getBenchmarkRate() > 0.0) {
+        ImGui::SameLine();
+        ImGui::Text("%.0f trees/s", m_forest.getBenchmarkRate());
+    }
     
     // tree stuff
     ImGui::Separator();
     ImGui::Text("Tree Settings");
     ImGui::Checkbox("Show Trees", &m_showTrees);
     
-    if (m_showTrees && !m_trees.empty()) {
-        TreeParameters& params = m_trees[0].getParameters();
+    if (m_showTrees) {
+        TreeParameters params = m_forest.getParameters();
         bool changed = false;
             
         ImGui::Text("Overall Shape");
@@ -675,7 +1001,7 @@ void Application::renderGUI() {
         if (ImGui::Checkbox("Show Leaves", &params.hasLeaves)) changed = true;
         if (params.hasLeaves) {
             if (ImGui::SliderFloat("Leaf Scale", &params.leafScale, 0.05f, 0.5f)) changed = true;
-            if (ImGui::SliderInt("Per Branch", &params.leavesPerBranch, 1, 15)) changed = true;
+            if (ImGui::SliderInt("Per Branch", &params.leavesPerBranch, 1, 40)) changed = true;
                 
             if (ImGui::TreeNode("Leaf Shape")) {
                 if (ImGui::SliderFloat("Width", &params.leafParams.lobeWidth, 0.1f, 1.0f)) changed = true;
@@ -695,20 +1021,21 @@ void Application::renderGUI() {
         }
             
         if (changed) {
-            for (auto& tree : m_trees) {
-                tree.setParameters(params);
-            }
+            m_forest.setParameters(params);
+            m_shadowCascades.invalidate();
         }
     }
 
     // finish creating window
     ImGui::End();
+
+    m_profiler.renderGUI();
 }
 
 GLuint Application::loadCubemap(const std::vector<std::string>& faces) {
     GLuint textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, textureID);
 
     int width, height, nrChannels;
 
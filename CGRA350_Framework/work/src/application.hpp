@@ -7,26 +7,36 @@
 // project
 #include "opengl.hpp"
 #include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_shader.hpp"
 
 #include "terrain.hpp"
 #include "camerapov.hpp"
 #include "Cockpit.hpp"
 #include "water.hpp"
 #include "tree.hpp"
+#include "forest.hpp"
+#include "tree_scatter.hpp"
 #include "cloud_renderer.hpp"
+#include "shadow_cascades.hpp"
+#include "shadow_mask.hpp"
+#include "shadow_evsm.hpp"
+#include "frame_uniforms.hpp"
+#include "frame_graph.hpp"
+#include "render_queue.hpp"
+#include "gpu_profiler.hpp"
 
 // Basic model that holds the shader, mesh and transform for drawing.
 // Can be copied and modified for adding in extra information for drawing
 // including textures for texture mapping etc.
 
 struct basic_model {
-	GLuint shader = 0;
+	cgra::shader_program shader;
 	cgra::gl_mesh mesh;
 	glm::vec3 color{0.7};
 	glm::mat4 modelTransform{1.0};
 	GLuint texture;
 
-	void draw(const glm::mat4 &view, const glm::mat4 proj);
+	void draw(const glm::mat4 &view);
 };
 
 
@@ -38,25 +48,44 @@ private:
 	glm::vec2 m_windowsize;
 	GLFWwindow *m_window;
 
-	GLuint m_shader;
-	GLuint m_terrainShader;
-	GLuint m_waterShader;
-	GLuint m_skyboxShader;
-	GLuint m_causticsShader;
-	GLuint m_treeShader;
-	GLuint m_shadowShader;
-	glm::mat4 lightSpaceMatrix;
+	cgra::shader_program m_shader;
+	cgra::shader_program m_terrainShader;
+	cgra::shader_program m_waterShader;
+	cgra::shader_program m_skyboxShader;
+	cgra::shader_program m_causticsShader;
+	cgra::shader_program m_treeShader;
+	cgra::shader_program m_impostorShader;
+	cgra::shader_program m_impostorBakeShader;
+	cgra::shader_program m_shadowShader;
+	cgra::shader_program m_sandDepthShader;
+	cgra::shader_program m_terrainDepthShader;
+	cgra::shader_program m_treeDepthShader;
+	cgra::shader_program m_impostorDepthShader;
+	cgra::shader_program m_shadowResolveShader;
+	cgra::shader_program m_shadowUpsampleShader;
+	cgra::shader_program m_evsmConvertShader;
+	cgra::shader_program m_evsmBlurShader;
 
 	Terrain m_terrain;
 	Water m_water;
     
     // Cloud Stuff
-    GLuint m_cloudShader;
+    cgra::shader_program m_cloudShader;
+    cgra::shader_program m_cloudTemporalShader;
+    cgra::shader_program m_cloudCompositeShader;
+    cgra::shader_program m_cloudWeatherShader;
+    cgra::shader_program m_cloudShadowShader;
     CloudRenderer m_cloudRenderer;
+    int m_cloudResolutionDivisor = 2;   // 1 = full, 2 = half, 4 = quarter
+    bool m_cloudTemporal = true;
+    float m_cloudShadowStrength = 0.7f;
     //bool m_showClouds = true;
     
     // Tree things
-    std::vector<Tree> m_trees;
+    Forest m_forest;
+    int m_treeCount = 50;
+    TreeScatter m_treeScatter;
+    ScatterSettings m_treeScatterSettings;
     TreeParameters m_treeParams;
     //bool m_showTrees = true;
     void generateTreePositions(int numClusters = 5, int treesPerCluster = 5);
@@ -69,9 +98,28 @@ private:
 	GLuint nightCubemap;
 	GLuint skyboxVAO = 0, skyboxVBO = 0;
 
-	GLuint m_shadowFBO;
-	GLuint m_shadowMap;
-	const int SHADOW_WIDTH = 4096, SHADOW_HEIGHT = 4096;
+	// Camera, sun and shadow data read by every scene shader, uploaded once a frame
+	FrameUniforms m_frameUniforms;
+
+	CascadedShadowMap m_shadowCascades;
+	ShadowMask m_shadowMask;
+	EvsmShadowMap m_shadowMoments;
+
+	// Shadow casters are culled per cascade and drawn with reduced-detail proxies
+	bool m_shadowCulling = true;
+	bool m_shadowProxies = true;
+	long long m_shadowTriangles = 0;       // submitted to the cascades last frame
+	long long m_shadowFullTriangles = 0;   // what the same cascades cost unculled at full detail
+
+	GpuProfiler m_profiler;
+
+	// The passes of a frame and the render targets only they use, such as the scene depth
+	FrameGraph m_frameGraph;
+
+	// Sorted scene draws. With m_equalShading the prepass fills the backbuffer's depth and
+	// the opaque shaders run with GL_EQUAL, once per pixel.
+	RenderQueue m_renderQueue;
+	bool m_equalShading = true;
 
 	float skyboxVertices[108] = {
 		// positions          
@@ -198,8 +246,8 @@ public:
 	GLuint loadTexture(const std::string& filepath);
 	GLuint loadCubemap(const std::vector<std::string>& faces);
 	void initSkybox();
-	void initShadowMap();
-	void renderSandPlane(const glm::mat4& view, const glm::mat4& proj, float time, const glm::vec3& sunPos, const glm::vec3& sunColour);
-	void renderShadows(glm::vec3 lightPos);
-	void renderSkybox(GLuint skyboxShader, GLuint skyboxVAO, GLuint cubemap, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& sunPos, const glm::vec3& sunColour);
+	void queueScene(const glm::mat4& view);
+	void renderSandPlane(float time);
+	void renderShadows(glm::vec3 lightPos, const glm::mat4& view, float aspect);
+	void renderSkybox(const cgra::shader_program& skyboxShader, GLuint skyboxVAO, GLuint cubemap, const glm::vec3& sunPos);
 };
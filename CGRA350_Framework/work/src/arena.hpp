@@ -0,0 +1,49 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+// Bump allocator for scratch data that is rebuilt from nothing on every pass, like a
+// tree's stem skeleton. reset() sizes a single block for the whole pass up front, so
+// each allocation is a pointer bump and nothing is reallocated or freed piecemeal.
+// The block is kept between passes and only ever grows. It cannot grow during a pass,
+// since that would move everything already allocated, so running past what reset()
+// sized for throws instead.
+class Arena {
+private:
+    std::unique_ptr<unsigned char[]> m_block;
+    size_t m_capacity = 0;
+    size_t m_used = 0;
+
+public:
+    // Discards everything allocated so far and makes room for at least bytes
+    void reset(size_t bytes) {
+        if (bytes > m_capacity) {
+            m_block.reset(new unsigned char[bytes]);
+            m_capacity = bytes;
+        }
+        m_used = 0;
+    }
+
+    // Uninitialised space for count objects of T, valid until the next reset. Throws
+    // std::length_error if the block is too small.
+    template <typename T>
+    T* allocate(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destructed");
+        size_t offset = (m_used + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (offset > m_capacity || count > (m_capacity - offset) / sizeof(T)) {
+            throw std::length_error("Arena: allocation exceeds the size given to reset");
+        }
+        m_used = offset + count * sizeof(T);
+        return reinterpret_cast<T*>(m_block.get() + offset);
+    }
+
+    // Bytes to reset() with for count objects of T, including alignment padding
+    template <typename T>
+    static size_t footprint(size_t count) {
+        return count * sizeof(T) + alignof(T);
+    }
+};
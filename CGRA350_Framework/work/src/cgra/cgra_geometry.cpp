@@ -26,7 +26,7 @@ namespace cgra {
 			glGenVertexArrays(1, &vao);
 			glGenBuffers(1, &vbo);
 			glGenBuffers(1, &ibo);
-			glBindVertexArray(vao);
+			gl_state::bind_vertex_array(vao);
 			glBindBuffer(GL_ARRAY_BUFFER, vbo);
 			glBufferData(GL_ARRAY_BUFFER, vcount * sizeof(float), vertices, GL_STATIC_DRAW);
 			glEnableVertexAttribArray(0);
@@ -37,7 +37,7 @@ namespace cgra {
 			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(draw_mesh_vertex), (void *)(offsetof(draw_mesh_vertex, uv)));
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
 			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * icount, indices, GL_STATIC_DRAW);
-			glBindVertexArray(0);
+			gl_state::bind_vertex_array(0);
 			return vao;
 		}
 	}
@@ -409,7 +409,7 @@ namespace cgra {
 			c = sizeof(idx) / sizeof(idx[0]);
 			m = compileDrawVAO(vert, v, idx, c);
 		}
-		glBindVertexArray(m);
+		gl_state::bind_vertex_array(m);
 		glDrawElements(GL_TRIANGLES, c, GL_UNSIGNED_INT, 0);
 	}
 
@@ -541,7 +541,7 @@ namespace cgra {
 			c = sizeof(idx) / sizeof(idx[0]);
 			m = compileDrawVAO(vert, v, idx, c);
 		}
-		glBindVertexArray(m);
+		gl_state::bind_vertex_array(m);
 		glDrawElements(GL_TRIANGLES, c, GL_UNSIGNED_INT, 0);
 	}
 
@@ -639,7 +639,7 @@ namespace cgra {
 			c = sizeof(idx) / sizeof(idx[0]);
 			m = compileDrawVAO(vert, v, idx, c);
 		}
-		glBindVertexArray(m);
+		gl_state::bind_vertex_array(m);
 		glDrawElements(GL_TRIANGLES, c, GL_UNSIGNED_INT, 0);
 	}
 
@@ -697,7 +697,7 @@ namespace cgra {
 			axis_shader = prog.build();
 		}
 
-		glUseProgram(axis_shader);
+		gl_state::use_program(axis_shader);
 		glUniformMatrix4fv(glGetUniformLocation(axis_shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
 		glUniformMatrix4fv(glGetUniformLocation(axis_shader, "uModelViewMatrix"), 1, false, value_ptr(view));
 		draw_dummy(6);
@@ -745,7 +745,7 @@ namespace cgra {
 
 		const glm::mat4 rot = glm::rotate(glm::mat4(1), glm::pi<float>() / 2.f, glm::vec3(0, 1, 0));
 
-		glUseProgram(grid_shader);
+		gl_state::use_program(grid_shader);
 		glUniformMatrix4fv(glGetUniformLocation(grid_shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
 		glUniformMatrix4fv(glGetUniformLocation(grid_shader, "uModelViewMatrix"), 1, false, value_ptr(view));
 		draw_dummy(21);
@@ -0,0 +1,105 @@
+
+// project
+#include "cgra_offscreen.hpp"
+#include "cgra_state.hpp"
+
+
+namespace cgra {
+
+	void fullscreen_quad::create() {
+		const float vertices[] = {
+			-1.0f,  1.0f,
+			-1.0f, -1.0f,
+			 1.0f, -1.0f,
+
+			-1.0f,  1.0f,
+			 1.0f, -1.0f,
+			 1.0f,  1.0f
+		};
+
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+
+		gl_state::bind_vertex_array(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+
+		gl_state::bind_vertex_array(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+
+	void fullscreen_quad::destroy() {
+		if (vao) gl_state::delete_vertex_arrays(1, &vao);
+		if (vbo) glDeleteBuffers(1, &vbo);
+		vao = vbo = 0;
+	}
+
+
+	void fullscreen_quad::bind() const {
+		gl_state::bind_vertex_array(vao);
+	}
+
+
+	void fullscreen_quad::draw() const {
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+
+
+	GLuint create_target(GLenum internal_format, GLenum format, int width, int height, GLenum filter) {
+		GLuint tex;
+		glGenTextures(1, &tex);
+		gl_state::bind_texture(GL_TEXTURE_2D, tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return tex;
+	}
+
+
+	GLuint create_framebuffer(GLuint colour) {
+		GLuint fbo;
+		glGenFramebuffers(1, &fbo);
+		gl_state::bind_framebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colour, 0);
+		return fbo;
+	}
+
+
+	offscreen_state begin_offscreen() {
+		offscreen_state saved;
+		saved.framebuffer = gl_state::bound_framebuffer(GL_FRAMEBUFFER);
+		glGetIntegerv(GL_VIEWPORT, saved.viewport);
+		saved.depth_test = gl_state::is_enabled(GL_DEPTH_TEST);
+		saved.blend = gl_state::is_enabled(GL_BLEND);
+		saved.depth_mask = gl_state::current_depth_mask();
+
+		gl_state::disable(GL_DEPTH_TEST);
+		gl_state::disable(GL_BLEND);
+		gl_state::depth_mask(GL_FALSE);
+		return saved;
+	}
+
+
+	void end_offscreen(const offscreen_state &saved) {
+		gl_state::bind_vertex_array(0);
+		gl_state::bind_framebuffer(GL_FRAMEBUFFER, saved.framebuffer);
+		glViewport(saved.viewport[0], saved.viewport[1], saved.viewport[2], saved.viewport[3]);
+		if (saved.depth_test) {
+			gl_state::enable(GL_DEPTH_TEST);
+		} else {
+			gl_state::disable(GL_DEPTH_TEST);
+		}
+		if (saved.blend) {
+			gl_state::enable(GL_BLEND);
+		} else {
+			gl_state::disable(GL_BLEND);
+		}
+		gl_state::depth_mask(saved.depth_mask);
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+
+	// Two triangles covering the viewport in NDC, positions (vec2) at location 0, for the
+	// fullscreen passes drawn with fullscreen_vert.glsl
+	struct fullscreen_quad {
+		GLuint vao = 0;
+		GLuint vbo = 0;
+
+		void create();
+		void destroy();
+
+		// bind once before a run of passes, then draw each one
+		void bind() const;
+		void draw() const;
+	};
+
+
+	// A single level 2D texture to render into, clamped at the edges. Left bound.
+	GLuint create_target(GLenum internal_format, GLenum format, int width, int height, GLenum filter);
+
+	// A framebuffer with colour as its only attachment. Left bound.
+	GLuint create_framebuffer(GLuint colour);
+
+
+	// What an offscreen pass changes and has to give back: the framebuffer, the viewport
+	// and the depth and blend state. begin_offscreen saves it and turns off depth testing,
+	// depth writes and blending, which no fullscreen pass wants; end_offscreen restores it.
+	struct offscreen_state {
+		GLuint framebuffer = 0;
+		GLint viewport[4] = {};
+		bool depth_test = false;
+		bool blend = false;
+		GLboolean depth_mask = GL_TRUE;
+	};
+
+	offscreen_state begin_offscreen();
+	void end_offscreen(const offscreen_state &saved);
+}
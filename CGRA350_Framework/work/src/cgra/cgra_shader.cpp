@@ -1,11 +1,16 @@
 
 // std
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
 // project
 #include "cgra_shader.hpp"
 #include <opengl.hpp>
@@ -62,7 +67,156 @@ void printProgramInfoLog(GLuint obj) {
 
 namespace cgra {
 
-	void shader_builder::set_shader(GLenum type, const std::string &filename) {
+	shader_program::shader_program(GLuint program) : m_program(program), m_reflection(std::make_shared<reflection>()) {
+		reflection &r = *m_reflection;
+
+		GLint count = 0, max_length = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+		std::vector<char> name(std::max(max_length, 1));
+		GLint max_location = -1;
+		for (GLint i = 0; i < count; i++) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(program, GLuint(i), GLsizei(name.size()), &length, &size, &type, name.data());
+
+			// arrays are reported by their first element, "name[0]"
+			std::string base(name.data(), length);
+			bool array = base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0;
+			if (array) base.erase(base.size() - 3);
+
+			for (GLint e = 0; e < size; e++) {
+				std::string element = array ? base + "[" + std::to_string(e) + "]" : base;
+				GLint location = glGetUniformLocation(program, element.c_str());
+				if (location < 0) continue; // in a uniform block
+				r.uniforms[element] = location;
+				if (e == 0) r.uniforms[base] = location;
+				max_location = std::max(max_location, location);
+			}
+		}
+		r.values.resize(size_t(max_location + 1));
+
+		GLint block_count = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &block_count);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+		name.resize(std::max(max_length, 1));
+		for (GLint i = 0; i < block_count; i++) {
+			GLsizei length = 0;
+			glGetActiveUniformBlockName(program, GLuint(i), GLsizei(name.size()), &length, name.data());
+			r.blocks[std::string(name.data(), length)] = GLuint(i);
+		}
+	}
+
+
+	GLint shader_program::uniform(const std::string &name) const {
+		if (!m_reflection) return -1;
+		auto it = m_reflection->uniforms.find(name);
+		return it == m_reflection->uniforms.end() ? -1 : it->second;
+	}
+
+
+	GLuint shader_program::uniform_block(const std::string &name) const {
+		if (!m_reflection) return GL_INVALID_INDEX;
+		auto it = m_reflection->blocks.find(name);
+		return it == m_reflection->blocks.end() ? GL_INVALID_INDEX : it->second;
+	}
+
+
+	void shader_program::bind_uniform_block(const std::string &name, GLuint binding) const {
+		GLuint index = uniform_block(name);
+		if (index != GL_INVALID_INDEX) glUniformBlockBinding(m_program, index, binding);
+	}
+
+
+	bool shader_program::changed(GLint location, const void *value, GLsizei size) const {
+		if (location < 0) return false;
+		if (!m_reflection || size_t(location) >= m_reflection->values.size()) return true;
+		uniform_value &cached = m_reflection->values[location];
+		if (cached.size == size && std::memcmp(cached.bytes, value, size_t(size)) == 0) return false;
+		cached.size = size;
+		std::memcpy(cached.bytes, value, size_t(size));
+		return true;
+	}
+
+
+	void shader_program::forget(GLint location, GLsizei count) const {
+		if (location < 0 || !m_reflection) return;
+		std::vector<uniform_value> &values = m_reflection->values;
+		for (size_t i = size_t(location); i < values.size() && i < size_t(location) + size_t(count); i++) {
+			values[i].size = 0;
+		}
+	}
+
+
+	void shader_program::set_uniform(GLint location, int value) const {
+		if (changed(location, &value, sizeof(value))) glUniform1i(location, value);
+	}
+
+
+	void shader_program::set_uniform(GLint location, GLuint value) const {
+		if (changed(location, &value, sizeof(value))) glUniform1ui(location, value);
+	}
+
+
+	void shader_program::set_uniform(GLint location, float value) const {
+		if (changed(location, &value, sizeof(value))) glUniform1f(location, value);
+	}
+
+
+	void shader_program::set_uniform(GLint location, const glm::ivec2 &value) const {
+		if (changed(location, &value, sizeof(value))) glUniform2iv(location, 1, glm::value_ptr(value));
+	}
+
+
+	void shader_program::set_uniform(GLint location, const glm::vec2 &value) const {
+		if (changed(location, &value, sizeof(value))) glUniform2fv(location, 1, glm::value_ptr(value));
+	}
+
+
+	void shader_program::set_uniform(GLint location, const glm::vec3 &value) const {
+		if (changed(location, &value, sizeof(value))) glUniform3fv(location, 1, glm::value_ptr(value));
+	}
+
+
+	void shader_program::set_uniform(GLint location, const glm::vec4 &value) const {
+		if (changed(location, &value, sizeof(value))) glUniform4fv(location, 1, glm::value_ptr(value));
+	}
+
+
+	void shader_program::set_uniform(GLint location, const glm::mat3 &value) const {
+		if (changed(location, &value, sizeof(value))) glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+
+	void shader_program::set_uniform(GLint location, const glm::mat4 &value) const {
+		if (changed(location, &value, sizeof(value))) glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+
+	void shader_program::set_uniform(GLint location, const float *values, GLsizei count) const {
+		if (location < 0) return;
+		forget(location, count);
+		glUniform1fv(location, count, values);
+	}
+
+
+	void shader_program::set_uniform(GLint location, const glm::vec4 *values, GLsizei count) const {
+		if (location < 0) return;
+		forget(location, count);
+		glUniform4fv(location, count, glm::value_ptr(values[0]));
+	}
+
+
+	void shader_program::set_uniform(GLint location, const glm::mat4 *values, GLsizei count) const {
+		if (location < 0) return;
+		forget(location, count);
+		glUniformMatrix4fv(location, count, GL_FALSE, glm::value_ptr(values[0]));
+	}
+
+
+	// Reads a shader file with each #include "file" line replaced by that file's contents
+	static std::string read_shader_file(const std::string &filename) {
 		std::ifstream fileStream(filename);
 
 		if (!fileStream) {
@@ -70,11 +224,30 @@ namespace cgra {
 			throw std::runtime_error("Error: Could not locate and open file " + filename);
 		}
 
-		std::stringstream buffer;
-		buffer << fileStream.rdbuf();
+		std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+		std::ostringstream buffer;
+		std::string line;
+		while (std::getline(fileStream, line)) {
+			size_t start = line.find_first_not_of(" \t");
+			if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+				size_t open = line.find('"', start + 8);
+				size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+				if (close != std::string::npos) {
+					buffer << read_shader_file(directory + line.substr(open + 1, close - open - 1));
+					continue;
+				}
+			}
+			buffer << line << '\n';
+		}
+		return buffer.str();
+	}
+
+
+	void shader_builder::set_shader(GLenum type, const std::string &filename) {
+		std::string source = read_shader_file(filename);
 
 		try {
-			set_shader_source(type, buffer.str());
+			set_shader_source(type, source);
 		}
 		catch (shader_compile_error &e) {
 			std::cerr << "Error: Could not compile " << filename << std::endl;
@@ -103,6 +276,8 @@ namespace cgra {
 				return "_TESS_EVALUATION_";
 			case GL_FRAGMENT_SHADER:
 				return "_FRAGMENT_";
+			case GL_COMPUTE_SHADER:
+				return "_COMPUTE_";
 			default:
 				return "_INVALID_SHADER_TYPE_";
 			}
@@ -138,7 +313,7 @@ namespace cgra {
 	}
 
 
-	GLuint shader_builder::build(GLuint program) {
+	shader_program shader_builder::build(GLuint program) {
 
 		// if the program exists get attached shaders and detach them
 		if (program) {
@@ -172,7 +347,7 @@ namespace cgra {
 		printProgramInfoLog(program); // print warnings and errors
 		if (!link_status) throw shader_link_error();
 
-		return program;
+		return shader_program(program);
 	}
 
 }
@@ -5,6 +5,11 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
 
 // project
 #include <opengl.hpp>
@@ -12,6 +17,78 @@
 
 namespace cgra {
 
+	// A linked program, as returned by shader_builder::build. The active uniforms and
+	// uniform blocks are reflected once at link time, so draws look up a uniform's
+	// handle in a hash map instead of asking the driver by string every frame.
+	//
+	// set_uniform remembers the last value written to each uniform and skips writes
+	// that would not change it. That only holds while every write to the uniform goes
+	// through this object or a copy of it (copies share the reflection), so a uniform
+	// set here must not also be set with glUniform*. Like glUniform*, the setters act
+	// on the current program. Does not own the program.
+	class shader_program {
+	private:
+		struct uniform_value {
+			GLsizei size = 0;
+			unsigned char bytes[sizeof(glm::mat4)];
+		};
+
+		struct reflection {
+			std::unordered_map<std::string, GLint> uniforms;
+			std::unordered_map<std::string, GLuint> blocks;
+			std::vector<uniform_value> values; // by location
+		};
+
+		GLuint m_program = 0;
+		std::shared_ptr<reflection> m_reflection;
+
+		// Records value as the uniform's current one, false if it already was
+		bool changed(GLint location, const void *value, GLsizei size) const;
+		void forget(GLint location, GLsizei count) const;
+
+	public:
+		shader_program() { }
+		explicit shader_program(GLuint program);
+
+		// implicit GLuint converter
+		operator GLuint() const noexcept { return m_program; }
+
+		// Location of an active uniform, -1 if the program has no such uniform. Array
+		// elements are found as "name[i]", and "name" is the first element.
+		GLint uniform(const std::string &name) const;
+
+		// Index of an active uniform block, GL_INVALID_INDEX if there is none
+		GLuint uniform_block(const std::string &name) const;
+
+		// Sources the named uniform block from a buffer binding point, does nothing if
+		// the program has no such block
+		void bind_uniform_block(const std::string &name, GLuint binding) const;
+
+		void set_uniform(GLint location, int value) const;
+		void set_uniform(GLint location, GLuint value) const;
+		void set_uniform(GLint location, float value) const;
+		void set_uniform(GLint location, const glm::ivec2 &value) const;
+		void set_uniform(GLint location, const glm::vec2 &value) const;
+		void set_uniform(GLint location, const glm::vec3 &value) const;
+		void set_uniform(GLint location, const glm::vec4 &value) const;
+		void set_uniform(GLint location, const glm::mat3 &value) const;
+		void set_uniform(GLint location, const glm::mat4 &value) const;
+
+		// Arrays, always written
+		void set_uniform(GLint location, const float *values, GLsizei count) const;
+		void set_uniform(GLint location, const glm::vec4 *values, GLsizei count) const;
+		void set_uniform(GLint location, const glm::mat4 *values, GLsizei count) const;
+
+		// Looks the uniform up by name first, for uniforms set once per draw
+		template <typename T>
+		void set_uniform(const std::string &name, const T &value) const {
+			set_uniform(uniform(name), value);
+		}
+	};
+
+
+	// Shader files may pull in other files with #include "file", resolved relative to
+	// the including file, for declarations shared between shaders
 	class shader_builder {
 	private:
 		std::map<GLenum, std::shared_ptr<gl_object>> m_shaders;
@@ -21,7 +98,8 @@ namespace cgra {
 		void set_shader(GLenum type, const std::string &filename);
 		void set_shader_source(GLenum type, const std::string &shadersource);
 
-		GLuint build(GLuint program = 0);
+		// Links the shaders into program, or a new program if it is 0
+		shader_program build(GLuint program = 0);
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,266 @@
+
+// std
+#include <cstring>
+
+// project
+#include "cgra_state.hpp"
+
+
+namespace cgra {
+	namespace gl_state {
+
+		namespace {
+			const int max_units = 32;
+			const GLenum targets[] = {
+				GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER
+			};
+			const int target_count = sizeof(targets) / sizeof(targets[0]);
+
+			// -1 where the state is unknown
+			struct shadow {
+				GLint program = -1;
+				GLint vertex_array = -1;
+				GLint active_unit = -1;
+				GLint textures[max_units][target_count];
+				int blend = -1, depth_test = -1, cull_face = -1, scissor_test = -1;
+				int color_mask = -1, depth_mask = -1;
+				GLint depth_func = -1;
+				GLint blend_src = -1, blend_dst = -1;
+				GLint cull_mode = -1;
+				GLint draw_framebuffer = -1, read_framebuffer = -1;
+
+				shadow() { std::memset(textures, -1, sizeof(textures)); }
+			};
+
+			shadow g_state;
+			counters g_frame, g_last_frame;
+
+			// Counts a call and returns true if it changes the shadowed value
+			template <typename T>
+			bool update(category c, T &shadowed, T value) {
+				g_frame.calls[c]++;
+				if (shadowed == value) {
+					g_frame.filtered[c]++;
+					return false;
+				}
+				shadowed = value;
+				return true;
+			}
+
+			int target_index(GLenum target) {
+				for (int i = 0; i < target_count; i++) {
+					if (targets[i] == target) return i;
+				}
+				return -1;
+			}
+
+			int *capability(GLenum cap) {
+				switch (cap) {
+				case GL_BLEND: return &g_state.blend;
+				case GL_DEPTH_TEST: return &g_state.depth_test;
+				case GL_CULL_FACE: return &g_state.cull_face;
+				case GL_SCISSOR_TEST: return &g_state.scissor_test;
+				default: return nullptr;
+				}
+			}
+		}
+
+
+		long long counters::total_calls() const {
+			long long total = 0;
+			for (long long c : calls) total += c;
+			return total;
+		}
+
+
+		long long counters::total_filtered() const {
+			long long total = 0;
+			for (long long f : filtered) total += f;
+			return total;
+		}
+
+
+		void use_program(GLuint program) {
+			if (update(program_calls, g_state.program, GLint(program))) glUseProgram(program);
+		}
+
+
+		void bind_vertex_array(GLuint vao) {
+			if (update(vertex_array_calls, g_state.vertex_array, GLint(vao))) glBindVertexArray(vao);
+		}
+
+
+		void active_texture(GLenum unit) {
+			if (update(texture_calls, g_state.active_unit, GLint(unit - GL_TEXTURE0))) glActiveTexture(unit);
+		}
+
+
+		void bind_texture(GLenum target, GLuint texture) {
+			int unit = g_state.active_unit;
+			int t = target_index(target);
+			if (unit < 0 || unit >= max_units || t < 0) {
+				g_frame.calls[texture_calls]++;
+				glBindTexture(target, texture);
+				return;
+			}
+			if (update(texture_calls, g_state.textures[unit][t], GLint(texture))) glBindTexture(target, texture);
+		}
+
+
+		void enable(GLenum cap) {
+			int *shadowed = capability(cap);
+			if (!shadowed) {
+				glEnable(cap);
+			} else if (update(capability_calls, *shadowed, 1)) {
+				glEnable(cap);
+			}
+		}
+
+
+		void disable(GLenum cap) {
+			int *shadowed = capability(cap);
+			if (!shadowed) {
+				glDisable(cap);
+			} else if (update(capability_calls, *shadowed, 0)) {
+				glDisable(cap);
+			}
+		}
+
+
+		bool is_enabled(GLenum cap) {
+			int *shadowed = capability(cap);
+			if (shadowed && *shadowed >= 0) return *shadowed != 0;
+			bool enabled = glIsEnabled(cap) != GL_FALSE;
+			if (shadowed) *shadowed = enabled ? 1 : 0;
+			return enabled;
+		}
+
+
+		void color_mask(GLboolean flag) {
+			if (update(depth_calls, g_state.color_mask, flag ? 1 : 0)) glColorMask(flag, flag, flag, flag);
+		}
+
+
+		void depth_mask(GLboolean flag) {
+			if (update(depth_calls, g_state.depth_mask, flag ? 1 : 0)) glDepthMask(flag);
+		}
+
+
+		void depth_func(GLenum func) {
+			if (update(depth_calls, g_state.depth_func, GLint(func))) glDepthFunc(func);
+		}
+
+
+		GLboolean current_color_mask() {
+			if (g_state.color_mask < 0) {
+				GLboolean mask[4];
+				glGetBooleanv(GL_COLOR_WRITEMASK, mask);
+				g_state.color_mask = mask[0] ? 1 : 0;
+			}
+			return g_state.color_mask ? GL_TRUE : GL_FALSE;
+		}
+
+
+		GLboolean current_depth_mask() {
+			if (g_state.depth_mask < 0) {
+				GLboolean mask;
+				glGetBooleanv(GL_DEPTH_WRITEMASK, &mask);
+				g_state.depth_mask = mask ? 1 : 0;
+			}
+			return g_state.depth_mask ? GL_TRUE : GL_FALSE;
+		}
+
+
+		GLenum current_depth_func() {
+			if (g_state.depth_func < 0) glGetIntegerv(GL_DEPTH_FUNC, &g_state.depth_func);
+			return GLenum(g_state.depth_func);
+		}
+
+
+		void blend_func(GLenum sfactor, GLenum dfactor) {
+			g_frame.calls[blend_calls]++;
+			if (g_state.blend_src == GLint(sfactor) && g_state.blend_dst == GLint(dfactor)) {
+				g_frame.filtered[blend_calls]++;
+				return;
+			}
+			g_state.blend_src = GLint(sfactor);
+			g_state.blend_dst = GLint(dfactor);
+			glBlendFunc(sfactor, dfactor);
+		}
+
+
+		void cull_face(GLenum mode) {
+			if (update(cull_calls, g_state.cull_mode, GLint(mode))) glCullFace(mode);
+		}
+
+
+		void bind_framebuffer(GLenum target, GLuint framebuffer) {
+			GLint fbo = GLint(framebuffer);
+			g_frame.calls[framebuffer_calls]++;
+			bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+			bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+			if ((!draw || g_state.draw_framebuffer == fbo) && (!read || g_state.read_framebuffer == fbo)) {
+				g_frame.filtered[framebuffer_calls]++;
+				return;
+			}
+			if (draw) g_state.draw_framebuffer = fbo;
+			if (read) g_state.read_framebuffer = fbo;
+			glBindFramebuffer(target, framebuffer);
+		}
+
+
+		GLuint bound_framebuffer(GLenum target) {
+			bool read = target == GL_READ_FRAMEBUFFER;
+			GLint &shadowed = read ? g_state.read_framebuffer : g_state.draw_framebuffer;
+			if (shadowed < 0) glGetIntegerv(read ? GL_READ_FRAMEBUFFER_BINDING : GL_DRAW_FRAMEBUFFER_BINDING, &shadowed);
+			return GLuint(shadowed);
+		}
+
+
+		void GLAPIENTRY delete_textures(GLsizei n, const GLuint *textures) {
+			for (GLsizei i = 0; i < n; i++) {
+				if (textures[i] == 0) continue;
+				for (auto &unit : g_state.textures) {
+					for (GLint &bound : unit) {
+						if (bound == GLint(textures[i])) bound = 0;
+					}
+				}
+			}
+			glDeleteTextures(n, textures);
+		}
+
+
+		void GLAPIENTRY delete_vertex_arrays(GLsizei n, const GLuint *arrays) {
+			for (GLsizei i = 0; i < n; i++) {
+				if (arrays[i] != 0 && g_state.vertex_array == GLint(arrays[i])) g_state.vertex_array = 0;
+			}
+			glDeleteVertexArrays(n, arrays);
+		}
+
+
+		void GLAPIENTRY delete_framebuffers(GLsizei n, const GLuint *framebuffers) {
+			for (GLsizei i = 0; i < n; i++) {
+				if (framebuffers[i] == 0) continue;
+				if (g_state.draw_framebuffer == GLint(framebuffers[i])) g_state.draw_framebuffer = 0;
+				if (g_state.read_framebuffer == GLint(framebuffers[i])) g_state.read_framebuffer = 0;
+			}
+			glDeleteFramebuffers(n, framebuffers);
+		}
+
+
+		void invalidate() {
+			g_state = shadow();
+		}
+
+
+		void end_frame() {
+			g_last_frame = g_frame;
+			g_frame = counters();
+		}
+
+
+		const counters & frame_counters() {
+			return g_last_frame;
+		}
+	}
+}
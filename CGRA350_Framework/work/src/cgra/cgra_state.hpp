@@ -0,0 +1,83 @@
+
+#pragma once
+
+// include glew.h before (instead of) gl.h
+#include <GL/glew.h>
+
+
+namespace cgra {
+
+	// Shadow copy of the GL state the renderer changes most often: the program, the vertex
+	// array, the texture bound to each unit, blend, depth, colour mask and cull state and the
+	// framebuffer. Each function here behaves like the GL call it is named after, but is
+	// dropped when it would not change anything.
+	//
+	// The shadow is only right while every change to this state goes through these
+	// functions, including deleting bound objects (see delete_textures etc.) since GL then
+	// falls back to 0 and reuses the name. Code that changes the state directly must
+	// restore it, as the ImGui renderer does, or call invalidate() afterwards.
+	namespace gl_state {
+
+		enum category {
+			program_calls,
+			vertex_array_calls,
+			texture_calls,     // active unit and bindings
+			capability_calls,  // enable and disable
+			depth_calls,       // depth and colour masks, depth function
+			blend_calls,
+			cull_calls,
+			framebuffer_calls,
+			category_count
+		};
+
+		// Calls made through the cache and how many of them were dropped
+		struct counters {
+			long long calls[category_count] = {};
+			long long filtered[category_count] = {};
+
+			long long total_calls() const;
+			long long total_filtered() const;
+		};
+
+		void use_program(GLuint program);
+		void bind_vertex_array(GLuint vao);
+
+		void active_texture(GLenum unit);
+		void bind_texture(GLenum target, GLuint texture);
+
+		// Blend, depth test, cull face and scissor test are shadowed, other capabilities are
+		// passed through
+		void enable(GLenum cap);
+		void disable(GLenum cap);
+		bool is_enabled(GLenum cap);
+
+		// Colour writes are switched for all channels together
+		void color_mask(GLboolean flag);
+		void depth_mask(GLboolean flag);
+		void depth_func(GLenum func);
+
+		// The current masks and depth function, read back from GL when the shadow does not
+		// know them, for passes that must leave them as they found them
+		GLboolean current_color_mask();
+		GLboolean current_depth_mask();
+		GLenum current_depth_func();
+
+		void blend_func(GLenum sfactor, GLenum dfactor);
+		void cull_face(GLenum mode);
+
+		void bind_framebuffer(GLenum target, GLuint framebuffer);
+		GLuint bound_framebuffer(GLenum target);
+
+		// Delete the objects and drop them from the shadow, same signatures as glDelete*
+		void GLAPIENTRY delete_textures(GLsizei n, const GLuint *textures);
+		void GLAPIENTRY delete_vertex_arrays(GLsizei n, const GLuint *arrays);
+		void GLAPIENTRY delete_framebuffers(GLsizei n, const GLuint *framebuffers);
+
+		// Forgets the shadowed state, the next call of each kind goes through
+		void invalidate();
+
+		// Finishes the frame's counters, which frame_counters then returns
+		void end_frame();
+		const counters & frame_counters();
+	}
+}
@@ -0,0 +1,215 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cloud_noise.hpp"
+#include "cgra/cgra_state.hpp"
+
+namespace {
+    const uint32_t cacheMagic = 0x564E4743; // "CGNV"
+    const uint32_t cacheVersion = 1;
+
+    // Integer hash of a lattice point, stable across platforms so the cache is portable
+    uint32_t hashCell(int x, int y, int z, uint32_t seed) {
+        uint32_t h = seed;
+        h ^= uint32_t(x) * 0x8da6b343u;
+        h ^= uint32_t(y) * 0xd8163841u;
+        h ^= uint32_t(z) * 0xcb1ab31fu;
+        h ^= h >> 16; h *= 0x7feb352du;
+        h ^= h >> 15; h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+
+    float hashToUnit(uint32_t h) {
+        return float(h & 0x00ffffffu) / float(0x01000000);
+    }
+
+    int wrap(int i, int period) {
+        int r = i % period;
+        return r < 0 ? r + period : r;
+    }
+
+    glm::vec3 gradient(int x, int y, int z, uint32_t seed) {
+        uint32_t h = hashCell(x, y, z, seed);
+        glm::vec3 g(hashToUnit(h), hashToUnit(h * 0x9e3779b9u), hashToUnit(h * 0x85ebca6bu));
+        return glm::normalize(g * 2.0f - 1.0f + glm::vec3(1e-6f));
+    }
+
+    // Gradient noise on a lattice that repeats every `period` cells, roughly in [-1, 1]
+    float perlin(glm::vec3 p, int period, uint32_t seed) {
+        glm::vec3 i = glm::floor(p);
+        glm::vec3 f = p - i;
+        glm::vec3 u = f * f * f * (f * (f * 6.0f - 15.0f) + 10.0f);
+
+        int x0 = int(i.x), y0 = int(i.y), z0 = int(i.z);
+        float corners[8];
+        for (int c = 0; c < 8; c++) {
+            int dx = c & 1, dy = (c >> 1) & 1, dz = (c >> 2) & 1;
+            glm::vec3 g = gradient(wrap(x0 + dx, period), wrap(y0 + dy, period), wrap(z0 + dz, period), seed);
+            corners[c] = glm::dot(g, f - glm::vec3(dx, dy, dz));
+        }
+
+        float x00 = glm::mix(corners[0], corners[1], u.x);
+        float x10 = glm::mix(corners[2], corners[3], u.x);
+        float x01 = glm::mix(corners[4], corners[5], u.x);
+        float x11 = glm::mix(corners[6], corners[7], u.x);
+        return glm::mix(glm::mix(x00, x10, u.y), glm::mix(x01, x11, u.y), u.z);
+    }
+
+    // Tileable FBM, the period doubles with the frequency so every octave still tiles
+    float perlinFbm(glm::vec3 uvw, int period, int octaves, uint32_t seed) {
+        float value = 0.0f, amplitude = 0.5f, total = 0.0f;
+        for (int o = 0; o < octaves; o++) {
+            value += amplitude * perlin(uvw * float(period), period, seed + o);
+            total += amplitude;
+            period *= 2;
+            amplitude *= 0.5f;
+        }
+        return value / total;
+    }
+
+    // F1 cellular distance with `cells` feature points per axis, wrapping at the tile edge
+    float worley(glm::vec3 uvw, int cells, uint32_t seed) {
+        glm::vec3 p = uvw * float(cells);
+        glm::vec3 id = glm::floor(p);
+        glm::vec3 f = p - id;
+
+        float minDist = 1.0f;
+        for (int k = -1; k <= 1; k++) {
+            for (int j = -1; j <= 1; j++) {
+                for (int i = -1; i <= 1; i++) {
+                    uint32_t h = hashCell(wrap(int(id.x) + i, cells), wrap(int(id.y) + j, cells),
+                                          wrap(int(id.z) + k, cells), seed);
+                    glm::vec3 point(hashToUnit(h), hashToUnit(h * 0x9e3779b9u), hashToUnit(h * 0x85ebca6bu));
+                    glm::vec3 diff = glm::vec3(i, j, k) + point - f;
+                    minDist = std::min(minDist, glm::dot(diff, diff));
+                }
+            }
+        }
+        return std::sqrt(minDist);
+    }
+
+    unsigned char toByte(float v) {
+        return (unsigned char)(glm::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+
+    // Fills every texel of a size^3 volume, one z-slice per task
+    template <typename Fn>
+    NoiseVolume bakeVolume(int size, Fn texel) {
+        NoiseVolume volume;
+        volume.size = size;
+        volume.data.resize(size_t(size) * size * size * 4);
+
+#ifdef CGRA_HAVE_OPENMP
+        #pragma omp parallel for schedule(dynamic)
+#endif
+        for (int z = 0; z < size; z++) {
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    glm::vec3 uvw = (glm::vec3(x, y, z) + 0.5f) / float(size);
+                    glm::vec4 v = texel(uvw);
+                    size_t idx = ((size_t(z) * size + y) * size + x) * 4;
+                    volume.data[idx + 0] = toByte(v.r);
+                    volume.data[idx + 1] = toByte(v.g);
+                    volume.data[idx + 2] = toByte(v.b);
+                    volume.data[idx + 3] = toByte(v.a);
+                }
+            }
+        }
+        return volume;
+    }
+}
+
+NoiseVolume cloud_noise::bakeShape(int size) {
+    return bakeVolume(size, [](glm::vec3 uvw) {
+        float w8 = worley(uvw, 8, 11);
+        float w16 = worley(uvw, 16, 12);
+        float w32 = worley(uvw, 32, 13);
+
+        // Perlin-Worley: billowy Perlin FBM remapped by inverted Worley FBM
+        float pf = perlinFbm(uvw, 4, 3, 1) * 0.5f + 0.5f;
+        float wf = (1.0f - w8) * 0.625f + (1.0f - w16) * 0.25f + (1.0f - w32) * 0.125f;
+        float perlinWorley = (pf - (wf - 1.0f)) / (2.0f - wf);
+
+        float coverage = perlin(uvw * 4.0f, 4, 7) * 0.5f + 0.5f;
+        return glm::vec4(perlinWorley, w8, w16, coverage);
+    });
+}
+
+NoiseVolume cloud_noise::bakeDetail(int size) {
+    return bakeVolume(size, [](glm::vec3 uvw) {
+        return glm::vec4(1.0f - worley(uvw, 2, 21),
+                         1.0f - worley(uvw, 4, 22),
+                         1.0f - worley(uvw, 8, 23),
+                         perlin(uvw * 4.0f, 4, 24) * 0.5f + 0.5f);
+    });
+}
+
+NoiseVolume cloud_noise::loadOrBake(const std::string& path, int size, NoiseVolume (*bake)(int)) {
+    std::ifstream in(path, std::ios::binary);
+    if (in) {
+        uint32_t magic = 0, version = 0;
+        int32_t cachedSize = 0;
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&cachedSize), sizeof(cachedSize));
+
+        if (in && magic == cacheMagic && version == cacheVersion && cachedSize == size) {
+            NoiseVolume volume;
+            volume.size = size;
+            volume.data.resize(size_t(size) * size * size * 4);
+            in.read(reinterpret_cast<char*>(volume.data.data()), volume.data.size());
+            if (in) return volume;
+        }
+        std::cerr << "Noise cache " << path << " is stale or corrupt, rebaking" << std::endl;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    NoiseVolume volume = bake(size);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Baked " << size << "^3 cloud noise in "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    std::ofstream out(path, std::ios::binary);
+    if (out) {
+        int32_t size32 = size;
+        out.write(reinterpret_cast<const char*>(&cacheMagic), sizeof(cacheMagic));
+        out.write(reinterpret_cast<const char*>(&cacheVersion), sizeof(cacheVersion));
+        out.write(reinterpret_cast<const char*>(&size32), sizeof(size32));
+        out.write(reinterpret_cast<const char*>(volume.data.data()), volume.data.size());
+    }
+    if (!out) {
+        std::cerr << "Warning: could not write noise cache " << path << std::endl;
+    }
+    return volume;
+}
+
+GLuint cloud_noise::upload(const NoiseVolume& volume) {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, volume.size, volume.size, volume.size, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, volume.data.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_3D);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, 0);
+    return tex;
+}
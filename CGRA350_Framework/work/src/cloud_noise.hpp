@@ -0,0 +1,36 @@
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+// OpenGL
+#include <GL/glew.h>
+
+// Tileable 3D noise volumes used by the cloud raymarcher, baked on the CPU
+// once and cached on disk so startup after the first run is just a file read.
+//
+// Shape  (RGBA8, 128^3): R = Perlin-Worley (4 cells), G = Worley (8 cells),
+//                        B = Worley (16 cells),     A = Perlin (4 cells)
+// Detail (RGBA8,  32^3): R/G/B = inverted Worley (2/4/8 cells), A = Perlin (4 cells)
+//
+// Worley channels in the shape volume store the raw F1 distance (0 at a feature
+// point) to match the procedural worleyNoise the shader used previously.
+struct NoiseVolume {
+    int size = 0;
+    std::vector<unsigned char> data; // size^3 RGBA texels, x fastest
+
+    bool empty() const { return data.empty(); }
+};
+
+namespace cloud_noise {
+    NoiseVolume bakeShape(int size);
+    NoiseVolume bakeDetail(int size);
+
+    // Returns the cached volume at path if it matches the expected size, otherwise bakes
+    // it with the given function and writes the cache back
+    NoiseVolume loadOrBake(const std::string& path, int size, NoiseVolume (*bake)(int));
+
+    // Uploads as a mipmapped, repeating GL_TEXTURE_3D
+    GLuint upload(const NoiseVolume& volume);
+}
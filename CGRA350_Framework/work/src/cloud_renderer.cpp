@@ -1,76 +1,402 @@
 #include "cloud_renderer.hpp"
+#include "cloud_noise.hpp"
+#include "cgra/cgra_state.hpp"
+#include <algorithm>
+#include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-CloudRenderer::CloudRenderer() : m_cloudShader(0), m_quadVAO(0), m_quadVBO(0) {}
+namespace {
+    // Radical inverse in the given base, used for a Halton(2,3) jitter sequence
+    float halton(unsigned int index, unsigned int base) {
+        float f = 1.0f, result = 0.0f;
+        while (index > 0) {
+            f /= float(base);
+            result += f * float(index % base);
+            index /= base;
+        }
+        return result;
+    }
+}
+
+CloudRenderer::CloudRenderer()
+    : m_cloudShader(0), m_temporalShader(0), m_compositeShader(0), m_weatherShader(0), m_shadowShader(0) {}
 
 CloudRenderer::~CloudRenderer() {
-    if (m_quadVAO) glDeleteVertexArrays(1, &m_quadVAO);
-    if (m_quadVBO) glDeleteBuffers(1, &m_quadVBO);
+    m_quad.destroy();
+    if (m_shapeNoise) cgra::gl_state::delete_textures(1, &m_shapeNoise);
+    if (m_detailNoise) cgra::gl_state::delete_textures(1, &m_detailNoise);
+    if (m_weatherFBO) cgra::gl_state::delete_framebuffers(1, &m_weatherFBO);
+    if (m_weatherMap) cgra::gl_state::delete_textures(1, &m_weatherMap);
+    if (m_shadowFBO) cgra::gl_state::delete_framebuffers(1, &m_shadowFBO);
+    if (m_shadowMap) cgra::gl_state::delete_textures(1, &m_shadowMap);
+    destroyTargets();
 }
 
-void CloudRenderer::init(GLuint shader) {
+void CloudRenderer::init(GLuint shader, GLuint temporalShader, GLuint compositeShader, GLuint weatherShader,
+                         GLuint shadowShader, const std::string& cacheDir) {
     m_cloudShader = shader;
-    setupQuad();
+    m_temporalShader = temporalShader;
+    m_compositeShader = compositeShader;
+    m_weatherShader = weatherShader;
+    m_shadowShader = shadowShader;
+    m_quad.create();
+    setupWeatherMap();
+    setupShadowMap();
+
+    NoiseVolume shape = cloud_noise::loadOrBake(cacheDir + "/cloud_shape_128.bin", 128, cloud_noise::bakeShape);
+    NoiseVolume detail = cloud_noise::loadOrBake(cacheDir + "/cloud_detail_32.bin", 32, cloud_noise::bakeDetail);
+    m_shapeNoise = cloud_noise::upload(shape);
+    m_detailNoise = cloud_noise::upload(detail);
+}
+
+void CloudRenderer::setupWeatherMap() {
+    // Sampled with nearest filtering so the conservative per-texel bound is never blurred down
+    m_weatherMap = cgra::create_target(GL_R16F, GL_RED, m_weatherResolution, m_weatherResolution, GL_NEAREST);
+    m_weatherFBO = cgra::create_framebuffer(m_weatherMap);
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+}
+
+void CloudRenderer::updateWeatherMap(const glm::vec3& cameraPos, float time, float coverage, float scale,
+                                     float evolutionSpeed, float cloudHeight, float cloudThickness) {
+    // Snap the window to whole texels so a moving camera doesn't shimmer the bound
+    float texelSize = m_weatherExtent / float(m_weatherResolution);
+    glm::vec2 origin = glm::floor((glm::vec2(cameraPos.x, cameraPos.z) - 0.5f * m_weatherExtent) / texelSize) * texelSize;
+
+    // The field drifts very slowly (wind is 0.01 units per time unit), the one-texel
+    // dilation in the map absorbs the drift between rebuilds
+    const float maxTimeDrift = 1.0f;
+    bool stale = !m_weatherValid
+        || origin != m_weatherOrigin
+        || coverage != m_weatherParams.x || scale != m_weatherParams.y || evolutionSpeed != m_weatherParams.z
+        || std::abs(time - m_weatherParams.w) > maxTimeDrift
+        || cloudHeight != m_weatherLayer.x || cloudThickness != m_weatherLayer.y;
+    if (!stale) return;
+
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_weatherFBO);
+    glViewport(0, 0, m_weatherResolution, m_weatherResolution);
+    cgra::gl_state::use_program(m_weatherShader);
+
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, m_shapeNoise);
+    glUniform1i(glGetUniformLocation(m_weatherShader, "uShapeNoise"), 0);
+
+    glUniform1f(glGetUniformLocation(m_weatherShader, "uTime"), time);
+    glUniform1f(glGetUniformLocation(m_weatherShader, "uCloudCoverage"), coverage);
+    glUniform1f(glGetUniformLocation(m_weatherShader, "uCloudScale"), scale);
+    glUniform1f(glGetUniformLocation(m_weatherShader, "uEvolutionSpeed"), evolutionSpeed);
+    glUniform1f(glGetUniformLocation(m_weatherShader, "uCloudHeight"), cloudHeight);
+    glUniform1f(glGetUniformLocation(m_weatherShader, "uCloudThickness"), cloudThickness);
+    glUniform2fv(glGetUniformLocation(m_weatherShader, "uWeatherOrigin"), 1, glm::value_ptr(origin));
+    glUniform1f(glGetUniformLocation(m_weatherShader, "uWeatherExtent"), m_weatherExtent);
+    glUniform1f(glGetUniformLocation(m_weatherShader, "uWeatherResolution"), float(m_weatherResolution));
+
+    m_quad.draw();
+
+    m_weatherOrigin = origin;
+    m_weatherParams = glm::vec4(coverage, scale, evolutionSpeed, time);
+    m_weatherLayer = glm::vec2(cloudHeight, cloudThickness);
+    m_weatherValid = true;
 }
 
-void CloudRenderer::setupQuad() {
-    // Fullscreen quad in NDC
-    float quadVertices[] = {
-        // positions
-        -1.0f,  1.0f,
-        -1.0f, -1.0f,
-         1.0f, -1.0f,
-         
-        -1.0f,  1.0f,
-         1.0f, -1.0f,
-         1.0f,  1.0f
-    };
-    
-    glGenVertexArrays(1, &m_quadVAO);
-    glGenBuffers(1, &m_quadVBO);
-    
-    glBindVertexArray(m_quadVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
-    
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-    
-    glBindVertexArray(0);
+void CloudRenderer::setupShadowMap() {
+    // Fully lit until the first update
+    m_shadowMap = cgra::create_target(GL_R16F, GL_RED, m_shadowResolution, m_shadowResolution, GL_LINEAR);
+    m_shadowFBO = cgra::create_framebuffer(m_shadowMap);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+}
+
+void CloudRenderer::updateShadowMap(const glm::vec3& sunPos, float time,
+                                    float coverage, float density, float speed,
+                                    float scale, float evolutionSpeed,
+                                    float cloudHeight, float cloudThickness, float fuzziness) {
+    // Parameter edits invalidate the whole map, otherwise refresh one band of rows per frame
+    glm::vec4 params(coverage, density, scale, fuzziness);
+    glm::vec2 layer(cloudHeight, cloudThickness);
+    if (params != m_shadowParams || layer != m_shadowLayer) m_shadowValid = false;
+
+    cgra::offscreen_state saved = cgra::begin_offscreen();
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_shadowFBO);
+    glViewport(0, 0, m_shadowResolution, m_shadowResolution);
+    if (m_shadowValid) {
+        int rows = (m_shadowResolution + m_shadowSlices - 1) / m_shadowSlices;
+        cgra::gl_state::enable(GL_SCISSOR_TEST);
+        glScissor(0, m_shadowSlice * rows, m_shadowResolution, rows);
+        m_shadowSlice = (m_shadowSlice + 1) % m_shadowSlices;
+    }
+
+    m_shadowSunDir = glm::normalize(sunPos);
+    m_shadowPlane = cloudHeight - cloudThickness * 0.5f - 3.0f;
+
+    cgra::gl_state::use_program(m_shadowShader);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, m_shapeNoise);
+    glUniform1i(glGetUniformLocation(m_shadowShader, "uShapeNoise"), 0);
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, m_detailNoise);
+    glUniform1i(glGetUniformLocation(m_shadowShader, "uDetailNoise"), 1);
+
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uTime"), time * speed);
+    glUniform3fv(glGetUniformLocation(m_shadowShader, "uSunDir"), 1, glm::value_ptr(m_shadowSunDir));
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uCloudCoverage"), coverage);
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uCloudDensity"), density);
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uCloudScale"), scale);
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uEvolutionSpeed"), evolutionSpeed);
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uCloudHeight"), cloudHeight);
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uCloudThickness"), cloudThickness);
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uCloudFuzziness"), fuzziness);
+    glUniform2fv(glGetUniformLocation(m_shadowShader, "uShadowOrigin"), 1, glm::value_ptr(m_shadowOrigin));
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uShadowExtent"), m_shadowExtent);
+    glUniform1f(glGetUniformLocation(m_shadowShader, "uShadowPlaneHeight"), m_shadowPlane);
+
+    m_quad.bind();
+    m_quad.draw();
+
+    // Restore state
+    cgra::gl_state::disable(GL_SCISSOR_TEST);
+    cgra::end_offscreen(saved);
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, 0);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, 0);
+
+    m_shadowParams = params;
+    m_shadowLayer = layer;
+    m_shadowValid = true;
+}
+
+void CloudRenderer::bindShadowMap(GLuint program, float strength) const {
+    cgra::gl_state::use_program(program);
+    cgra::gl_state::active_texture(GL_TEXTURE7);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_shadowMap);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+
+    glUniform1i(glGetUniformLocation(program, "uCloudShadowMap"), 7);
+    glUniform4f(glGetUniformLocation(program, "uCloudShadowRegion"),
+                m_shadowOrigin.x, m_shadowOrigin.y, 1.0f / m_shadowExtent, m_shadowValid ? strength : 0.0f);
+    glUniform3fv(glGetUniformLocation(program, "uCloudShadowSunDir"), 1, glm::value_ptr(m_shadowSunDir));
+    glUniform1f(glGetUniformLocation(program, "uCloudShadowPlane"), m_shadowPlane);
+}
+
+void CloudRenderer::setResolutionDivisor(int divisor) {
+    divisor = glm::clamp(divisor, 1, 4);
+    if (divisor == m_resolutionDivisor) return;
+    m_resolutionDivisor = divisor;
+    // Force the targets to be rebuilt at the new size
+    if (m_width > 0 && m_height > 0) createTargets();
+}
+
+void CloudRenderer::setTemporalReprojection(bool enabled) {
+    if (enabled != m_temporal) m_historyValid = false;
+    m_temporal = enabled;
+}
+
+void CloudRenderer::resize(int width, int height) {
+    if (width == m_width && height == m_height) return;
+    m_width = width;
+    m_height = height;
+    if (m_width > 0 && m_height > 0) createTargets();
+}
+
+void CloudRenderer::createTargets() {
+    destroyTargets();
+
+    m_lowWidth = std::max(1, (m_width + m_resolutionDivisor - 1) / m_resolutionDivisor);
+    m_lowHeight = std::max(1, (m_height + m_resolutionDivisor - 1) / m_resolutionDivisor);
+
+    // Raymarch output, read back with texelFetch so no filtering needed
+    m_marchColour = cgra::create_target(GL_RGBA16F, GL_RGBA, m_lowWidth, m_lowHeight, GL_NEAREST);
+    m_marchDepth = cgra::create_target(GL_R32F, GL_RED, m_lowWidth, m_lowHeight, GL_NEAREST);
+
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+
+    glGenFramebuffers(1, &m_marchFBO);
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_marchFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_marchColour, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_marchDepth, 0);
+    glDrawBuffers(2, drawBuffers);
+
+    // History is sampled at reprojected (non texel-aligned) positions, so filter it
+    for (int i = 0; i < 2; i++) {
+        m_historyColour[i] = cgra::create_target(GL_RGBA16F, GL_RGBA, m_lowWidth, m_lowHeight, GL_LINEAR);
+        m_historyDepth[i] = cgra::create_target(GL_R32F, GL_RED, m_lowWidth, m_lowHeight, GL_NEAREST);
+
+        glGenFramebuffers(1, &m_historyFBO[i]);
+        cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_historyFBO[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_historyColour[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_historyDepth[i], 0);
+        glDrawBuffers(2, drawBuffers);
+    }
+
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+    m_historyValid = false;
+}
+
+void CloudRenderer::destroyTargets() {
+    if (m_marchFBO) cgra::gl_state::delete_framebuffers(1, &m_marchFBO);
+    if (m_marchColour) cgra::gl_state::delete_textures(1, &m_marchColour);
+    if (m_marchDepth) cgra::gl_state::delete_textures(1, &m_marchDepth);
+    m_marchFBO = m_marchColour = m_marchDepth = 0;
+
+    for (int i = 0; i < 2; i++) {
+        if (m_historyFBO[i]) cgra::gl_state::delete_framebuffers(1, &m_historyFBO[i]);
+        if (m_historyColour[i]) cgra::gl_state::delete_textures(1, &m_historyColour[i]);
+        if (m_historyDepth[i]) cgra::gl_state::delete_textures(1, &m_historyDepth[i]);
+        m_historyFBO[i] = m_historyColour[i] = m_historyDepth[i] = 0;
+    }
 }
 
 void CloudRenderer::render(const glm::mat4& view, const glm::mat4& proj,
                           const glm::vec3& cameraPos, float time,
-                          const glm::vec3& sunPos, const glm::vec3& sunColor) {
-    glUseProgram(m_cloudShader);
-    
-    // Calculate inverse view-projection
+                          const glm::vec3& sunPos, const glm::vec3& sunColour,
+                          float coverage, float density, float speed,
+                          float scale, float evolutionSpeed,
+                          float cloudHeight, float cloudThickness, float fuzziness,
+                          GLuint sceneDepth) {
+    if (m_marchFBO == 0) return;
+
     glm::mat4 viewProj = proj * view;
     glm::mat4 invViewProj = glm::inverse(viewProj);
-    
-    // Set uniforms
+
+    // Sub-texel jitter (in NDC) so the history accumulates samples across the low-res footprint
+    unsigned int jitterIndex = (m_frameIndex % 8) + 1;
+    glm::vec2 jitter(0.0f);
+    if (m_temporal) {
+        jitter = glm::vec2(halton(jitterIndex, 2) - 0.5f, halton(jitterIndex, 3) - 0.5f);
+        jitter *= glm::vec2(2.0f / m_lowWidth, 2.0f / m_lowHeight);
+    }
+
+    cgra::offscreen_state saved = cgra::begin_offscreen();
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    m_quad.bind();
+
+    // 0. Refresh the empty-space map if the cloud field has changed
+    updateWeatherMap(cameraPos, time * speed, coverage, scale, evolutionSpeed, cloudHeight, cloudThickness);
+
+    glViewport(0, 0, m_lowWidth, m_lowHeight);
+
+    // 1. Raymarch into the reduced-resolution target
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_marchFBO);
+    cgra::gl_state::use_program(m_cloudShader);
+
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, m_shapeNoise);
+    glUniform1i(glGetUniformLocation(m_cloudShader, "uShapeNoise"), 0);
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, m_detailNoise);
+    glUniform1i(glGetUniformLocation(m_cloudShader, "uDetailNoise"), 1);
+    cgra::gl_state::active_texture(GL_TEXTURE2);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_weatherMap);
+    glUniform1i(glGetUniformLocation(m_cloudShader, "uWeatherMap"), 2);
+    glUniform2fv(glGetUniformLocation(m_cloudShader, "uWeatherOrigin"), 1, glm::value_ptr(m_weatherOrigin));
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uWeatherExtent"), m_weatherExtent);
+    cgra::gl_state::active_texture(GL_TEXTURE3);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, sceneDepth);
+    glUniform1i(glGetUniformLocation(m_cloudShader, "uSceneDepth"), 3);
+    glUniform1i(glGetUniformLocation(m_cloudShader, "uResolutionDivisor"), m_resolutionDivisor);
+
     glUniformMatrix4fv(glGetUniformLocation(m_cloudShader, "uInvViewProj"),
                        1, GL_FALSE, glm::value_ptr(invViewProj));
+    glUniform2fv(glGetUniformLocation(m_cloudShader, "uJitter"), 1, glm::value_ptr(jitter));
+    glUniform1i(glGetUniformLocation(m_cloudShader, "uFrameIndex"), int(m_frameIndex % 1024));
     glUniform3fv(glGetUniformLocation(m_cloudShader, "uCameraPos"),
                  1, glm::value_ptr(cameraPos));
-    glUniform1f(glGetUniformLocation(m_cloudShader, "uTime"), time);
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uTime"), time * speed);
     glUniform3fv(glGetUniformLocation(m_cloudShader, "uSunPos"),
                  1, glm::value_ptr(sunPos));
     glUniform3fv(glGetUniformLocation(m_cloudShader, "uSunColor"),
-                 1, glm::value_ptr(sunColor));
-    
-    // Enable blending for clouds
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDepthMask(GL_FALSE); // Don't write to depth buffer
-    
-    // Render fullscreen quad
-    glBindVertexArray(m_quadVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
-    
+                 1, glm::value_ptr(sunColour));
+
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uCloudCoverage"), coverage);
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uCloudDensity"), density);
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uCloudScale"), scale);
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uEvolutionSpeed"), evolutionSpeed);
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uCloudHeight"), cloudHeight);
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uCloudThickness"), cloudThickness);
+    glUniform1f(glGetUniformLocation(m_cloudShader, "uCloudFuzziness"), fuzziness);
+
+    m_quad.draw();
+
+    // 2. Temporal reprojection: blend this frame into the reprojected history
+    GLuint resolvedColour = m_marchColour;
+    GLuint resolvedDepth = m_marchDepth;
+
+    if (m_temporal) {
+        int prev = m_historyIndex;
+        int next = 1 - m_historyIndex;
+
+        cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_historyFBO[next]);
+        cgra::gl_state::use_program(m_temporalShader);
+
+        cgra::gl_state::active_texture(GL_TEXTURE0);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_marchColour);
+        glUniform1i(glGetUniformLocation(m_temporalShader, "uCurrentColour"), 0);
+        cgra::gl_state::active_texture(GL_TEXTURE1);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_marchDepth);
+        glUniform1i(glGetUniformLocation(m_temporalShader, "uCurrentDepth"), 1);
+        cgra::gl_state::active_texture(GL_TEXTURE2);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_historyColour[prev]);
+        glUniform1i(glGetUniformLocation(m_temporalShader, "uHistoryColour"), 2);
+
+        glUniformMatrix4fv(glGetUniformLocation(m_temporalShader, "uInvViewProj"),
+                           1, GL_FALSE, glm::value_ptr(invViewProj));
+        glUniformMatrix4fv(glGetUniformLocation(m_temporalShader, "uPrevViewProj"),
+                           1, GL_FALSE, glm::value_ptr(m_prevViewProj));
+        glUniform3fv(glGetUniformLocation(m_temporalShader, "uCameraPos"), 1, glm::value_ptr(cameraPos));
+        glUniform1f(glGetUniformLocation(m_temporalShader, "uBlend"), m_historyBlend);
+        glUniform1i(glGetUniformLocation(m_temporalShader, "uHistoryValid"), m_historyValid ? 1 : 0);
+
+        m_quad.draw();
+
+        m_historyIndex = next;
+        m_historyValid = true;
+        resolvedColour = m_historyColour[next];
+        resolvedDepth = m_historyDepth[next];
+    }
+
+    // 3. Bilateral upsample and composite over the scene at full resolution
+    // No depth test: the scene depth is read in the shader to reject cloud behind geometry
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, saved.framebuffer);
+    glViewport(0, 0, m_width, m_height);
+    cgra::gl_state::enable(GL_BLEND);
+    cgra::gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    cgra::gl_state::use_program(m_compositeShader);
+
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, resolvedColour);
+    glUniform1i(glGetUniformLocation(m_compositeShader, "uCloudColour"), 0);
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, resolvedDepth);
+    glUniform1i(glGetUniformLocation(m_compositeShader, "uCloudDepth"), 1);
+    glUniform2f(glGetUniformLocation(m_compositeShader, "uLowResSize"), float(m_lowWidth), float(m_lowHeight));
+    cgra::gl_state::active_texture(GL_TEXTURE2);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, sceneDepth);
+    glUniform1i(glGetUniformLocation(m_compositeShader, "uSceneDepth"), 2);
+    glUniformMatrix4fv(glGetUniformLocation(m_compositeShader, "uInvViewProj"),
+                       1, GL_FALSE, glm::value_ptr(invViewProj));
+    glUniform3fv(glGetUniformLocation(m_compositeShader, "uCameraPos"), 1, glm::value_ptr(cameraPos));
+
+    m_quad.draw();
+
     // Restore state
-    glDepthMask(GL_TRUE);
-    glDisable(GL_BLEND);
+    cgra::end_offscreen(saved);
+    cgra::gl_state::active_texture(GL_TEXTURE3);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+    cgra::gl_state::active_texture(GL_TEXTURE2);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, 0);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_3D, 0);
+
+    m_prevViewProj = viewProj;
+    m_frameIndex++;
 }
@@ -1,24 +1,111 @@
 #pragma once
 
+#include <string>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include "cgra/cgra_offscreen.hpp"
 
 class CloudRenderer {
 private:
     GLuint m_cloudShader;
-    GLuint m_quadVAO, m_quadVBO;
-    
+    GLuint m_temporalShader;
+    GLuint m_compositeShader;
+    GLuint m_weatherShader;
+    GLuint m_shadowShader;
+    cgra::fullscreen_quad m_quad;
+
+    // Baked tileable noise volumes (see cloud_noise.hpp)
+    GLuint m_shapeNoise = 0;
+    GLuint m_detailNoise = 0;
+
+    // Conservative top-down coverage map for empty-space skipping, centred on the camera
+    // and only rebuilt when the cloud parameters change or the field has drifted
+    GLuint m_weatherFBO = 0;
+    GLuint m_weatherMap = 0;
+    int m_weatherResolution = 256;
+    float m_weatherExtent = 2048.0f;
+    glm::vec2 m_weatherOrigin{0.0f};
+    glm::vec4 m_weatherParams{-1.0f};   // coverage, scale, evolution speed, time
+    glm::vec2 m_weatherLayer{-1.0f};    // height, thickness
+    bool m_weatherValid = false;
+
+    // Top-down cloud transmittance over the island, sampled by the scene shaders for cloud
+    // shadows. Clouds evolve slowly so only a band of rows is re-marched each frame
+    GLuint m_shadowFBO = 0;
+    GLuint m_shadowMap = 0;
+    int m_shadowResolution = 256;
+    float m_shadowExtent = 512.0f;
+    glm::vec2 m_shadowOrigin{-256.0f};
+    int m_shadowSlices = 4;
+    int m_shadowSlice = 0;
+    glm::vec3 m_shadowSunDir{0.0f, 1.0f, 0.0f};
+    float m_shadowPlane = 0.0f;
+    glm::vec4 m_shadowParams{-1.0f};    // coverage, density, scale, fuzziness
+    glm::vec2 m_shadowLayer{-1.0f};     // height, thickness
+    bool m_shadowValid = false;
+
+    // Reduced-resolution raymarch target (colour + transmittance-weighted ray depth)
+    GLuint m_marchFBO = 0;
+    GLuint m_marchColour = 0;
+    GLuint m_marchDepth = 0;
+
+    // Ping-pong history buffers for temporal reprojection
+    GLuint m_historyFBO[2] = { 0, 0 };
+    GLuint m_historyColour[2] = { 0, 0 };
+    GLuint m_historyDepth[2] = { 0, 0 };
+    int m_historyIndex = 0;
+    bool m_historyValid = false;
+
+    int m_width = 0, m_height = 0;          // full framebuffer size
+    int m_lowWidth = 0, m_lowHeight = 0;    // raymarch target size
+    int m_resolutionDivisor = 2;            // 1 = full, 2 = half, 4 = quarter
+    bool m_temporal = true;
+    float m_historyBlend = 0.1f;            // weight of the newest frame
+
+    unsigned int m_frameIndex = 0;
+    glm::mat4 m_prevViewProj{1.0f};
+
 public:
     CloudRenderer();
     ~CloudRenderer();
-    
-    void init(GLuint shader);
+
+    // Noise volumes are loaded from (or baked into) cacheDir
+    void init(GLuint shader, GLuint temporalShader, GLuint compositeShader, GLuint weatherShader,
+              GLuint shadowShader, const std::string& cacheDir);
     void render(const glm::mat4& view, const glm::mat4& proj,
                 const glm::vec3& cameraPos, float time,
                 const glm::vec3& sunPos, const glm::vec3& sunColour,
                 float coverage, float density, float speed,
                 float scale, float evolutionSpeed,
-                float cloudHeight, float cloudThickness, float fuzziness);
+                float cloudHeight, float cloudThickness, float fuzziness,
+                GLuint sceneDepth);
+
+    // Re-marches part of the cloud shadow map, call before drawing anything that receives it
+    void updateShadowMap(const glm::vec3& sunPos, float time,
+                         float coverage, float density, float speed,
+                         float scale, float evolutionSpeed,
+                         float cloudHeight, float cloudThickness, float fuzziness);
+
+    // Binds the shadow map to texture unit 7 and sets the cloudShadow() uniforms on program
+    // (strength 0 disables cloud shadows in that program)
+    void bindShadowMap(GLuint program, float strength) const;
+
+    // Resizes the internal targets to match the framebuffer (no-op if unchanged)
+    void resize(int width, int height);
+
+    void setResolutionDivisor(int divisor);
+    int getResolutionDivisor() const { return m_resolutionDivisor; }
+    void setTemporalReprojection(bool enabled);
+    bool getTemporalReprojection() const { return m_temporal; }
+
+    // Forces the next frame to ignore accumulated history
+    void resetHistory() { m_historyValid = false; }
+
 private:
-    void setupQuad();
+    void setupWeatherMap();
+    void setupShadowMap();
+    void updateWeatherMap(const glm::vec3& cameraPos, float time, float coverage, float scale,
+                          float evolutionSpeed, float cloudHeight, float cloudThickness);
+    void createTargets();
+    void destroyTargets();
 };
@@ -0,0 +1,604 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "forest.hpp"
+
+namespace {
+    // First attribute location of the per-instance model matrix, one per column,
+    // followed by the cross-fade attribute
+    const GLuint instanceAttrib = 4;
+    const GLuint lodAttrib = 8;
+
+    // Distance bands the selected instances are ordered by, see Forest::selectLods
+    const int sortBands = 32;
+
+    // Seed of one archetype's random stream, a hash of the forest seed and its id
+    uint32_t treeSeed(uint32_t seed, uint32_t id) {
+        uint32_t h = seed ^ (id * 0x9e3779b9u);
+        h ^= h >> 16; h *= 0x7feb352du;
+        h ^= h >> 15; h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+}
+
+// Start from the tuned defaults set up by the Tree constructor
+Forest::Forest() : m_params(Tree().getParameters()) {}
+
+Forest::~Forest() {
+    for (Tree& tree : m_archetypes) tree.release();
+    if (m_cullBuffer) glDeleteBuffers(1, &m_cullBuffer);
+    if (m_lodBuffer) glDeleteBuffers(1, &m_lodBuffer);
+}
+
+void Forest::initImpostors(const cgra::shader_program& bakeShader, const cgra::shader_program& drawShader,
+                           const cgra::shader_program& depthShader, GLuint barkTexture) {
+    m_impostors.init(bakeShader);
+    m_impostorShader = drawShader;
+    m_impostorDepthShader = depthShader;
+    m_barkTexture = barkTexture;
+    m_impostorsDirty = true;
+}
+
+void Forest::setInstances(const std::vector<Instance>& instances) {
+    m_instances = instances;
+    m_instancesDirty = true;
+}
+
+void Forest::setParameters(const TreeParameters& params) {
+    m_params = params;
+    m_archetypesDirty = true;
+    m_lastEdit = std::chrono::steady_clock::now();
+    m_editing = true;
+}
+
+void Forest::setVariantCount(int count) {
+    count = std::max(count, 1);
+    if (count != m_variantCount) m_archetypesDirty = true;
+    m_variantCount = count;
+}
+
+void Forest::setSeed(uint32_t seed) {
+    if (seed != m_seed) m_archetypesDirty = true;
+    m_seed = seed;
+}
+
+void Forest::setGpuStems(bool enabled) {
+    if (enabled != m_gpuStems) m_archetypesDirty = true;
+    m_gpuStems = enabled;
+}
+
+void Forest::setGpuCulling(bool enabled) {
+    if (enabled != m_gpuCulling) m_instancesDirty = true;
+    m_gpuCulling = enabled;
+}
+
+bool Forest::isGpuCullingAvailable() {
+    m_culler.init();
+    return m_culler.isAvailable();
+}
+
+bool Forest::isGpuStemsAvailable() {
+    m_trunkGenerator.init();
+    return m_trunkGenerator.isAvailable();
+}
+
+void Forest::generateArchetypes() {
+    auto start = std::chrono::high_resolution_clock::now();
+    bool gpuStems = m_gpuStems && isGpuStemsAvailable();
+
+    // Constructed in place and never copied afterwards, each Tree owns its meshes and
+    // is released before it goes
+    if (int(m_archetypes.size()) != m_variantCount) {
+        for (Tree& tree : m_archetypes) tree.release();
+        m_archetypes.clear();
+        m_archetypes.resize(m_variantCount);
+    }
+
+    int variants = int(m_archetypes.size());
+    for (int a = 0; a < variants; a++) {
+        m_archetypes[a].setParameters(m_params);
+        m_archetypes[a].setSeed(treeSeed(m_seed, uint32_t(a)));
+        m_archetypes[a].setGpuStems(gpuStems);
+    }
+
+    bool store = !m_editing;
+    int cached = 0, stored = 0;
+#ifdef CGRA_HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic) reduction(+:cached, stored)
+#endif
+    for (int a = 0; a < variants; a++) {
+        if (m_treeCache.load(m_archetypes[a])) {
+            cached++;
+        } else {
+            m_archetypes[a].generateGeometry();
+            if (store && m_treeCache.store(m_archetypes[a])) stored++;
+        }
+    }
+    m_cachedArchetypes = cached;
+    if (stored > 0) m_treeCache.evict();
+
+    double stemMs = 0.0;
+    for (Tree& tree : m_archetypes) {
+        tree.uploadMeshes(&m_trunkGenerator);
+        stemMs += tree.getStemGenerationMs();
+    }
+    m_stemMs[gpuStems ? 1 : 0] = stemMs;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    m_generationMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+    m_archetypesDirty = false;
+    m_instancesDirty = true;
+    m_impostorsDirty = true;
+}
+
+double Forest::benchmarkGeneration(int trees) {
+    Tree tree;
+    tree.setParameters(m_params);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < trees; i++) {
+        tree.setSeed(treeSeed(m_seed, uint32_t(i)));
+        tree.regenerate();
+        tree.generateGeometry();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    m_benchmarkRate = seconds > 0.0 ? trees / seconds : 0.0;
+    return m_benchmarkRate;
+}
+
+void Forest::buildInstances() {
+    int variants = int(m_archetypes.size());
+    m_firstInstance.assign(variants, 0);
+    m_instanceCount.assign(variants, 0);
+
+    for (size_t i = 0; i < m_instances.size(); i++) m_instanceCount[i % variants]++;
+    for (int a = 1; a < variants; a++) m_firstInstance[a] = m_firstInstance[a - 1] + m_instanceCount[a - 1];
+
+    m_instanceData.resize(m_instances.size());
+    m_boundsMin.resize(m_instances.size());
+    m_boundsMax.resize(m_instances.size());
+
+    std::vector<int> next = m_firstInstance;
+    for (size_t i = 0; i < m_instances.size(); i++) {
+        const Instance& instance = m_instances[i];
+        int archetype = int(i % variants);
+        int slot = next[archetype]++;
+
+        // Same transform as Tree::draw, with the yaw applied in the tree's own frame
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), instance.position);
+        if (glm::length(instance.rotation) > 0.001f) {
+            model = glm::rotate(model, instance.rotation.x, glm::vec3(1, 0, 0));
+            model = glm::rotate(model, instance.rotation.y, glm::vec3(0, 1, 0));
+            model = glm::rotate(model, instance.rotation.z, glm::vec3(0, 0, 1));
+        }
+        model = glm::rotate(model, instance.yaw, glm::vec3(0, 1, 0));
+        m_instanceData[slot].model = model;
+
+        const Tree& tree = m_archetypes[archetype];
+        glm::vec3 center = glm::vec3(model * glm::vec4((tree.getLocalBoundsMin() + tree.getLocalBoundsMax()) * 0.5f, 1.0f));
+        glm::vec3 halfSize = (tree.getLocalBoundsMax() - tree.getLocalBoundsMin()) * 0.5f;
+        glm::vec3 extent(0.0f);
+        for (int k = 0; k < 3; k++) {
+            extent[k] = std::abs(model[0][k]) * halfSize.x + std::abs(model[1][k]) * halfSize.y + std::abs(model[2][k]) * halfSize.z;
+        }
+        m_boundsMin[slot] = center - extent;
+        m_boundsMax[slot] = center + extent;
+    }
+
+    if (m_gpuCulling && isGpuCullingAvailable()) buildCullInstances();
+
+    // The previous selection refers to the old instances, draw nothing until the next one
+    m_lodCount.clear();
+    m_instancesDirty = false;
+}
+
+void Forest::buildCullInstances() {
+    int variants = int(m_archetypes.size());
+    std::vector<ForestCuller::Instance> instances(m_instanceData.size());
+    for (int a = 0; a < variants; a++) {
+        const Tree& tree = m_archetypes[a];
+        float radius = glm::length(tree.getLocalBoundsMax() - tree.getLocalBoundsMin()) * 0.5f;
+        for (int i = m_firstInstance[a]; i < m_firstInstance[a] + m_instanceCount[a]; i++) {
+            instances[i].model = m_instanceData[i].model;
+            instances[i].boundsMin = glm::vec4(m_boundsMin[i], float(a));
+            instances[i].boundsMax = glm::vec4(m_boundsMax[i], radius);
+        }
+    }
+    m_culler.setInstances(instances, m_firstInstance, m_instanceCount);
+
+    // The meshes drawLevels and drawImpostors draw from each bucket, parts a level doesn't
+    // have are left empty
+    std::vector<ForestCuller::Draw> draws(size_t(variants) * LOD_LEVELS * DRAW_PARTS);
+    for (int a = 0; a < variants; a++) {
+        const Tree& tree = m_archetypes[a];
+        for (int level = 0; level < LOD_LEVELS; level++) {
+            int bucket = a * LOD_LEVELS + level;
+            ForestCuller::Draw* parts = &draws[size_t(bucket) * DRAW_PARTS];
+            for (int p = 0; p < DRAW_PARTS; p++) {
+                parts[p].bucket = GLuint(bucket);
+                parts[p].perTree = 1;
+            }
+
+            if (level == IMPOSTOR_LEVEL) {
+                parts[DRAW_WOOD].indexCount = GLuint(m_impostors.getQuad().index_count);
+                continue;
+            }
+            if (level == 0) {
+                parts[DRAW_WOOD].indexCount = GLuint(tree.getTrunkMesh().index_count);
+                parts[DRAW_BRANCHES].indexCount = GLuint(tree.getBranchesMesh().index_count);
+            } else {
+                parts[DRAW_WOOD].indexCount = GLuint(tree.getLodWoodMesh(level).index_count);
+            }
+            parts[DRAW_LEAVES].indexCount = GLuint(tree.getLeafMesh(level).index_count);
+            parts[DRAW_LEAVES].perTree = GLuint(tree.getLeafInstanceCount(level));
+        }
+    }
+    m_culler.setDraws(draws);
+}
+
+void Forest::storeArchetypes() {
+    // The uploaded meshes no longer have their CPU geometry, so what is missing from the
+    // cache is generated again, once, now that the edit is over
+    for (Tree& tree : m_archetypes) {
+        if (!m_treeCache.contains(tree)) {
+            tree.regenerate();
+            m_archetypesDirty = true;
+        }
+    }
+}
+
+void Forest::update() {
+    if (m_editing && std::chrono::steady_clock::now() - m_lastEdit >= m_storeDelay) {
+        m_editing = false;
+        if (m_treeCache.isEnabled()) storeArchetypes();
+    }
+    applyChanges();
+}
+
+void Forest::applyChanges() {
+    if (m_archetypesDirty) generateArchetypes();
+    if (m_instancesDirty) buildInstances();
+    if (m_impostorsDirty && m_impostorShader) {
+        m_impostors.bake(m_archetypes, m_barkTexture);
+        m_impostorsDirty = false;
+    }
+}
+
+void Forest::bindInstances(const cgra::gl_mesh& mesh, GLuint buffer, int firstInstance, int divisor) const {
+    cgra::gl_state::bind_vertex_array(mesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    size_t base = size_t(firstInstance) * sizeof(InstanceData);
+    for (GLuint c = 0; c < 4; c++) {
+        size_t offset = base + offsetof(InstanceData, model) + c * sizeof(glm::vec4);
+        glEnableVertexAttribArray(instanceAttrib + c);
+        glVertexAttribPointer(instanceAttrib + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offset);
+        glVertexAttribDivisor(instanceAttrib + c, divisor);
+    }
+    glEnableVertexAttribArray(lodAttrib);
+    glVertexAttribPointer(lodAttrib, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, lod)));
+    glVertexAttribDivisor(lodAttrib, divisor);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Forest::drawInstanced(const cgra::gl_mesh& mesh, GLuint buffer, int firstInstance, int count, int perTree) {
+    if (mesh.vao == 0 || mesh.index_count == 0 || count == 0 || perTree == 0) return;
+    bindInstances(mesh, buffer, firstInstance, perTree);
+    glDrawElementsInstanced(mesh.mode, mesh.index_count, GL_UNSIGNED_INT, 0, count * perTree);
+    m_drawCalls++;
+}
+
+void Forest::drawLeaves(const cgra::shader_program& shader, const Tree& tree, int level, GLuint buffer, int firstInstance, int count) {
+    if (count == 0) return;
+    int perTree = tree.bindLeaves(shader, level, Tree::LEAF_UNIT);
+    drawInstanced(tree.getLeafMesh(level), buffer, firstInstance, count, perTree);
+}
+
+void Forest::drawBucket(const cgra::gl_mesh& mesh, int bucket, DrawPart part, int perTree) {
+    if (!m_gpuCulled || !m_culler.isIndirect()) {
+        GLuint buffer = m_gpuCulled ? m_culler.getInstanceBuffer() : m_lodBuffer;
+        drawInstanced(mesh, buffer, m_lodFirst[bucket], m_lodCount[bucket], perTree);
+        return;
+    }
+
+    // The command's base instance offsets into the bucket, so the attributes start at 0
+    if (mesh.vao == 0 || mesh.index_count == 0 || perTree == 0) return;
+    bindInstances(mesh, m_culler.getInstanceBuffer(), 0, perTree);
+    m_culler.drawIndirect(mesh, bucket * DRAW_PARTS + part);
+    m_drawCalls++;
+}
+
+void Forest::buildOcclusion(GLuint depthTexture, int width, int height, const glm::mat4& viewProj) {
+    if (m_gpuCulled && m_culler.getOcclusion()) m_culler.buildOcclusion(depthTexture, width, height, viewProj);
+}
+
+void Forest::countLods() {
+    m_lodTriangles = 0;
+    for (int& count : m_levelInstances) count = 0;
+    for (size_t b = 0; b < m_lodCount.size(); b++) {
+        int a = int(b / LOD_LEVELS), level = int(b % LOD_LEVELS);
+        int triangles = level == IMPOSTOR_LEVEL ? 2 : m_archetypes[a].getLodTriangleCount(level);
+        m_lodTriangles += (long long)triangles * m_lodCount[b];
+        m_levelInstances[level] += m_lodCount[b];
+    }
+}
+
+void Forest::selectLods(const glm::mat4& view, const glm::mat4& proj, int viewportHeight) {
+    applyChanges();
+
+    int variants = int(m_archetypes.size());
+    m_gpuCulled = m_gpuCulling && isGpuCullingAvailable();
+    if (m_gpuCulled) {
+        ForestCuller::LodSettings lods;
+        lods.enabled = m_lodEnabled;
+        lods.pixelScale = proj[1][1] * float(viewportHeight) * m_lodBias;
+        std::copy(std::begin(m_lodPixels), std::end(m_lodPixels), lods.pixels);
+        lods.fadeBand = m_lodFadeBand;
+        m_culler.cull(view, proj, lods);
+
+        m_lodFirst.resize(size_t(variants) * LOD_LEVELS);
+        for (size_t b = 0; b < m_lodFirst.size(); b++) m_lodFirst[b] = m_culler.getBucketFirst(int(b));
+        m_lodCount = m_culler.getBucketCounts();
+        countLods();
+        return;
+    }
+
+    m_lodBuckets.resize(size_t(variants) * LOD_LEVELS);
+    m_lodDistances.resize(m_lodBuckets.size());
+    for (std::vector<InstanceData>& bucket : m_lodBuckets) bucket.clear();
+    for (std::vector<float>& distances : m_lodDistances) distances.clear();
+    float farthest = 0.0f;
+
+    // Projected diameter in pixels of a sphere of radius r at distance d is r * proj[1][1] * height / d
+    glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
+    float pixelScale = proj[1][1] * float(viewportHeight) * m_lodBias;
+
+    for (int a = 0; a < variants; a++) {
+        const Tree& tree = m_archetypes[a];
+        float radius = glm::length(tree.getLocalBoundsMax() - tree.getLocalBoundsMin()) * 0.5f;
+        std::vector<InstanceData>* buckets = &m_lodBuckets[size_t(a) * LOD_LEVELS];
+        std::vector<float>* distances = &m_lodDistances[size_t(a) * LOD_LEVELS];
+
+        for (int i = m_firstInstance[a]; i < m_firstInstance[a] + m_instanceCount[a]; i++) {
+            InstanceData instance = m_instanceData[i];
+            if (!m_lodEnabled) {
+                buckets[0].push_back(instance);
+                distances[0].push_back(0.0f);
+                continue;
+            }
+
+            glm::vec3 center = (m_boundsMin[i] + m_boundsMax[i]) * 0.5f;
+            float distance = std::max(glm::length(center - cameraPos), 0.001f);
+            farthest = std::max(farthest, distance);
+            float pixels = radius * pixelScale / distance;
+
+            int level = 0;
+            while (level < IMPOSTOR_LEVEL && pixels < m_lodPixels[level]) level++;
+
+            // Just above the next threshold, fade out this level as the next one fades in
+            float fadeStart = level < IMPOSTOR_LEVEL ? m_lodPixels[level] * (1.0f + m_lodFadeBand) : 0.0f;
+            if (pixels < fadeStart) {
+                float fade = (fadeStart - pixels) / (m_lodPixels[level] * m_lodFadeBand);
+                instance.lod = glm::vec4(fade, 0.0f, 0.0f, 0.0f);
+                buckets[level].push_back(instance);
+                distances[level].push_back(distance);
+                instance.lod = glm::vec4(fade, 1.0f, 0.0f, 0.0f);
+                buckets[level + 1].push_back(instance);
+                distances[level + 1].push_back(distance);
+            } else {
+                buckets[level].push_back(instance);
+                distances[level].push_back(distance);
+            }
+        }
+    }
+
+    // Each bucket is laid out nearest band first (a counting sort, linear in the trees),
+    // which is all the depth prepass needs to draw most occluders before what they hide
+    float bandScale = farthest > 0.0f ? sortBands / farthest : 0.0f;
+    auto band = [&](float distance) { return std::min(int(distance * bandScale), sortBands - 1); };
+
+    m_lodFirst.assign(m_lodBuckets.size(), 0);
+    m_lodCount.assign(m_lodBuckets.size(), 0);
+    size_t total = 0;
+    for (size_t b = 0; b < m_lodBuckets.size(); b++) {
+        m_lodFirst[b] = int(total);
+        m_lodCount[b] = int(m_lodBuckets[b].size());
+        total += m_lodBuckets[b].size();
+    }
+    m_lodInstances.resize(total);
+    for (size_t b = 0; b < m_lodBuckets.size(); b++) {
+        int next[sortBands + 1] = {};
+        for (float distance : m_lodDistances[b]) next[band(distance) + 1]++;
+        for (int k = 0; k < sortBands; k++) next[k + 1] += next[k];
+        for (size_t i = 0; i < m_lodBuckets[b].size(); i++) {
+            m_lodInstances[m_lodFirst[b] + next[band(m_lodDistances[b][i])]++] = m_lodBuckets[b][i];
+        }
+    }
+    countLods();
+    if (m_lodInstances.empty()) return;
+
+    if (m_lodBuffer == 0) glGenBuffers(1, &m_lodBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_lodBuffer);
+    glBufferData(GL_ARRAY_BUFFER, m_lodInstances.size() * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, m_lodInstances.size() * sizeof(InstanceData), m_lodInstances.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Forest::drawLevels(const cgra::shader_program& shader, bool leaves) {
+    // Indirect counts are only known on the GPU, so every bucket is drawn
+    bool indirect = m_gpuCulled && m_culler.isIndirect();
+    for (size_t a = 0; a < m_archetypes.size(); a++) {
+        const Tree& tree = m_archetypes[a];
+        for (int level = 0; level < IMPOSTOR_LEVEL; level++) {
+            int bucket = int(a) * LOD_LEVELS + level;
+            if (leaves) {
+                if (!indirect && m_lodCount[bucket] == 0) continue;
+                int perTree = tree.bindLeaves(shader, level, Tree::LEAF_UNIT);
+                drawBucket(tree.getLeafMesh(level), bucket, DRAW_LEAVES, perTree);
+            } else if (level == 0) {
+                drawBucket(tree.getTrunkMesh(), bucket, DRAW_WOOD);
+                drawBucket(tree.getBranchesMesh(), bucket, DRAW_BRANCHES);
+            } else {
+                drawBucket(tree.getLodWoodMesh(level), bucket, DRAW_WOOD);
+            }
+        }
+    }
+}
+
+void Forest::drawImpostors(const cgra::shader_program& shader) {
+    bool indirect = m_gpuCulled && m_culler.isIndirect();
+    if (!m_impostors.isReady() || (!indirect && m_levelInstances[IMPOSTOR_LEVEL] == 0)) return;
+
+    cgra::gl_state::use_program(shader);
+    m_impostors.bind(shader, 0, 1);
+
+    for (size_t a = 0; a < m_archetypes.size(); a++) {
+        shader.set_uniform("uImpostorLayer", float(a));
+        shader.set_uniform("uImpostorExtent", m_impostors.getExtent(int(a)));
+        drawBucket(m_impostors.getQuad(), int(a) * LOD_LEVELS + IMPOSTOR_LEVEL, DRAW_WOOD);
+    }
+}
+
+void Forest::draw(const cgra::shader_program& shader, GLuint trunkDiffuse, GLuint trunkNormal, GLuint trunkRoughness) {
+    applyChanges();
+    m_drawCalls = 0;
+    if (m_instances.empty() || m_lodCount.empty()) return;
+
+    cgra::gl_state::use_program(shader);
+    shader.set_uniform("uInstanced", 1);
+
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, trunkDiffuse);
+    shader.set_uniform("uTrunkDiffuse", 0);
+
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, trunkNormal);
+    shader.set_uniform("uTrunkNormal", 1);
+
+    cgra::gl_state::active_texture(GL_TEXTURE2);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, trunkRoughness);
+    shader.set_uniform("uTrunkRoughness", 2);
+    shader.set_uniform("uLeafInstances", Tree::LEAF_UNIT);
+
+    // All wood first, then all leaves, so uIsLeaf changes once per frame
+    shader.set_uniform("uIsLeaf", 0);
+    drawLevels(shader, false);
+
+    if (m_params.hasLeaves) {
+        shader.set_uniform("uIsLeaf", 1);
+        drawLevels(shader, true);
+        shader.set_uniform("uIsLeaf", 0);
+    }
+
+    shader.set_uniform("uInstanced", 0);
+
+    if (m_impostorShader) drawImpostors(m_impostorShader);
+    cgra::gl_state::bind_vertex_array(0);
+}
+
+void Forest::drawShadows(const cgra::shader_program& shader) {
+    applyChanges();
+    if (m_instances.empty() || m_lodCount.empty()) return;
+
+    cgra::gl_state::use_program(shader);
+    shader.set_uniform("uInstanced", 1);
+
+    drawLevels(shader, false);
+    if (m_params.hasLeaves) {
+        shader.set_uniform("uIsLeaf", 1);
+        drawLevels(shader, true);
+        shader.set_uniform("uIsLeaf", 0);
+    }
+
+    shader.set_uniform("uInstanced", 0);
+
+    // Only coverage decides an impostor's depth, so its lighting is left to draw
+    if (m_impostorDepthShader) drawImpostors(m_impostorDepthShader);
+    cgra::gl_state::bind_vertex_array(0);
+}
+
+long long Forest::drawShadowCasters(const cgra::shader_program& shader, bool proxies,
+                                    const std::function<bool(const glm::vec3&, const glm::vec3&)>& visible) {
+    applyChanges();
+    if (m_instances.empty()) return 0;
+
+    // Gather the visible instances, still grouped by archetype, and stream them in one upload
+    int variants = int(m_archetypes.size());
+    std::vector<int> first(variants, 0), count(variants, 0);
+    m_visible.clear();
+    for (int a = 0; a < variants; a++) {
+        first[a] = int(m_visible.size());
+        for (int i = m_firstInstance[a]; i < m_firstInstance[a] + m_instanceCount[a]; i++) {
+            if (visible(m_boundsMin[i], m_boundsMax[i])) m_visible.push_back(m_instanceData[i]);
+        }
+        count[a] = int(m_visible.size()) - first[a];
+    }
+    if (m_visible.empty()) return 0;
+
+    if (m_cullBuffer == 0) glGenBuffers(1, &m_cullBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_cullBuffer);
+    glBufferData(GL_ARRAY_BUFFER, m_visible.size() * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, m_visible.size() * sizeof(InstanceData), m_visible.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    cgra::gl_state::use_program(shader);
+    shader.set_uniform("uInstanced", 1);
+
+    long long triangles = 0;
+    for (int a = 0; a < variants; a++) {
+        const Tree& tree = m_archetypes[a];
+        if (proxies) {
+            drawInstanced(tree.getShadowStemMesh(), m_cullBuffer, first[a], count[a]);
+            triangles += (long long)tree.getShadowTriangleCount() * count[a];
+        } else {
+            drawInstanced(tree.getTrunkMesh(), m_cullBuffer, first[a], count[a]);
+            drawInstanced(tree.getBranchesMesh(), m_cullBuffer, first[a], count[a]);
+            triangles += (long long)tree.getTriangleCount() * count[a];
+        }
+    }
+
+    if (m_params.hasLeaves) {
+        shader.set_uniform("uIsLeaf", 1);
+        int level = proxies ? Tree::getShadowLeafLevel() : 0;
+        for (int a = 0; a < variants; a++) {
+            drawLeaves(shader, m_archetypes[a], level, m_cullBuffer, first[a], count[a]);
+        }
+        shader.set_uniform("uIsLeaf", 0);
+    }
+
+    shader.set_uniform("uInstanced", 0);
+    cgra::gl_state::bind_vertex_array(0);
+    return triangles;
+}
+
+long long Forest::getTriangleCount() {
+    applyChanges();
+    long long triangles = 0;
+    for (size_t a = 0; a < m_archetypes.size(); a++) {
+        triangles += (long long)m_archetypes[a].getTriangleCount() * m_instanceCount[a];
+    }
+    return triangles;
+}
+
+bool Forest::getBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const {
+    if (m_boundsMin.empty()) return false;
+    boundsMin = m_boundsMin[0];
+    boundsMax = m_boundsMax[0];
+    for (size_t i = 1; i < m_boundsMin.size(); i++) {
+        boundsMin = glm::min(boundsMin, m_boundsMin[i]);
+        boundsMax = glm::max(boundsMax, m_boundsMax[i]);
+    }
+    return true;
+}
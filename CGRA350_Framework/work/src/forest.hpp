@@ -0,0 +1,252 @@
+#pragma once
+
+// std
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "forest_culler.hpp"
+#include "tree.hpp"
+#include "tree_cache.hpp"
+#include "tree_impostors.hpp"
+#include "trunk_generator.hpp"
+
+// Draws many trees from a small pool of archetype meshes.
+//
+// Every tree in the scene shares one TreeParameters, so instead of generating a mesh per
+// tree the forest generates a few variants (archetypes) of that parameter set and assigns
+// each placed tree to one of them. Trees are drawn with one instanced draw per archetype
+// per part (trunk, branches, leaves), reading their model matrix from a per-instance
+// attribute (locations 4-7), so the number of draw calls and uniform updates does not
+// depend on the number of trees.
+//
+// The archetype meshes are owned by Tree objects; the forest binds its instance buffers
+// into their vertex arrays. Shaders select the instance matrix with uInstanced.
+//
+// Archetype i is seeded from a hash of (forest seed, i), so a seed always produces the
+// same forest. Their geometry is generated in parallel (OpenMP) and only the final
+// upload runs on the GL thread. With GPU stems enabled (GL 4.3) the trunk and branch
+// rings are expanded by a compute shader instead, see TrunkGenerator.
+//
+// Every frame selectLods picks a level of detail per tree from its projected size: the
+// full mesh, the two reduced meshes of Tree, or a TreeImpostors billboard (one quad).
+// Trees near a threshold are drawn at both levels and cross-faded with a screen-door
+// dither, driven by a second per-instance attribute (location 8).
+//
+// With GPU culling the selection moves to a ForestCuller, which also drops trees outside
+// the frustum or behind last frame's depth and, on GL 4.3, feeds the draws indirectly.
+class Forest {
+public:
+    struct Instance {
+        glm::vec3 position;
+        glm::vec3 rotation;        // euler angles, as Tree::setRotation
+        float yaw = 0.0f;          // spin about the tree's own up axis, hides repeated archetypes
+    };
+
+    // Mesh levels of Tree, then the impostor
+    static const int LOD_LEVELS = Tree::LOD_LEVELS + 1;
+    static const int IMPOSTOR_LEVEL = LOD_LEVELS - 1;
+
+private:
+    // Per-instance attributes: model matrix (locations 4-7) and cross-fade (location 8,
+    // x = fade amount, y = 1 for the incoming level)
+    struct InstanceData {
+        glm::mat4 model;
+        glm::vec4 lod{0.0f};
+    };
+
+    TreeParameters m_params;
+    int m_variantCount = 4;
+    uint32_t m_seed = 12345;
+    double m_generationMs = 0.0;
+    double m_benchmarkRate = 0.0;
+
+    TrunkGenerator m_trunkGenerator;
+    bool m_gpuStems = false;
+    double m_stemMs[2] = {};        // last stem generation time on the CPU [0] and GPU [1] path
+    std::vector<Tree> m_archetypes;
+    bool m_archetypesDirty = true;
+
+    // Archetypes generated before are read back from disk instead. While the parameters
+    // are being edited every frame generates new trees, so nothing is stored until they
+    // have been left alone for m_storeDelay.
+    TreeCache m_treeCache;
+    int m_cachedArchetypes = 0;     // read from the cache at the last generation
+    std::chrono::steady_clock::duration m_storeDelay = std::chrono::milliseconds(500);
+    std::chrono::steady_clock::time_point m_lastEdit;
+    bool m_editing = false;         // edited since the archetypes were last stored
+
+    std::vector<Instance> m_instances;
+    bool m_instancesDirty = true;
+
+    // Instances grouped by archetype: transforms, world bounds, and each archetype's range
+    std::vector<InstanceData> m_instanceData;
+    std::vector<glm::vec3> m_boundsMin;
+    std::vector<glm::vec3> m_boundsMax;
+    std::vector<int> m_firstInstance;
+    std::vector<int> m_instanceCount;
+
+    GLuint m_cullBuffer = 0;        // visible instances, streamed per shadow cascade
+    std::vector<InstanceData> m_visible;
+    int m_drawCalls = 0;
+
+    // Level of detail selection. A tree moves down a level when its projected diameter
+    // falls below m_lodPixels (scaled by the bias), fading over the top m_lodFadeBand of it.
+    bool m_lodEnabled = true;
+    float m_lodBias = 1.0f;
+    float m_lodPixels[LOD_LEVELS - 1] = { 400.0f, 160.0f, 80.0f };
+    float m_lodFadeBand = 0.15f;
+
+    // Selected instances grouped by [archetype][level], streamed into m_lodBuffer, and
+    // their distances from the camera
+    std::vector<std::vector<InstanceData>> m_lodBuckets;
+    std::vector<std::vector<float>> m_lodDistances;
+    std::vector<InstanceData> m_lodInstances;
+    std::vector<int> m_lodFirst;
+    std::vector<int> m_lodCount;
+    GLuint m_lodBuffer = 0;
+    int m_levelInstances[LOD_LEVELS] = {};
+    long long m_lodTriangles = 0;
+
+    // GPU selection, replaces the above when m_gpuCulled. Each bucket has one indirect
+    // draw per part, see buildCullInstances.
+    enum DrawPart { DRAW_WOOD, DRAW_BRANCHES, DRAW_LEAVES, DRAW_PARTS };
+    ForestCuller m_culler;
+    bool m_gpuCulling = false;
+    bool m_gpuCulled = false;
+
+    TreeImpostors m_impostors;
+    cgra::shader_program m_impostorShader;
+    cgra::shader_program m_impostorDepthShader;
+    GLuint m_barkTexture = 0;
+    bool m_impostorsDirty = true;
+
+    void generateArchetypes();
+    void storeArchetypes();
+
+    // Rebuilds what the setters marked dirty. The draw paths call this for changes made
+    // earlier in the frame; only update decides when an edit has settled.
+    void applyChanges();
+    void buildInstances();
+    void buildCullInstances();
+    void countLods();
+
+    // Points the instance attributes of mesh at buffer, starting at firstInstance and
+    // advancing one tree every divisor instances
+    void bindInstances(const cgra::gl_mesh& mesh, GLuint buffer, int firstInstance, int divisor) const;
+
+    // Draws mesh perTree times for each of count trees. Leaves are instanced per leaf
+    // within each tree, so their perTree is the tree's leaf count (see Tree::bindLeaves).
+    void drawInstanced(const cgra::gl_mesh& mesh, GLuint buffer, int firstInstance, int count, int perTree = 1);
+    void drawLeaves(const cgra::shader_program& shader, const Tree& tree, int level, GLuint buffer, int firstInstance, int count);
+
+    // Draws one part of the trees selected into a [archetype][level] bucket
+    void drawBucket(const cgra::gl_mesh& mesh, int bucket, DrawPart part, int perTree = 1);
+
+    // Instanced draws of the selected mesh levels (wood or leaves) and impostors
+    void drawLevels(const cgra::shader_program& shader, bool leaves);
+    void drawImpostors(const cgra::shader_program& shader);
+
+public:
+    Forest();
+    ~Forest();
+
+    Forest(const Forest&) = delete;
+    Forest& operator=(const Forest&) = delete;
+
+    // Shaders for baking impostors, drawing them and drawing only their depth (see
+    // drawShadows), and the bark the bake samples
+    void initImpostors(const cgra::shader_program& bakeShader, const cgra::shader_program& drawShader,
+                       const cgra::shader_program& depthShader, GLuint barkTexture);
+
+    // Regenerates archetypes and instances that changed, and stores archetypes once an
+    // edit has settled. Call once per frame, before the frame's first pass.
+    void update();
+
+    // Replaces the placed trees, archetypes are assigned round-robin
+    void setInstances(const std::vector<Instance>& instances);
+    void clear() { setInstances({}); }
+    int getInstanceCount() const { return int(m_instances.size()); }
+
+    const TreeParameters& getParameters() const { return m_params; }
+    void setParameters(const TreeParameters& params);
+    int getVariantCount() const { return m_variantCount; }
+    void setVariantCount(int count);
+    uint32_t getSeed() const { return m_seed; }
+    void setSeed(uint32_t seed);
+
+    // Wall time of the last archetype generation, CPU geometry and upload
+    double getGenerationMs() const { return m_generationMs; }
+
+    // Keeps generated archetypes in directory (see TreeCache), empty to generate every time
+    void setCacheDirectory(const std::string& directory) { m_treeCache.setDirectory(directory); }
+    int getCachedArchetypeCount() const { return m_cachedArchetypes; }
+
+    // Trunk and branch geometry from the compute shader, falls back to the CPU when unavailable
+    bool getGpuStems() const { return m_gpuStems; }
+    void setGpuStems(bool enabled);
+    bool isGpuStemsAvailable();
+
+    // Trunk and branch generation time summed over the archetypes, as last measured on each path
+    double getStemGenerationMs(bool gpu) const { return m_stemMs[gpu ? 1 : 0]; }
+
+    // Times the full CPU geometry generation of trees with the current parameters on one
+    // thread, and returns (and keeps) the rate in trees per second. Nothing is uploaded.
+    double benchmarkGeneration(int trees);
+    double getBenchmarkRate() const { return m_benchmarkRate; }
+
+    // Chooses every tree's level of detail for this frame's camera, used by draw and drawShadows
+    void selectLods(const glm::mat4& view, const glm::mat4& proj, int viewportHeight);
+
+    bool getLodEnabled() const { return m_lodEnabled; }
+    void setLodEnabled(bool enabled) { m_lodEnabled = enabled; }
+    float getLodBias() const { return m_lodBias; }
+    void setLodBias(float bias) { m_lodBias = bias; }
+
+    // Culling and level selection on the GPU, see ForestCuller
+    bool getGpuCulling() const { return m_gpuCulling; }
+    void setGpuCulling(bool enabled);
+    bool isGpuCullingAvailable();
+    bool isGpuCullingIndirect() const { return m_culler.isIndirect(); }
+    bool getOcclusionCulling() const { return m_culler.getOcclusion(); }
+    void setOcclusionCulling(bool enabled) { m_culler.setOcclusion(enabled); }
+
+    // Builds the occlusion pyramid for the next frame's GPU culling from the depth prepass
+    void buildOcclusion(GLuint depthTexture, int width, int height, const glm::mat4& viewProj);
+
+    // Trees drawn at each level (the last is the impostor) and their triangles, as last
+    // selected. With indirect GPU culling these are a frame behind.
+    int getLodInstanceCount(int level) const { return m_levelInstances[level]; }
+    long long getLodTriangleCount() const { return m_lodTriangles; }
+
+    // The camera and sun come from the per-frame uniforms
+    void draw(const cgra::shader_program& shader, GLuint trunkDiffuse, GLuint trunkNormal, GLuint trunkRoughness);
+
+    // Depth of every tree at its selected level of detail, for the depth prepass. Shading
+    // can test GL_EQUAL against it when shader shares draw's vertex shader; impostors
+    // use the depth shader given to initImpostors.
+    void drawShadows(const cgra::shader_program& shader);
+
+    // Shadow casters for one cascade: only instances whose bounds pass visible, drawn
+    // with the archetypes' reduced-detail proxies if proxies is set. Returns the triangles drawn.
+    long long drawShadowCasters(const cgra::shader_program& shader, bool proxies,
+                                const std::function<bool(const glm::vec3&, const glm::vec3&)>& visible);
+
+    // Triangles of every tree at full detail
+    long long getTriangleCount();
+
+    // World bounds of all instances, false if there are none
+    bool getBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+
+    // Instanced draws issued by the last call to draw
+    int getDrawCalls() const { return m_drawCalls; }
+};
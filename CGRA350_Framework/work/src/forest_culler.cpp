@@ -0,0 +1,369 @@
+// std
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+// project
+#include "forest_culler.hpp"
+
+namespace {
+    // Bytes per output instance: the model matrix and the cross-fade (Forest::InstanceData)
+    const size_t instanceStride = sizeof(glm::mat4) + sizeof(glm::vec4);
+
+    // DrawElementsIndirectCommand: count, instanceCount, firstIndex, baseVertex, baseInstance
+    const size_t commandStride = 5 * sizeof(GLuint);
+}
+
+ForestCuller::~ForestCuller() {
+    for (GLuint program : { m_cullProgram, m_commandProgram, m_feedbackProgram, m_hiZProgram }) {
+        if (program) glDeleteProgram(program);
+    }
+    for (GLuint buffer : { m_sourceBuffer, m_instanceBuffer, m_archetypeBuffer, m_counterBuffer,
+                           m_statsBuffer, m_drawBuffer, m_commandBuffer }) {
+        if (buffer) glDeleteBuffers(1, &buffer);
+    }
+    if (m_sourceVAO) cgra::gl_state::delete_vertex_arrays(1, &m_sourceVAO);
+    m_quad.destroy();
+    if (!m_queries.empty()) glDeleteQueries(GLsizei(m_queries.size()), m_queries.data());
+    if (m_hiZTexture) cgra::gl_state::delete_textures(1, &m_hiZTexture);
+    if (m_hiZFBO) cgra::gl_state::delete_framebuffers(1, &m_hiZFBO);
+}
+
+void ForestCuller::init() {
+    if (m_initialised) return;
+    m_initialised = true;
+
+    try {
+        cgra::shader_builder sb;
+        sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/fullscreen_vert.glsl"));
+        sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("/res/shaders/hiz_downsample_frag.glsl"));
+        m_hiZProgram = sb.build();
+    } catch (...) {
+        std::cerr << "Warning: could not build hiz_downsample_frag.glsl, trees are culled on the CPU" << std::endl;
+        return;
+    }
+
+    if (GLEW_VERSION_4_3) {
+        try {
+            cgra::shader_builder cull;
+            cull.set_shader(GL_COMPUTE_SHADER, CGRA_SRCDIR + std::string("/res/shaders/forest_cull.comp.glsl"));
+            m_cullProgram = cull.build();
+
+            cgra::shader_builder commands;
+            commands.set_shader(GL_COMPUTE_SHADER, CGRA_SRCDIR + std::string("/res/shaders/forest_cull_commands.comp.glsl"));
+            m_commandProgram = commands.build();
+            m_indirect = true;
+        } catch (...) {
+            std::cerr << "Warning: could not build the forest culling compute shaders" << std::endl;
+            if (m_cullProgram) glDeleteProgram(m_cullProgram);
+            m_cullProgram = cgra::shader_program();
+        }
+    } else {
+        std::cout << "GL 4.3 not available, trees are culled with transform feedback" << std::endl;
+    }
+
+    if (!m_indirect) {
+        // Varyings have to be named before linking, in the order of the instance attributes
+        GLuint program = glCreateProgram();
+        const char* varyings[] = { "gModel0", "gModel1", "gModel2", "gModel3", "gLod" };
+        glTransformFeedbackVaryings(program, 5, varyings, GL_INTERLEAVED_ATTRIBS);
+        try {
+            cgra::shader_builder sb;
+            sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("/res/shaders/forest_cull_vert.glsl"));
+            sb.set_shader(GL_GEOMETRY_SHADER, CGRA_SRCDIR + std::string("/res/shaders/forest_cull_geom.glsl"));
+            m_feedbackProgram = sb.build(program);
+        } catch (...) {
+            std::cerr << "Warning: could not build forest_cull_vert.glsl, trees are culled on the CPU" << std::endl;
+            glDeleteProgram(program);
+            return;
+        }
+    }
+
+    glGenBuffers(1, &m_sourceBuffer);
+    glGenBuffers(1, &m_instanceBuffer);
+    if (m_indirect) {
+        glGenBuffers(1, &m_archetypeBuffer);
+        glGenBuffers(1, &m_counterBuffer);
+        glGenBuffers(1, &m_statsBuffer);
+        glGenBuffers(1, &m_drawBuffer);
+        glGenBuffers(1, &m_commandBuffer);
+    } else {
+        glGenVertexArrays(1, &m_sourceVAO);
+        cgra::gl_state::bind_vertex_array(m_sourceVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_sourceBuffer);
+        for (GLuint c = 0; c < 4; c++) {
+            glEnableVertexAttribArray(c);
+            glVertexAttribPointer(c, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(offsetof(Instance, model) + c * sizeof(glm::vec4)));
+        }
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, boundsMin));
+        glEnableVertexAttribArray(5);
+        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, boundsMax));
+        cgra::gl_state::bind_vertex_array(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // For the Hi-Z passes
+    m_quad.create();
+    glGenFramebuffers(1, &m_hiZFBO);
+}
+
+void ForestCuller::setInstances(const std::vector<Instance>& instances, const std::vector<int>& firstInstance,
+                                const std::vector<int>& instanceCount) {
+    m_instanceCount = int(instances.size());
+    m_firstInstance = firstInstance;
+    m_archetypeCount = instanceCount;
+    m_statsPending = false;
+
+    // Every bucket can hold all of its archetype's instances, a tree is in at most one
+    // bucket per level
+    int variants = int(firstInstance.size());
+    m_bucketFirst.assign(size_t(variants) * LEVELS, 0);
+    m_bucketCount.assign(size_t(variants) * LEVELS, 0);
+    for (int a = 0; a < variants; a++) {
+        for (int level = 0; level < LEVELS; level++) {
+            m_bucketFirst[a * LEVELS + level] = firstInstance[a] * LEVELS + level * instanceCount[a];
+        }
+    }
+
+    if (!isAvailable() || instances.empty()) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_sourceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * LEVELS * instanceStride, NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (m_indirect) {
+        std::vector<glm::uvec2> archetypes(variants);
+        for (int a = 0; a < variants; a++) archetypes[a] = glm::uvec2(firstInstance[a] * LEVELS, instanceCount[a]);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_archetypeBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, archetypes.size() * sizeof(glm::uvec2), archetypes.data(), GL_STATIC_DRAW);
+        for (GLuint buffer : { m_counterBuffer, m_statsBuffer }) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, m_bucketCount.size() * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    } else if (m_queries.size() != m_bucketCount.size()) {
+        if (!m_queries.empty()) glDeleteQueries(GLsizei(m_queries.size()), m_queries.data());
+        m_queries.assign(m_bucketCount.size(), 0);
+        glGenQueries(GLsizei(m_queries.size()), m_queries.data());
+    }
+}
+
+void ForestCuller::setDraws(std::vector<Draw> draws) {
+    m_drawCount = int(draws.size());
+    if (!m_indirect || draws.empty()) return;
+
+    for (Draw& draw : draws) draw.baseInstance = GLuint(m_bucketFirst[draw.bucket]);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_drawBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, draws.size() * sizeof(Draw), draws.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Until the first cull every command draws nothing
+    std::vector<GLuint> empty(draws.size() * commandStride / sizeof(GLuint), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, draws.size() * commandStride, empty.data(), GL_DYNAMIC_COPY);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void ForestCuller::setCullUniforms(const cgra::shader_program& program, const glm::mat4& viewProj, const glm::vec3& cameraPos, const LodSettings& lods) {
+    cgra::gl_state::use_program(program);
+
+    // Frustum planes from the rows of the view-projection (Gribb and Hartmann), pointing inwards
+    glm::mat4 rows = glm::transpose(viewProj);
+    glm::vec4 planes[6] = {
+        rows[3] + rows[0], rows[3] - rows[0],
+        rows[3] + rows[1], rows[3] - rows[1],
+        rows[3] + rows[2], rows[3] - rows[2]
+    };
+    program.set_uniform(program.uniform("uFrustum"), planes, 6);
+    program.set_uniform("uCameraPos", cameraPos);
+
+    program.set_uniform("uLodEnabled", lods.enabled ? 1 : 0);
+    program.set_uniform("uPixelScale", lods.pixelScale);
+    program.set_uniform(program.uniform("uLodPixels"), lods.pixels, LEVELS - 1);
+    program.set_uniform("uLodFadeBand", lods.fadeBand);
+
+    bool occlusion = m_occlusion && m_hiZValid;
+    program.set_uniform("uOcclusion", occlusion ? 1 : 0);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, occlusion ? m_hiZTexture : 0);
+    program.set_uniform("uHiZ", 0);
+    program.set_uniform("uHiZViewProj", m_hiZViewProj);
+    program.set_uniform("uDepthSize", m_depthSize);
+    program.set_uniform("uHiZLevels", m_hiZLevels);
+}
+
+void ForestCuller::cull(const glm::mat4& view, const glm::mat4& proj, const LodSettings& lods) {
+    if (!isAvailable() || m_instanceCount == 0) return;
+
+    glm::mat4 viewProj = proj * view;
+    glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
+    if (m_indirect) {
+        cullCompute(viewProj, cameraPos, lods);
+    } else {
+        cullFeedback(viewProj, cameraPos, lods);
+    }
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+}
+
+void ForestCuller::cullCompute(const glm::mat4& viewProj, const glm::vec3& cameraPos, const LodSettings& lods) {
+    // Last frame's counts have long finished by now, so reading them back doesn't stall
+    if (m_statsPending) {
+        glBindBuffer(GL_COPY_READ_BUFFER, m_statsBuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, m_bucketCount.size() * sizeof(GLuint), m_bucketCount.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counterBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    setCullUniforms(m_cullProgram, viewProj, cameraPos, lods);
+    m_cullProgram.set_uniform("uInstanceCount", GLuint(m_instanceCount));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_sourceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_archetypeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_counterBuffer);
+    glDispatchCompute(GLuint((m_instanceCount + 63) / 64), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    if (m_drawCount > 0) {
+        cgra::gl_state::use_program(m_commandProgram);
+        m_commandProgram.set_uniform("uDrawCount", GLuint(m_drawCount));
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_drawBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_counterBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_commandBuffer);
+        glDispatchCompute(GLuint((m_drawCount + 63) / 64), 1, 1);
+    }
+
+    // The commands and instances are read by the draws next, the counters by the copy
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    for (GLuint binding = 0; binding < 4; binding++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, m_counterBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_statsBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, m_bucketCount.size() * sizeof(GLuint));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_statsPending = true;
+}
+
+void ForestCuller::cullFeedback(const glm::mat4& viewProj, const glm::vec3& cameraPos, const LodSettings& lods) {
+    setCullUniforms(m_feedbackProgram, viewProj, cameraPos, lods);
+    GLint levelLocation = m_feedbackProgram.uniform("uLevel");
+
+    // One pass per bucket, each archetype's range of vertices captured into the bucket's range
+    cgra::gl_state::enable(GL_RASTERIZER_DISCARD);
+    cgra::gl_state::bind_vertex_array(m_sourceVAO);
+    int variants = int(m_firstInstance.size());
+    for (int a = 0; a < variants; a++) {
+        if (m_archetypeCount[a] == 0) continue;
+        for (int level = 0; level < LEVELS; level++) {
+            int bucket = a * LEVELS + level;
+            m_feedbackProgram.set_uniform(levelLocation, level);
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_instanceBuffer,
+                              GLintptr(m_bucketFirst[bucket] * instanceStride), GLsizeiptr(m_archetypeCount[a] * instanceStride));
+            glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, m_queries[bucket]);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, m_firstInstance[a], m_archetypeCount[a]);
+            glEndTransformFeedback();
+            glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+        }
+    }
+    cgra::gl_state::bind_vertex_array(0);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    cgra::gl_state::disable(GL_RASTERIZER_DISCARD);
+
+    // Without indirect draws the counts are needed on the CPU now, this waits for the passes
+    for (int a = 0; a < variants; a++) {
+        for (int level = 0; level < LEVELS; level++) {
+            int bucket = a * LEVELS + level;
+            GLuint written = 0;
+            if (m_archetypeCount[a] > 0) glGetQueryObjectuiv(m_queries[bucket], GL_QUERY_RESULT, &written);
+            m_bucketCount[bucket] = int(written);
+        }
+    }
+}
+
+void ForestCuller::createHiZ(int width, int height) {
+    if (m_hiZTexture == 0) glGenTextures(1, &m_hiZTexture);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_hiZTexture);
+
+    // Every level down to 1x1, each half the one above rounded down
+    int w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+    m_hiZLevels = 0;
+    for (;;) {
+        glTexImage2D(GL_TEXTURE_2D, m_hiZLevels, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+        m_hiZLevels++;
+        if (w == 1 && h == 1) break;
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_hiZLevels - 1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+
+    m_depthSize = glm::ivec2(width, height);
+    m_hiZValid = false;
+}
+
+void ForestCuller::buildOcclusion(GLuint depthTexture, int width, int height, const glm::mat4& viewProj) {
+    if (!isAvailable() || width <= 0 || height <= 0) return;
+    if (m_depthSize != glm::ivec2(width, height)) createHiZ(width, height);
+
+    cgra::offscreen_state saved = cgra::begin_offscreen();
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_hiZFBO);
+    m_quad.bind();
+    cgra::gl_state::use_program(m_hiZProgram);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    m_hiZProgram.set_uniform("uSource", 0);
+
+    // Each level reads the one above, limited to that level so it never samples the one being written
+    glm::ivec2 source(width, height);
+    for (int level = 0; level < m_hiZLevels; level++) {
+        glm::ivec2 target = glm::max(source / 2, glm::ivec2(1));
+        if (level == 0) {
+            cgra::gl_state::bind_texture(GL_TEXTURE_2D, depthTexture);
+        } else {
+            cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_hiZTexture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        }
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_hiZTexture, level);
+        glViewport(0, 0, target.x, target.y);
+        m_hiZProgram.set_uniform("uSourceSize", source);
+        m_hiZProgram.set_uniform("uTargetSize", target);
+        m_quad.draw();
+        source = target;
+    }
+
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_hiZTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_hiZLevels - 1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+
+    // Restore state
+    cgra::end_offscreen(saved);
+
+    m_hiZViewProj = viewProj;
+    m_hiZValid = true;
+}
+
+void ForestCuller::drawIndirect(const cgra::gl_mesh& mesh, int draw) const {
+    cgra::gl_state::bind_vertex_array(mesh.vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    glDrawElementsIndirect(mesh.mode, GL_UNSIGNED_INT, (void*)(size_t(draw) * commandStride));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+// std
+#include <vector>
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_offscreen.hpp"
+#include "cgra/cgra_shader.hpp"
+#include "tree.hpp"
+
+// GPU culling and level of detail selection for the forest's instances.
+//
+// Every instance is tested against the camera frustum and, optionally, a Hi-Z pyramid
+// (max-depth mips) of the previous frame's depth prepass, then assigned a level of detail
+// exactly as Forest::selectLods does on the CPU. Survivors are written to a per
+// [archetype][level] bucket of one instance buffer, so the CPU only issues a fixed
+// number of draws however many trees there are.
+//
+// With GL 4.3 a compute shader appends instances with atomic counters, a second dispatch
+// turns the counts into indirect draw commands, and the forest draws each mesh with
+// glDrawElementsIndirect without reading anything back. On GL 3.3 a vertex and geometry
+// shader do the same tests with transform feedback, one pass per bucket, and the counts
+// come back through GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN queries (which waits for them).
+class ForestCuller {
+public:
+    static const int LEVELS = Tree::LOD_LEVELS + 1;
+
+    // One instance as read by the culling shaders, matches CullInstance in forest_cull.comp.glsl
+    struct Instance {
+        glm::mat4 model;
+        glm::vec4 boundsMin;       // world bounds, w = archetype index
+        glm::vec4 boundsMax;       // w = the archetype's radius for the level of detail
+    };
+
+    // Level of detail thresholds, as used by Forest::selectLods
+    struct LodSettings {
+        bool enabled = true;
+        float pixelScale = 1.0f;   // projected diameter in pixels of a unit sphere at unit distance
+        float pixels[LEVELS - 1] = {};
+        float fadeBand = 0.0f;
+    };
+
+    // Indirect draw of one mesh from one bucket, perTree instances per tree (leaves)
+    struct Draw {
+        GLuint indexCount = 0;
+        GLuint perTree = 0;
+        GLuint bucket = 0;
+        GLuint baseInstance = 0;   // filled in by setDraws
+    };
+
+private:
+    cgra::shader_program m_cullProgram;       // compute path
+    cgra::shader_program m_commandProgram;
+    cgra::shader_program m_feedbackProgram;   // transform feedback path
+    cgra::shader_program m_hiZProgram;
+    bool m_initialised = false;
+    bool m_indirect = false;
+
+    // Instances grouped by archetype, and the output buckets: [archetype][level] holds up
+    // to that archetype's instance count, starting at m_bucketFirst
+    GLuint m_sourceBuffer = 0;
+    GLuint m_sourceVAO = 0;
+    GLuint m_instanceBuffer = 0;
+    int m_instanceCount = 0;
+    std::vector<int> m_firstInstance;
+    std::vector<int> m_archetypeCount;
+    std::vector<int> m_bucketFirst;
+    std::vector<int> m_bucketCount;
+
+    GLuint m_archetypeBuffer = 0;   // compute path: per archetype first output slot and capacity
+    GLuint m_counterBuffer = 0;     // visible instances per bucket
+    GLuint m_statsBuffer = 0;       // copy of the counters, read back a frame later
+    bool m_statsPending = false;
+    GLuint m_drawBuffer = 0;        // Draw templates
+    GLuint m_commandBuffer = 0;     // DrawElementsIndirectCommand per Draw
+    int m_drawCount = 0;
+    std::vector<GLuint> m_queries;  // transform feedback path, one per bucket
+
+    // Hi-Z pyramid of the last buildOcclusion, level 0 at half the depth resolution
+    GLuint m_hiZTexture = 0;
+    GLuint m_hiZFBO = 0;
+    cgra::fullscreen_quad m_quad;
+    glm::ivec2 m_depthSize{0};
+    int m_hiZLevels = 0;
+    glm::mat4 m_hiZViewProj{1.0f};
+    bool m_hiZValid = false;
+    bool m_occlusion = true;
+
+    void createHiZ(int width, int height);
+    void setCullUniforms(const cgra::shader_program& program, const glm::mat4& viewProj, const glm::vec3& cameraPos, const LodSettings& lods);
+    void cullCompute(const glm::mat4& viewProj, const glm::vec3& cameraPos, const LodSettings& lods);
+    void cullFeedback(const glm::mat4& viewProj, const glm::vec3& cameraPos, const LodSettings& lods);
+
+public:
+    ForestCuller() = default;
+    ~ForestCuller();
+
+    ForestCuller(const ForestCuller&) = delete;
+    ForestCuller& operator=(const ForestCuller&) = delete;
+
+    // Builds the shaders for the best supported path, safe to call repeatedly
+    void init();
+    bool isAvailable() const { return m_cullProgram != 0 || m_feedbackProgram != 0; }
+
+    // True when draws come from indirect commands, see drawIndirect
+    bool isIndirect() const { return m_indirect; }
+
+    // Uploads the instances, grouped by archetype into the given ranges
+    void setInstances(const std::vector<Instance>& instances, const std::vector<int>& firstInstance,
+                      const std::vector<int>& instanceCount);
+
+    // Indirect draws issued by drawIndirect, in command order. Call after setInstances.
+    void setDraws(std::vector<Draw> draws);
+
+    // Culls and selects levels for the camera. Occlusion uses the last buildOcclusion.
+    void cull(const glm::mat4& view, const glm::mat4& proj, const LodSettings& lods);
+
+    // Builds the Hi-Z pyramid from a depth texture rendered with viewProj, for the next cull
+    void buildOcclusion(GLuint depthTexture, int width, int height, const glm::mat4& viewProj);
+
+    bool getOcclusion() const { return m_occlusion; }
+    void setOcclusion(bool enabled) { m_occlusion = enabled; }
+
+    // Per-instance attribute buffer of the buckets (see Forest::InstanceData)
+    GLuint getInstanceBuffer() const { return m_instanceBuffer; }
+    int getBucketFirst(int bucket) const { return m_bucketFirst[bucket]; }
+
+    // Instances in each bucket: exact on the transform feedback path, a frame late on the
+    // indirect path, where they are only statistics
+    const std::vector<int>& getBucketCounts() const { return m_bucketCount; }
+
+    // Draws mesh with command draw, its instance attributes must point at the start of
+    // getInstanceBuffer() since the command's base instance selects the bucket
+    void drawIndirect(const cgra::gl_mesh& mesh, int draw) const;
+};
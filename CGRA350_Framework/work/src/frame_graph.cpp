@@ -0,0 +1,280 @@
+// std
+#include <algorithm>
+#include <stdexcept>
+
+// project
+#include "frame_graph.hpp"
+#include "cgra/cgra_state.hpp"
+
+namespace {
+    // Pooled textures are shared by size and format, the clear belongs to each use
+    bool sameStorage(const FrameGraphTextureDesc& a, const FrameGraphTextureDesc& b) {
+        return a.width == b.width && a.height == b.height && a.internalFormat == b.internalFormat;
+    }
+}
+
+bool FrameGraphTextureDesc::isDepth() const {
+    switch (internalFormat) {
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32:
+    case GL_DEPTH_COMPONENT32F:
+        return true;
+    default:
+        return false;
+    }
+}
+
+FrameGraph::Resource FrameGraph::Builder::create(const std::string& name, const FrameGraphTextureDesc& desc) {
+    ResourceNode node;
+    node.name = name;
+    node.desc = desc;
+    node.transient = true;
+    m_graph.m_resources.push_back(node);
+    Resource resource = Resource(m_graph.m_resources.size() - 1);
+    write(resource);
+    return resource;
+}
+
+void FrameGraph::Builder::read(Resource resource) {
+    std::vector<Resource>& reads = m_graph.m_passes[m_pass].reads;
+    if (std::find(reads.begin(), reads.end(), resource) != reads.end()) return;
+    reads.push_back(resource);
+    m_graph.m_resources[resource].readers.push_back(m_pass);
+}
+
+void FrameGraph::Builder::write(Resource resource) {
+    std::vector<Resource>& writes = m_graph.m_passes[m_pass].writes;
+    if (std::find(writes.begin(), writes.end(), resource) != writes.end()) return;
+    writes.push_back(resource);
+    m_graph.m_resources[resource].writers.push_back(m_pass);
+}
+
+void FrameGraph::Builder::renderTo(Resource resource) {
+    write(resource);
+    m_graph.m_passes[m_pass].target = resource;
+}
+
+void FrameGraph::Builder::sideEffect() {
+    m_graph.m_passes[m_pass].sideEffect = true;
+}
+
+FrameGraph::~FrameGraph() {
+    for (PooledTexture& pooled : m_pool) {
+        cgra::gl_state::delete_framebuffers(1, &pooled.framebuffer);
+        cgra::gl_state::delete_textures(1, &pooled.texture);
+    }
+}
+
+void FrameGraph::reset() {
+    m_resources.clear();
+    m_passes.clear();
+    m_order.clear();
+}
+
+FrameGraph::Resource FrameGraph::importBackbuffer(const std::string& name, int width, int height, GLbitfield clear, const glm::vec4& clearColour) {
+    ResourceNode node;
+    node.name = name;
+    node.desc.width = width;
+    node.desc.height = height;
+    node.desc.clear = clear;
+    node.clearColour = clearColour;
+    node.output = true;
+    m_resources.push_back(node);
+    return Resource(m_resources.size() - 1);
+}
+
+FrameGraph::Resource FrameGraph::import(const std::string& name, GLuint texture) {
+    ResourceNode node;
+    node.name = name;
+    node.texture = texture;
+    m_resources.push_back(node);
+    return Resource(m_resources.size() - 1);
+}
+
+void FrameGraph::addPass(const std::string& name, const Setup& setup, const Execute& execute) {
+    PassNode pass;
+    pass.name = name;
+    pass.execute = execute;
+    m_passes.push_back(pass);
+
+    Builder builder(*this, int(m_passes.size() - 1));
+    setup(builder);
+}
+
+void FrameGraph::compile() {
+    int passCount = int(m_passes.size());
+
+    // A pass depends on the writers of what it reads, and on the earlier writers of what
+    // it writes since it may draw over their results
+    std::vector<std::vector<int>> dependencies(passCount);
+    for (const ResourceNode& resource : m_resources) {
+        for (size_t w = 1; w < resource.writers.size(); w++) {
+            dependencies[resource.writers[w]].push_back(resource.writers[w - 1]);
+        }
+        for (int reader : resource.readers) {
+            for (int writer : resource.writers) {
+                if (writer != reader) dependencies[reader].push_back(writer);
+            }
+        }
+    }
+
+    // Passes that reach the backbuffer or outside the graph run, and so does everything
+    // they depend on
+    std::vector<int> stack;
+    for (int p = 0; p < passCount; p++) {
+        PassNode& pass = m_passes[p];
+        pass.live = pass.sideEffect;
+        for (Resource resource : pass.writes) pass.live |= m_resources[resource].output;
+        if (pass.live) stack.push_back(p);
+    }
+    while (!stack.empty()) {
+        int p = stack.back();
+        stack.pop_back();
+        for (int dependency : dependencies[p]) {
+            if (!m_passes[dependency].live) {
+                m_passes[dependency].live = true;
+                stack.push_back(dependency);
+            }
+        }
+    }
+
+    // Live passes in dependency order, the earliest declared first among those ready
+    std::vector<bool> done(passCount, false);
+    m_order.clear();
+    for (int p = 0; p < passCount; p++) done[p] = !m_passes[p].live;
+    for (;;) {
+        int next = -1;
+        bool remaining = false;
+        for (int p = 0; p < passCount && next < 0; p++) {
+            if (done[p]) continue;
+            remaining = true;
+            bool ready = true;
+            for (int dependency : dependencies[p]) ready &= done[dependency];
+            if (ready) next = p;
+        }
+        if (next < 0) {
+            if (remaining) throw std::runtime_error("Frame graph has a dependency cycle");
+            break;
+        }
+        done[next] = true;
+        m_order.push_back(next);
+    }
+
+    for (int i = 0; i < int(m_order.size()); i++) {
+        const PassNode& pass = m_passes[m_order[i]];
+        for (const std::vector<Resource>* uses : { &pass.reads, &pass.writes }) {
+            for (Resource r : *uses) {
+                ResourceNode& resource = m_resources[r];
+                if (resource.firstUse < 0) resource.firstUse = i;
+                resource.lastUse = i;
+            }
+        }
+    }
+}
+
+int FrameGraph::acquire(const FrameGraphTextureDesc& desc) {
+    for (size_t i = 0; i < m_pool.size(); i++) {
+        if (!m_pool[i].inUse && sameStorage(m_pool[i].desc, desc)) {
+            m_pool[i].inUse = true;
+            m_pool[i].usedThisFrame = true;
+            return int(i);
+        }
+    }
+
+    PooledTexture pooled;
+    pooled.desc = desc;
+    pooled.inUse = true;
+    pooled.usedThisFrame = true;
+
+    bool depth = desc.isDepth();
+    glGenTextures(1, &pooled.texture);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, pooled.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0,
+                 depth ? GL_DEPTH_COMPONENT : GL_RGBA, depth ? GL_FLOAT : GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+
+    GLuint previousFBO = cgra::gl_state::bound_framebuffer(GL_FRAMEBUFFER);
+    glGenFramebuffers(1, &pooled.framebuffer);
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, pooled.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, depth ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pooled.texture, 0);
+    if (depth) {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, previousFBO);
+
+    m_pool.push_back(pooled);
+    return int(m_pool.size() - 1);
+}
+
+void FrameGraph::release(int pooled) {
+    m_pool[pooled].inUse = false;
+}
+
+void FrameGraph::execute(const std::function<void(const std::string&)>& beforePass) {
+    compile();
+
+    for (int i = 0; i < int(m_order.size()); i++) {
+        PassNode& pass = m_passes[m_order[i]];
+
+        for (Resource r : pass.writes) {
+            ResourceNode& resource = m_resources[r];
+            if (resource.transient && resource.pooled < 0) {
+                resource.pooled = acquire(resource.desc);
+                resource.texture = m_pool[resource.pooled].texture;
+                resource.framebuffer = m_pool[resource.pooled].framebuffer;
+            }
+        }
+
+        if (pass.target != NONE) {
+            ResourceNode& target = m_resources[pass.target];
+            cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, target.framebuffer);
+            glViewport(0, 0, target.desc.width, target.desc.height);
+            if (!target.cleared && target.desc.clear) {
+                if (target.desc.clear & GL_COLOR_BUFFER_BIT) {
+                    glClearColor(target.clearColour.r, target.clearColour.g, target.clearColour.b, target.clearColour.a);
+                }
+                if (target.desc.clear & GL_DEPTH_BUFFER_BIT) cgra::gl_state::depth_mask(GL_TRUE);
+                glClear(target.desc.clear);
+            }
+            target.cleared = true;
+        }
+
+        if (beforePass) beforePass(pass.name);
+        pass.execute(*this);
+
+        // Storage whose last pass has run is free for the targets of later passes
+        for (const std::vector<Resource>* uses : { &pass.reads, &pass.writes }) {
+            for (Resource r : *uses) {
+                ResourceNode& resource = m_resources[r];
+                if (resource.transient && resource.lastUse == i && resource.pooled >= 0) {
+                    release(resource.pooled);
+                    resource.pooled = -1;
+                }
+            }
+        }
+    }
+
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+    // Textures no pass asked for this frame (after a resize, say) are dropped
+    for (size_t i = 0; i < m_pool.size();) {
+        if (m_pool[i].usedThisFrame) {
+            m_pool[i].usedThisFrame = false;
+            i++;
+        } else {
+            cgra::gl_state::delete_framebuffers(1, &m_pool[i].framebuffer);
+            cgra::gl_state::delete_textures(1, &m_pool[i].texture);
+            m_pool.erase(m_pool.begin() + i);
+        }
+    }
+}
+
+GLuint FrameGraph::getTexture(Resource resource) const {
+    return m_resources[resource].texture;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+// std
+#include <functional>
+#include <string>
+#include <vector>
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// A texture the graph owns for the frame. Targets with the same description share the
+// pooled textures, so two whose passes don't overlap end up in the same storage.
+struct FrameGraphTextureDesc {
+    int width = 0;
+    int height = 0;
+    GLenum internalFormat = GL_RGBA8;
+    GLbitfield clear = 0;           // cleared by the first pass that renders to it
+
+    bool isDepth() const;
+};
+
+// The passes of a frame and the resources they share.
+//
+// Each frame the passes are declared again with the resources they read and write. The
+// graph then orders them so a resource is read only after all its writers have run (in
+// declaration order where nothing else decides), drops passes whose results nothing
+// reads, and gives each transient texture pooled storage for just the passes between its
+// first and last use. A pass that renders to a resource has its framebuffer and viewport
+// bound for it, and the resource is cleared once, by the first such pass that runs.
+//
+// GL orders render-to-texture writes and later reads by itself, so the graph places no
+// barriers. Passes that write through images or storage buffers keep their own.
+class FrameGraph {
+public:
+    typedef int Resource;
+    static const Resource NONE = -1;
+
+    class Builder {
+    private:
+        FrameGraph& m_graph;
+        int m_pass;
+
+    public:
+        Builder(FrameGraph& graph, int pass) : m_graph(graph), m_pass(pass) {}
+
+        // A texture allocated from the pool and written by this pass
+        Resource create(const std::string& name, const FrameGraphTextureDesc& desc);
+
+        // Reads see the resource after every pass that writes it
+        void read(Resource resource);
+        void write(Resource resource);
+
+        // Writes the resource as this pass's render target
+        void renderTo(Resource resource);
+
+        // The pass has effects outside the graph and always runs
+        void sideEffect();
+    };
+
+    typedef std::function<void(Builder&)> Setup;
+    typedef std::function<void(const FrameGraph&)> Execute;
+
+private:
+    struct ResourceNode {
+        std::string name;
+        FrameGraphTextureDesc desc;
+        glm::vec4 clearColour = glm::vec4(0.0f);
+        bool transient = false;
+        bool output = false;        // the backbuffer, its writers always run
+        GLuint texture = 0;
+        GLuint framebuffer = 0;
+        std::vector<int> writers, readers;
+        int firstUse = -1, lastUse = -1;    // positions in m_order
+        int pooled = -1;
+        bool cleared = false;
+    };
+
+    struct PassNode {
+        std::string name;
+        Execute execute;
+        std::vector<Resource> reads, writes;
+        Resource target = NONE;
+        bool sideEffect = false;
+        bool live = false;
+    };
+
+    struct PooledTexture {
+        FrameGraphTextureDesc desc;
+        GLuint texture = 0;
+        GLuint framebuffer = 0;
+        bool inUse = false;
+        bool usedThisFrame = false;
+    };
+
+    std::vector<ResourceNode> m_resources;
+    std::vector<PassNode> m_passes;
+    std::vector<int> m_order;       // live passes in execution order
+    std::vector<PooledTexture> m_pool;
+
+    void compile();
+    int acquire(const FrameGraphTextureDesc& desc);
+    void release(int pooled);
+
+public:
+    FrameGraph() = default;
+    ~FrameGraph();
+
+    FrameGraph(const FrameGraph&) = delete;
+    FrameGraph& operator=(const FrameGraph&) = delete;
+
+    // Forgets the last frame's passes and resources, the pooled textures are kept
+    void reset();
+
+    // The default framebuffer, cleared to clearColour by its first pass
+    Resource importBackbuffer(const std::string& name, int width, int height, GLbitfield clear, const glm::vec4& clearColour);
+
+    // Something owned outside the graph (a module's render target, a buffer) that passes
+    // depend on through it. Passes that write it bind it themselves.
+    Resource import(const std::string& name, GLuint texture = 0);
+
+    void addPass(const std::string& name, const Setup& setup, const Execute& execute);
+
+    // Orders, culls and runs the passes. beforePass, if given, is called with the name
+    // of each pass about to run.
+    void execute(const std::function<void(const std::string&)>& beforePass = nullptr);
+
+    // The texture behind a resource, valid while the pass that asks runs
+    GLuint getTexture(Resource resource) const;
+
+    int getPassCount() const { return int(m_passes.size()); }
+    int getCulledPassCount() const { return int(m_passes.size() - m_order.size()); }
+    int getPooledTextureCount() const { return int(m_pool.size()); }
+};
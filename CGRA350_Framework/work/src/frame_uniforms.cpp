@@ -0,0 +1,39 @@
+#include "frame_uniforms.hpp"
+
+FrameUniforms::~FrameUniforms() {
+    if (m_buffer) glDeleteBuffers(1, &m_buffer);
+}
+
+void FrameUniforms::init() {
+    if (m_buffer) return;
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void FrameUniforms::attach(const cgra::shader_program& program) {
+    program.bind_uniform_block("FrameUniforms", BINDING);
+}
+
+void FrameUniforms::setCamera(const glm::mat4& view, const glm::mat4& proj) {
+    m_data.view = view;
+    m_data.proj = proj;
+    m_data.viewProj = proj * view;
+    m_data.invViewProj = glm::inverse(m_data.viewProj);
+    m_data.cameraPos = glm::vec3(glm::inverse(view)[3]);
+}
+
+void FrameUniforms::setSun(const glm::vec3& sunPos, const glm::vec3& sunColour) {
+    m_data.sunPos = sunPos;
+    m_data.sunColour = sunColour;
+}
+
+void FrameUniforms::upload() {
+    // Orphan the previous frame's storage rather than wait for draws still reading it
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &m_data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, m_buffer);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_shader.hpp"
+
+// Mirrors the std140 FrameUniforms block in frame_uniforms.glsl. A vec3 takes 16 bytes
+// unless a scalar packs into its fourth component.
+struct FrameData {
+    glm::mat4 view;
+    glm::mat4 proj;
+    glm::mat4 viewProj;
+    glm::mat4 invViewProj;
+    glm::vec3 cameraPos;
+    float pad0;
+    glm::vec3 sunPos;
+    float pad1;
+    glm::vec3 sunColour;
+    float lightSize;
+    float nearPlane;
+    int blockerSearchSamples;
+    int pcfSamples;
+    int pad2;
+
+    glm::mat4 cascadeMatrices[4];
+    glm::vec4 cascadeSplits;
+    glm::vec4 cascadeScale;
+    glm::vec4 cascadeFilterScale;
+    glm::vec3 cascadeCameraPos;
+    int cascadeCount;
+    glm::vec3 cascadeCameraForward;
+    float pad3;
+};
+
+static_assert(sizeof(FrameData) == 656, "FrameData must match the std140 layout of FrameUniforms");
+
+// The per-frame uniform buffer. Everything that is the same for every draw in a frame
+// (camera, sun, shadow filtering and cascades) is written into data() as it becomes
+// known, uploaded once, and read by every scene shader from BINDING.
+class FrameUniforms {
+private:
+    GLuint m_buffer = 0;
+    FrameData m_data = {};
+
+public:
+    static const GLuint BINDING = 0;
+
+    FrameUniforms() = default;
+    ~FrameUniforms();
+
+    FrameUniforms(const FrameUniforms&) = delete;
+    FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+    void init();
+
+    // Points the program's FrameUniforms block, if it has one, at BINDING
+    static void attach(const cgra::shader_program& program);
+
+    FrameData& data() { return m_data; }
+
+    void setCamera(const glm::mat4& view, const glm::mat4& proj);
+    void setSun(const glm::vec3& sunPos, const glm::vec3& sunColour);
+
+    // Uploads data() and binds the buffer to BINDING
+    void upload();
+};
@@ -0,0 +1,92 @@
+// project
+#include "gpu_profiler.hpp"
+#include "cgra/cgra_gui.hpp"
+
+namespace {
+    // Weight of the newest sample in the displayed average
+    const double averageBlend = 0.1;
+
+    // Passes not timed for this many frames are shown as idle
+    const unsigned idleFrames = 30;
+}
+
+GpuProfiler::~GpuProfiler() {
+    for (Pass& pass : m_passes) {
+        glDeleteQueries(FRAME_LATENCY, pass.queries);
+    }
+}
+
+void GpuProfiler::collect(Pass& pass) {
+    for (int slot = 0; slot < FRAME_LATENCY; slot++) {
+        if (!pass.pending[slot]) continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &elapsed);
+        double ms = double(elapsed) / 1.0e6;
+        pass.averageMs = (pass.averageMs == 0.0) ? ms : pass.averageMs + (ms - pass.averageMs) * averageBlend;
+        pass.pending[slot] = false;
+    }
+}
+
+void GpuProfiler::beginFrame() {
+    end();
+    m_frame++;
+    for (Pass& pass : m_passes) collect(pass);
+}
+
+void GpuProfiler::begin(const std::string& name) {
+    if (!m_enabled) return;
+    // Only one time-elapsed query can be active, so a new pass ends the current one
+    end();
+
+    int index = -1;
+    for (int i = 0; i < int(m_passes.size()); i++) {
+        if (m_passes[i].name == name) index = i;
+    }
+    if (index < 0) {
+        m_passes.emplace_back();
+        m_passes.back().name = name;
+        glGenQueries(FRAME_LATENCY, m_passes.back().queries);
+        index = int(m_passes.size()) - 1;
+    }
+
+    // A slot still pending after FRAME_LATENCY frames is dropped and reused
+    Pass& pass = m_passes[index];
+    int slot = m_frame % FRAME_LATENCY;
+    glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+    pass.pending[slot] = true;
+    pass.lastFrame = m_frame;
+    m_active = index;
+}
+
+void GpuProfiler::end() {
+    if (m_active < 0) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    m_active = -1;
+}
+
+void GpuProfiler::renderGUI() {
+    if (!m_enabled) return;
+
+    ImGui::SetNextWindowPos(ImVec2(310, 5), ImGuiSetCond_Once);
+    ImGui::Begin("GPU Profiler", 0, ImGuiWindowFlags_AlwaysAutoResize);
+
+    double total = 0.0;
+    for (const Pass& pass : m_passes) {
+        bool idle = m_frame - pass.lastFrame > idleFrames;
+        if (idle) {
+            ImGui::TextDisabled("%-28s %6.3f ms (idle)", pass.name.c_str(), pass.averageMs);
+        } else {
+            ImGui::Text("%-28s %6.3f ms", pass.name.c_str(), pass.averageMs);
+            total += pass.averageMs;
+        }
+    }
+    ImGui::Separator();
+    ImGui::Text("%-28s %6.3f ms", "Total (timed passes)", total);
+
+    ImGui::End();
+}
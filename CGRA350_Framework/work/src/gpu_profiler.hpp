@@ -0,0 +1,54 @@
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+// OpenGL
+#include <GL/glew.h>
+
+// GPU timings of named render passes using GL_TIME_ELAPSED queries.
+//
+// Results are read back a few frames late so querying never stalls the pipeline. Passes
+// can't be nested (only one GL_TIME_ELAPSED query may be active), beginning one ends the
+// current one. A pass that stops being drawn keeps its last average, shown as idle, so
+// alternatives such as the two shadow filters can be compared side by side.
+class GpuProfiler {
+public:
+    static const int FRAME_LATENCY = 4;
+
+private:
+    struct Pass {
+        std::string name;
+        GLuint queries[FRAME_LATENCY] = {};
+        bool pending[FRAME_LATENCY] = {};
+        double averageMs = 0.0;
+        unsigned lastFrame = 0;     // last frame the pass was timed in
+    };
+
+    std::vector<Pass> m_passes;
+    int m_active = -1;
+    unsigned m_frame = 0;
+    bool m_enabled = true;
+
+    void collect(Pass& pass);
+
+public:
+    GpuProfiler() = default;
+    ~GpuProfiler();
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    // Call once at the start of every frame, reads back finished queries
+    void beginFrame();
+
+    void begin(const std::string& name);
+    void end();
+
+    bool getEnabled() const { return m_enabled; }
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+
+    // Draws the timings as a small ImGui window
+    void renderGUI();
+};
@@ -39,9 +39,7 @@ int main() {
 		abort(); // unrecoverable error
 	}
 
-	// force OpenGL to create a 3.3 core context
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	// force OpenGL to create a core context
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 	// disallow legacy functionality (helps OS X work)
@@ -56,7 +54,14 @@ int main() {
 	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
 
 	// create a windowed mode window and its OpenGL context
-	GLFWwindow *window = glfwCreateWindow(800, 600, "Hello World!", nullptr, nullptr);
+	// try 4.3 first for compute shaders (GPU tree generation), then fall back to 3.3
+	GLFWwindow *window = nullptr;
+	for (int version : { 43, 33 }) {
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version / 10);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version % 10);
+		window = glfwCreateWindow(800, 600, "Hello World!", nullptr, nullptr);
+		if (window) break;
+	}
 	if (!window) {
 		cerr << "Error: Could not create GLFW window" << endl;
 		abort(); // unrecoverable error
@@ -12,6 +12,8 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include "cgra/cgra_state.hpp"
+
 
 
 namespace cgra {
@@ -23,9 +25,9 @@ namespace cgra {
 		if (vao == 0) {
 			glGenVertexArrays(1, &vao);
 		}
-		glBindVertexArray(vao);
+		gl_state::bind_vertex_array(vao);
 		glDrawArraysInstanced(GL_POINTS, 0, 1, instances);
-		glBindVertexArray(0);
+		gl_state::bind_vertex_array(0);
 	}
 
 
@@ -112,21 +114,21 @@ namespace cgra {
 		static gl_object gen_vertex_array() {
 			GLuint o;
 			glGenVertexArrays(1, &o);
-			return { o, glDeleteVertexArrays };
+			return { o, gl_state::delete_vertex_arrays };
 		}
 
 		// returns a gl_object with an OpenGL texture identifier
 		static gl_object gen_texture() {
 			GLuint o;
 			glGenTextures(1, &o);
-			return { o, glDeleteTextures };
+			return { o, gl_state::delete_textures };
 		}
 
 		// returns a gl_object with an OpenGL framebuffer identifier
 		static gl_object gen_framebuffer() {
 			GLuint o;
 			glGenFramebuffers(1, &o);
-			return { o, glDeleteFramebuffers };
+			return { o, gl_state::delete_framebuffers };
 		}
 
 		// returns a gl_object with an OpenGL shader identifier
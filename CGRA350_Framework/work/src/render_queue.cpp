@@ -0,0 +1,72 @@
+// std
+#include <algorithm>
+#include <cstring>
+
+// project
+#include "render_queue.hpp"
+
+namespace {
+    const int PASS_SHIFT = 62;
+    const uint64_t PROGRAM_MASK = 0xfff;
+    const uint64_t MATERIAL_MASK = 0xffff;
+
+    // Non-negative floats order the same as their bit patterns, which leaves 31 bits
+    uint64_t distanceBits(float distance) {
+        distance = distance > 0.0f ? distance : 0.0f;   // also catches NaN
+        uint32_t bits;
+        std::memcpy(&bits, &distance, sizeof(bits));
+        return bits;
+    }
+}
+
+uint64_t RenderQueue::makeKey(Pass pass, GLuint program, GLuint material, float distance) {
+    uint64_t key = uint64_t(pass) << PASS_SHIFT;
+    if (pass == TRANSPARENT) {
+        key |= (0x7fffffffull - distanceBits(distance)) << 28;
+        key |= (program & PROGRAM_MASK) << 16;
+        key |= material & MATERIAL_MASK;
+    } else {
+        key |= (program & PROGRAM_MASK) << 50;
+        key |= (material & MATERIAL_MASK) << 34;
+        key |= distanceBits(distance);
+    }
+    return key;
+}
+
+void RenderQueue::clear() {
+    m_items.clear();
+    m_sorted = true;
+    m_drawCount = 0;
+    m_programChanges = 0;
+}
+
+void RenderQueue::submit(Pass pass, GLuint program, GLuint material, float distance, const Draw& draw) {
+    Item item;
+    item.key = makeKey(pass, program, material, distance);
+    item.program = program;
+    item.draw = draw;
+    m_items.push_back(item);
+    m_sorted = false;
+}
+
+void RenderQueue::execute(Pass pass) {
+    if (!m_sorted) {
+        std::stable_sort(m_items.begin(), m_items.end(), [](const Item& a, const Item& b) { return a.key < b.key; });
+        m_sorted = true;
+    }
+
+    uint64_t passKey = uint64_t(pass) << PASS_SHIFT;
+    auto begin = std::lower_bound(m_items.begin(), m_items.end(), passKey,
+                                  [](const Item& item, uint64_t key) { return item.key < key; });
+
+    bool first = true;
+    GLuint program = 0;
+    for (auto it = begin; it != m_items.end() && (it->key >> PASS_SHIFT) == uint64_t(pass); ++it) {
+        if (first || it->program != program) m_programChanges++;
+        first = false;
+        program = it->program;
+
+        it->draw();
+        m_drawCount++;
+    }
+}
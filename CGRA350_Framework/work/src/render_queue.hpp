@@ -0,0 +1,57 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// OpenGL
+#include <GL/glew.h>
+
+// The frame's draws, sorted before they are issued.
+//
+// Every draw gets a 64-bit key with its pass in the top bits, then its program, its
+// material (whatever it binds, usually its main texture) and its distance from the
+// camera. Sorting the keys groups the draws of a pass by program and material, so state
+// changes only when it must, and orders draws that share both front to back so early
+// depth tests reject what they can. Transparent draws put the distance before the
+// program, inverted, to blend back to front.
+class RenderQueue {
+public:
+    enum Pass {
+        DEPTH_PREPASS,
+        OPAQUE,
+        TRANSPARENT,
+        PASS_COUNT
+    };
+
+    typedef std::function<void()> Draw;
+
+private:
+    struct Item {
+        uint64_t key;
+        GLuint program;
+        Draw draw;
+    };
+
+    std::vector<Item> m_items;
+    bool m_sorted = true;
+    int m_drawCount = 0;
+    int m_programChanges = 0;
+
+public:
+    // distance is from the camera to the nearest point of what is drawn
+    static uint64_t makeKey(Pass pass, GLuint program, GLuint material, float distance);
+
+    // Forgets the last frame's draws
+    void clear();
+
+    void submit(Pass pass, GLuint program, GLuint material, float distance, const Draw& draw);
+
+    // Issues the draws of one pass in key order
+    void execute(Pass pass);
+
+    // Draws issued since clear, and how often the program changed between them
+    int getDrawCount() const { return m_drawCount; }
+    int getProgramChanges() const { return m_programChanges; }
+};
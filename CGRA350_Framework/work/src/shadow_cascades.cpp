@@ -0,0 +1,254 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+
+// project
+#include "frame_uniforms.hpp"
+#include "shadow_cascades.hpp"
+
+namespace {
+    // World size the PCSS light size (uLightSize) was tuned for: the old fixed 60x60 ortho
+    const float referenceExtent = 60.0f;
+}
+
+CascadedShadowMap::~CascadedShadowMap() {
+    if (m_fbo) cgra::gl_state::delete_framebuffers(1, &m_fbo);
+    if (m_depthArray) cgra::gl_state::delete_textures(1, &m_depthArray);
+}
+
+void CascadedShadowMap::init() {
+    glGenFramebuffers(1, &m_fbo);
+    createTargets();
+}
+
+void CascadedShadowMap::createTargets() {
+    int size = 0;
+    for (int i = 0; i < m_cascadeCount; i++) size = std::max(size, m_resolution[i]);
+    if (size == m_arraySize && m_depthArray) return;
+
+    if (m_depthArray) cgra::gl_state::delete_textures(1, &m_depthArray);
+    glGenTextures(1, &m_depthArray);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, m_depthArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, MAX_CASCADES, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+
+    m_arraySize = size;
+
+    // The new array is empty, so every cascade has to be rendered straight away
+    invalidate();
+    for (int i = 0; i < MAX_CASCADES; i++) m_renderedFrame[i] = 0;
+}
+
+void CascadedShadowMap::setCascadeCount(int count) {
+    count = glm::clamp(count, 1, MAX_CASCADES);
+    if (count != m_cascadeCount) invalidate();
+    m_cascadeCount = count;
+}
+
+void CascadedShadowMap::setResolution(int cascade, int resolution) {
+    resolution = glm::clamp(resolution, 256, 4096);
+    if (resolution != m_resolution[cascade]) m_valid[cascade] = false;
+    m_resolution[cascade] = resolution;
+}
+
+void CascadedShadowMap::invalidate() {
+    for (int i = 0; i < MAX_CASCADES; i++) m_valid[i] = false;
+}
+
+long long CascadedShadowMap::getTexelCount() const {
+    long long total = 0;
+    for (int i = 0; i < m_cascadeCount; i++) total += (long long)m_resolution[i] * m_resolution[i];
+    return total;
+}
+
+void CascadedShadowMap::update(const glm::mat4& view, float fovY, float aspect, float nearPlane, const glm::vec3& sunPos) {
+    createTargets();
+
+    glm::mat4 invView = glm::inverse(view);
+    m_cameraPos = glm::vec3(invView[3]);
+    m_cameraForward = -glm::normalize(glm::vec3(invView[2]));
+
+    // Practical split scheme: blend of logarithmic and uniform distributions
+    float farPlane = m_shadowDistance;
+    for (int i = 0; i < m_cascadeCount; i++) {
+        float p = float(i + 1) / float(m_cascadeCount);
+        float logSplit = nearPlane * std::pow(farPlane / nearPlane, p);
+        float uniformSplit = nearPlane + (farPlane - nearPlane) * p;
+        m_splits[i] = glm::mix(uniformSplit, logSplit, m_splitLambda);
+    }
+
+    // Keep the cached light direction until the sun has moved past the threshold
+    glm::vec3 sunDir = glm::normalize(sunPos);
+    float cosThreshold = std::cos(glm::radians(m_angleThreshold));
+    if (!m_cacheEnabled || glm::dot(sunDir, m_lightDir) < cosThreshold) {
+        m_lightDir = sunDir;
+        invalidate();
+    }
+
+    glm::vec3 lightDir = m_lightDir;
+    glm::vec3 up = (std::abs(lightDir.z) > 0.99f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 0, 1);
+
+    float tanHalfY = std::tan(fovY * 0.5f);
+    float tanHalfX = tanHalfY * aspect;
+
+    for (int i = 0; i < m_cascadeCount; i++) {
+        float sliceNear = (i == 0) ? nearPlane : m_splits[i - 1];
+        float sliceFar = m_splits[i];
+
+        // Corners of the frustum slice in world space
+        glm::vec3 corners[8];
+        int c = 0;
+        for (float d : { sliceNear, sliceFar }) {
+            for (int y = -1; y <= 1; y += 2) {
+                for (int x = -1; x <= 1; x += 2) {
+                    glm::vec4 viewCorner(x * tanHalfX * d, y * tanHalfY * d, -d, 1.0f);
+                    corners[c++] = glm::vec3(invView * viewCorner);
+                }
+            }
+        }
+
+        glm::vec3 center(0.0f);
+        for (const glm::vec3& corner : corners) center += corner;
+        center /= 8.0f;
+
+        float radius = 0.0f;
+        for (const glm::vec3& corner : corners) radius = std::max(radius, glm::length(corner - center));
+        // A cached cascade is still usable while its slice stays inside the rendered region
+        bool reusable = m_cacheEnabled && m_valid[i] && covers(i, center, radius);
+        m_stale[i] = !reusable;
+        if (reusable) continue;
+
+        radius = std::ceil(radius * m_fitPadding * 16.0f) / 16.0f;
+
+        float depth = radius + m_casterMargin;
+        glm::mat4 lightView = glm::lookAt(center + lightDir * depth, center, up);
+        glm::mat4 lightProj = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * depth);
+
+        // Snap the projected world origin to a texel so the map only moves in whole texels
+        float halfRes = m_resolution[i] * 0.5f;
+        glm::vec4 origin = lightProj * lightView * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        glm::vec2 texelOrigin = glm::vec2(origin) * halfRes;
+        glm::vec2 offset = (glm::round(texelOrigin) - texelOrigin) / halfRes;
+        lightProj[3][0] += offset.x;
+        lightProj[3][1] += offset.y;
+
+        m_fitLightSpace[i] = lightProj * lightView;
+        m_fitRadius[i] = radius;
+        m_fitDepth[i] = depth;
+    }
+}
+
+bool CascadedShadowMap::covers(int cascade, const glm::vec3& center, float radius) const {
+    // Don't keep a cascade that is much larger than needed, it wastes resolution
+    if (radius * m_fitPadding < m_radius[cascade] * 0.8f) return false;
+
+    // Orthographic, so the sphere maps to a circle of radius / m_radius in NDC
+    glm::vec3 ndc = glm::vec3(m_lightSpace[cascade] * glm::vec4(center, 1.0f));
+    float r = radius / m_radius[cascade];
+    float rz = radius / m_depth[cascade];
+    float marginZ = m_casterMargin / m_depth[cascade];
+
+    return std::abs(ndc.x) + r <= 1.0f && std::abs(ndc.y) + r <= 1.0f &&
+           ndc.z - rz - marginZ >= -1.0f && ndc.z + rz <= 1.0f;
+}
+
+bool CascadedShadowMap::intersects(int cascade, const glm::vec3& boundsMin, const glm::vec3& boundsMax) const {
+    // The projection is orthographic, so the box maps to a box around its projected centre
+    // whose half extents are the absolute matrix applied to the world half extents
+    const glm::mat4& m = m_lightSpace[cascade];
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    glm::vec3 halfSize = (boundsMax - boundsMin) * 0.5f;
+    glm::vec3 ndc = glm::vec3(m * glm::vec4(center, 1.0f));
+
+    for (int k = 0; k < 3; k++) {
+        float extent = std::abs(m[0][k]) * halfSize.x + std::abs(m[1][k]) * halfSize.y + std::abs(m[2][k]) * halfSize.z;
+        if (ndc[k] - extent > 1.0f || ndc[k] + extent < -1.0f) return false;
+    }
+    return true;
+}
+
+void CascadedShadowMap::render(const cgra::shader_program& shadowShader, const std::function<void(int cascade)>& drawCasters) {
+    m_frame++;
+
+    // Pick the stale cascades to render this frame. When amortizing only the one that
+    // was rendered longest ago is updated, except cascades that were never rendered.
+    bool renderCascade[MAX_CASCADES] = {};
+    int oldest = -1;
+    for (int i = 0; i < m_cascadeCount; i++) {
+        if (!m_stale[i]) continue;
+        if (!m_amortize || m_renderedFrame[i] == 0) {
+            renderCascade[i] = true;
+        } else if (oldest < 0 || m_renderedFrame[i] < m_renderedFrame[oldest]) {
+            oldest = i;
+        }
+    }
+    if (oldest >= 0) {
+        bool any = false;
+        for (int i = 0; i < m_cascadeCount; i++) any |= renderCascade[i];
+        if (!any) renderCascade[oldest] = true;
+    }
+
+    m_renderedLastFrame = 0;
+    for (int i = 0; i < m_cascadeCount; i++) m_renderedLastFrame += renderCascade[i];
+    if (m_renderedLastFrame == 0) return;
+
+    cgra::gl_state::use_program(shadowShader);
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_fbo);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    cgra::gl_state::enable(GL_SCISSOR_TEST);
+
+    for (int i = 0; i < m_cascadeCount; i++) {
+        if (!renderCascade[i]) continue;
+
+        m_lightSpace[i] = m_fitLightSpace[i];
+        m_radius[i] = m_fitRadius[i];
+        m_depth[i] = m_fitDepth[i];
+        m_renderedResolution[i] = m_resolution[i];
+        m_renderedFrame[i] = m_frame;
+        m_valid[i] = true;
+        m_stale[i] = false;
+
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthArray, 0, i);
+
+        // Only touch this cascade's corner of the layer
+        glViewport(0, 0, m_resolution[i], m_resolution[i]);
+        glScissor(0, 0, m_resolution[i], m_resolution[i]);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        shadowShader.set_uniform("lightSpaceMatrix", m_lightSpace[i]);
+        drawCasters(i);
+    }
+
+    cgra::gl_state::disable(GL_SCISSOR_TEST);
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void CascadedShadowMap::bind(GLuint program, int unit) const {
+    cgra::gl_state::use_program(program);
+    cgra::gl_state::active_texture(GL_TEXTURE0 + unit);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, m_depthArray);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(program, "uShadowCascades"), unit);
+}
+
+void CascadedShadowMap::writeFrameData(FrameData& data) const {
+    for (int i = 0; i < MAX_CASCADES; i++) {
+        bool used = i < m_cascadeCount;
+        data.cascadeMatrices[i] = m_lightSpace[i];
+        data.cascadeSplits[i] = m_splits[i];
+        data.cascadeScale[i] = used ? float(m_renderedResolution[i]) / float(m_arraySize) : 0.0f;
+        data.cascadeFilterScale[i] = used ? referenceExtent / (2.0f * m_radius[i]) : 0.0f;
+    }
+    data.cascadeCount = m_cascadeCount;
+    data.cascadeCameraPos = m_cameraPos;
+    data.cascadeCameraForward = m_cameraForward;
+}
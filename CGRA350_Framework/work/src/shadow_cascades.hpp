@@ -0,0 +1,131 @@
+#pragma once
+
+// std
+#include <functional>
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_shader.hpp"
+
+struct FrameData;
+
+// Cascaded shadow maps for the sun, fitted to slices of the camera frustum.
+//
+// Every cascade lives in one layer of a depth texture array allocated at the largest
+// cascade resolution. A cascade with a lower resolution renders only into the lower-left
+// corner of its layer, so it costs fill for its own resolution and the shaders scale
+// its texture coordinates by uCascadeScale.
+//
+// Each cascade is fitted with a bounding sphere of its frustum slice, so its size is
+// independent of camera rotation, and its origin is snapped to whole shadow texels.
+// Together these keep shadow edges from swimming as the camera moves.
+//
+// Rendered cascades are cached. The light direction is only refreshed once the sun has
+// moved further than an angular threshold, and a cascade is only re-rendered when that
+// happens, when its casters were invalidated, or when its frustum slice leaves the
+// (slightly padded) region it was rendered for. Receivers always use the matrices the
+// cascades were rendered with, so a cached cascade stays consistent with its texels.
+class CascadedShadowMap {
+public:
+    static const int MAX_CASCADES = 4;
+
+private:
+    GLuint m_fbo = 0;
+    GLuint m_depthArray = 0;
+    int m_arraySize = 0;
+
+    int m_cascadeCount = 4;
+    int m_resolution[MAX_CASCADES] = { 2048, 2048, 1024, 1024 };
+    float m_shadowDistance = 250.0f;   // far split of the last cascade, unshadowed past it
+    float m_splitLambda = 0.75f;       // 0 = uniform splits, 1 = logarithmic
+    float m_casterMargin = 150.0f;     // extra depth towards the sun for casters outside the slice
+
+    // Caching
+    bool m_cacheEnabled = true;
+    bool m_amortize = false;           // render at most one stale cascade per frame
+    float m_angleThreshold = 0.2f;     // degrees the sun may move before the cascades are refitted
+    float m_fitPadding = 1.1f;         // slack on the fitted radius so small camera moves reuse the map
+    glm::vec3 m_lightDir{0.0f};        // sun direction the cascades are fitted with
+    unsigned m_frame = 0;
+    int m_renderedLastFrame = 0;
+
+    float m_splits[MAX_CASCADES] = {};
+    glm::vec3 m_cameraPos{0.0f};
+    glm::vec3 m_cameraForward{0.0f, 0.0f, -1.0f};
+
+    // What each cascade was last rendered with, used by the receivers
+    glm::mat4 m_lightSpace[MAX_CASCADES];
+    float m_radius[MAX_CASCADES] = {};
+    float m_depth[MAX_CASCADES] = {};
+    int m_renderedResolution[MAX_CASCADES] = {};
+    unsigned m_renderedFrame[MAX_CASCADES] = {};
+    bool m_valid[MAX_CASCADES] = {};
+
+    // This frame's fit, copied into the above when the cascade is rendered
+    glm::mat4 m_fitLightSpace[MAX_CASCADES];
+    float m_fitRadius[MAX_CASCADES] = {};
+    float m_fitDepth[MAX_CASCADES] = {};
+    bool m_stale[MAX_CASCADES] = {};
+
+    void createTargets();
+    bool covers(int cascade, const glm::vec3& center, float radius) const;
+
+public:
+    CascadedShadowMap() = default;
+    ~CascadedShadowMap();
+
+    CascadedShadowMap(const CascadedShadowMap&) = delete;
+    CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+    void init();
+
+    // Recomputes the splits and light matrices for this frame's camera
+    void update(const glm::mat4& view, float fovY, float aspect, float nearPlane, const glm::vec3& sunPos);
+
+    // Renders the cascades that are stale, drawCasters is called once per rendered
+    // cascade with the shadow shader bound and its lightSpaceMatrix set
+    void render(const cgra::shader_program& shadowShader, const std::function<void(int cascade)>& drawCasters);
+
+    // Marks every cascade stale, call when a shadow caster is added, removed or changed
+    void invalidate();
+
+    // True if a world-space box overlaps the light volume of a cascade, including the margin
+    // towards the sun. Valid inside drawCasters for the cascade being rendered.
+    bool intersects(int cascade, const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+
+    // Binds the depth array to the given texture unit as uShadowCascades on program
+    void bind(GLuint program, int unit) const;
+
+    // Writes the matrices and splits the receivers need into the per-frame uniforms
+    void writeFrameData(FrameData& data) const;
+
+    int getCascadeCount() const { return m_cascadeCount; }
+    void setCascadeCount(int count);
+    int getResolution(int cascade) const { return m_resolution[cascade]; }
+    void setResolution(int cascade, int resolution);
+    float getShadowDistance() const { return m_shadowDistance; }
+    void setShadowDistance(float distance) { m_shadowDistance = distance; }
+    bool getCacheEnabled() const { return m_cacheEnabled; }
+    void setCacheEnabled(bool enabled) { m_cacheEnabled = enabled; }
+    bool getAmortize() const { return m_amortize; }
+    void setAmortize(bool amortize) { m_amortize = amortize; }
+    float getAngleThreshold() const { return m_angleThreshold; }
+    void setAngleThreshold(float degrees) { m_angleThreshold = degrees; }
+    int getCascadesRenderedLastFrame() const { return m_renderedLastFrame; }
+    float getSplit(int cascade) const { return m_splits[cascade]; }
+    const glm::mat4& getLightSpaceMatrix(int cascade) const { return m_lightSpace[cascade]; }
+
+    // Depth array and what each layer currently holds, for passes that post-process it
+    GLuint getDepthArray() const { return m_depthArray; }
+    int getArraySize() const { return m_arraySize; }
+    int getRenderedResolution(int cascade) const { return m_renderedResolution[cascade]; }
+    unsigned getRenderedFrame(int cascade) const { return m_renderedFrame[cascade]; }
+
+    // Shadow-map texels rendered per frame across all cascades
+    long long getTexelCount() const;
+};
@@ -0,0 +1,151 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "shadow_evsm.hpp"
+#include "shadow_cascades.hpp"
+
+namespace {
+    GLuint createMomentArray(int size, int layers, bool mipmapped) {
+        GLuint tex;
+        glGenTextures(1, &tex);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, tex);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16F, size, size, layers, 0, GL_RGBA, GL_FLOAT, NULL);
+        if (mipmapped) {
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        } else {
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, mipmapped ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+        return tex;
+    }
+}
+
+EvsmShadowMap::~EvsmShadowMap() {
+    m_quad.destroy();
+    if (m_fbo) cgra::gl_state::delete_framebuffers(1, &m_fbo);
+    if (m_momentArray) cgra::gl_state::delete_textures(1, &m_momentArray);
+    if (m_tempArray) cgra::gl_state::delete_textures(1, &m_tempArray);
+}
+
+void EvsmShadowMap::init(GLuint convertShader, GLuint blurShader) {
+    m_convertShader = convertShader;
+    m_blurShader = blurShader;
+    glGenFramebuffers(1, &m_fbo);
+    m_quad.create();
+}
+
+void EvsmShadowMap::setBlurRadius(int radius) {
+    radius = glm::clamp(radius, 0, 8);
+    if (radius == m_blurRadius) return;
+    m_blurRadius = radius;
+    for (unsigned& frame : m_convertedFrame) frame = 0;
+}
+
+void EvsmShadowMap::createTargets(int depthArraySize) {
+    if (m_momentArray) cgra::gl_state::delete_textures(1, &m_momentArray);
+    if (m_tempArray) cgra::gl_state::delete_textures(1, &m_tempArray);
+
+    m_size = std::max(1, depthArraySize / 2);
+    m_momentArray = createMomentArray(m_size, CascadedShadowMap::MAX_CASCADES, true);
+    m_tempArray = createMomentArray(m_size, 1, false);
+    m_depthArraySize = depthArraySize;
+
+    for (unsigned& frame : m_convertedFrame) frame = 0;
+}
+
+void EvsmShadowMap::update(const CascadedShadowMap& cascades) {
+    if (cascades.getArraySize() != m_depthArraySize) createTargets(cascades.getArraySize());
+
+    cgra::offscreen_state saved = cgra::begin_offscreen();
+    GLfloat clearColour[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColour);
+
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_fbo);
+    m_quad.bind();
+
+    bool converted = false;
+    for (int i = 0; i < cascades.getCascadeCount(); i++) {
+        unsigned rendered = cascades.getRenderedFrame(i);
+        if (rendered == 0 || rendered == m_convertedFrame[i]) continue;
+        convertCascade(cascades, i);
+        m_convertedFrame[i] = rendered;
+        converted = true;
+    }
+
+    if (converted) {
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, m_momentArray);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // Restore state
+    cgra::end_offscreen(saved);
+    glClearColor(clearColour[0], clearColour[1], clearColour[2], clearColour[3]);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+}
+
+void EvsmShadowMap::convertCascade(const CascadedShadowMap& cascades, int cascade) {
+    int region = std::max(1, cascades.getRenderedResolution(cascade) / 2);
+
+    // Outside the cascade's region the layer holds far-plane (fully lit) moments so the
+    // blur and the coarser mips don't pull shadow in from uninitialised texels
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_momentArray, 0, cascade);
+    glViewport(0, 0, m_size, m_size);
+    float pos = std::exp(m_exponents.x), neg = -std::exp(-m_exponents.y);
+    glClearColor(pos, pos * pos, neg, neg * neg);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Warp and downsample depth into moments
+    glViewport(0, 0, region, region);
+    cgra::gl_state::use_program(m_convertShader);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, cascades.getDepthArray());
+    glUniform1i(glGetUniformLocation(m_convertShader, "uShadowDepth"), 0);
+    glUniform1i(glGetUniformLocation(m_convertShader, "uLayer"), cascade);
+    glUniform2fv(glGetUniformLocation(m_convertShader, "uExponents"), 1, glm::value_ptr(m_exponents));
+    m_quad.draw();
+
+    if (m_blurRadius > 0) {
+        cgra::gl_state::use_program(m_blurShader);
+        glUniform1i(glGetUniformLocation(m_blurShader, "uSource"), 0);
+        glUniform1i(glGetUniformLocation(m_blurShader, "uRadius"), m_blurRadius);
+        glUniform2i(glGetUniformLocation(m_blurShader, "uRegion"), region, region);
+
+        // Horizontal into the temporary layer
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_tempArray, 0, 0);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, m_momentArray);
+        glUniform1i(glGetUniformLocation(m_blurShader, "uLayer"), cascade);
+        glUniform2i(glGetUniformLocation(m_blurShader, "uDirection"), 1, 0);
+        m_quad.draw();
+
+        // Vertical back into the cascade's layer
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_momentArray, 0, cascade);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, m_tempArray);
+        glUniform1i(glGetUniformLocation(m_blurShader, "uLayer"), 0);
+        glUniform2i(glGetUniformLocation(m_blurShader, "uDirection"), 0, 1);
+        m_quad.draw();
+    }
+
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void EvsmShadowMap::bind(GLuint program, int unit) const {
+    cgra::gl_state::use_program(program);
+    cgra::gl_state::active_texture(GL_TEXTURE0 + unit);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, m_momentArray);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+
+    glUniform1i(glGetUniformLocation(program, "uShadowMoments"), unit);
+    glUniform2fv(glGetUniformLocation(program, "uEvsmExponents"), 1, glm::value_ptr(m_exponents));
+    glUniform1f(glGetUniformLocation(program, "uEvsmBleedReduction"), m_bleedReduction);
+}
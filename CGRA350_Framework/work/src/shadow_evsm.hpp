@@ -0,0 +1,63 @@
+#pragma once
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_offscreen.hpp"
+
+class CascadedShadowMap;
+
+// Exponential variance shadow maps built from the cascade depth array.
+//
+// Every cascade's depth is warped into EVSM moments (exp(c+ z), its square, -exp(-c- z)
+// and its square) at half the cascade resolution, blurred with a separable Gaussian and
+// mipmapped. A single trilinear fetch then gives a pre-filtered soft shadow through
+// Chebyshev's inequality, instead of the blocker search and PCF taps of PCSS.
+//
+// Moments are stored as RGBA16F, which limits the exponents to about 5.5 before exp(2c)
+// overflows. Only cascades that CascadedShadowMap re-rendered are reconverted.
+class EvsmShadowMap {
+private:
+    GLuint m_convertShader = 0;
+    GLuint m_blurShader = 0;
+    cgra::fullscreen_quad m_quad;
+
+    GLuint m_fbo = 0;
+    GLuint m_momentArray = 0;       // one layer per cascade, mipmapped
+    GLuint m_tempArray = 0;         // single layer between the blur passes
+    int m_size = 0;
+    int m_depthArraySize = 0;
+
+    glm::vec2 m_exponents{5.0f, 5.0f};
+    float m_bleedReduction = 0.3f;  // cuts off the low tail of Chebyshev's bound
+    int m_blurRadius = 3;           // in moment texels
+
+    unsigned m_convertedFrame[4] = {};
+
+    void createTargets(int depthArraySize);
+    void convertCascade(const CascadedShadowMap& cascades, int cascade);
+
+public:
+    EvsmShadowMap() = default;
+    ~EvsmShadowMap();
+
+    EvsmShadowMap(const EvsmShadowMap&) = delete;
+    EvsmShadowMap& operator=(const EvsmShadowMap&) = delete;
+
+    void init(GLuint convertShader, GLuint blurShader);
+
+    // Rebuilds the moments of every cascade rendered since the last update
+    void update(const CascadedShadowMap& cascades);
+
+    // Binds the moment array to the given texture unit and sets the EVSM uniforms on program
+    void bind(GLuint program, int unit) const;
+
+    int getBlurRadius() const { return m_blurRadius; }
+    void setBlurRadius(int radius);
+    float getBleedReduction() const { return m_bleedReduction; }
+    void setBleedReduction(float amount) { m_bleedReduction = amount; }
+};
@@ -0,0 +1,128 @@
+// std
+#include <algorithm>
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "frame_uniforms.hpp"
+#include "shadow_mask.hpp"
+#include "shadow_cascades.hpp"
+#include "shadow_evsm.hpp"
+
+ShadowMask::~ShadowMask() {
+    m_quad.destroy();
+    destroyTargets();
+}
+
+void ShadowMask::init(GLuint resolveShader, GLuint upsampleShader) {
+    m_resolveShader = resolveShader;
+    m_upsampleShader = upsampleShader;
+    m_quad.create();
+}
+
+void ShadowMask::setHalfResolution(bool half) {
+    if (half == m_halfResolution) return;
+    m_halfResolution = half;
+    if (m_width > 0 && m_height > 0) createTargets();
+}
+
+void ShadowMask::resize(int width, int height) {
+    if (width == m_width && height == m_height) return;
+    m_width = width;
+    m_height = height;
+    if (m_width > 0 && m_height > 0) createTargets();
+}
+
+void ShadowMask::createTargets() {
+    destroyTargets();
+
+    m_mask = cgra::create_target(GL_R8, GL_RED, m_width, m_height, GL_NEAREST);
+    m_maskFBO = cgra::create_framebuffer(m_mask);
+
+    if (m_halfResolution) {
+        // Rounded up so the last low-res texel still maps onto a full-res depth texel
+        m_lowWidth = std::max(1, (m_width + 1) / 2);
+        m_lowHeight = std::max(1, (m_height + 1) / 2);
+        m_lowMask = cgra::create_target(GL_R8, GL_RED, m_lowWidth, m_lowHeight, GL_NEAREST);
+        m_lowFBO = cgra::create_framebuffer(m_lowMask);
+    }
+
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, 0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+}
+
+void ShadowMask::destroyTargets() {
+    if (m_maskFBO) cgra::gl_state::delete_framebuffers(1, &m_maskFBO);
+    if (m_mask) cgra::gl_state::delete_textures(1, &m_mask);
+    if (m_lowFBO) cgra::gl_state::delete_framebuffers(1, &m_lowFBO);
+    if (m_lowMask) cgra::gl_state::delete_textures(1, &m_lowMask);
+    m_maskFBO = m_mask = m_lowFBO = m_lowMask = 0;
+}
+
+void ShadowMask::resolve(const CascadedShadowMap& cascades, const EvsmShadowMap& moments, GLuint sceneDepth) {
+    if (m_maskFBO == 0) return;
+
+    glm::vec2 screenSize(m_width, m_height);
+
+    cgra::offscreen_state saved = cgra::begin_offscreen();
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    m_quad.bind();
+
+    // Resolve pass, straight into the full-res mask or into the half-res target
+    cascades.bind(m_resolveShader, 6);
+    moments.bind(m_resolveShader, 4);
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_halfResolution ? m_lowFBO : m_maskFBO);
+    if (m_halfResolution) {
+        glViewport(0, 0, m_lowWidth, m_lowHeight);
+    } else {
+        glViewport(0, 0, m_width, m_height);
+    }
+
+    cgra::gl_state::use_program(m_resolveShader);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, sceneDepth);
+    glUniform1i(glGetUniformLocation(m_resolveShader, "uSceneDepth"), 0);
+    glUniform1i(glGetUniformLocation(m_resolveShader, "uDepthStep"), m_halfResolution ? 2 : 1);
+    glUniform2fv(glGetUniformLocation(m_resolveShader, "uScreenSize"), 1, glm::value_ptr(screenSize));
+    glUniform1i(glGetUniformLocation(m_resolveShader, "uShadowFilter"), m_filter == ShadowFilter::EVSM ? 1 : 0);
+    m_quad.draw();
+
+    // Bilateral upsample to full resolution
+    if (m_halfResolution) {
+        cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_maskFBO);
+        glViewport(0, 0, m_width, m_height);
+
+        cgra::gl_state::use_program(m_upsampleShader);
+        cgra::gl_state::active_texture(GL_TEXTURE0);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_lowMask);
+        glUniform1i(glGetUniformLocation(m_upsampleShader, "uLowMask"), 0);
+        cgra::gl_state::active_texture(GL_TEXTURE1);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D, sceneDepth);
+        glUniform1i(glGetUniformLocation(m_upsampleShader, "uSceneDepth"), 1);
+        glUniform2f(glGetUniformLocation(m_upsampleShader, "uLowResSize"), float(m_lowWidth), float(m_lowHeight));
+        m_quad.draw();
+    }
+
+    // Restore state
+    cgra::end_offscreen(saved);
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
+}
+
+void ShadowMask::writeFrameData(FrameData& data) const {
+    data.lightSize = m_lightSize;
+    data.nearPlane = m_nearPlane;
+    data.blockerSearchSamples = m_blockerSearchSamples;
+    data.pcfSamples = m_pcfSamples;
+}
+
+void ShadowMask::bind(GLuint program, int unit) const {
+    cgra::gl_state::use_program(program);
+    cgra::gl_state::active_texture(GL_TEXTURE0 + unit);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, m_mask);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(program, "uShadowMask"), unit);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_offscreen.hpp"
+
+class CascadedShadowMap;
+class EvsmShadowMap;
+struct FrameData;
+
+enum class ShadowFilter {
+    PCSS,   // blocker search + PCF over the cascade depth
+    EVSM    // one filtered fetch of pre-blurred moments (see EvsmShadowMap)
+};
+
+// Screen-space sun visibility, resolved from the depth prepass.
+//
+// PCSS runs once per visible pixel in a full-screen pass instead of once per shaded
+// fragment in every material, and the materials read the result with a single
+// texelFetch at gl_FragCoord (see sunShadow() in terrain_frag.glsl). At half resolution
+// the mask is resolved at every other depth texel and brought back to full resolution
+// with a depth-aware bilateral upsample.
+class ShadowMask {
+private:
+    GLuint m_resolveShader = 0;
+    GLuint m_upsampleShader = 0;
+    cgra::fullscreen_quad m_quad;
+
+    // Full-res visibility read by the materials
+    GLuint m_maskFBO = 0;
+    GLuint m_mask = 0;
+
+    // Half-res resolve target, only allocated when m_halfResolution is set
+    GLuint m_lowFBO = 0;
+    GLuint m_lowMask = 0;
+
+    int m_width = 0, m_height = 0;
+    int m_lowWidth = 0, m_lowHeight = 0;
+    bool m_halfResolution = true;
+    ShadowFilter m_filter = ShadowFilter::PCSS;
+
+    // PCSS settings, previously duplicated in every material
+    float m_lightSize = 0.01f;
+    float m_nearPlane = 0.1f;
+    int m_blockerSearchSamples = 32;
+    int m_pcfSamples = 64;
+
+    void createTargets();
+    void destroyTargets();
+
+public:
+    ShadowMask() = default;
+    ~ShadowMask();
+
+    ShadowMask(const ShadowMask&) = delete;
+    ShadowMask& operator=(const ShadowMask&) = delete;
+
+    void init(GLuint resolveShader, GLuint upsampleShader);
+
+    // Resizes the targets to match the framebuffer (no-op if unchanged)
+    void resize(int width, int height);
+
+    // Resolves sun visibility for every pixel of sceneDepth, cascades must already be rendered
+    // (and converted to moments when filtering with EVSM). The camera, the sun and the
+    // cascade matrices come from the per-frame uniforms.
+    void resolve(const CascadedShadowMap& cascades, const EvsmShadowMap& moments, GLuint sceneDepth);
+
+    // Writes the PCSS settings into the per-frame uniforms
+    void writeFrameData(FrameData& data) const;
+
+    // Binds the mask to the given texture unit as uShadowMask on program
+    void bind(GLuint program, int unit) const;
+
+    bool getHalfResolution() const { return m_halfResolution; }
+    void setHalfResolution(bool half);
+    ShadowFilter getFilter() const { return m_filter; }
+    void setFilter(ShadowFilter filter) { m_filter = filter; }
+    int getBlockerSearchSamples() const { return m_blockerSearchSamples; }
+    void setBlockerSearchSamples(int samples) { m_blockerSearchSamples = glm::clamp(samples, 1, 64); }
+    int getPCFSamples() const { return m_pcfSamples; }
+    void setPCFSamples(int samples) { m_pcfSamples = glm::clamp(samples, 1, 64); }
+};
@@ -1,6 +1,7 @@
 // std
 #include <cmath>
 #include <algorithm>
+#include <limits>
 
 // glm
 #include <glm/gtc/matrix_transform.hpp>
@@ -213,6 +214,76 @@ void Terrain::generateMesh() {
 
     m_mesh = mb.build();
     m_meshGenerated = true;
+
+    generateShadowProxy();
+}
+
+void Terrain::generateShadowProxy() {
+    // Sample every m_shadowStep-th row and column, always including the far edge
+    int cols = (m_width - 2) / m_shadowStep + 2;
+    int rows = (m_height - 2) / m_shadowStep + 2;
+    auto sampleX = [&](int i) { return std::min(i * m_shadowStep, m_width - 1); };
+    auto sampleZ = [&](int j) { return std::min(j * m_shadowStep, m_height - 1); };
+
+    cgra::mesh_builder mb;
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < cols; i++) {
+            int x = sampleX(i);
+            int z = sampleZ(j);
+
+            // Lowest height over every proxy quad that uses this vertex. Each corner of a
+            // quad is then no higher than anything inside it, and neither is any blend of
+            // them, so the proxy stays under the full-detail surface it shadows
+            float height = m_heightMap[z][x];
+            int x0 = sampleX(std::max(i - 1, 0)), x1 = sampleX(std::min(i + 1, cols - 1));
+            int z0 = sampleZ(std::max(j - 1, 0)), z1 = sampleZ(std::min(j + 1, rows - 1));
+            for (int sz = z0; sz <= z1; sz++) {
+                for (int sx = x0; sx <= x1; sx++) {
+                    height = std::min(height, m_heightMap[sz][sx]);
+                }
+            }
+
+            cgra::mesh_vertex vertex;
+            vertex.pos = glm::vec3(static_cast<float>(x) / (m_width - 1) * m_scale - m_scale * 0.5f,
+                                   height,
+                                   static_cast<float>(z) / (m_height - 1) * m_scale - m_scale * 0.5f);
+            vertex.norm = glm::vec3(0.0f, 1.0f, 0.0f);
+            mb.push_vertex(vertex);
+        }
+    }
+
+    // Indices are written tile by tile so each tile is one contiguous range
+    m_shadowTiles.clear();
+    for (int tz = 0; tz < rows - 1; tz += m_shadowTileQuads) {
+        for (int tx = 0; tx < cols - 1; tx += m_shadowTileQuads) {
+            ShadowTile tile;
+            tile.firstIndex = static_cast<int>(mb.indices.size());
+            tile.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+            tile.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+
+            for (int z = tz; z < std::min(tz + m_shadowTileQuads, rows - 1); z++) {
+                for (int x = tx; x < std::min(tx + m_shadowTileQuads, cols - 1); x++) {
+                    GLuint topLeft = z * cols + x;
+                    GLuint topRight = topLeft + 1;
+                    GLuint bottomLeft = topLeft + cols;
+                    GLuint bottomRight = bottomLeft + 1;
+
+                    mb.push_indices({ topLeft, bottomLeft, topRight, topRight, bottomLeft, bottomRight });
+
+                    for (GLuint idx : { topLeft, topRight, bottomLeft, bottomRight }) {
+                        tile.boundsMin = glm::min(tile.boundsMin, mb.vertices[idx].pos);
+                        tile.boundsMax = glm::max(tile.boundsMax, mb.vertices[idx].pos);
+                    }
+                }
+            }
+
+            tile.indexCount = static_cast<int>(mb.indices.size()) - tile.firstIndex;
+            m_shadowTiles.push_back(tile);
+        }
+    }
+
+    m_shadowMesh.destroy();
+    m_shadowMesh = mb.build();
 }
 
 float Terrain::getHeightAt(int x, int z) const {
@@ -233,6 +304,39 @@ float Terrain::getHeightAtWorld(float x, float z) const {
     return getHeightAt(mapX, mapZ);
 }
 
+void Terrain::sampleWorld(const glm::vec2* points, size_t count, float* heights, glm::vec3* normals) const {
+    const float toGridX = (m_width - 1) / m_scale;
+    const float toGridZ = (m_height - 1) / m_scale;
+    const float spacingX = m_scale / (m_width - 1);
+    const float spacingZ = m_scale / (m_height - 1);
+
+    for (size_t i = 0; i < count; i++) {
+        float gridX = (points[i].x + m_scale * 0.5f) * toGridX;
+        float gridZ = (points[i].y + m_scale * 0.5f) * toGridZ;
+        int x = static_cast<int>(floor(gridX));
+        int z = static_cast<int>(floor(gridZ));
+
+        if (x < 0 || x >= m_width - 1 || z < 0 || z >= m_height - 1) {
+            heights[i] = 0.0f;
+            normals[i] = glm::vec3(0.0f, 1.0f, 0.0f);
+            continue;
+        }
+
+        float fx = gridX - x;
+        float fz = gridZ - z;
+        const std::vector<float>& row0 = m_heightMap[z];
+        const std::vector<float>& row1 = m_heightMap[z + 1];
+        float h0 = row0[x] + (row0[x + 1] - row0[x]) * fx;
+        float h1 = row1[x] + (row1[x + 1] - row1[x]) * fx;
+        heights[i] = h0 + (h1 - h0) * fz;
+
+        // Gradient of the bilinear patch, in world units
+        float dhdx = ((row0[x + 1] - row0[x]) * (1.0f - fz) + (row1[x + 1] - row1[x]) * fz) / spacingX;
+        float dhdz = (h1 - h0) / spacingZ;
+        normals[i] = glm::normalize(glm::vec3(-dhdx, 1.0f, -dhdz));
+    }
+}
+
 glm::vec3 Terrain::getNormalAtWorld(float worldX, float worldZ) const {
     // Convert world coordinates to grid coordinates
     float gridX = (worldX / m_scale + 0.5f) * m_width;
@@ -263,75 +367,55 @@ glm::vec3 Terrain::getNormalAtWorld(float worldX, float worldZ) const {
 }
 
 
-void Terrain::draw(const glm::mat4& view, const glm::mat4& proj, GLuint shader, const glm::vec3& color, const glm::vec3& sunPos, const glm::vec3& sunColour,
-    GLuint grassDiff, GLuint grassNorm, GLuint grassRough, const glm::mat4& lightSpaceMatrix, GLuint shadowMap) {
+glm::mat4 Terrain::modelView(const glm::mat4& view) const {
+    return view * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.5f, 0.0f));
+}
+
+void Terrain::draw(const glm::mat4& view, const cgra::shader_program& shader, const glm::vec3& color,
+    GLuint grassDiff, GLuint grassNorm, GLuint grassRough) {
     if (!m_meshGenerated) {
         generateMesh();
     }
 
-    glm::mat4 modelview = view * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.5f, 0.0f));
-
-    glUseProgram(shader);
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uProjectionMatrix"), 1, false, glm::value_ptr(proj));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uModelViewMatrix"), 1, false, glm::value_ptr(modelview));
-	glUniformMatrix4fv(glGetUniformLocation(shader, "uLightSpacematrix"), 1, false, glm::value_ptr(lightSpaceMatrix));
-    glUniform3fv(glGetUniformLocation(shader, "uColor"), 1, value_ptr(color));
+    cgra::gl_state::use_program(shader);
+    shader.set_uniform("uModelViewMatrix", modelView(view));
+    shader.set_uniform("uColor", color);
 
 	// Example values for terrain shader uniforms
 	// ideally these would be parameters of the Terrain class or passed into this function
     // - Tyler
-    glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
     float sunRadius = 10.0f;
     glm::vec3 terrainAlbedo = color;
     float terrainMetallic = 0.0f;
     float terrainWaterDepth = 2.0f;
     float windIntensity = 1.0f;
 
-    // PCSS Parameters
-    float lightSize = 0.01f;              // Controls shadow softness (0.005-0.02 range)
-    float nearPlane = 0.1f;               // Should match your shadow camera's near plane
-    int blockerSearchSamples = 32;        // Blocker search quality (8-32)
-    int pcfSamples = 64;                  // PCF filter quality (16-64)
-
-    glUniform3fv(glGetUniformLocation(shader, "uCameraPos"), 1, glm::value_ptr(cameraPos));
-    glUniform3fv(glGetUniformLocation(shader, "uSunPos"), 1, glm::value_ptr(sunPos));
-    glUniform3fv(glGetUniformLocation(shader, "uSunColor"), 1, glm::value_ptr(sunColour));
-    glUniform1f(glGetUniformLocation(shader, "uSunRadius"), sunRadius);
-    glUniform3fv(glGetUniformLocation(shader, "uAlbedo"), 1, glm::value_ptr(terrainAlbedo));
-    glUniform1f(glGetUniformLocation(shader, "uMetallic"), terrainMetallic);
-    glUniform1f(glGetUniformLocation(shader, "uWaterDepth"), terrainWaterDepth);
-    glUniform1f(glGetUniformLocation(shader, "uWindIntensity"), windIntensity);
-
-    // Set PCSS uniforms
-    glUniform1f(glGetUniformLocation(shader, "uLightSize"), lightSize);
-    glUniform1f(glGetUniformLocation(shader, "uNearPlane"), nearPlane);
-    glUniform1i(glGetUniformLocation(shader, "uBlockerSearchSamples"), blockerSearchSamples);
-    glUniform1i(glGetUniformLocation(shader, "uPCFSamples"), pcfSamples);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, grassDiff);
-    glUniform1i(glGetUniformLocation(shader, "uGrassTexture"), 0);
-
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, grassNorm);
-    glUniform1i(glGetUniformLocation(shader, "uGrassNormal"), 1);
-
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, grassRough);
-    glUniform1i(glGetUniformLocation(shader, "uGrassRoughness"), 2);
-
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
-    glUniform1i(glGetUniformLocation(shader, "uShadowMap"), 3);
-
-    glUniform1i(glGetUniformLocation(shader, "uUseTextures"), 1);
-    glUniform1f(glGetUniformLocation(shader, "uGrassHeight"), m_grassHeight);
+    shader.set_uniform("uSunRadius", sunRadius);
+    shader.set_uniform("uAlbedo", terrainAlbedo);
+    shader.set_uniform("uMetallic", terrainMetallic);
+    shader.set_uniform("uWaterDepth", terrainWaterDepth);
+    shader.set_uniform("uWindIntensity", windIntensity);
+
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, grassDiff);
+    shader.set_uniform("uGrassTexture", 0);
+
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, grassNorm);
+    shader.set_uniform("uGrassNormal", 1);
+
+    cgra::gl_state::active_texture(GL_TEXTURE2);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, grassRough);
+    shader.set_uniform("uGrassRoughness", 2);
+
+    shader.set_uniform("uUseTextures", 1);
+    shader.set_uniform("uGrassHeight", m_grassHeight);
 
     m_mesh.draw();
 
     for (int i = 0; i < 3; i++) {
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        cgra::gl_state::active_texture(GL_TEXTURE0 + i);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D, 0);
     }
 }
 
@@ -348,13 +432,55 @@ void Terrain::regenerate() {
     generateMesh();
 }
 
-void Terrain::drawShadows(GLuint shader) {
+void Terrain::drawDepth(const glm::mat4& view, const cgra::shader_program& shader) {
+    if (!m_meshGenerated) {
+        generateMesh();
+    }
+
+    cgra::gl_state::use_program(shader);
+    shader.set_uniform("uModelViewMatrix", modelView(view));
+
+    m_mesh.draw();
+}
+
+void Terrain::drawShadows(const cgra::shader_program& shader) {
     if (!m_meshGenerated) {
         generateMesh();
     }
     
-    glUseProgram(shader);
-	glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, false, glm::value_ptr(glm::mat4(1.0f)));
+    cgra::gl_state::use_program(shader);
+	shader.set_uniform("model", glm::mat4(1.0f));
 
     m_mesh.draw();
 }
+
+int Terrain::drawShadowProxy(const cgra::shader_program& shader, const std::function<bool(const glm::vec3&, const glm::vec3&)>& visible) {
+    if (!m_meshGenerated) {
+        generateMesh();
+    }
+
+    cgra::gl_state::use_program(shader);
+    shader.set_uniform("model", glm::mat4(1.0f));
+    cgra::gl_state::bind_vertex_array(m_shadowMesh.vao);
+
+    int drawn = 0;
+    int runStart = 0, runCount = 0;
+    auto flush = [&]() {
+        if (runCount == 0) return;
+        glDrawElements(GL_TRIANGLES, runCount, GL_UNSIGNED_INT, (void*)(runStart * sizeof(GLuint)));
+        drawn += runCount / 3;
+        runCount = 0;
+    };
+
+    for (const ShadowTile& tile : m_shadowTiles) {
+        if (!visible(tile.boundsMin, tile.boundsMax)) {
+            flush();
+            continue;
+        }
+        if (runCount == 0) runStart = tile.firstIndex;
+        runCount += tile.indexCount;
+    }
+    flush();
+
+    return drawn;
+}
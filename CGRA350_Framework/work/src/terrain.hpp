@@ -1,6 +1,7 @@
 #pragma once
 
 // std
+#include <functional>
 #include <vector>
 
 // glm
@@ -8,6 +9,7 @@
 
 // project
 #include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_shader.hpp"
 
 class Terrain {
 private:
@@ -32,6 +34,18 @@ private:
     cgra::gl_mesh m_mesh;
     bool m_meshGenerated;
 
+    // Decimated copy for the shadow cascades, split into tiles that can be culled
+    struct ShadowTile {
+        int firstIndex;
+        int indexCount;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+    cgra::gl_mesh m_shadowMesh;
+    std::vector<ShadowTile> m_shadowTiles;
+    int m_shadowStep = 4;         // heightmap samples per proxy quad
+    int m_shadowTileQuads = 16;   // proxy quads along each side of a tile
+
     // Height data
     std::vector<std::vector<float>> m_heightMap;
 
@@ -45,6 +59,10 @@ private:
     // Mesh generation
     void generateHeightMap();
     void generateMesh();
+    void generateShadowProxy();
+
+    // The terrain is drawn 1.5 units below its height map
+    glm::mat4 modelView(const glm::mat4& view) const;
 
     // Permutation table for noise
     static const int m_permutation[512];
@@ -82,12 +100,24 @@ public:
     
     glm::vec3 getNormalAtWorld(float worldX, float worldZ) const;
 
-    // Rendering
-    void draw(const glm::mat4& view, const glm::mat4& proj, GLuint shader, const glm::vec3& color = glm::vec3(0.2f, 0.8f, 0.2f), 
-        const glm::vec3& sunPos = glm::vec3(0.0f, 100.0f, 0.0f), const glm::vec3& sunColour = glm::vec3(1.0f, 1.0f, 1.0f),
-        GLuint grassTexture = 0, GLuint grassNorm = 0, GLuint grassRough = 0, const glm::mat4& lightSpaceMatrix = glm::mat4(1.0f), GLuint shadowMap = 0);
+    // Height and surface normal at count world-space (x, z) points, interpolated between
+    // height map samples like the mesh. Points off the terrain get height 0, normal up.
+    void sampleWorld(const glm::vec2* points, size_t count, float* heights, glm::vec3* normals) const;
+
+    // Rendering, the projection, camera and sun come from the per-frame uniforms
+    void draw(const glm::mat4& view, const cgra::shader_program& shader, const glm::vec3& color = glm::vec3(0.2f, 0.8f, 0.2f),
+        GLuint grassTexture = 0, GLuint grassNorm = 0, GLuint grassRough = 0);
+
+    void drawShadows(const cgra::shader_program& shader);
+
+    // Depth only, positioned exactly as draw places the terrain so shading can test GL_EQUAL
+    void drawDepth(const glm::mat4& view, const cgra::shader_program& shader);
+
+    // Draws the tiles of the decimated shadow mesh that pass the visible test,
+    // merging runs of visible tiles into one draw. Returns the triangles drawn.
+    int drawShadowProxy(const cgra::shader_program& shader, const std::function<bool(const glm::vec3&, const glm::vec3&)>& visible);
 
-    void drawShadows(GLuint shader);
+    int getTriangleCount() const { return (m_width - 1) * (m_height - 1) * 2; }
 
     // Setters for texture control
     void setGrassHeight(float height) { m_grassHeight = height; }
@@ -6,11 +6,23 @@
 #include <iostream>
 #include <cmath>
 #include <random>
+#include <algorithm>
+#include <limits>
+#include <chrono>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/quaternion.hpp>
 
-// Random number generator
-static std::mt19937 rng(12345); // Fixed seed for consistency
+namespace {
+    // Unit offsets (cos, sin) around a stem ring of the given number of sides
+    std::vector<glm::vec2> ringTable(int sides) {
+        std::vector<glm::vec2> table(sides);
+        for (int j = 0; j < sides; j++) {
+            float angle = (float)j / sides * glm::two_pi<float>();
+            table[j] = glm::vec2(cos(angle), sin(angle));
+        }
+        return table;
+    }
+}
 
 Tree::Tree(const glm::vec3& position)
     : m_position(position)
@@ -53,18 +65,86 @@ Tree::Tree(const glm::vec3& position)
 }
 
 void Tree::setParameters(const TreeParameters& params) {
+    const TreeParameters& old = m_params;
+
+    // Radii and lengths at every level follow from the overall shape
+    bool global = params.shape != old.shape || params.baseSize != old.baseSize || params.scale != old.scale ||
+        params.scaleV != old.scaleV || params.levels != old.levels || params.ratio != old.ratio ||
+        params.ratioPower != old.ratioPower || params.flare != old.flare;
+
+    int skeletonFrom = global ? 0 : 4;
+    for (int level = std::min(params.levels, 4) - 1; level >= 0 && !global; level--) {
+        const BranchLevel& a = params.level[level];
+        const BranchLevel& b = old.level[level];
+        if (a.nLength != b.nLength || a.nLengthV != b.nLengthV || a.nTaper != b.nTaper ||
+            a.nCurveRes != b.nCurveRes || a.nCurve != b.nCurve || a.nCurveV != b.nCurveV || a.nCurveBack != b.nCurveBack ||
+            a.nBranches != b.nBranches || a.nBranchDist != b.nBranchDist || a.nDownAngle != b.nDownAngle ||
+            a.nDownAngleV != b.nDownAngleV || a.nRotate != b.nRotate || a.nRotateV != b.nRotateV) {
+            skeletonFrom = level;
+        }
+    }
+
+    const LeafParameters& a = params.leafParams;
+    const LeafParameters& b = old.leafParams;
+    bool leafShape = a.lobeWidth != b.lobeWidth || a.lobeHeight != b.lobeHeight || a.lobeOffset != b.lobeOffset ||
+        a.topAngle != b.topAngle || a.bottomAngle != b.bottomAngle || a.lobeCount != b.lobeCount ||
+        a.lobeSeparation != b.lobeSeparation || a.lobeScale != b.lobeScale || a.color != b.color;
+
+    unsigned parts = 0;
+    if (skeletonFrom < 4) parts |= DIRTY_SKELETON;
+    if (params.radialSegments != old.radialSegments) parts |= DIRTY_TRUNK | DIRTY_BRANCHES;
+    if (params.hasLeaves != old.hasLeaves) parts |= DIRTY_LEAVES | DIRTY_PROXIES;   // twigs are skipped in the proxies under leaves
+    if (params.leafScale != old.leafScale || params.leavesPerBranch != old.leavesPerBranch) parts |= DIRTY_LEAVES;
+    if (leafShape) parts |= DIRTY_LEAF_SHAPE;
+
     m_params = params;
-    m_meshGenerated = false;
+    if (parts) markDirty(parts, skeletonFrom);
 }
 
 void Tree::regenerate() {
+    markDirty(DIRTY_ALL);
+}
+
+void Tree::release() {
+    cgra::gl_mesh* meshes[] = { &m_trunkMesh, &m_branchesMesh, &m_leavesMesh, &m_leafCardMesh,
+                                &m_shadowStemMesh, &m_lodWoodMesh[0], &m_lodWoodMesh[1] };
+    for (cgra::gl_mesh* mesh : meshes) {
+        mesh->destroy();
+        *mesh = cgra::gl_mesh();
+    }
+
+    if (m_leafBuffer) glDeleteBuffers(1, &m_leafBuffer);
+    cgra::gl_state::delete_textures(1, &m_leafTexture);
+    m_leafBuffer = 0;
+    m_leafTexture = 0;
+
+    m_pendingUpload = 0;
+    regenerate();
+}
+
+void Tree::markDirty(unsigned parts, int skeletonFrom) {
+    // A regrown skeleton needs everything built on it; the trunk is stem 0 and only
+    // changes with level 0
+    if (parts & DIRTY_SKELETON) {
+        parts |= DIRTY_BRANCHES | DIRTY_LEAVES;
+        if (skeletonFrom == 0) parts |= DIRTY_TRUNK;
+        m_skeletonFrom = (m_dirty & DIRTY_SKELETON) ? std::min(m_skeletonFrom, skeletonFrom) : skeletonFrom;
+    }
+    if (parts & (DIRTY_TRUNK | DIRTY_BRANCHES)) parts |= DIRTY_PROXIES;
+
+    m_dirty |= parts;
     m_meshGenerated = false;
-    m_stems.clear();
+    m_geometryReady = false;
+}
+
+// Maps the raw engine output directly, the std distributions differ between standard
+// libraries and would make the same seed generate different trees
+float Tree::random01() {
+    return float(m_rng() >> 8) * (1.0f / 16777216.0f);
 }
 
 float Tree::randomVariance(float variance) {
-    std::uniform_real_distribution<float> dist(-variance, variance);
-    return dist(rng);
+    return (random01() * 2.0f - 1.0f) * variance;
 }
 
 float Tree::stemRadius(int level, float offset, float length) {
@@ -120,157 +200,324 @@ int Tree::branchesAtSegment(int level, int segmentIndex, int totalSegments) {
             int startBranch = segmentOffset * branchesPerSegment;
             int endBranch = std::min(startBranch + branchesPerSegment, params.nBranches);
             
-            return endBranch - startBranch;  // Return number of branches for this segment
+            return std::max(endBranch - startBranch, 0);  // Return number of branches for this segment
         }
     }
     
     return 0;
 }
 
-void Tree::generateStem(int level, const glm::vec3& startPos, const glm::vec3& startDir,
-                       float length, float baseRadius, int parentSegment) {
-    if (level >= m_params.levels) return;
-    
-    const BranchLevel& params = m_params.level[level];
-    
-    Stem stem;
-    stem.level = level;
-    stem.position = startPos;
-    stem.direction = glm::normalize(startDir);
-    stem.length = length;
-    stem.radius = baseRadius;
-    
-    glm::vec3 currentPos = startPos;
-    glm::vec3 currentDir = stem.direction;
-    float segmentLength = length / params.nCurveRes;
-    
-    for (int i = 0; i <= params.nCurveRes; i++) {
-        float offset = i * segmentLength;
-        float radius = stemRadius(level, offset, length);
-        
-        if (level > 0 && baseRadius > 0.0f) {
-            radius = std::min(radius, baseRadius * 0.5f);
+void Tree::generateSkeleton(int fromLevel) {
+    const int levels = glm::clamp(m_params.levels, 1, 4);
+
+    // Every stem of a level has the same rings and the same branches at each ring, so
+    // the size of the whole skeleton follows from the parameters before growing it
+    int rings[4] = {}, firstStem[5] = {}, stems[4] = {}, firstTable[4] = {}, firstSegment[5] = {};
+    int tableSize = 0;
+    for (int level = 0; level < levels; level++) {
+        rings[level] = std::max(m_params.level[level].nCurveRes, 1) + 1;
+        firstTable[level] = tableSize;
+        tableSize += rings[level];
+    }
+    for (int level = 0; level < levels; level++) {
+        if (level == 0) {
+            stems[level] = 1;
+        } else {
+            int children = 0;
+            for (int i = 0; i < rings[level - 1]; i++) children += branchesAtSegment(level - 1, i, rings[level - 1] - 1);
+            stems[level] = stems[level - 1] * children;
         }
-        
-        StemSegment seg;
-        seg.position = currentPos;
-        seg.direction = currentDir;
-        seg.rotation = glm::rotation(glm::vec3(0, 1, 0), currentDir);
-        seg.radius = radius;
-        seg.length = segmentLength;
-        seg.level = level;
-        seg.segmentIndex = i;
-        seg.totalSegments = params.nCurveRes;
-        
-        stem.segments.push_back(seg);
-        
-        int branchCount = branchesAtSegment(level, i, params.nCurveRes);
-        
-        if (branchCount > 0 && level + 1 < m_params.levels) {
-            const BranchLevel& childParams = m_params.level[level + 1];
-            
-            // Create multiple branches at this segment
-            for (int branchIdx = 0; branchIdx < branchCount; branchIdx++) {
+        firstStem[level + 1] = firstStem[level] + stems[level];
+        firstSegment[level + 1] = firstSegment[level] + stems[level] * rings[level];
+    }
+    const int stemCount = firstStem[levels];
+    const int segmentCount = firstSegment[levels];
+
+    // The levels above fromLevel are copied from the last skeleton, which only works if
+    // they were laid out the same
+    const Skeleton& old = m_skeleton;
+    fromLevel = std::min(fromLevel, levels);
+    if (old.levels != levels) fromLevel = 0;
+    for (int level = 0; level < fromLevel; level++) {
+        if (old.levelStems[level] != stems[level] || old.levelRings[level] != rings[level]) fromLevel = 0;
+    }
+
+    // Where each stem starts, filled in by its parent
+    struct StemStart {
+        glm::vec3 position;
+        glm::vec3 direction;
+        float baseRadius;
+    };
+
+    m_spareArena.reset(Arena::footprint<int>(tableSize) + Arena::footprint<StemStart>(stemCount) +
+                       Arena::footprint<int>(stemCount) * 3 + Arena::footprint<float>(stemCount) +
+                       Arena::footprint<glm::vec3>(segmentCount) * 2 + Arena::footprint<glm::quat>(segmentCount) +
+                       Arena::footprint<float>(segmentCount) * 2);
+    int* branchTable = m_spareArena.allocate<int>(tableSize);
+    StemStart* starts = m_spareArena.allocate<StemStart>(stemCount);
+
+    Skeleton sk;
+    sk.levels = levels;
+    sk.stemCount = stemCount;
+    sk.segmentCount = segmentCount;
+    sk.level = m_spareArena.allocate<int>(stemCount);
+    sk.firstSegment = m_spareArena.allocate<int>(stemCount);
+    sk.segments = m_spareArena.allocate<int>(stemCount);
+    sk.length = m_spareArena.allocate<float>(stemCount);
+    sk.position = m_spareArena.allocate<glm::vec3>(segmentCount);
+    sk.direction = m_spareArena.allocate<glm::vec3>(segmentCount);
+    sk.rotation = m_spareArena.allocate<glm::quat>(segmentCount);
+    sk.radius = m_spareArena.allocate<float>(segmentCount);
+    sk.v = m_spareArena.allocate<float>(segmentCount);
+    for (int level = 0; level < levels; level++) {
+        sk.levelStems[level] = stems[level];
+        sk.levelRings[level] = rings[level];
+    }
+
+    // Stems are stored level by level, so the kept levels are a prefix of every array
+    if (fromLevel > 0) {
+        size_t keptStems = size_t(firstStem[fromLevel]);
+        size_t keptSegments = size_t(firstSegment[fromLevel]);
+        std::copy(old.level, old.level + keptStems, sk.level);
+        std::copy(old.firstSegment, old.firstSegment + keptStems, sk.firstSegment);
+        std::copy(old.segments, old.segments + keptStems, sk.segments);
+        std::copy(old.length, old.length + keptStems, sk.length);
+        std::copy(old.position, old.position + keptSegments, sk.position);
+        std::copy(old.direction, old.direction + keptSegments, sk.direction);
+        std::copy(old.rotation, old.rotation + keptSegments, sk.rotation);
+        std::copy(old.radius, old.radius + keptSegments, sk.radius);
+        std::copy(old.v, old.v + keptSegments, sk.v);
+    }
+
+    for (int level = 0; level < levels; level++) {
+        for (int i = 0; i < rings[level]; i++) {
+            branchTable[firstTable[level] + i] = level + 1 < levels ? branchesAtSegment(level, i, rings[level] - 1) : 0;
+        }
+    }
+
+    starts[0].position = glm::vec3(0, 0, 0);
+    starts[0].direction = glm::vec3(0, 1, 0);
+    starts[0].baseRadius = m_params.baseSize;
+
+    // Grow one level at a time; each stem appends its children to the next level. The
+    // last kept level only places its children again, as fromLevel may have moved them.
+    for (int level = std::max(fromLevel - 1, 0); level < levels; level++) {
+        const int curveRes = rings[level] - 1;
+        const int* branches = branchTable + firstTable[level];
+        int nextChild = level + 1 < levels ? firstStem[level + 1] : 0;
+
+        for (int s = firstStem[level]; s < firstStem[level + 1]; s++) {
+            const int first = firstSegment[level] + (s - firstStem[level]) * rings[level];
+
+            if (level >= fromLevel) {
+                const StemStart& start = starts[s];
+                float length = (level == 0) ? m_params.scale * m_params.level[0].nLength : sk.length[s];
+                sk.level[s] = level;
+                sk.firstSegment[s] = first;
+                sk.segments[s] = rings[level];
+                sk.length[s] = length;
+
+                glm::vec3 currentPos = start.position;
+                glm::vec3 currentDir = glm::normalize(start.direction);
+                glm::quat rotation = glm::rotation(glm::vec3(0, 1, 0), currentDir);
+                float segmentLength = length / curveRes;
+
+                for (int i = 0; i <= curveRes; i++) {
+                    float radius = stemRadius(level, i * segmentLength, length);
+                    if (level > 0 && start.baseRadius > 0.0f) {
+                        radius = std::min(radius, start.baseRadius * 0.5f);
+                    }
+
+                    int segment = first + i;
+                    sk.position[segment] = currentPos;
+                    sk.direction[segment] = currentDir;
+                    sk.rotation[segment] = rotation;
+                    sk.radius[segment] = radius;
+                    sk.v[segment] = (float)i / curveRes;
+
+                    if (i < curveRes) {
+                        currentPos += currentDir * segmentLength;
+                    }
+                }
+            }
+
+            for (int i = 0; i <= curveRes; i++) {
+                int branchCount = branches[i];
+                if (branchCount == 0) continue;
+
+                const int segment = first + i;
+                const glm::vec3 currentDir = sk.direction[segment];
+                const BranchLevel& childParams = m_params.level[level + 1];
                 float downAngle = glm::radians(childParams.nDownAngle);
-                
-                // Distribute branches around the stem
-                float baseRotation = glm::radians(childParams.nRotate * i);
-                float branchSpacing = glm::two_pi<float>() / std::max(branchCount, 1);
-                float rotateAngle = baseRotation + branchIdx * branchSpacing;
-                
+
                 glm::vec3 perpendicular;
                 if (glm::abs(glm::dot(currentDir, glm::vec3(0, 0, 1))) < 0.99f) {
                     perpendicular = glm::normalize(glm::cross(currentDir, glm::vec3(0, 0, 1)));
                 } else {
                     perpendicular = glm::normalize(glm::cross(currentDir, glm::vec3(1, 0, 0)));
                 }
-                
-                glm::quat rotAroundStem = glm::angleAxis(rotateAngle, currentDir);
-                glm::vec3 outward = rotAroundStem * perpendicular;
-                
-                glm::quat downRotation = glm::angleAxis(downAngle, glm::cross(currentDir, outward));
-                glm::vec3 branchDir = downRotation * currentDir;
-                
-                float childLength = length * childParams.nLength;
-                generateStem(level + 1, currentPos, branchDir, childLength, radius);
+
+                // Distribute branches around the stem
+                for (int branchIdx = 0; branchIdx < branchCount; branchIdx++) {
+                    float baseRotation = glm::radians(childParams.nRotate * i);
+                    float branchSpacing = glm::two_pi<float>() / branchCount;
+                    float rotateAngle = baseRotation + branchIdx * branchSpacing;
+
+                    glm::quat rotAroundStem = glm::angleAxis(rotateAngle, currentDir);
+                    glm::vec3 outward = rotAroundStem * perpendicular;
+
+                    glm::quat downRotation = glm::angleAxis(downAngle, glm::cross(currentDir, outward));
+
+                    int child = nextChild++;
+                    starts[child].position = sk.position[segment];
+                    starts[child].direction = downRotation * currentDir;
+                    starts[child].baseRadius = sk.radius[segment];
+                    sk.length[child] = sk.length[s] * childParams.nLength;
+                }
             }
         }
-        
-        if (i < params.nCurveRes) {
-            currentPos += currentDir * segmentLength;
-        }
     }
-    
-    m_stems.push_back(stem);
+
+    m_skeleton = sk;
+    std::swap(m_arena, m_spareArena);
 }
 
-void Tree::generateMeshFromSegments() {
-    cgra::mesh_builder trunkBuilder;
-    cgra::mesh_builder branchBuilder;
+void Tree::generateMeshFromSegments(bool trunk, bool branches) {
+    auto start = std::chrono::high_resolution_clock::now();
 
+    const Skeleton& sk = m_skeleton;
     const int radSegs = m_params.radialSegments;
+    const bool rebuild[2] = { trunk, branches };
+    int* partIndexCount[2] = { &m_trunkIndexCount, &m_branchIndexCount };
+    cgra::mesh_builder* builders[2] = { &m_trunkBuilder, &m_branchBuilder };
+    std::vector<StemRing>* partRings[2] = { &m_trunkRings, &m_branchRings };
+
+    // Both meshes are sized up front: a stem of n rings has n * radSegs vertices and
+    // (n - 1) * radSegs quads. The trunk is always stem 0.
+    size_t vertexCount[2] = {}, indexCount[2] = {};
+    for (int s = 0; s < sk.stemCount; s++) {
+        int part = sk.level[s] == 0 ? 0 : 1;
+        vertexCount[part] += size_t(sk.segments[s]) * radSegs;
+        indexCount[part] += size_t(sk.segments[s] - 1) * radSegs * 6;
+    }
 
-    for (const Stem& stem : m_stems) {
-        cgra::mesh_builder& mb = (stem.level == 0) ? trunkBuilder : branchBuilder;
-        size_t vertexStart = mb.vertices.size();
-
-        for (const StemSegment& seg : stem.segments) {
-            for (int j = 0; j < radSegs; j++) {
-                float angle = (float)j / radSegs * glm::two_pi<float>();
-                glm::vec3 offset(cos(angle) * seg.radius, 0, sin(angle) * seg.radius);
-                glm::vec3 worldOffset = seg.rotation * offset;
-                glm::vec3 normal = glm::normalize(worldOffset);
-
-                cgra::mesh_vertex vertex;
-                vertex.pos = seg.position + worldOffset;
-                vertex.norm = normal;
-                vertex.uv = glm::vec2((float)j / radSegs, (float)seg.segmentIndex / seg.totalSegments);
+    if (m_gpuStems) {
+        for (int part = 0; part < 2; part++) {
+            if (!rebuild[part]) continue;
+            *builders[part] = cgra::mesh_builder();
+            partRings[part]->resize(vertexCount[part] / radSegs);
+            *partIndexCount[part] = 0;
+        }
 
-                mb.push_vertex(vertex);
+        StemRing* next[2] = { m_trunkRings.data(), m_branchRings.data() };
+        for (int s = 0; s < sk.stemCount; s++) {
+            int part = sk.level[s] == 0 ? 0 : 1;
+            if (!rebuild[part]) continue;
+            int& indexCount = *partIndexCount[part];
+            int stemRings = sk.segments[s];
+            for (int r = 0; r < stemRings; r++) {
+                int seg = sk.firstSegment[s] + r;
+                StemRing& ring = *next[part]++;
+                ring.positionV = glm::vec4(sk.position[seg], sk.v[seg]);
+                ring.rotation = glm::vec4(sk.rotation[seg].x, sk.rotation[seg].y, sk.rotation[seg].z, sk.rotation[seg].w);
+                ring.radius = sk.radius[seg];
+                ring.indexBase = uint32_t(indexCount);
+                ring.hasNext = (r + 1 < stemRings) ? 1u : 0u;
+                if (ring.hasNext) indexCount += radSegs * 6;
             }
         }
+    } else {
+        for (int part = 0; part < 2; part++) {
+            if (!rebuild[part]) continue;
+            partRings[part]->clear();
+            *builders[part] = cgra::mesh_builder();
+            builders[part]->vertices.resize(vertexCount[part]);
+            builders[part]->indices.resize(indexCount[part]);
+        }
 
-        size_t ringCount = stem.segments.size();
-        for (size_t r = 0; r < ringCount - 1; r++) {
-            size_t baseIdx = vertexStart + r * radSegs;
-            for (int j = 0; j < radSegs; j++) {
-                int j_next = (j + 1) % radSegs;
-
-                mb.push_index(static_cast<GLuint>(baseIdx + j));
-                mb.push_index(static_cast<GLuint>(baseIdx + j_next));
-                mb.push_index(static_cast<GLuint>(baseIdx + radSegs + j));
+        std::vector<glm::vec2> ring = ringTable(radSegs);
+        size_t vertexEnd[2] = {}, indexEnd[2] = {};
+        for (int s = 0; s < sk.stemCount; s++) {
+            int part = sk.level[s] == 0 ? 0 : 1;
+            if (!rebuild[part]) continue;
+            cgra::mesh_vertex* vertices = builders[part]->vertices.data();
+            GLuint* indices = builders[part]->indices.data();
+            size_t vertexStart = vertexEnd[part];
+
+            for (int seg = sk.firstSegment[s]; seg < sk.firstSegment[s] + sk.segments[s]; seg++) {
+                glm::mat3 basis = glm::mat3_cast(sk.rotation[seg]);
+                for (int j = 0; j < radSegs; j++) {
+                    glm::vec3 normal = basis[0] * ring[j].x + basis[2] * ring[j].y;
+
+                    cgra::mesh_vertex& vertex = vertices[vertexEnd[part]++];
+                    vertex.pos = sk.position[seg] + normal * sk.radius[seg];
+                    vertex.norm = normal;
+                    vertex.uv = glm::vec2((float)j / radSegs, sk.v[seg]);
+                }
+            }
 
-                mb.push_index(static_cast<GLuint>(baseIdx + j_next));
-                mb.push_index(static_cast<GLuint>(baseIdx + radSegs + j_next));
-                mb.push_index(static_cast<GLuint>(baseIdx + radSegs + j));
+            for (int r = 0; r + 1 < sk.segments[s]; r++) {
+                GLuint baseIdx = GLuint(vertexStart + size_t(r) * radSegs);
+                for (int j = 0; j < radSegs; j++) {
+                    GLuint j_next = GLuint((j + 1) % radSegs);
+                    GLuint* quad = indices + indexEnd[part];
+                    quad[0] = baseIdx + j;
+                    quad[1] = baseIdx + j_next;
+                    quad[2] = baseIdx + radSegs + j;
+                    quad[3] = baseIdx + j_next;
+                    quad[4] = baseIdx + radSegs + j_next;
+                    quad[5] = baseIdx + radSegs + j;
+                    indexEnd[part] += 6;
+                }
             }
         }
+        for (int part = 0; part < 2; part++) {
+            if (rebuild[part]) *partIndexCount[part] = int(indexCount[part]);
+        }
     }
 
-    m_trunkMesh = trunkBuilder.build();
-    m_branchesMesh = branchBuilder.build();
+    auto end = std::chrono::high_resolution_clock::now();
+    m_stemMs = std::chrono::duration<double, std::milli>(end - start).count();
 }
 
-void Tree::generateLeavesMesh() {
+void Tree::generateLeavesMesh(bool shape, bool placement) {
+    // Every leaf is an instance of one shape, built once in units of the leaf scale
+    if (shape) {
+        m_leafBuilder = cgra::mesh_builder();
+        m_leafCardBuilder = cgra::mesh_builder();
+        const LeafParameters& lp = m_params.leafParams;
+        if (lp.lobeCount == 1) {
+            createSimpleLeaf(m_leafBuilder, lp);
+        } else {
+            createLobedLeaf(m_leafBuilder, lp);
+        }
+        createLeafCard(m_leafCardBuilder, lp);
+    }
+
+    if (!placement) return;
+    m_leaves.clear();
     if (!m_params.hasLeaves) return;
 
-    cgra::mesh_builder leafBuilder;
-    std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
+    // Leaves are the only random part of a tree, so placing them again from the seed
+    // gives the same leaves whatever else was rebuilt
+    m_rng.seed(m_seed);
 
-    for (const Stem& stem : m_stems) {
-        if (stem.level != m_params.levels - 1) continue;
+    const Skeleton& sk = m_skeleton;
+    int numLeaves = m_params.leavesPerBranch;
+    m_leaves.reserve(size_t(sk.stemCount) * numLeaves * 2);
 
-        int numLeaves = m_params.leavesPerBranch;
+    for (int s = 0; s < sk.stemCount; s++) {
+        if (sk.level[s] != m_params.levels - 1) continue;
 
         for (int i = 0; i < numLeaves; i++) {
-            float baseT = 0.2f + (float)i / (numLeaves - 1) * 0.8f;
+            float baseT = 0.2f + (float)i / std::max(numLeaves - 1, 1) * 0.8f;
             float t = baseT + randomVariance(0.05f);
             t = glm::clamp(t, 0.0f, 1.0f);
 
-            int segmentIdx = (int)(t * (stem.segments.size() - 1));
-            segmentIdx = glm::clamp(segmentIdx, 0, (int)stem.segments.size() - 1);
+            int segmentIdx = (int)(t * (sk.segments[s] - 1));
+            segmentIdx = glm::clamp(segmentIdx, 0, sk.segments[s] - 1);
 
-            const StemSegment& seg = stem.segments[segmentIdx];
+            int seg = sk.firstSegment[s] + segmentIdx;
 
             int leavesAround = 2;
             for (int j = 0; j < leavesAround; j++) {
@@ -278,25 +525,19 @@ void Tree::generateLeavesMesh() {
                     (float)j / leavesAround * glm::two_pi<float>();
                 rotAngle += randomVariance(0.3f);
 
-                glm::vec3 leafPos = seg.position + seg.direction * randomVariance(0.02f);
+                glm::vec3 leafPos = sk.position[seg] + sk.direction[seg] * randomVariance(0.02f);
 
-                createLeaf(leafBuilder, leafPos, seg.direction, seg.rotation, rotAngle);
+                createLeaf(leafPos, sk.direction[seg], rotAngle);
             }
         }
     }
-
-    m_leavesMesh = leafBuilder.build();
 }
 
-void Tree::createLeaf(cgra::mesh_builder& mb, const glm::vec3& position,
-                     const glm::vec3& stemDir, const glm::quat& stemRot, float rotAngle) {
-    const LeafParameters& lp = m_params.leafParams;
+void Tree::createLeaf(const glm::vec3& position, const glm::vec3& stemDir, float rotAngle) {
     float scale = m_params.leafScale;
     
-    std::uniform_real_distribution<float> dist01(0.0f, 1.0f);
-    
     // Add scale variation
-    scale *= (0.8f + dist01(rng) * 0.4f);
+    scale *= (0.8f + random01() * 0.4f);
     
     glm::vec3 perpendicular;
     if (glm::abs(glm::dot(stemDir, glm::vec3(0, 0, 1))) < 0.99f) {
@@ -310,36 +551,37 @@ void Tree::createLeaf(cgra::mesh_builder& mb, const glm::vec3& position,
     glm::vec3 leafRight = glm::cross(stemDir, leafUp);
     
     // Random tilt angle for variety
-    float tiltAngle = glm::radians(25.0f + dist01(rng) * 20.0f);
+    float tiltAngle = glm::radians(25.0f + random01() * 20.0f);
     glm::quat tilt = glm::angleAxis(tiltAngle, leafRight);
-    glm::vec3 leafNormal = tilt * stemDir;
     leafUp = tilt * leafUp;
-    
-    if (lp.lobeCount == 1) {
-        createSimpleLeaf(mb, position, leafRight, leafUp, leafNormal, scale, lp);
-    } else {
-        createLobedLeaf(mb, position, leafRight, leafUp, leafNormal, scale, lp);
-    }
+
+    // The shape's x/y/z axes go to right/up/normal. q and -q are the same rotation,
+    // so keep w positive and store only xyz.
+    glm::quat orientation = glm::quat_cast(glm::mat3(leafRight, leafUp, glm::cross(leafRight, leafUp)));
+    if (orientation.w < 0.0f) orientation = -orientation;
+
+    LeafInstance leaf;
+    leaf.position = position;
+    leaf.scale = scale;
+    leaf.orientation = glm::vec3(orientation.x, orientation.y, orientation.z);
+    leaf.variant = random01();
+    m_leaves.push_back(leaf);
 }
 
-void Tree::createSimpleLeaf(cgra::mesh_builder& mb, const glm::vec3& center,
-                           const glm::vec3& right, const glm::vec3& up,
-                           const glm::vec3& normal, float scale,
-                           const LeafParameters& lp) {
-   
-    size_t baseIdx = mb.vertices.size();
-    
+glm::vec3 Tree::leafColour() const {
+    return m_params.leafParams.lobeCount == 1 ? glm::vec3(0.518f, 0.929f, 0.204f) : glm::vec3(0.376f, 0.722f, 0.114f);
+}
+
+void Tree::createSimpleLeaf(cgra::mesh_builder& mb, const LeafParameters& lp) {
     int segments = 10;  // More segments for smoother leaves
-    float width = lp.lobeWidth * scale;
-    float height = lp.lobeHeight * scale;
+    float width = lp.lobeWidth;
+    float height = lp.lobeHeight;
 
-    glm::vec3 colour = glm::vec3(0.518f, 0.929f, 0.204f);
-    
+    // Single sided, facing +z; the shaders light leaves from both sides
     cgra::mesh_vertex centerVert;
-    centerVert.pos = center;
-    centerVert.norm = normal;
+    centerVert.norm = glm::vec3(0, 0, 1);
     centerVert.uv = glm::vec2(0.5f, 0.5f);
-    centerVert.col = colour;
+    centerVert.col = leafColour();
     mb.push_vertex(centerVert);
     
     for (int i = 0; i <= segments; i++) {
@@ -360,78 +602,35 @@ void Tree::createSimpleLeaf(cgra::mesh_builder& mb, const glm::vec3& center,
         }
         
         cgra::mesh_vertex v;
-        v.pos = center + right * x + up * y;
-        v.norm = normal;
+        v.pos = glm::vec3(x, y, 0.0f);
+        v.norm = centerVert.norm;
         v.uv = glm::vec2(0.5f + x / width * 0.5f, 0.5f + y / height * 0.5f);
-        v.col = colour;
+        v.col = centerVert.col;
         mb.push_vertex(v);
     }
     
     for (int i = 0; i < segments; i++) {
-        mb.push_index(static_cast<GLuint>(baseIdx));
-        mb.push_index(static_cast<GLuint>(baseIdx + 1 + i));
-        mb.push_index(static_cast<GLuint>(baseIdx + 1 + ((i + 1) % (segments + 1))));
-    }
-
-    
-    // Back face
-    GLuint backBaseIdx = static_cast<GLuint>(mb.vertices.size());
-    centerVert.norm = -normal;
-    centerVert.col = colour;
-    mb.push_vertex(centerVert);
-    
-    for (int i = 0; i <= segments; i++) {
-        float angle = (float)i / segments * glm::two_pi<float>();
-        float x = cos(angle) * width;
-        float y = sin(angle) * height;
-        
-        float angleFactor = sin(angle);
-        float taper = 1.0f - abs(angleFactor) * 0.5f;
-        x *= taper;
-        
-        if (angleFactor > 0.7f) {
-            float tipFactor = (angleFactor - 0.7f) / 0.3f;
-            x *= (1.0f - tipFactor * 0.5f);
-            y *= (1.0f + tipFactor * 0.2f);
-        }
-        
-        cgra::mesh_vertex v;
-        v.pos = center + right * x + up * y;
-        v.norm = -normal;
-        v.uv = glm::vec2(0.5f + x / width * 0.5f, 0.5f + y / height * 0.5f);
-        v.col = colour;
-        mb.push_vertex(v);
-    }
-    
-    for (int i = 0; i < segments; i++) {
-        mb.push_index(backBaseIdx);
-        mb.push_index(backBaseIdx + 1 + ((i + 1) % (segments + 1)));
-        mb.push_index(backBaseIdx + 1 + i);
+        mb.push_index(0);
+        mb.push_index(static_cast<GLuint>(1 + i));
+        mb.push_index(static_cast<GLuint>(1 + ((i + 1) % (segments + 1))));
     }
 }
 
-void Tree::createLobedLeaf(cgra::mesh_builder& mb, const glm::vec3& center,
-                          const glm::vec3& right, const glm::vec3& up,
-                          const glm::vec3& normal, float scale,
-                          const LeafParameters& lp) {
-    size_t baseIdx = mb.vertices.size();
-
-    glm::vec3 colour = glm::vec3(0.376f, 0.722f, 0.114f);
-    
+void Tree::createLobedLeaf(cgra::mesh_builder& mb, const LeafParameters& lp) {
     cgra::mesh_vertex centerVert;
-    centerVert.pos = center + up * lp.lobeOffset * scale;
-    centerVert.norm = normal;
+    centerVert.pos = glm::vec3(0.0f, lp.lobeOffset, 0.0f);
+    centerVert.norm = glm::vec3(0, 0, 1);
     centerVert.uv = glm::vec2(0.5f, 0.5f);
-    centerVert.col = colour;
+    centerVert.col = leafColour();
     mb.push_vertex(centerVert);
     
     std::vector<glm::vec3> lobePoints;
     
     for (int lobe = 0; lobe < lp.lobeCount; lobe++) {
         float lobeAngle = (float)lobe / lp.lobeCount * glm::two_pi<float>();
-        float lobeDist = lp.lobeHeight * scale * (lobe == 0 ? 1.0f : lp.lobeScale);
+        float lobeDist = lp.lobeHeight * (lobe == 0 ? 1.0f : lp.lobeScale);
         
-        glm::vec3 lobeDir = glm::cos(lobeAngle) * right + glm::sin(lobeAngle) * up;
+        glm::vec3 lobeDir(glm::cos(lobeAngle), glm::sin(lobeAngle), 0.0f);
         glm::vec3 lobeTip = centerVert.pos + lobeDir * lobeDist;
         
         int pointsPerLobe = 5;
@@ -443,136 +642,300 @@ void Tree::createLobedLeaf(cgra::mesh_builder& mb, const glm::vec3& center,
     }
     
     for (size_t i = 0; i < lobePoints.size(); i++) {
-        cgra::mesh_vertex v;
+        cgra::mesh_vertex v = centerVert;
         v.pos = lobePoints[i];
-        v.norm = normal;
-        v.uv = glm::vec2(0.5f, 0.5f);
-        v.col = colour;
         mb.push_vertex(v);
     }
     
     for (size_t i = 0; i < lobePoints.size(); i++) {
-        mb.push_index(baseIdx);
-        mb.push_index(baseIdx + 1 + i);
-        mb.push_index(baseIdx + 1 + ((i + 1) % lobePoints.size()));
+        mb.push_index(0);
+        mb.push_index(static_cast<GLuint>(1 + i));
+        mb.push_index(static_cast<GLuint>(1 + ((i + 1) % lobePoints.size())));
     }
-    
-    // Back face
-    size_t backBaseIdx = mb.vertices.size();
-    centerVert.norm = -normal;
-    centerVert.col = colour;
-    mb.push_vertex(centerVert);
-    
-    for (size_t i = 0; i < lobePoints.size(); i++) {
-        cgra::mesh_vertex v;
-        v.pos = lobePoints[i];
-        v.norm = -normal;
-        v.uv = glm::vec2(0.5f, 0.5f);
-        v.col = colour;
-        mb.push_vertex(v);
+}
+
+void Tree::createLeafCard(cgra::mesh_builder& mb, const LeafParameters& lp) {
+    // A diamond with the pointed tip of createSimpleLeaf. Lobed leaves get the same
+    // card, which covers their central lobe.
+    for (glm::vec2 p : { glm::vec2(0.0f, -lp.lobeHeight), glm::vec2(lp.lobeWidth, 0.0f),
+                         glm::vec2(0.0f, lp.lobeHeight * 1.2f), glm::vec2(-lp.lobeWidth, 0.0f) }) {
+        cgra::mesh_vertex vertex;
+        vertex.pos = glm::vec3(p, 0.0f);
+        vertex.norm = glm::vec3(0, 0, 1);
+        vertex.col = leafColour();
+        mb.push_vertex(vertex);
     }
-    
-    for (size_t i = 0; i < lobePoints.size(); i++) {
-        mb.push_index(backBaseIdx);
-        mb.push_index(backBaseIdx + 1 + ((i + 1) % lobePoints.size()));
-        mb.push_index(backBaseIdx + 1 + i);
+    mb.push_indices({ 0, 1, 2, 0, 2, 3 });
+}
+
+void Tree::buildStems(cgra::mesh_builder& mb, int radialSegments, int ringStep, bool skipTwigs) const {
+    const Skeleton& sk = m_skeleton;
+    const std::vector<glm::vec2> ring = ringTable(radialSegments);
+
+    // Every ringStep-th ring, always keeping the last so the stem keeps its length
+    auto keptRings = [ringStep](int segments) { return (segments - 1 + ringStep - 1) / ringStep + 1; };
+    auto kept = [&sk, skipTwigs, this](int s) {
+        bool leafBearing = m_params.hasLeaves && m_params.levels > 1 && sk.level[s] == m_params.levels - 1;
+        return !(skipTwigs && leafBearing) && sk.segments[s] >= 2;
+    };
+
+    size_t vertexCount = 0, indexCount = 0;
+    for (int s = 0; s < sk.stemCount; s++) {
+        if (!kept(s)) continue;
+        vertexCount += size_t(keptRings(sk.segments[s])) * radialSegments;
+        indexCount += size_t(keptRings(sk.segments[s]) - 1) * radialSegments * 6;
     }
+    mb.vertices.reserve(mb.vertices.size() + vertexCount);
+    mb.indices.reserve(mb.indices.size() + indexCount);
+
+    for (int s = 0; s < sk.stemCount; s++) {
+        if (!kept(s)) continue;
+
+        int rings = keptRings(sk.segments[s]);
+        size_t vertexStart = mb.vertices.size();
+        for (int r = 0; r < rings; r++) {
+            int seg = sk.firstSegment[s] + std::min(r * ringStep, sk.segments[s] - 1);
+            glm::mat3 basis = glm::mat3_cast(sk.rotation[seg]);
+            for (int j = 0; j < radialSegments; j++) {
+                glm::vec3 normal = basis[0] * ring[j].x + basis[2] * ring[j].y;
+
+                cgra::mesh_vertex vertex;
+                vertex.pos = sk.position[seg] + normal * sk.radius[seg];
+                vertex.norm = normal;
+                vertex.uv = glm::vec2((float)j / radialSegments, sk.v[seg]);
+                mb.push_vertex(vertex);
+            }
+        }
+
+        for (int r = 0; r + 1 < rings; r++) {
+            size_t baseIdx = vertexStart + size_t(r) * radialSegments;
+            for (int j = 0; j < radialSegments; j++) {
+                int j_next = (j + 1) % radialSegments;
+                mb.push_indices({ GLuint(baseIdx + j), GLuint(baseIdx + j_next), GLuint(baseIdx + radialSegments + j) });
+                mb.push_indices({ GLuint(baseIdx + j_next), GLuint(baseIdx + radialSegments + j_next), GLuint(baseIdx + radialSegments + j) });
+            }
+        }
+    }
+}
+
+void Tree::generateShadowProxy() {
+    m_shadowStemBuilder = cgra::mesh_builder();
+
+    // A quarter of the radial segments and every other ring is plenty at shadow-map
+    // resolution, and the leaves are drawn as cards (see getShadowLeafLevel)
+    buildStems(m_shadowStemBuilder, std::max(3, m_params.radialSegments / 4), 2, true);
+    m_shadowStemTriangles = int(m_shadowStemBuilder.indices.size()) / 3;
 }
 
-void Tree::draw(const glm::mat4& view, const glm::mat4& proj, GLuint shader,
-    const glm::vec3& sunPos, const glm::vec3& sunColour,
-    GLuint trunkDiffuse, GLuint trunkNormal, GLuint trunkRoughness, const glm::vec3& cameraPos, const glm::mat4& lightSpaceMatrix, GLuint shadowMap) {
-    if (!m_meshGenerated) {
-        m_stems.clear();
-        float trunkLength = m_params.scale * m_params.level[0].nLength;
-        generateStem(0, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0), trunkLength, m_params.baseSize);
-        generateMeshFromSegments();
-        generateLeavesMesh();
-        m_meshGenerated = true;
+void Tree::computeBounds() {
+    m_boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    m_boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+    const Skeleton& sk = m_skeleton;
+    for (int seg = 0; seg < sk.segmentCount; seg++) {
+        m_boundsMin = glm::min(m_boundsMin, sk.position[seg] - glm::vec3(sk.radius[seg]));
+        m_boundsMax = glm::max(m_boundsMax, sk.position[seg] + glm::vec3(sk.radius[seg]));
     }
+    for (const LeafInstance& leaf : m_leaves) {
+        glm::quat q(std::sqrt(std::max(1.0f - glm::dot(leaf.orientation, leaf.orientation), 0.0f)),
+                    leaf.orientation.x, leaf.orientation.y, leaf.orientation.z);
+        for (const cgra::mesh_vertex& vertex : m_leafCardBuilder.vertices) {
+            glm::vec3 p = leaf.position + q * (vertex.pos * leaf.scale);
+            m_boundsMin = glm::min(m_boundsMin, p);
+            m_boundsMax = glm::max(m_boundsMax, p);
+        }
+    }
+
+    if (sk.stemCount == 0) {
+        m_boundsMin = m_boundsMax = glm::vec3(0.0f);
+    }
+}
 
-    // Create model matrix
+void Tree::generateLods() {
+    const int radialSegments[LOD_MESHES] = { std::max(3, m_params.radialSegments / 2), std::max(3, m_params.radialSegments / 4) };
+    for (int l = 0; l < LOD_MESHES; l++) {
+        m_lodWoodBuilder[l] = cgra::mesh_builder();
+        buildStems(m_lodWoodBuilder[l], radialSegments[l], l + 1, l > 0);
+        m_lodWoodTriangles[l] = int(m_lodWoodBuilder[l].indices.size()) / 3;
+    }
+}
+
+void Tree::generateGeometry() {
+    const unsigned dirty = m_dirty;
+    if (dirty & DIRTY_SKELETON) generateSkeleton(m_skeletonFrom);
+    m_stemMs = 0.0;
+    if (dirty & (DIRTY_TRUNK | DIRTY_BRANCHES)) generateMeshFromSegments(dirty & DIRTY_TRUNK, dirty & DIRTY_BRANCHES);
+    if (dirty & (DIRTY_LEAVES | DIRTY_LEAF_SHAPE)) generateLeavesMesh(dirty & DIRTY_LEAF_SHAPE, dirty & DIRTY_LEAVES);
+    if (dirty & DIRTY_PROXIES) {
+        generateShadowProxy();
+        generateLods();
+    }
+    computeBounds();
+    finishGeometry(dirty);
+}
+
+void Tree::finishGeometry(unsigned built) {
+    m_triangleCount = (m_trunkIndexCount + m_branchIndexCount) / 3 + leafTriangles(0);
+    m_shadowTriangleCount = m_shadowStemTriangles + leafTriangles(getShadowLeafLevel());
+    for (int l = 0; l < LOD_MESHES; l++) {
+        m_lodTriangleCount[l] = m_lodWoodTriangles[l] + leafTriangles(l + 1);
+    }
+
+    m_pendingUpload |= built;
+    m_dirty = 0;
+    m_geometryReady = true;
+}
+
+void Tree::uploadMeshes(TrunkGenerator* generator) {
+    if (!m_geometryReady) return;
+
+    // Only the meshes whose geometry was rebuilt are replaced
+    const unsigned pending = m_pendingUpload;
+    const bool stemParts[2] = { (pending & DIRTY_TRUNK) != 0, (pending & DIRTY_BRANCHES) != 0 };
+    cgra::gl_mesh* stemMeshes[2] = { &m_trunkMesh, &m_branchesMesh };
+    cgra::mesh_builder* stemBuilders[2] = { &m_trunkBuilder, &m_branchBuilder };
+    std::vector<StemRing>* stemRings[2] = { &m_trunkRings, &m_branchRings };
+    const int stemIndexCounts[2] = { m_trunkIndexCount, m_branchIndexCount };
+
+    for (int part = 0; part < 2; part++) {
+        if (!stemParts[part]) continue;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        stemMeshes[part]->destroy();
+        *stemMeshes[part] = cgra::gl_mesh();
+        if (m_gpuStems && generator) {
+            // Waits for the GPU timers, so count the GPU time rather than the CPU wait
+            double gpuMs = 0.0;
+            *stemMeshes[part] = generator->generate(*stemRings[part], m_params.radialSegments, stemIndexCounts[part], &gpuMs);
+            m_stemMs += gpuMs;
+        } else {
+            if (!stemBuilders[part]->indices.empty()) *stemMeshes[part] = stemBuilders[part]->build();
+            auto end = std::chrono::high_resolution_clock::now();
+            m_stemMs += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+        *stemBuilders[part] = cgra::mesh_builder();
+        stemRings[part]->clear();
+    }
+
+    // The leaf shapes are kept on the CPU too, they are tiny and give the leaf bounds
+    // and triangle counts when only the placement changes
+    struct Part {
+        unsigned dirty;
+        cgra::gl_mesh* mesh;
+        cgra::mesh_builder* builder;
+        bool keep;
+    } parts[] = {
+        { DIRTY_LEAF_SHAPE, &m_leavesMesh, &m_leafBuilder, true },
+        { DIRTY_LEAF_SHAPE, &m_leafCardMesh, &m_leafCardBuilder, true },
+        { DIRTY_PROXIES, &m_shadowStemMesh, &m_shadowStemBuilder, false },
+        { DIRTY_PROXIES, &m_lodWoodMesh[0], &m_lodWoodBuilder[0], false },
+        { DIRTY_PROXIES, &m_lodWoodMesh[1], &m_lodWoodBuilder[1], false },
+    };
+    for (Part& part : parts) {
+        if (!(pending & part.dirty)) continue;
+        part.mesh->destroy();
+        *part.mesh = part.builder->indices.empty() ? cgra::gl_mesh() : part.builder->build();
+        if (!part.keep) *part.builder = cgra::mesh_builder();
+    }
+
+    // Leaf records are read by the vertex shaders as a buffer texture, two texels per leaf
+    if (pending & DIRTY_LEAVES) {
+        if (m_leafTexture == 0) {
+            glGenBuffers(1, &m_leafBuffer);
+            glGenTextures(1, &m_leafTexture);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, m_leafBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, m_leaves.size() * sizeof(LeafInstance), m_leaves.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        cgra::gl_state::bind_texture(GL_TEXTURE_BUFFER, m_leafTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_leafBuffer);
+        cgra::gl_state::bind_texture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    m_pendingUpload = 0;
+    m_geometryReady = false;
+    m_meshGenerated = true;
+}
+
+void Tree::generateMeshes() {
+    if (m_meshGenerated) return;
+    if (!m_geometryReady) generateGeometry();
+    uploadMeshes();
+}
+
+glm::mat4 Tree::modelMatrix() const {
     glm::mat4 model = glm::translate(glm::mat4(1.0f), m_position);
     if (glm::length(m_rotation) > 0.001f) {
         model = glm::rotate(model, m_rotation.x, glm::vec3(1, 0, 0));
         model = glm::rotate(model, m_rotation.y, glm::vec3(0, 1, 0));
         model = glm::rotate(model, m_rotation.z, glm::vec3(0, 0, 1));
     }
+    return model;
+}
 
-    glm::mat4 modelview = view * model;
+void Tree::getWorldBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) {
+    generateMeshes();
 
-    glUseProgram(shader);
+    // Transform the local box as a centre and absolute-matrix extents
+    glm::mat4 model = modelMatrix();
+    glm::vec3 center = glm::vec3(model * glm::vec4((m_boundsMin + m_boundsMax) * 0.5f, 1.0f));
+    glm::vec3 halfSize = (m_boundsMax - m_boundsMin) * 0.5f;
+    glm::vec3 extent(0.0f);
+    for (int k = 0; k < 3; k++) {
+        extent[k] = std::abs(model[0][k]) * halfSize.x + std::abs(model[1][k]) * halfSize.y + std::abs(model[2][k]) * halfSize.z;
+    }
+    boundsMin = center - extent;
+    boundsMax = center + extent;
+}
 
-    // Set matrices
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uProjectionMatrix"), 1, GL_FALSE, glm::value_ptr(proj));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uModelViewMatrix"), 1, GL_FALSE, glm::value_ptr(modelview));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uModelMatrix"), 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(glGetUniformLocation(shader, "uLightSpacematrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+void Tree::draw(const cgra::shader_program& shader, GLuint trunkDiffuse, GLuint trunkNormal, GLuint trunkRoughness) {
+    generateMeshes();
 
-    // Set lighting uniforms
-    glUniform3fv(glGetUniformLocation(shader, "uSunPos"), 1, glm::value_ptr(sunPos));
-    glUniform3fv(glGetUniformLocation(shader, "uSunColor"), 1, glm::value_ptr(sunColour));
-    glUniform3fv(glGetUniformLocation(shader, "uCameraPos"), 1, glm::value_ptr(cameraPos));
-    glUniform1f(glGetUniformLocation(shader, "uLightSize"), 0.01f);
-    glUniform1f(glGetUniformLocation(shader, "uNearPlane"), 0.1f);
-    glUniform1i(glGetUniformLocation(shader, "uBlockerSearchSamples"), 16);
-    glUniform1i(glGetUniformLocation(shader, "uPCFSamples"), 32);
+    glm::mat4 model = modelMatrix();
 
-    // Bind textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, trunkDiffuse);
-    glUniform1i(glGetUniformLocation(shader, "uTrunkDiffuse"), 0);
+    cgra::gl_state::use_program(shader);
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, trunkNormal);
-    glUniform1i(glGetUniformLocation(shader, "uTrunkNormal"), 1);
+    shader.set_uniform("uModelMatrix", model);
+    shader.set_uniform("uInstanced", 0);
 
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, trunkRoughness);
-    glUniform1i(glGetUniformLocation(shader, "uTrunkRoughness"), 2);
+    // Bind textures
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, trunkDiffuse);
+    shader.set_uniform("uTrunkDiffuse", 0);
+
+    cgra::gl_state::active_texture(GL_TEXTURE1);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, trunkNormal);
+    shader.set_uniform("uTrunkNormal", 1);
 
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
-    glUniform1i(glGetUniformLocation(shader, "uShadowMap"), 3);
+    cgra::gl_state::active_texture(GL_TEXTURE2);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, trunkRoughness);
+    shader.set_uniform("uTrunkRoughness", 2);
+    shader.set_uniform("uLeafInstances", LEAF_UNIT);
 
     // Draw trunk (not leaves)
-    glUniform1i(glGetUniformLocation(shader, "uIsLeaf"), 0);
+    shader.set_uniform("uIsLeaf", 0);
     if (m_trunkMesh.vbo != 0 && m_trunkMesh.index_count > 0) {
         m_trunkMesh.draw();
     }
 
     // Draw branches (not leaves)
-    glUniform1i(glGetUniformLocation(shader, "uIsLeaf"), 0);
+    shader.set_uniform("uIsLeaf", 0);
     if (m_branchesMesh.vbo != 0 && m_branchesMesh.index_count > 0) {
         m_branchesMesh.draw();
     }
 
     // Draw leaves (IS leaves)
-    glUniform1i(glGetUniformLocation(shader, "uIsLeaf"), 1);
-    if (m_params.hasLeaves && m_leavesMesh.vbo != 0 && m_leavesMesh.index_count > 0) {
-        m_leavesMesh.draw();
-    }
+    shader.set_uniform("uIsLeaf", 1);
+    drawLeaves(shader, 0);
+    shader.set_uniform("uIsLeaf", 0);
 }
 
-void Tree::drawShadows(GLuint shader) {
-    if (!m_meshGenerated) {
-        m_stems.clear();
-        float trunkLength = m_params.scale * m_params.level[0].nLength;
-        generateStem(0, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0), trunkLength, m_params.baseSize);
-        generateMeshFromSegments();
-        generateLeavesMesh();
-        m_meshGenerated = true;
-    }
+void Tree::drawShadows(const cgra::shader_program& shader) {
+    generateMeshes();
 
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), m_position);
-    if (glm::length(m_rotation) > 0.001f) {
-        model = glm::rotate(model, m_rotation.x, glm::vec3(1, 0, 0));
-        model = glm::rotate(model, m_rotation.y, glm::vec3(0, 1, 0));
-        model = glm::rotate(model, m_rotation.z, glm::vec3(0, 0, 1));
-    }
+    glm::mat4 model = modelMatrix();
 
-    glUseProgram(shader);
-    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, false, glm::value_ptr(model));
+    cgra::gl_state::use_program(shader);
+    shader.set_uniform("model", model);
 
     // Draw trunk
     if (m_trunkMesh.vbo != 0 && m_trunkMesh.index_count > 0) {
@@ -583,7 +946,56 @@ void Tree::drawShadows(GLuint shader) {
         m_branchesMesh.draw();
     }
     // draw leaves
-    if (m_params.hasLeaves && m_leavesMesh.vbo != 0 && m_leavesMesh.index_count > 0) {
-        m_leavesMesh.draw();
+    shader.set_uniform("uIsLeaf", 1);
+    drawLeaves(shader, 0);
+    shader.set_uniform("uIsLeaf", 0);
+}
+
+void Tree::drawShadowProxy(const cgra::shader_program& shader) {
+    generateMeshes();
+
+    glm::mat4 model = modelMatrix();
+
+    cgra::gl_state::use_program(shader);
+    shader.set_uniform("model", model);
+
+    if (m_shadowStemMesh.index_count > 0) {
+        m_shadowStemMesh.draw();
     }
+    shader.set_uniform("uIsLeaf", 1);
+    drawLeaves(shader, getShadowLeafLevel());
+    shader.set_uniform("uIsLeaf", 0);
+}
+
+int Tree::leafInstanceCount(int level) const {
+    int stride = leafStride(level);
+    return (int(m_leaves.size()) + stride - 1) / stride;
+}
+
+int Tree::leafTriangles(int level) const {
+    const cgra::mesh_builder& shape = (level == 0) ? m_leafBuilder : m_leafCardBuilder;
+    return int(shape.indices.size()) / 3 * leafInstanceCount(level);
+}
+
+int Tree::bindLeaves(const cgra::shader_program& shader, int level, int textureUnit) const {
+    cgra::gl_state::active_texture(GL_TEXTURE0 + textureUnit);
+    cgra::gl_state::bind_texture(GL_TEXTURE_BUFFER, m_leafTexture);
+    shader.set_uniform("uLeafInstances", textureUnit);
+
+    // Half the cards at 1.4x the size keeps roughly the same canopy coverage
+    int count = leafInstanceCount(level);
+    shader.set_uniform("uLeafCount", count);
+    shader.set_uniform("uLeafStride", leafStride(level));
+    shader.set_uniform("uLeafScale", level >= 2 ? 1.4f : 1.0f);
+    return count;
+}
+
+void Tree::drawLeaves(const cgra::shader_program& shader, int level) const {
+    const cgra::gl_mesh& mesh = getLeafMesh(level);
+    if (!m_params.hasLeaves || mesh.index_count == 0 || m_leaves.empty()) return;
+
+    int count = bindLeaves(shader, level, LEAF_UNIT);
+    cgra::gl_state::bind_vertex_array(mesh.vao);
+    glDrawElementsInstanced(mesh.mode, mesh.index_count, GL_UNSIGNED_INT, 0, count);
+    cgra::gl_state::bind_vertex_array(0);
 }
@@ -2,8 +2,13 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <random>
 #include <vector>
 #include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_shader.hpp"
+#include "arena.hpp"
+#include "trunk_generator.hpp"
 
 struct BranchLevel {
     // Length and shape
@@ -67,80 +72,243 @@ struct TreeParameters {
 };
 
 class Tree {
+    // Reads and writes the generated geometry, see tree_cache.hpp
+    friend class TreeCache;
+
+public:
+    // One leaf, drawn as an instance of the tree's leaf shape (see leaf_instance.glsl) and
+    // read by the shaders as two RGBA32F texels. The orientation is a unit quaternion
+    // with w >= 0, so only xyz are stored and w is rebuilt in the shader.
+    struct LeafInstance {
+        glm::vec3 position;
+        float scale = 1.0f;
+        glm::vec3 orientation;     // takes the shape's x/y/z axes to leaf right/up/normal
+        float variant = 0.0f;      // 0-1, picks the leaf's tint
+    };
+
 private:
     TreeParameters m_params;
     glm::vec3 m_position;
     glm::vec3 m_rotation;  // ADD THIS - rotation for terrain alignment
     cgra::gl_mesh m_trunkMesh;
     cgra::gl_mesh m_branchesMesh;
-    cgra::gl_mesh m_leavesMesh;
+    cgra::gl_mesh m_leavesMesh;        // the leaf shape every leaf instance shares
+    cgra::gl_mesh m_leafCardMesh;      // a diamond card, for reduced detail
     bool m_meshGenerated;
-    
-    struct StemSegment {
-        glm::vec3 position;
-        glm::vec3 direction;       // Unit vector pointing forward
-        glm::quat rotation;
-        float radius;
-        float length;              // Length of this segment
-        int level;                 // 0=trunk, 1=branch, 2=twig, etc
-        int segmentIndex;          // Index within this stem
-        int totalSegments;         // Total segments in this stem
+
+    // Parts of the geometry that are out of date. Parameter edits only mark the parts
+    // they affect (see setParameters), generateGeometry rebuilds just those, and
+    // uploadMeshes replaces just the meshes they feed.
+    enum : unsigned {
+        DIRTY_SKELETON = 1 << 0,       // stems from m_skeletonFrom down
+        DIRTY_TRUNK = 1 << 1,          // trunk mesh
+        DIRTY_BRANCHES = 1 << 2,       // branch mesh
+        DIRTY_PROXIES = 1 << 3,        // shadow and LOD stems
+        DIRTY_LEAVES = 1 << 4,         // leaf placement
+        DIRTY_LEAF_SHAPE = 1 << 5,     // leaf and card shapes
+        DIRTY_ALL = (1 << 6) - 1
     };
-    
-    std::vector<StemSegment> m_segments;
-    
-    struct Stem {
-        glm::vec3 position;
-        glm::vec3 direction;       // Unit vector pointing forward
-        glm::quat rotation;
-        float radius;
-        float length;              // Length of this segment
-        int level;                 // 0=trunk, 1=branch, 2=twig, etc
-        int segmentIndex;          // Index within this stem
-        int totalSegments;
-        std::vector<StemSegment> segments;
+    unsigned m_dirty = DIRTY_ALL;
+    unsigned m_pendingUpload = 0;
+    int m_skeletonFrom = 0;
+
+    void markDirty(unsigned parts, int skeletonFrom = 0);
+
+    // Each tree draws from its own stream, so generation is independent of the order
+    // trees are generated in and can run on several threads at once
+    uint32_t m_seed = 12345;
+    std::mt19937 m_rng;
+
+    // Geometry built by generateGeometry, waiting for uploadMeshes on the GL thread
+    cgra::mesh_builder m_trunkBuilder;
+    cgra::mesh_builder m_branchBuilder;
+    cgra::mesh_builder m_leafBuilder;
+    cgra::mesh_builder m_leafCardBuilder;
+    cgra::mesh_builder m_shadowStemBuilder;
+    bool m_geometryReady = false;
+
+    // With GPU stems the trunk and branches are left as rings for TrunkGenerator
+    // instead of being expanded into m_trunkBuilder/m_branchBuilder
+    bool m_gpuStems = false;
+    std::vector<StemRing> m_trunkRings;
+    std::vector<StemRing> m_branchRings;
+    int m_trunkIndexCount = 0;
+    int m_branchIndexCount = 0;
+    double m_stemMs = 0.0;
+
+    // Every leaf's placement, and the buffer texture the shaders read it from
+    std::vector<LeafInstance> m_leaves;
+    GLuint m_leafBuffer = 0;
+    GLuint m_leafTexture = 0;
+
+    // Reduced-detail casters for the shadow cascades
+    cgra::gl_mesh m_shadowStemMesh;
+    int m_triangleCount = 0;
+    int m_shadowTriangleCount = 0;
+    int m_shadowStemTriangles = 0;
+
+    // Levels of detail 1 and 2 (level 0 is the full mesh), see generateLods
+    static const int LOD_MESHES = 2;
+    cgra::mesh_builder m_lodWoodBuilder[LOD_MESHES];
+    cgra::gl_mesh m_lodWoodMesh[LOD_MESHES];
+    int m_lodTriangleCount[LOD_MESHES] = {};
+    int m_lodWoodTriangles[LOD_MESHES] = {};
+
+    // Local-space bounds of the generated geometry
+    glm::vec3 m_boundsMin{0.0f};
+    glm::vec3 m_boundsMax{0.0f};
+
+    // The stem skeleton, flattened into arrays allocated from m_arena. Stems are stored
+    // level by level, trunk first, and each stem is a run of consecutive segments (the
+    // rings of its mesh). Valid from generateSkeleton until the next generation.
+    struct Skeleton {
+        int levels = 0;
+        int levelStems[4] = {};
+        int levelRings[4] = {};
+        int stemCount = 0;
+        int segmentCount = 0;
+
+        // Per stem
+        int* level = nullptr;              // 0=trunk, 1=branch, 2=twig, etc
+        int* firstSegment = nullptr;
+        int* segments = nullptr;           // nCurveRes + 1 of its level
+        float* length = nullptr;
+
+        // Per segment
+        glm::vec3* position = nullptr;
+        glm::vec3* direction = nullptr;    // Unit vector pointing forward
+        glm::quat* rotation = nullptr;     // Takes +Y to direction
+        float* radius = nullptr;
+        float* v = nullptr;                // Texture v, the segment's index / nCurveRes
     };
-    std::vector<Stem> m_stems;
+    Skeleton m_skeleton;
+    Arena m_arena;
+    Arena m_spareArena;                    // the next skeleton is built here, then swapped in
     
     // Helper functions
+    float random01();
     float randomVariance(float variance);
     float stemRadius(int level, float offset, float length);
     int branchesAtSegment(int level, int segmentIndex, int totalSegments);
     
-    // Generation functions
-    void generateStem(int level, const glm::vec3& startPos, const glm::vec3& startDir,
-                     float length, float baseRadius, int parentSegment = -1);
-    void generateMeshFromSegments();
-    void generateLeavesMesh();
+    // Generation functions. generateSkeleton keeps the levels above fromLevel.
+    void generateSkeleton(int fromLevel);
+    void generateMeshFromSegments(bool trunk, bool branches);
+    void generateLeavesMesh(bool shape, bool placement);
+    void generateShadowProxy();
+    void generateLods();
+    void computeBounds();
+
+    // Totals the triangles and queues the parts in built for uploadMeshes
+    void finishGeometry(unsigned built);
+
+    // Simplified stems shared by the shadow proxy and the LOD meshes: every ringStep-th
+    // ring with radialSegments sides, optionally without the leaf-bearing twigs
+    void buildStems(cgra::mesh_builder& mb, int radialSegments, int ringStep, bool skipTwigs) const;
+
+    // Leaves drawn at a level of detail: level 0 uses the leaf shape, higher levels the
+    // card, and level 2 only every other leaf
+    static int leafStride(int level) { return level >= 2 ? 2 : 1; }
+    int leafInstanceCount(int level) const;
+    int leafTriangles(int level) const;
+    glm::mat4 modelMatrix() const;
     
-    void createLeaf(cgra::mesh_builder& mb, const glm::vec3& position,
-                   const glm::vec3& stemDir, const glm::quat& stemRot, float rotAngle);
-    void createSimpleLeaf(cgra::mesh_builder& mb, const glm::vec3& center,
-                         const glm::vec3& right, const glm::vec3& up,
-                         const glm::vec3& normal, float scale,
-                         const LeafParameters& lp);
-    void createLobedLeaf(cgra::mesh_builder& mb, const glm::vec3& center,
-                        const glm::vec3& right, const glm::vec3& up,
-                        const glm::vec3& normal, float scale,
-                        const LeafParameters& lp);
+    void createLeaf(const glm::vec3& position, const glm::vec3& stemDir, float rotAngle);
+
+    // Leaf shapes in the leaf's own frame (x = right, y = up, facing +z), in units of its scale
+    glm::vec3 leafColour() const;
+    void createSimpleLeaf(cgra::mesh_builder& mb, const LeafParameters& lp);
+    void createLobedLeaf(cgra::mesh_builder& mb, const LeafParameters& lp);
+    void createLeafCard(cgra::mesh_builder& mb, const LeafParameters& lp);
     
 public:
     Tree(const glm::vec3& position = glm::vec3(0.0f, 0.0f, 0.0f));
     
+    // Compares params with the current set and marks only the geometry they affect:
+    // leaf shape edits rebuild the leaf meshes, radial segments re-skin the existing
+    // skeleton, and a branch level's edits regrow the skeleton from that level down
     void setParameters(const TreeParameters& params);
     void regenerate();
-    void draw(const glm::mat4& view, const glm::mat4& proj, GLuint shader,
-        const glm::vec3& sunPos = glm::vec3(0.0f, 100.0f, 0.0f), const glm::vec3& sunColour = glm::vec3(1.0f, 1.0f, 1.0f),
-        GLuint trunkDiffuse = 0, GLuint trunkNormal = 0, GLuint trunkRoughness = 0, const glm::vec3& cameraPos = glm::vec3(0.0f, 1.0f, 0.0f), 
-        const glm::mat4& lightSpaceMatrix = glm::mat4(1.0f), GLuint shadowMap = 0);
 
-    void drawShadows(GLuint shader);
+    // Deletes the uploaded meshes and leaf records. Trees are never copied, so whoever
+    // owns one calls this before dropping it; drawing again regenerates everything.
+    void release();
+    // The camera and sun come from the per-frame uniforms
+    void draw(const cgra::shader_program& shader, GLuint trunkDiffuse = 0, GLuint trunkNormal = 0, GLuint trunkRoughness = 0);
+
+    void drawShadows(const cgra::shader_program& shader);
+
+    // Generates the meshes if the parameters changed since they were last built
+    void generateMeshes();
+
+    // The two halves of generateMeshes. generateGeometry only touches this tree's own
+    // data, so different trees can generate on worker threads; uploadMeshes needs the GL
+    // context. With GPU stems enabled uploadMeshes must be given an available generator.
+    void generateGeometry();
+    void uploadMeshes(TrunkGenerator* generator = nullptr);
+
+    bool getGpuStems() const { return m_gpuStems; }
+    void setGpuStems(bool enabled) {
+        if (enabled != m_gpuStems) markDirty(DIRTY_TRUNK | DIRTY_BRANCHES);
+        m_gpuStems = enabled;
+    }
+
+    // Time spent building the trunk and branch meshes at the last generation: ring
+    // expansion and upload on the CPU path, ring packing and the dispatch on the GPU path
+    double getStemGenerationMs() const { return m_stemMs; }
+
+    uint32_t getSeed() const { return m_seed; }
+    // The seed only drives leaf placement, the stems are deterministic
+    void setSeed(uint32_t seed) {
+        if (seed != m_seed) markDirty(DIRTY_LEAVES);
+        m_seed = seed;
+    }
+
+    // Cheaper shadow caster: fewer radial segments and rings on the trunk and branches,
+    // no leaf-bearing twigs (the leaves cover them), and one quad per leaf
+    void drawShadowProxy(const cgra::shader_program& shader);
+
+    // World-space bounding box, generates the mesh if needed
+    void getWorldBounds(glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+    int getTriangleCount() const { return m_triangleCount; }
+    int getShadowTriangleCount() const { return m_shadowTriangleCount; }
+
+    // Reduced levels of detail for distant trees. Level 1 keeps every stem with half the
+    // radial segments and replaces each leaf by a card; level 2 drops the twigs and
+    // every other ring and keeps every other leaf card, enlarged to cover the gap.
+    static const int LOD_LEVELS = LOD_MESHES + 1;
+    const cgra::gl_mesh& getLodWoodMesh(int level) const { return m_lodWoodMesh[level - 1]; }
+    int getLodTriangleCount(int level) const { return level == 0 ? m_triangleCount : m_lodTriangleCount[level - 1]; }
+
+    // Where drawLeaves binds the leaf records, clear of the bark textures. Programs that
+    // also sample bark point uLeafInstances here before their first draw: samplers of
+    // different types may not share a unit, even in draws that never read the leaves.
+    static constexpr int LEAF_UNIT = 3;
+
+    // Leaves are instanced: getLeafMesh(level) is drawn once per leaf, after bindLeaves
+    // has bound the leaf records to textureUnit and set the leaf uniforms on shader.
+    // bindLeaves returns the leaves per tree. The shader must also have uIsLeaf set.
+    const cgra::gl_mesh& getLeafMesh(int level) const { return level == 0 ? m_leavesMesh : m_leafCardMesh; }
+    int bindLeaves(const cgra::shader_program& shader, int level, int textureUnit) const;
+    int getLeafInstanceCount(int level) const { return leafInstanceCount(level); }
+    void drawLeaves(const cgra::shader_program& shader, int level) const;
+    static int getShadowLeafLevel() { return 1; }
+    int getLeafCount() const { return int(m_leaves.size()); }
+
+    // Generated meshes and their local-space bounds, for drawing the tree instanced (see Forest)
+    const cgra::gl_mesh& getTrunkMesh() const { return m_trunkMesh; }
+    const cgra::gl_mesh& getBranchesMesh() const { return m_branchesMesh; }
+    const cgra::gl_mesh& getShadowStemMesh() const { return m_shadowStemMesh; }
+    glm::vec3 getLocalBoundsMin() const { return m_boundsMin; }
+    glm::vec3 getLocalBoundsMax() const { return m_boundsMax; }
     
     TreeParameters& getParameters() { return m_params; }
     
     void setRotation(const glm::vec3& rotation) {
         m_rotation = rotation;
         m_meshGenerated = false;
+        m_geometryReady = false;
     }
     glm::vec3 getRotation() const { return m_rotation; }
 };
@@ -0,0 +1,407 @@
+// std
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+// platform
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// project
+#include "tree_cache.hpp"
+
+namespace {
+    const uint32_t cacheMagic = 0x52544743; // "CGTR"
+    const uint32_t cacheVersion = 1;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint64_t payloadSize;      // bytes after the header, a short file is a partial write
+    };
+
+    // A whole file mapped read-only, so an entry is read straight from the page cache
+    class MappedFile {
+    private:
+        const char* m_data = nullptr;
+        size_t m_size = 0;
+#ifdef _WIN32
+        HANDLE m_file = INVALID_HANDLE_VALUE;
+        HANDLE m_mapping = nullptr;
+#endif
+
+    public:
+        explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+            m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (m_file == INVALID_HANDLE_VALUE) return;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) return;
+            m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!m_mapping) return;
+            m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+            if (m_data) m_size = size_t(size.QuadPart);
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    m_data = static_cast<const char*>(data);
+                    m_size = size_t(st.st_size);
+                }
+            }
+            close(fd);
+#endif
+        }
+
+        ~MappedFile() {
+#ifdef _WIN32
+            if (m_data) UnmapViewOfFile(m_data);
+            if (m_mapping) CloseHandle(m_mapping);
+            if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+            if (m_data) munmap(const_cast<char*>(m_data), m_size);
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+    };
+
+    // FNV-1a over each field, never over whole structs, whose padding is undefined
+    struct Hasher {
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        template <typename T>
+        void add(const T& value) {
+            static_assert(std::is_arithmetic<T>::value, "hash fields one at a time");
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+            for (size_t i = 0; i < sizeof(T); i++) {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3ull;
+            }
+        }
+    };
+
+    // Entries are a header followed by flat arrays, each prefixed with its element count
+    class Writer {
+    public:
+        std::vector<char> bytes;
+
+        template <typename T>
+        void put(const T* data, size_t count) {
+            static_assert(std::is_trivially_copyable<T>::value, "cached data is copied bytewise");
+            const char* p = reinterpret_cast<const char*>(data);
+            bytes.insert(bytes.end(), p, p + count * sizeof(T));
+        }
+        template <typename T>
+        void put(const T& value) { put(&value, 1); }
+        template <typename T>
+        void putArray(const T* data, size_t count) {
+            put(uint64_t(count));
+            put(data, count);
+        }
+        template <typename T>
+        void putArray(const std::vector<T>& v) { putArray(v.data(), v.size()); }
+        void putMesh(const cgra::mesh_builder& mb) {
+            put(uint32_t(mb.mode));
+            putArray(mb.vertices);
+            putArray(mb.indices);
+        }
+    };
+
+    // Reads back what Writer wrote, failing rather than reading past the end
+    class Reader {
+    private:
+        const char* m_next;
+        const char* m_end;
+
+    public:
+        Reader(const char* data, size_t size) : m_next(data), m_end(data + size) {}
+
+        bool atEnd() const { return m_next == m_end; }
+
+        template <typename T>
+        bool get(T* data, size_t count) {
+            static_assert(std::is_trivially_copyable<T>::value, "cached data is copied bytewise");
+            if (count > size_t(m_end - m_next) / sizeof(T)) return false;
+            std::memcpy(data, m_next, count * sizeof(T));
+            m_next += count * sizeof(T);
+            return true;
+        }
+        template <typename T>
+        bool get(T& value) { return get(&value, 1); }
+        bool getCount(size_t& count, size_t expected = SIZE_MAX) {
+            uint64_t count64 = 0;
+            if (!get(count64) || (expected != SIZE_MAX && count64 != expected)) return false;
+            count = size_t(count64);
+            return true;
+        }
+        template <typename T>
+        bool getArray(T* data, size_t expected) {
+            size_t count = 0;
+            return getCount(count, expected) && get(data, count);
+        }
+        template <typename T>
+        bool getArray(std::vector<T>& v) {
+            size_t count = 0;
+            if (!getCount(count) || count > size_t(m_end - m_next) / sizeof(T)) return false;
+            v.resize(count);
+            return get(v.data(), count);
+        }
+        bool getMesh(cgra::mesh_builder& mb) {
+            uint32_t mode = 0;
+            if (!get(mode)) return false;
+            mb.mode = GLenum(mode);
+            return getArray(mb.vertices) && getArray(mb.indices);
+        }
+    };
+}
+
+uint64_t TreeCache::key(const TreeParameters& params, uint32_t seed, bool gpuStems) {
+    Hasher h;
+    h.add(params.shape);
+    h.add(params.baseSize);
+    h.add(params.scale);
+    h.add(params.scaleV);
+    h.add(params.levels);
+    h.add(params.ratio);
+    h.add(params.ratioPower);
+    h.add(params.flare);
+    for (const BranchLevel& level : params.level) {
+        h.add(level.nLength);
+        h.add(level.nLengthV);
+        h.add(level.nTaper);
+        h.add(level.nCurveRes);
+        h.add(level.nCurve);
+        h.add(level.nCurveV);
+        h.add(level.nCurveBack);
+        h.add(level.nBranches);
+        h.add(level.nBranchDist);
+        h.add(level.nDownAngle);
+        h.add(level.nDownAngleV);
+        h.add(level.nRotate);
+        h.add(level.nRotateV);
+    }
+    h.add(uint8_t(params.hasLeaves));
+    h.add(params.leafScale);
+    h.add(params.leavesPerBranch);
+    const LeafParameters& lp = params.leafParams;
+    h.add(lp.lobeWidth);
+    h.add(lp.lobeHeight);
+    h.add(lp.lobeOffset);
+    h.add(lp.topAngle);
+    h.add(lp.bottomAngle);
+    h.add(lp.lobeCount);
+    h.add(lp.lobeSeparation);
+    h.add(lp.lobeScale);
+    h.add(lp.color.r);
+    h.add(lp.color.g);
+    h.add(lp.color.b);
+    h.add(params.radialSegments);
+    h.add(seed);
+    h.add(uint8_t(gpuStems));
+    return h.hash;
+}
+
+std::string TreeCache::entryPath(const Tree& tree) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "tree_%016llx.bin",
+        (unsigned long long)key(tree.m_params, tree.m_seed, tree.m_gpuStems));
+    return m_directory + "/" + name;
+}
+
+bool TreeCache::store(const Tree& tree) const {
+    const unsigned whole = Tree::DIRTY_TRUNK | Tree::DIRTY_BRANCHES | Tree::DIRTY_PROXIES;
+    if (!isEnabled() || !tree.m_geometryReady || (tree.m_pendingUpload & whole) != whole) return false;
+
+    Writer w;
+    w.put(Header{ cacheMagic, cacheVersion, key(tree.m_params, tree.m_seed, tree.m_gpuStems), 0 });
+
+    const Tree::Skeleton& sk = tree.m_skeleton;
+    w.put(sk.levels);
+    w.put(sk.levelStems, 4);
+    w.put(sk.levelRings, 4);
+    w.put(sk.stemCount);
+    w.put(sk.segmentCount);
+    w.putArray(sk.level, sk.stemCount);
+    w.putArray(sk.firstSegment, sk.stemCount);
+    w.putArray(sk.segments, sk.stemCount);
+    w.putArray(sk.length, sk.stemCount);
+    w.putArray(sk.position, sk.segmentCount);
+    w.putArray(sk.direction, sk.segmentCount);
+    w.putArray(sk.rotation, sk.segmentCount);
+    w.putArray(sk.radius, sk.segmentCount);
+    w.putArray(sk.v, sk.segmentCount);
+
+    w.putMesh(tree.m_trunkBuilder);
+    w.putMesh(tree.m_branchBuilder);
+    w.putArray(tree.m_trunkRings);
+    w.putArray(tree.m_branchRings);
+    w.put(tree.m_trunkIndexCount);
+    w.put(tree.m_branchIndexCount);
+
+    w.putMesh(tree.m_leafBuilder);
+    w.putMesh(tree.m_leafCardBuilder);
+    w.putArray(tree.m_leaves);
+
+    w.putMesh(tree.m_shadowStemBuilder);
+    w.put(tree.m_shadowStemTriangles);
+    for (int l = 0; l < Tree::LOD_MESHES; l++) {
+        w.putMesh(tree.m_lodWoodBuilder[l]);
+        w.put(tree.m_lodWoodTriangles[l]);
+    }
+    w.put(tree.m_boundsMin);
+    w.put(tree.m_boundsMax);
+
+    reinterpret_cast<Header*>(w.bytes.data())->payloadSize = w.bytes.size() - sizeof(Header);
+
+    // Written aside and renamed into place, so a reader never maps a half-written entry
+    std::string path = entryPath(tree);
+    std::string partial = path + ".part";
+    std::error_code ec;
+    std::filesystem::create_directories(m_directory, ec);
+    {
+        std::ofstream out(partial, std::ios::binary);
+        out.write(w.bytes.data(), std::streamsize(w.bytes.size()));
+        if (!out) {
+            std::cerr << "Warning: could not write tree cache " << partial << std::endl;
+            return false;
+        }
+    }
+    std::filesystem::rename(partial, path, ec);
+    if (ec) {
+        std::cerr << "Warning: could not write tree cache " << path << std::endl;
+        std::filesystem::remove(partial, ec);
+        return false;
+    }
+    return true;
+}
+
+bool TreeCache::contains(const Tree& tree) const {
+    std::error_code ec;
+    return isEnabled() && std::filesystem::exists(entryPath(tree), ec);
+}
+
+void TreeCache::evict() const {
+    if (!isEnabled()) return;
+
+    struct Entry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type used;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(m_directory, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.compare(0, 5, "tree_") != 0 || it->path().extension() != ".bin") continue;
+
+        std::error_code statError;
+        Entry entry{ it->path(), it->last_write_time(statError), 0 };
+        entry.size = it->file_size(statError);
+        if (statError) continue;
+        entries.push_back(entry);
+        total += entry.size;
+    }
+    if (total <= m_capacity) return;
+
+    // load refreshes the write time, so the oldest is the least recently used
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const Entry& entry : entries) {
+        if (total <= m_capacity) break;
+        if (std::filesystem::remove(entry.path, ec)) total -= entry.size;
+    }
+}
+
+bool TreeCache::load(Tree& tree) const {
+    if (!isEnabled() || tree.m_dirty == 0) return false;
+
+    std::string path = entryPath(tree);
+    MappedFile file(path);
+    if (!file.data()) return false;
+
+    Header header;
+    Reader r(file.data(), file.size());
+    Tree::Skeleton sk;
+    bool valid = r.get(header) && header.magic == cacheMagic && header.version == cacheVersion &&
+        header.key == key(tree.m_params, tree.m_seed, tree.m_gpuStems) &&
+        header.payloadSize == file.size() - sizeof(Header) &&
+        r.get(sk.levels) && r.get(sk.levelStems, 4) && r.get(sk.levelRings, 4) &&
+        r.get(sk.stemCount) && r.get(sk.segmentCount) && sk.stemCount >= 0 && sk.segmentCount >= 0 &&
+        size_t(sk.stemCount) * 16 + size_t(sk.segmentCount) * 48 <= file.size();
+    if (!valid) {
+        std::cerr << "Tree cache " << path << " is stale or corrupt, regenerating" << std::endl;
+        return false;
+    }
+
+    // The skeleton goes into the spare arena and is swapped in, as generateSkeleton does
+    Arena& arena = tree.m_spareArena;
+    arena.reset(Arena::footprint<int>(sk.stemCount) * 3 + Arena::footprint<float>(sk.stemCount) +
+                Arena::footprint<glm::vec3>(sk.segmentCount) * 2 + Arena::footprint<glm::quat>(sk.segmentCount) +
+                Arena::footprint<float>(sk.segmentCount) * 2);
+    sk.level = arena.allocate<int>(sk.stemCount);
+    sk.firstSegment = arena.allocate<int>(sk.stemCount);
+    sk.segments = arena.allocate<int>(sk.stemCount);
+    sk.length = arena.allocate<float>(sk.stemCount);
+    sk.position = arena.allocate<glm::vec3>(sk.segmentCount);
+    sk.direction = arena.allocate<glm::vec3>(sk.segmentCount);
+    sk.rotation = arena.allocate<glm::quat>(sk.segmentCount);
+    sk.radius = arena.allocate<float>(sk.segmentCount);
+    sk.v = arena.allocate<float>(sk.segmentCount);
+
+    valid = r.getArray(sk.level, sk.stemCount) && r.getArray(sk.firstSegment, sk.stemCount) &&
+        r.getArray(sk.segments, sk.stemCount) && r.getArray(sk.length, sk.stemCount) &&
+        r.getArray(sk.position, sk.segmentCount) && r.getArray(sk.direction, sk.segmentCount) &&
+        r.getArray(sk.rotation, sk.segmentCount) && r.getArray(sk.radius, sk.segmentCount) &&
+        r.getArray(sk.v, sk.segmentCount);
+
+    valid = valid && r.getMesh(tree.m_trunkBuilder) && r.getMesh(tree.m_branchBuilder) &&
+        r.getArray(tree.m_trunkRings) && r.getArray(tree.m_branchRings) &&
+        r.get(tree.m_trunkIndexCount) && r.get(tree.m_branchIndexCount);
+
+    valid = valid && r.getMesh(tree.m_leafBuilder) && r.getMesh(tree.m_leafCardBuilder) && r.getArray(tree.m_leaves);
+
+    valid = valid && r.getMesh(tree.m_shadowStemBuilder) && r.get(tree.m_shadowStemTriangles);
+    for (int l = 0; l < Tree::LOD_MESHES; l++) {
+        valid = valid && r.getMesh(tree.m_lodWoodBuilder[l]) && r.get(tree.m_lodWoodTriangles[l]);
+    }
+    valid = valid && r.get(tree.m_boundsMin) && r.get(tree.m_boundsMax) && r.atEnd();
+
+    if (!valid) {
+        // Some of the tree may have been overwritten, so none of it can be kept
+        std::cerr << "Tree cache " << path << " is corrupt, regenerating" << std::endl;
+        tree.regenerate();
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+    tree.m_skeleton = sk;
+    std::swap(tree.m_arena, tree.m_spareArena);
+    tree.m_stemMs = 0.0;
+    tree.finishGeometry(Tree::DIRTY_ALL);
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+
+// project
+#include "tree.hpp"
+
+// On-disk cache of generated tree geometry, so a tree seen before (on an earlier run, or
+// under an earlier preset) skips generation. Each entry holds one tree's skeleton, leaves
+// and meshes, and is named after a hash of everything they depend on: the parameters,
+// the seed and whether the stems are built on the GPU.
+class TreeCache {
+private:
+    std::string m_directory;
+    uint64_t m_capacity = uint64_t(256) << 20;
+
+    std::string entryPath(const Tree& tree) const;
+
+public:
+    // Where entries are kept, an empty directory disables the cache
+    void setDirectory(const std::string& directory) { m_directory = directory; }
+    bool isEnabled() const { return !m_directory.empty(); }
+
+    // Bytes the entries may take up in all, see evict
+    void setCapacity(uint64_t bytes) { m_capacity = bytes; }
+
+    // Hash of the inputs to a tree's geometry
+    static uint64_t key(const TreeParameters& params, uint32_t seed, bool gpuStems);
+
+    // If tree needs generating and has a valid entry, maps the entry and reads it into
+    // the tree, which is then ready for uploadMeshes as though generateGeometry had run
+    bool load(Tree& tree) const;
+
+    // Writes the geometry tree has just generated, if it generated all of it. A partial
+    // rebuild leaves out the parts already uploaded, so there is nothing whole to store.
+    bool store(const Tree& tree) const;
+
+    // Whether tree, with its current parameters, has an entry
+    bool contains(const Tree& tree) const;
+
+    // Deletes entries, least recently loaded or stored first, until the rest fit the
+    // capacity. Not safe to run alongside load or store.
+    void evict() const;
+};
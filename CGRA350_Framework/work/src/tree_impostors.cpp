@@ -0,0 +1,174 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// glm
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "tree_impostors.hpp"
+#include "tree.hpp"
+
+namespace {
+    GLuint createAtlasArray(int layers) {
+        GLuint tex;
+        glGenTextures(1, &tex);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, tex);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8,
+                     TreeImpostors::COLUMNS * TreeImpostors::TILE_SIZE, TreeImpostors::ROWS * TreeImpostors::TILE_SIZE,
+                     layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+        return tex;
+    }
+
+    void drawMesh(const cgra::gl_mesh& mesh) {
+        if (mesh.vao == 0 || mesh.index_count == 0) return;
+        cgra::gl_state::bind_vertex_array(mesh.vao);
+        glDrawElements(mesh.mode, mesh.index_count, GL_UNSIGNED_INT, 0);
+    }
+}
+
+TreeImpostors::~TreeImpostors() {
+    if (m_fbo) cgra::gl_state::delete_framebuffers(1, &m_fbo);
+    if (m_depthBuffer) glDeleteRenderbuffers(1, &m_depthBuffer);
+    if (m_albedoArray) cgra::gl_state::delete_textures(1, &m_albedoArray);
+    if (m_normalArray) cgra::gl_state::delete_textures(1, &m_normalArray);
+    m_quad.destroy();
+}
+
+void TreeImpostors::init(const cgra::shader_program& bakeShader) {
+    m_bakeShader = bakeShader;
+    glGenFramebuffers(1, &m_fbo);
+
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, COLUMNS * TILE_SIZE, ROWS * TILE_SIZE);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    cgra::mesh_builder mb;
+    for (glm::vec2 corner : { glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(1, 1), glm::vec2(-1, 1) }) {
+        cgra::mesh_vertex vertex;
+        vertex.pos = glm::vec3(corner, 0.0f);
+        vertex.uv = corner * 0.5f + 0.5f;
+        mb.push_vertex(vertex);
+    }
+    mb.push_indices({ 0, 1, 2, 0, 2, 3 });
+    m_quad = mb.build();
+}
+
+void TreeImpostors::createTargets(int layers) {
+    if (m_albedoArray) cgra::gl_state::delete_textures(1, &m_albedoArray);
+    if (m_normalArray) cgra::gl_state::delete_textures(1, &m_normalArray);
+    m_albedoArray = createAtlasArray(layers);
+    m_normalArray = createAtlasArray(layers);
+    m_layers = layers;
+}
+
+void TreeImpostors::bake(const std::vector<Tree>& archetypes, GLuint barkTexture) {
+    if (m_fbo == 0 || archetypes.empty()) return;
+    if (int(archetypes.size()) != m_layers) createTargets(int(archetypes.size()));
+
+    GLuint previousFBO = cgra::gl_state::bound_framebuffer(GL_FRAMEBUFFER);
+    GLint previousViewport[4];
+    GLfloat previousClear[4];
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, previousClear);
+    bool scissor = cgra::gl_state::is_enabled(GL_SCISSOR_TEST);
+    bool depthTest = cgra::gl_state::is_enabled(GL_DEPTH_TEST);
+    GLboolean colorMask = cgra::gl_state::current_color_mask();
+    GLboolean depthMask = cgra::gl_state::current_depth_mask();
+    GLenum depthFunc = cgra::gl_state::current_depth_func();
+
+    // Baked from whichever pass first needs the impostors, so none of its state is assumed
+    cgra::gl_state::disable(GL_SCISSOR_TEST);
+    cgra::gl_state::enable(GL_DEPTH_TEST);
+    cgra::gl_state::color_mask(GL_TRUE);
+    cgra::gl_state::depth_mask(GL_TRUE);
+    cgra::gl_state::depth_func(GL_LESS);
+
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, m_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+    const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+    cgra::gl_state::use_program(m_bakeShader);
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D, barkTexture);
+    m_bakeShader.set_uniform("uTrunkDiffuse", 0);
+    m_bakeShader.set_uniform("uLeafInstances", Tree::LEAF_UNIT);
+
+    m_extents.resize(archetypes.size());
+    for (size_t a = 0; a < archetypes.size(); a++) {
+        const Tree& tree = archetypes[a];
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_albedoArray, 0, GLint(a));
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, m_normalArray, 0, GLint(a));
+        glViewport(0, 0, COLUMNS * TILE_SIZE, ROWS * TILE_SIZE);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // Fit the views to the bounds about the up axis, so every view shares one extent
+        // and a billboard quad can be sized without knowing which views it blends
+        glm::vec3 boundsMin = tree.getLocalBoundsMin();
+        glm::vec3 boundsMax = tree.getLocalBoundsMax();
+        float radius = std::max(std::max(-boundsMin.x, boundsMax.x), std::max(-boundsMin.z, boundsMax.z)) * 1.05f;
+        float halfHeight = (boundsMax.y - boundsMin.y) * 0.5f * 1.05f;
+        glm::vec3 center(0.0f, (boundsMin.y + boundsMax.y) * 0.5f, 0.0f);
+        radius = std::max(radius, 0.01f);
+        halfHeight = std::max(halfHeight, 0.01f);
+        m_extents[a] = glm::vec3(radius, center.y, halfHeight);
+
+        float distance = radius + halfHeight + 1.0f;
+        glm::mat4 proj = glm::ortho(-radius, radius, -halfHeight, halfHeight, 0.0f, 2.0f * distance);
+
+        for (int v = 0; v < VIEWS; v++) {
+            // View v looks at the tree from azimuth theta, its right vector is (sin, 0, -cos)
+            float theta = float(v) / VIEWS * glm::two_pi<float>();
+            glm::vec3 eye = center + glm::vec3(std::cos(theta), 0.0f, std::sin(theta)) * distance;
+            glm::mat4 viewProj = proj * glm::lookAt(eye, center, glm::vec3(0, 1, 0));
+
+            glViewport((v % COLUMNS) * TILE_SIZE, (v / COLUMNS) * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+            m_bakeShader.set_uniform("uViewProj", viewProj);
+            drawMesh(tree.getTrunkMesh());
+            drawMesh(tree.getBranchesMesh());
+
+            m_bakeShader.set_uniform("uIsLeaf", 1);
+            tree.drawLeaves(m_bakeShader, 0);
+            m_bakeShader.set_uniform("uIsLeaf", 0);
+        }
+    }
+    cgra::gl_state::bind_vertex_array(0);
+
+    for (GLuint tex : { m_albedoArray, m_normalArray }) {
+        cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, tex);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+
+    cgra::gl_state::bind_framebuffer(GL_FRAMEBUFFER, previousFBO);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    glClearColor(previousClear[0], previousClear[1], previousClear[2], previousClear[3]);
+    if (scissor) cgra::gl_state::enable(GL_SCISSOR_TEST);
+    if (!depthTest) cgra::gl_state::disable(GL_DEPTH_TEST);
+    cgra::gl_state::color_mask(colorMask);
+    cgra::gl_state::depth_mask(depthMask);
+    cgra::gl_state::depth_func(depthFunc);
+}
+
+void TreeImpostors::bind(GLuint program, int albedoUnit, int normalUnit) const {
+    cgra::gl_state::active_texture(GL_TEXTURE0 + albedoUnit);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, m_albedoArray);
+    glUniform1i(glGetUniformLocation(program, "uImpostorAlbedo"), albedoUnit);
+
+    cgra::gl_state::active_texture(GL_TEXTURE0 + normalUnit);
+    cgra::gl_state::bind_texture(GL_TEXTURE_2D_ARRAY, m_normalArray);
+    glUniform1i(glGetUniformLocation(program, "uImpostorNormal"), normalUnit);
+
+    glUniform1i(glGetUniformLocation(program, "uImpostorViews"), VIEWS);
+    glUniform2i(glGetUniformLocation(program, "uImpostorGrid"), COLUMNS, ROWS);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// std
+#include <vector>
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_shader.hpp"
+
+class Tree;
+
+// Multi-view billboard impostors for the most distant level of detail of a Forest.
+//
+// Each archetype is rendered offscreen from VIEWS directions around its up axis, with an
+// orthographic camera fitted to its bounds, into one layer of an albedo and a normal
+// texture array (VIEWS tiles per layer, normals in the tree's local space). At draw time
+// impostor_vert.glsl turns a quad to face the camera about the tree's up axis and
+// impostor_frag.glsl blends the two nearest views, relighting them with the baked normals.
+class TreeImpostors {
+public:
+    static const int VIEWS = 8;
+    static const int COLUMNS = 4;
+    static const int ROWS = VIEWS / COLUMNS;
+    static const int TILE_SIZE = 256;
+
+private:
+    cgra::shader_program m_bakeShader;
+    GLuint m_fbo = 0;
+    GLuint m_depthBuffer = 0;
+    GLuint m_albedoArray = 0;       // RGBA8, alpha = coverage, one layer per archetype
+    GLuint m_normalArray = 0;       // RGBA8, local-space normal * 0.5 + 0.5
+    int m_layers = 0;
+
+    // Per archetype: x = horizontal radius about the up axis, y = centre height, z = half height
+    std::vector<glm::vec3> m_extents;
+
+    cgra::gl_mesh m_quad;           // corners at (+-1, +-1) in the position attribute
+
+    void createTargets(int layers);
+
+public:
+    TreeImpostors() = default;
+    ~TreeImpostors();
+
+    TreeImpostors(const TreeImpostors&) = delete;
+    TreeImpostors& operator=(const TreeImpostors&) = delete;
+
+    void init(const cgra::shader_program& bakeShader);
+    bool isReady() const { return m_layers > 0; }
+
+    // Renders every view of every archetype from its full-detail meshes. Saves and
+    // restores the framebuffer, viewport and clear colour, so it is safe mid-frame.
+    void bake(const std::vector<Tree>& archetypes, GLuint barkTexture);
+
+    // Binds the atlas to two texture units and sets the layout uniforms on program
+    void bind(GLuint program, int albedoUnit, int normalUnit) const;
+
+    glm::vec3 getExtent(int archetype) const { return m_extents[archetype]; }
+    const cgra::gl_mesh& getQuad() const { return m_quad; }
+};
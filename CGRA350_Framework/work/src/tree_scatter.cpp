@@ -0,0 +1,225 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+
+// glm
+#include <glm/gtc/constants.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/quaternion.hpp>
+
+// project
+#include "tree_scatter.hpp"
+#include "terrain.hpp"
+
+namespace {
+    uint32_t hash(uint32_t h) {
+        h ^= h >> 16; h *= 0x7feb352du;
+        h ^= h >> 15; h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+
+    // Seed of one tile's stream, so it is the same whichever thread fills the tile
+    uint32_t tileSeed(uint32_t seed, int tileX, int tileZ, uint32_t stream) {
+        return hash(seed ^ hash(uint32_t(tileX) * 0x9e3779b9u ^ hash(uint32_t(tileZ) + stream)));
+    }
+
+    // The top 24 bits of the engine's 31, like Tree::random01 independent of the
+    // standard library's distributions
+    float random01(std::minstd_rand& rng) {
+        return float((rng() - 1) >> 7) * (1.0f / 16777216.0f);
+    }
+}
+
+int TreeScatter::cellIndex(const glm::vec2& p) const {
+    int x = std::min(int((p.x - m_origin.x) / m_cellSize), m_gridSize - 1);
+    int z = std::min(int((p.y - m_origin.y) / m_cellSize), m_gridSize - 1);
+    return z * m_gridSize + x;
+}
+
+bool TreeScatter::isFree(const glm::vec2& p, float minDistance2) const {
+    // A cell's diagonal is the spacing, so any point closer than it is within two cells,
+    // and not in the corner cells of that 5x5 block
+    int cell = cellIndex(p);
+    int cx = cell % m_gridSize, cz = cell / m_gridSize;
+    if (m_grid[cell].x != std::numeric_limits<float>::infinity()) return false;
+    for (int z = std::max(cz - 2, 0); z <= std::min(cz + 2, m_gridSize - 1); z++) {
+        bool edgeRow = (z == cz - 2 || z == cz + 2);
+        for (int x = std::max(cx - 2, 0); x <= std::min(cx + 2, m_gridSize - 1); x++) {
+            if (edgeRow && (x == cx - 2 || x == cx + 2)) continue;
+            glm::vec2 q = m_grid[z * m_gridSize + x];
+            glm::vec2 d = q - p;
+            if (q.x != std::numeric_limits<float>::infinity() && glm::dot(d, d) < minDistance2) return false;
+        }
+    }
+    return true;
+}
+
+void TreeScatter::fillTile(int tileX, int tileZ, int tilesPerSide, const ScatterSettings& settings) {
+    Tile& tile = m_tiles[tileZ * tilesPerSide + tileX];
+    tile.points.clear();
+    tile.active.clear();
+
+    std::minstd_rand rng(tileSeed(settings.seed, tileX, tileZ, 0));
+    const float spacing = settings.spacing;
+    const float tileSize = TILE_CELLS * m_cellSize;
+    const glm::vec2 lo = m_origin + glm::vec2(tileX, tileZ) * tileSize;
+    const glm::vec2 hi = glm::min(lo + tileSize, m_origin + settings.areaSize);
+
+    // Ownership goes by cell rather than position, so rounding at a tile edge can never
+    // put a point in a cell another tile writes
+    auto tryInsert = [&](const glm::vec2& p) {
+        if (p.x < m_origin.x || p.y < m_origin.y || p.x >= m_origin.x + settings.areaSize || p.y >= m_origin.y + settings.areaSize) return false;
+        int cell = cellIndex(p);
+        if ((cell % m_gridSize) / TILE_CELLS != tileX || (cell / m_gridSize) / TILE_CELLS != tileZ) return false;
+        if (!isFree(p, spacing * spacing)) return false;
+        m_grid[cell] = p;
+        tile.points.push_back(p);
+        tile.active.push_back(p);
+        return true;
+    };
+
+    for (int i = 0; i < ATTEMPTS; i++) {
+        if (tryInsert(lo + glm::vec2(random01(rng), random01(rng)) * (hi - lo))) break;
+    }
+
+    // Bridson, with the candidates evenly around a circle just over one spacing from a
+    // random active point, from a random start angle. This packs more tightly than
+    // sampling the whole annulus out to two spacings and needs fewer candidates.
+    const float radius = spacing * 1.0001f;
+    glm::vec2 circle[ATTEMPTS];
+    for (int k = 0; k < ATTEMPTS; k++) {
+        float a = glm::two_pi<float>() * k / ATTEMPTS;
+        circle[k] = glm::vec2(std::cos(a), std::sin(a)) * radius;
+    }
+
+    while (!tile.active.empty()) {
+        size_t i = rng() % tile.active.size();
+        glm::vec2 base = tile.active[i];
+        float angle = random01(rng) * glm::two_pi<float>();
+        float c = std::cos(angle), s = std::sin(angle);
+        bool placed = false;
+        for (int k = 0; k < ATTEMPTS && !placed; k++) {
+            placed = tryInsert(base + glm::vec2(c * circle[k].x - s * circle[k].y, s * circle[k].x + c * circle[k].y));
+        }
+        if (!placed) {
+            tile.active[i] = tile.active.back();
+            tile.active.pop_back();
+        }
+    }
+}
+
+void TreeScatter::placeTile(int index, const Terrain& terrain, const ScatterSettings& settings) {
+    Tile& tile = m_tiles[index];
+    size_t count = tile.points.size();
+    tile.heights.resize(count);
+    tile.normals.resize(count);
+    tile.instances.clear();
+    tile.ranks.clear();
+    terrain.sampleWorld(tile.points.data(), count, tile.heights.data(), tile.normals.data());
+
+    std::minstd_rand rng(tileSeed(settings.seed, index, 0, 1));
+    const float heightFade = std::max(settings.heightFade, 1e-4f);
+    const float slopeFade = std::max(settings.slopeFade, 1e-4f);
+    const float maxTilt = glm::radians(settings.maxTilt);
+
+    for (size_t i = 0; i < count; i++) {
+        float height = tile.heights[i];
+        glm::vec3 normal = tile.normals[i];
+        float slope = glm::degrees(std::acos(glm::clamp(normal.y, -1.0f, 1.0f)));
+
+        float density = glm::smoothstep(settings.minHeight, settings.minHeight + heightFade, height) *
+            (1.0f - glm::smoothstep(settings.maxHeight - heightFade, settings.maxHeight, height)) *
+            (1.0f - glm::smoothstep(settings.maxSlope - slopeFade, settings.maxSlope, slope));
+
+        // Draw every number whether or not the tree is kept, so one point's mask never
+        // shifts the stream of the next
+        float keep = random01(rng);
+        float yaw = random01(rng) * glm::two_pi<float>();
+        uint32_t rank = rng();
+        if (keep >= density) continue;
+
+        Forest::Instance tree;
+        tree.position = glm::vec3(tile.points[i].x, height + settings.groundOffset, tile.points[i].y);
+        tree.rotation = glm::vec3(0.0f);
+        tree.yaw = yaw;
+
+        // Lean towards the terrain normal, within the tilt limit
+        if (normal.y < 0.99f) {
+            glm::vec3 eulerAngles = glm::eulerAngles(glm::rotation(glm::vec3(0, 1, 0), normal));
+            eulerAngles.x = glm::clamp(eulerAngles.x, -maxTilt, maxTilt);
+            eulerAngles.z = glm::clamp(eulerAngles.z, -maxTilt, maxTilt);
+            tree.rotation = eulerAngles;
+        }
+
+        tile.instances.push_back(tree);
+        tile.ranks.push_back(rank);
+    }
+}
+
+void TreeScatter::scatter(const Terrain& terrain, const ScatterSettings& settings, std::vector<Forest::Instance>& instances) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    ScatterSettings s = settings;
+    s.spacing = std::max(s.spacing, s.areaSize / 4096.0f);
+    m_origin = glm::vec2(-s.areaSize * 0.5f);
+    m_cellSize = s.spacing / std::sqrt(2.0f);
+    m_gridSize = std::max(int(std::ceil(s.areaSize / m_cellSize)), 1);
+    m_grid.assign(size_t(m_gridSize) * m_gridSize, glm::vec2(std::numeric_limits<float>::infinity()));
+
+    int tilesPerSide = (m_gridSize + TILE_CELLS - 1) / TILE_CELLS;
+    m_tiles.resize(size_t(tilesPerSide) * tilesPerSide);
+
+    for (int phase = 0; phase < 4; phase++) {
+        int px = phase & 1, pz = phase >> 1;
+        int columns = (tilesPerSide - px + 1) / 2;
+        int rows = (tilesPerSide - pz + 1) / 2;
+#ifdef CGRA_HAVE_OPENMP
+        #pragma omp parallel for schedule(dynamic)
+#endif
+        for (int i = 0; i < columns * rows; i++) {
+            fillTile(px + 2 * (i % columns), pz + 2 * (i / columns), tilesPerSide, s);
+        }
+    }
+
+    int tileCount = int(m_tiles.size());
+#ifdef CGRA_HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic)
+#endif
+    for (int t = 0; t < tileCount; t++) {
+        placeTile(t, terrain, s);
+    }
+
+    // Gather in tile order; over the limit, keep the trees with the lowest random rank,
+    // which thins evenly everywhere
+    m_candidateCount = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> order;
+    for (const Tile& tile : m_tiles) {
+        m_candidateCount += int(tile.points.size());
+        for (uint32_t rank : tile.ranks) order.emplace_back(rank, uint32_t(order.size()));
+    }
+    size_t keep = std::min(order.size(), size_t(std::max(s.maxCount, 0)));
+    if (keep < order.size()) {
+        std::nth_element(order.begin(), order.begin() + keep, order.end());
+        order.resize(keep);
+        std::sort(order.begin(), order.end(), [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) {
+            return a.second < b.second;
+        });
+    }
+
+    instances.clear();
+    instances.reserve(keep);
+    size_t next = 0, tileFirst = 0;
+    for (const Tile& tile : m_tiles) {
+        for (; next < order.size() && order[next].second < tileFirst + tile.instances.size(); next++) {
+            instances.push_back(tile.instances[order[next].second - tileFirst]);
+        }
+        tileFirst += tile.instances.size();
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    m_scatterMs = std::chrono::duration<double, std::milli>(end - start).count();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "forest.hpp"
+
+class Terrain;
+
+struct ScatterSettings {
+    uint32_t seed = 1;
+    float areaSize = 200.0f;       // side of the square scattered over, centred on the origin
+    float spacing = 4.0f;          // minimum distance between two trees
+    int maxCount = 50;             // a random subset is kept above this
+
+    // Density masks: trees fade in above minHeight, out towards maxHeight (the tree
+    // line), and out on slopes steeper than maxSlope degrees, each over its fade
+    float minHeight = 0.5f;
+    float maxHeight = 12.0f;
+    float heightFade = 1.0f;
+    float maxSlope = 35.0f;
+    float slopeFade = 10.0f;
+
+    // Trees lean towards the terrain normal by up to this many degrees
+    float maxTilt = 15.0f;
+
+    // The terrain mesh is drawn this far below its height map
+    float groundOffset = -1.5f;
+};
+
+// Blue-noise (Poisson-disk) placement of forest instances on the terrain.
+//
+// The area is covered by a grid of cells small enough to hold one point each, so a
+// neighbour check looks at the 5x5 cells around a candidate. The grid is split into
+// square tiles filled with Bridson's algorithm, in four passes over a 2x2 colouring of
+// the tiles: tiles of one colour are at least a tile apart, so they never read each
+// other's cells and run in parallel. Every tile draws from its own seeded stream, so the
+// result does not depend on the thread count. Each tile's points are then sampled from
+// the terrain in one batch and thinned by the density masks.
+class TreeScatter {
+private:
+    static const int TILE_CELLS = 32;   // cells along each side of a tile
+    static const int ATTEMPTS = 12;     // candidates tried around each active point
+
+    // One slot per cell, x = +inf when empty
+    std::vector<glm::vec2> m_grid;
+    int m_gridSize = 0;
+    float m_cellSize = 0.0f;
+    glm::vec2 m_origin{0.0f};
+
+    struct Tile {
+        std::vector<glm::vec2> points;
+        std::vector<glm::vec2> active;
+        std::vector<float> heights;
+        std::vector<glm::vec3> normals;
+        std::vector<Forest::Instance> instances;
+        std::vector<uint32_t> ranks;    // random order for the count limit
+    };
+    std::vector<Tile> m_tiles;
+
+    int m_candidateCount = 0;
+    double m_scatterMs = 0.0;
+
+    void fillTile(int tileX, int tileZ, int tilesPerSide, const ScatterSettings& settings);
+    void placeTile(int tile, const Terrain& terrain, const ScatterSettings& settings);
+    int cellIndex(const glm::vec2& p) const;
+    bool isFree(const glm::vec2& p, float minDistance2) const;
+
+public:
+    // Replaces instances with the scattered trees
+    void scatter(const Terrain& terrain, const ScatterSettings& settings, std::vector<Forest::Instance>& instances);
+
+    // Blue-noise points before the masks and the count limit, and the time taken
+    int getCandidateCount() const { return m_candidateCount; }
+    double getScatterMs() const { return m_scatterMs; }
+};
@@ -0,0 +1,102 @@
+// std
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+// project
+#include "trunk_generator.hpp"
+#include "cgra/cgra_shader.hpp"
+
+TrunkGenerator::~TrunkGenerator() {
+    if (m_program) glDeleteProgram(m_program);
+    if (m_ringBuffer) glDeleteBuffers(1, &m_ringBuffer);
+    if (m_timers[0]) glDeleteQueries(2, m_timers);
+}
+
+void TrunkGenerator::init() {
+    if (m_initialised) return;
+    m_initialised = true;
+
+    if (!GLEW_VERSION_4_3) {
+        std::cout << "GL 4.3 not available, trees use the CPU stem generator" << std::endl;
+        return;
+    }
+
+    try {
+        cgra::shader_builder sb;
+        sb.set_shader(GL_COMPUTE_SHADER, CGRA_SRCDIR + std::string("/res/shaders/trunk_gen.comp.glsl"));
+        m_program = sb.build();
+    } catch (...) {
+        std::cerr << "Warning: could not build trunk_gen.comp.glsl, trees use the CPU stem generator" << std::endl;
+        return;
+    }
+
+    glGenBuffers(1, &m_ringBuffer);
+    glGenQueries(2, m_timers);
+    m_available = true;
+}
+
+cgra::gl_mesh TrunkGenerator::generate(const std::vector<StemRing>& rings, int radialSegments, int indexCount, double* gpuMs) {
+    cgra::gl_mesh m;
+    if (!m_available || rings.empty() || indexCount == 0) return m;
+
+    size_t vertexCount = rings.size() * size_t(radialSegments);
+
+    // Same layout as mesh_builder::build, but the buffers are left for the shader to fill
+    glGenVertexArrays(1, &m.vao);
+    glGenBuffers(1, &m.vbo);
+    glGenBuffers(1, &m.ibo);
+
+    cgra::gl_state::bind_vertex_array(m.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(cgra::mesh_vertex), NULL, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(cgra::mesh_vertex), (void*)(offsetof(cgra::mesh_vertex, pos)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(cgra::mesh_vertex), (void*)(offsetof(cgra::mesh_vertex, norm)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(cgra::mesh_vertex), (void*)(offsetof(cgra::mesh_vertex, uv)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(cgra::mesh_vertex), (void*)(offsetof(cgra::mesh_vertex, col)));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+    cgra::gl_state::bind_vertex_array(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    m.index_count = indexCount;
+    m.mode = GL_TRIANGLES;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ringBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, rings.size() * sizeof(StemRing), rings.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_ringBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m.vbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m.ibo);
+
+    cgra::gl_state::use_program(m_program);
+    glUniform1ui(glGetUniformLocation(m_program, "uRingCount"), GLuint(rings.size()));
+    glUniform1i(glGetUniformLocation(m_program, "uRadialSegments"), radialSegments);
+    glUniform1ui(glGetUniformLocation(m_program, "uVertexStride"), GLuint(sizeof(cgra::mesh_vertex) / sizeof(float)));
+
+    if (gpuMs) glQueryCounter(m_timers[0], GL_TIMESTAMP);
+    glDispatchCompute(GLuint((rings.size() + 63) / 64), 1, 1);
+    if (gpuMs) glQueryCounter(m_timers[1], GL_TIMESTAMP);
+
+    // The buffers are read as vertex attributes and indices next
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+
+    for (GLuint binding = 0; binding < 3; binding++) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+
+    if (gpuMs) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(m_timers[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(m_timers[1], GL_QUERY_RESULT, &end);
+        *gpuMs = double(end - begin) / 1.0e6;
+    }
+
+    return m;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// OpenGL
+#include <GL/glew.h>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_mesh.hpp"
+
+// One ring of a tree stem, the input of the GPU stem generator. Matches the std430
+// Ring struct in trunk_gen.comp.glsl.
+struct StemRing {
+    glm::vec4 positionV;       // xyz = ring centre, w = v texture coordinate
+    glm::vec4 rotation;        // quaternion (x, y, z, w) taking +Y to the stem direction
+    float radius = 0.0f;
+    uint32_t indexBase = 0;    // first index of the strip to the next ring
+    uint32_t hasNext = 0;      // 0 for the last ring of a stem
+    uint32_t pad = 0;
+};
+
+// GPU path for tree trunk and branch geometry.
+//
+// The CPU still grows the stem skeleton (cheap, see Tree::generateSkeleton), then trunk_gen.comp.glsl
+// expands every ring into its vertices and the quad strip to the next ring, writing
+// straight into the vertex and index buffers of the mesh that gets drawn. Compute
+// shaders need GL 4.3; without it isAvailable() is false and trees use the CPU path.
+class TrunkGenerator {
+private:
+    GLuint m_program = 0;
+    GLuint m_ringBuffer = 0;
+    GLuint m_timers[2] = {};       // timestamps, since a GpuProfiler pass may be timing already
+    bool m_initialised = false;
+    bool m_available = false;
+
+public:
+    TrunkGenerator() = default;
+    ~TrunkGenerator();
+
+    TrunkGenerator(const TrunkGenerator&) = delete;
+    TrunkGenerator& operator=(const TrunkGenerator&) = delete;
+
+    // Checks for compute support and builds the shader, safe to call repeatedly
+    void init();
+    bool isAvailable() const { return m_available; }
+
+    // Builds a mesh of rings.size() * radialSegments vertices and indexCount indices.
+    // If gpuMs is given it receives the GPU time of the dispatch (this waits for it).
+    cgra::gl_mesh generate(const std::vector<StemRing>& rings, int radialSegments, int indexCount, double* gpuMs = nullptr);
+};
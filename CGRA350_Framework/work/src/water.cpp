@@ -160,66 +160,48 @@ void Water::update(float deltaTime) {
     m_time += deltaTime * 0.5f; // Speed multiplier
 }
 
-void Water::draw(const glm::mat4& view, const glm::mat4& proj, GLuint shader, GLuint cubemap,
-    const glm::vec3& color, const glm::vec3& sunPos, const glm::vec3& sunColour,
-    const glm::mat4& lightSpaceMatrix, GLuint shadowMap) {
+void Water::draw(const cgra::shader_program& shader, GLuint cubemap) {
     if (!m_meshGenerated) return;
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    cgra::gl_state::enable(GL_DEPTH_TEST);
+    cgra::gl_state::enable(GL_BLEND);
+    cgra::gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     glm::mat4 model = glm::mat4(1.0f);
-    glm::vec3 cameraPos = glm::vec3(glm::inverse(view)[3]);
 
-    glUseProgram(shader);
+    cgra::gl_state::use_program(shader);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
-    glUniform1i(glGetUniformLocation(shader, "uEnvironmentMap"), 0); // 0 = GL_TEXTURE0
+    cgra::gl_state::active_texture(GL_TEXTURE0);
+    cgra::gl_state::bind_texture(GL_TEXTURE_CUBE_MAP, cubemap);
+    shader.set_uniform("uEnvironmentMap", 0); // 0 = GL_TEXTURE0
 
-    glUniformMatrix4fv(glGetUniformLocation(shader, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(proj));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "uLightSpaceMatrix"), 1, false, glm::value_ptr(lightSpaceMatrix));
+    shader.set_uniform("modelMatrix", model);
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
-    glUniform1i(glGetUniformLocation(shader, "uShadowMap"), 1);
+    shader.set_uniform("uOpacity", 0.8f);
 
-    glUniform3fv(glGetUniformLocation(shader, "cameraPosition"), 1, glm::value_ptr(cameraPos));
+    shader.set_uniform("uTroughColor", glm::vec3(0.094f, 0.400f, 0.569f));    // deep blue
+    shader.set_uniform("uSurfaceColor", glm::vec3(0.608f, 0.847f, 0.753f));    // surface blue
+    shader.set_uniform("uPeakColor", glm::vec3(0.733f, 0.847f, 0.878f));       // light/white for peaks
 
-    glUniform3fv(glGetUniformLocation(shader, "uSunPos"), 1, glm::value_ptr(sunPos));
-    glUniform3fv(glGetUniformLocation(shader, "uSunColor"), 1, glm::value_ptr(sunColour));
+    shader.set_uniform("uPeakThreshold", 0.08f);      // adjust as needed
+    shader.set_uniform("uPeakTransition", 0.05f);     // adjust as needed
+    shader.set_uniform("uTroughThreshold", -0.04f);   // adjust as needed
+    shader.set_uniform("uTroughTransition", 0.15f);   // adjust as needed
 
-    glUniform1f(glGetUniformLocation(shader, "uOpacity"), 0.8f);
+    shader.set_uniform("uFresnelScale", 0.65f);       // adjust as needed
+    shader.set_uniform("uFresnelPower", 0.68f);       // adjust as needed
 
-    glUniform3fv(glGetUniformLocation(shader, "uTroughColor"), 1, glm::value_ptr(glm::vec3(0.094f, 0.400f, 0.569f)));    // deep blue
-    glUniform3fv(glGetUniformLocation(shader, "uSurfaceColor"), 1, glm::value_ptr(glm::vec3(0.608f, 0.847f, 0.753f)));    // surface blue
-    glUniform3fv(glGetUniformLocation(shader, "uPeakColor"), 1, glm::value_ptr(glm::vec3(0.733f, 0.847f, 0.878f)));       // light/white for peaks
-
-    glUniform1f(glGetUniformLocation(shader, "uPeakThreshold"), 0.08f);      // adjust as needed
-    glUniform1f(glGetUniformLocation(shader, "uPeakTransition"), 0.05f);     // adjust as needed
-    glUniform1f(glGetUniformLocation(shader, "uTroughThreshold"), -0.04f);   // adjust as needed
-    glUniform1f(glGetUniformLocation(shader, "uTroughTransition"), 0.15f);   // adjust as needed
-
-    glUniform1f(glGetUniformLocation(shader, "uFresnelScale"), 0.65f);       // adjust as needed
-    glUniform1f(glGetUniformLocation(shader, "uFresnelPower"), 0.68f);       // adjust as needed
-
-    glUniform1f(glGetUniformLocation(shader, "uLightSize"), 0.01f);
-    glUniform1f(glGetUniformLocation(shader, "uNearPlane"), 0.1f);
-    glUniform1i(glGetUniformLocation(shader, "uBlockerSearchSamples"), 16);
-    glUniform1i(glGetUniformLocation(shader, "uPCFSamples"), 32);
-
-    glUniform1f(glGetUniformLocation(shader, "uTime"), m_time);
-    glUniform1f(glGetUniformLocation(shader, "uWavesAmplitude"), 0.02f);
-    glUniform1f(glGetUniformLocation(shader, "uWavesFrequency"), 1.5f);
-    glUniform1f(glGetUniformLocation(shader, "uWavesSpeed"), 0.6f);
-    glUniform1f(glGetUniformLocation(shader, "uWavesPersistence"), 0.330f);
-    glUniform1f(glGetUniformLocation(shader, "uWavesLacunarity"), 1.5f);
-    glUniform1f(glGetUniformLocation(shader, "uWavesIterations"), 7.0f);
+    shader.set_uniform("uTime", m_time);
+    shader.set_uniform("uWavesAmplitude", 0.02f);
+    shader.set_uniform("uWavesFrequency", 1.5f);
+    shader.set_uniform("uWavesSpeed", 0.6f);
+    shader.set_uniform("uWavesPersistence", 0.330f);
+    shader.set_uniform("uWavesLacunarity", 1.5f);
+    shader.set_uniform("uWavesIterations", 7.0f);
 
     m_mesh.draw();
+
+    cgra::gl_state::disable(GL_BLEND);
 }
 
 void Water::reset() {
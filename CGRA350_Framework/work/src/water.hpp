@@ -9,6 +9,7 @@
 
 // project
 #include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_shader.hpp"
 
 class Water {
 private:
@@ -42,11 +43,8 @@ public:
     ~Water() = default;
 
     void update(float deltaTime);
-    void draw(const glm::mat4& view, const glm::mat4& proj, GLuint shader, GLuint cubemap,
-        const glm::vec3& color = glm::vec3(0.0f, 0.4f, 0.8f),
-        const glm::vec3& sunPos = glm::vec3(0.0f, 100.0f, 0.0f),
-        const glm::vec3& sunColour = glm::vec3(1.0f, 1.0f, 1.0f),
-        const glm::mat4& lightSpaceMatrix = glm::mat4(1.0f), GLuint shadowMap = 0);
+    // The camera, sun and shadow cascades come from the per-frame uniforms
+    void draw(const cgra::shader_program& shader, GLuint cubemap);
 
     void reset();
     float getHeightAt(float x, float z, float time) const;